@@ -0,0 +1,571 @@
+/*
+ * Soft:        Perform a GET query to a remote HTTP/HTTPS server.
+ *              Set a timer to compute global remote server response
+ *              time.
+ *
+ * Part:        Benchmark engine. Runs concurrent GET queries for a
+ *              count or a duration and reports throughput and latency.
+ *
+ * Authors:     Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+/* system includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <openssl/err.h>
+
+/* keepalived includes */
+#include "memory.h"
+#include "utils.h"
+#include "timer.h"
+
+/* genhash includes */
+#include "include/bench.h"
+#include "include/http.h"
+#include "include/main.h"
+
+/*
+ * Each connection runs its own chain of threads, so the benchmark
+ * uses the same scheduler and I/O multiplexer as a single GET :
+ *
+ *     bench_next_thread (stop, or reuse a kept alive connection)
+ *            v
+ *     bench_connect_thread (non blocking connect)
+ *            v
+ *     bench_tls_thread (non blocking TLS handshake)
+ *            v
+ *     bench_read_thread (read and parse the response)
+ *            v
+ *     bench_next_thread ...
+ */
+
+static bench_conn_t *conns;
+static unsigned active;
+static timeval_t bench_start;
+static timeval_t bench_end;
+static timeval_t bench_last;		/* When the last connection finished */
+
+/* Counters */
+static unsigned long issued;
+static unsigned long completed;
+static unsigned long failed;
+static unsigned long bad_status;
+static unsigned long handshakes;
+static unsigned long resumed;
+static unsigned long long bytes;
+
+static bench_samples_t connect_samples;
+static bench_samples_t tls_samples;
+static bench_samples_t ttfb_samples;
+static bench_samples_t total_samples;
+
+static int bench_next_thread(thread_t *);
+static int bench_connect_thread(thread_t *);
+static int bench_tls_thread(thread_t *);
+static int bench_read_thread(thread_t *);
+
+static void
+add_sample(bench_samples_t *samples, timeval_t start)
+{
+	if (samples->count == samples->alloc) {
+		samples->alloc = samples->alloc ? samples->alloc * 2 : 1024;
+		samples->val = REALLOC(samples->val, samples->alloc * sizeof(*samples->val));
+	}
+	samples->val[samples->count++] = timer_long(timer_sub(timer_now(), start));
+}
+
+static bool
+bench_done(void)
+{
+	if (req->requests && issued >= req->requests)
+		return true;
+	if (req->duration && timer_cmp(timer_now(), bench_end) >= 0)
+		return true;
+	return false;
+}
+
+static void
+bench_close(bench_conn_t *conn)
+{
+	if (conn->ssl) {
+		/* Keep the session, TLSv1.3 tickets are only seen after the handshake */
+		if (req->ssl_resume) {
+			if (conn->session)
+				SSL_SESSION_free(conn->session);
+			conn->session = SSL_get1_session(conn->ssl);
+		}
+		SSL_shutdown(conn->ssl);
+		SSL_free(conn->ssl);
+		conn->ssl = NULL;
+	}
+	if (conn->fd != -1) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	conn->reused = false;
+}
+
+/* Give up on the current request, and move on to the next one */
+static int
+bench_fail(thread_t *thread, bench_conn_t *conn)
+{
+	failed++;
+	bench_close(conn);
+	thread_add_event(thread->master, bench_next_thread, conn, 0);
+	return 0;
+}
+
+static int
+bench_connect(thread_t *thread, bench_conn_t *conn)
+{
+	struct sockaddr_storage addr;
+	struct linger li = { .l_onoff = 1, .l_linger = 0 };
+	int ret;
+
+	conn->stage = timer_now();
+
+	conn->fd = socket(req->dst->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+	if (conn->fd == -1) {
+		fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+		return bench_fail(thread, conn);
+	}
+
+	/* free the tcp port after closing the socket descriptor */
+	setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &li, sizeof li);
+
+#ifdef _WITH_SO_MARK_
+	if (req->mark &&
+	    setsockopt(conn->fd, SOL_SOCKET, SO_MARK, &req->mark, sizeof req->mark)) {
+		fprintf(stderr, "Error setting fwmark %u to socket: %s\n",
+			req->mark, strerror(errno));
+		return bench_fail(thread, conn);
+	}
+#endif
+
+	memcpy(&addr, req->dst->ai_addr, req->dst->ai_addrlen);
+	if (req->dst->ai_family == AF_INET6)
+		((struct sockaddr_in6 *)&addr)->sin6_port = req->addr_port;
+	else
+		((struct sockaddr_in *)&addr)->sin_port = req->addr_port;
+
+	ret = connect(conn->fd, (struct sockaddr *)&addr, req->dst->ai_addrlen);
+	if (ret && errno != EINPROGRESS)
+		return bench_fail(thread, conn);
+
+	thread_add_write(thread->master, bench_connect_thread, conn,
+			 conn->fd, HTTP_CNX_TIMEOUT);
+	return 0;
+}
+
+static int
+bench_send(thread_t *thread, bench_conn_t *conn)
+{
+	const char *url = req->urls[conn->url++ % req->num_urls];
+	int len;
+	int ret;
+
+	len = http_format_request(conn->buffer, MAX_BUFFER_LENGTH, url, req->keepalive);
+
+	if (conn->ssl)
+		ret = SSL_write(conn->ssl, conn->buffer, len);
+	else
+		ret = (int)send(conn->fd, conn->buffer, (size_t)len, 0);
+	if (ret != len)
+		return bench_fail(thread, conn);
+
+	conn->got_first = false;
+	conn->header_done = false;
+	conn->chunked = false;
+	conn->close = !req->keepalive;
+	conn->status = 0;
+	conn->content_length = -1;
+	conn->body = 0;
+	conn->len = 0;
+
+	thread_add_read(thread->master, bench_read_thread, conn,
+			conn->fd, HTTP_CNX_TIMEOUT);
+	return 0;
+}
+
+static int
+bench_handshake(thread_t *thread, bench_conn_t *conn)
+{
+	int ret;
+
+	ret = SSL_connect(conn->ssl);
+	if (ret > 0) {
+		add_sample(&tls_samples, conn->stage);
+		if (SSL_session_reused(conn->ssl))
+			resumed++;
+		return bench_send(thread, conn);
+	}
+
+	switch (SSL_get_error(conn->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		thread_add_read(thread->master, bench_tls_thread, conn,
+				conn->fd, HTTP_CNX_TIMEOUT);
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		thread_add_write(thread->master, bench_tls_thread, conn,
+				 conn->fd, HTTP_CNX_TIMEOUT);
+		break;
+	default:
+		if (req->verbose)
+			ERR_print_errors_fp(stderr);
+		return bench_fail(thread, conn);
+	}
+
+	return 0;
+}
+
+static int
+bench_tls_thread(thread_t *thread)
+{
+	bench_conn_t *conn = THREAD_ARG(thread);
+
+	if (thread->type == THREAD_READ_TIMEOUT ||
+	    thread->type == THREAD_WRITE_TIMEOUT)
+		return bench_fail(thread, conn);
+
+	return bench_handshake(thread, conn);
+}
+
+static int
+bench_connect_thread(thread_t *thread)
+{
+	bench_conn_t *conn = THREAD_ARG(thread);
+	socklen_t slen = sizeof(int);
+	int status;
+
+	if (thread->type == THREAD_WRITE_TIMEOUT)
+		return bench_fail(thread, conn);
+
+	if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &status, &slen) || status)
+		return bench_fail(thread, conn);
+
+	add_sample(&connect_samples, conn->stage);
+
+	if (!req->ssl)
+		return bench_send(thread, conn);
+
+	conn->ssl = SSL_new(req->ctx);
+	SSL_set_fd(conn->ssl, conn->fd);
+	if (req->ssl_resume && conn->session)
+		SSL_set_session(conn->ssl, conn->session);
+	handshakes++;
+
+	conn->stage = timer_now();
+	return bench_handshake(thread, conn);
+}
+
+/* Parse the response header, once it has been fully received */
+static bool
+bench_parse_header(bench_conn_t *conn)
+{
+	char *end, *line, *next;
+
+	conn->buffer[conn->len] = '\0';
+	if (!(end = strstr(conn->buffer, "\r\n\r\n")))
+		return false;
+	*end = '\0';
+
+	if (sscanf(conn->buffer, "HTTP/%*d.%*d %d", &conn->status) != 1)
+		conn->status = 0;
+
+	for (line = strstr(conn->buffer, "\r\n"); line; line = next) {
+		line += 2;
+		next = strstr(line, "\r\n");
+		if (next)
+			*next = '\0';
+
+		if (!strncasecmp(line, "Content-Length:", 15))
+			conn->content_length = strtol(line + 15, NULL, 10);
+		else if (!strncasecmp(line, "Transfer-Encoding:", 18))
+			conn->chunked = !!strcasestr(line + 18, "chunked");
+		else if (!strncasecmp(line, "Connection:", 11) && strcasestr(line + 11, "close"))
+			conn->close = true;
+	}
+	if (!strncmp(conn->buffer, "HTTP/1.0", 8) && !conn->close && req->keepalive) {
+		/* HTTP/1.0 servers only keep alive if they say so */
+		conn->close = true;
+	}
+	if (conn->status == 204 || conn->status == 304)
+		conn->content_length = 0;
+
+	/* Only keep the start of the body */
+	end += 4;
+	conn->len -= (size_t)(end - conn->buffer);
+	memmove(conn->buffer, end, conn->len);
+	conn->header_done = true;
+
+	return true;
+}
+
+/* Account for newly read data. Returns true when the response is complete */
+static bool
+bench_process(bench_conn_t *conn, size_t r)
+{
+	conn->len += r;
+
+	if (!conn->header_done) {
+		if (!bench_parse_header(conn))
+			return false;
+		r = conn->len;
+	}
+
+	conn->body += r;
+
+	if (conn->content_length >= 0) {
+		conn->len = 0;
+		return conn->body >= (size_t)conn->content_length;
+	}
+
+	if (conn->chunked) {
+		if (conn->len >= 7 && !memcmp(conn->buffer + conn->len - 7, "\r\n0\r\n\r\n", 7))
+			return true;
+		if (conn->body == conn->len && conn->len == 5 && !memcmp(conn->buffer, "0\r\n\r\n", 5))
+			return true;
+
+		/* Keep enough to spot the last chunk */
+		if (conn->len > 6) {
+			memmove(conn->buffer, conn->buffer + conn->len - 6, 6);
+			conn->len = 6;
+		}
+		return false;
+	}
+
+	/* Read until the server closes the connection */
+	conn->len = 0;
+	return false;
+}
+
+static int
+bench_complete(thread_t *thread, bench_conn_t *conn)
+{
+	add_sample(&total_samples, conn->start);
+	completed++;
+	if (conn->status < 200 || conn->status >= 400)
+		bad_status++;
+
+	if (conn->close)
+		bench_close(conn);
+	else
+		conn->reused = true;
+
+	thread_add_event(thread->master, bench_next_thread, conn, 0);
+	return 0;
+}
+
+static int
+bench_read_thread(thread_t *thread)
+{
+	bench_conn_t *conn = THREAD_ARG(thread);
+	size_t space;
+	int r;
+
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return bench_fail(thread, conn);
+
+	while (true) {
+		/* The header must fit in the buffer */
+		space = MAX_BUFFER_LENGTH - 1 - conn->len;
+		if (!space)
+			return bench_fail(thread, conn);
+
+		if (conn->ssl) {
+			r = SSL_read(conn->ssl, conn->buffer + conn->len, (int)space);
+			if (r <= 0) {
+				switch (SSL_get_error(conn->ssl, r)) {
+				case SSL_ERROR_WANT_READ:
+					r = -2;
+					break;
+				case SSL_ERROR_ZERO_RETURN:
+					r = 0;
+					break;
+				default:
+					r = -1;
+				}
+			}
+		} else {
+			r = (int)read(conn->fd, conn->buffer + conn->len, space);
+			if (r == -1 && (errno == EAGAIN || errno == EINTR))
+				r = -2;
+		}
+
+		if (r == -2)
+			break;
+
+		if (r == 0 && conn->header_done && conn->content_length < 0 && !conn->chunked)
+			return bench_complete(thread, conn);
+
+		if (r == 0 && conn->reused && !conn->got_first) {
+			/* The server closed the kept alive connection, reconnect */
+			conn->url--;
+			bench_close(conn);
+			return bench_connect(thread, conn);
+		}
+
+		if (r <= 0)
+			return bench_fail(thread, conn);
+
+		if (!conn->got_first) {
+			add_sample(&ttfb_samples, conn->start);
+			conn->got_first = true;
+		}
+		bytes += (unsigned long long)r;
+
+		if (bench_process(conn, (size_t)r))
+			return bench_complete(thread, conn);
+
+		/* Plain sockets are selected again, TLS may have buffered records */
+		if (!conn->ssl)
+			break;
+	}
+
+	thread_add_read(thread->master, bench_read_thread, conn,
+			conn->fd, HTTP_CNX_TIMEOUT);
+	return 0;
+}
+
+static int
+bench_next_thread(thread_t *thread)
+{
+	bench_conn_t *conn = THREAD_ARG(thread);
+
+	if (bench_done()) {
+		bench_close(conn);
+		if (!--active) {
+			bench_last = timer_now();
+			thread_add_terminate_event(thread->master);
+		}
+		return 0;
+	}
+
+	issued++;
+	conn->start = timer_now();
+
+	if (conn->reused)
+		return bench_send(thread, conn);
+
+	return bench_connect(thread, conn);
+}
+
+/* Register the benchmark connections */
+void
+init_bench(void)
+{
+	unsigned i;
+
+	if (!req->requests && !req->duration)
+		req->requests = BENCH_DEFAULT_REQUESTS;
+
+	conns = (bench_conn_t *) MALLOC(req->concurrency * sizeof(bench_conn_t));
+	for (i = 0; i < req->concurrency; i++) {
+		conns[i].fd = -1;
+		conns[i].url = i;
+		conns[i].buffer = (char *) MALLOC(MAX_BUFFER_LENGTH);
+		thread_add_event(master, bench_next_thread, &conns[i], 0);
+	}
+	active = req->concurrency;
+
+	bench_start = bench_last = timer_now();
+	bench_end = timer_add_long(bench_start, req->duration * TIMER_HZ);
+}
+
+static int
+cmp_sample(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+percentile(bench_samples_t *samples, unsigned pct)
+{
+	size_t i = (samples->count - 1) * pct / 100;
+
+	return (double)samples->val[i] / (TIMER_HZ / 1000);
+}
+
+static void
+report_samples(const char *name, bench_samples_t *samples)
+{
+	if (!samples->count)
+		return;
+
+	qsort(samples->val, samples->count, sizeof(*samples->val), cmp_sample);
+	printf("  %-8s %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+	       percentile(samples, 0), percentile(samples, 50),
+	       percentile(samples, 90), percentile(samples, 99),
+	       percentile(samples, 100));
+}
+
+void
+bench_report(void)
+{
+	double secs;
+
+	/* Interrupted before all the connections finished */
+	if (active)
+		bench_last = timer_now();
+
+	secs = (double)timer_long(timer_sub(bench_last, bench_start)) / TIMER_HZ;
+	if (secs <= 0)
+		secs = 1.0 / TIMER_HZ;
+
+	printf("Requests: %lu completed, %lu failed, %lu bad status in %.3f secs\n",
+	       completed, failed, bad_status, secs);
+	printf("Throughput: %.1f requests/sec, %.3f MB/sec\n",
+	       completed / secs, bytes / secs / (1024 * 1024));
+	if (req->ssl)
+		printf("TLS: %lu handshakes, %lu resumed\n", handshakes, resumed);
+	printf("Latency (ms)    min        p50        p90        p99        max\n");
+	report_samples("connect", &connect_samples);
+	report_samples("tls", &tls_samples);
+	report_samples("ttfb", &ttfb_samples);
+	report_samples("total", &total_samples);
+}
+
+static void
+free_samples(bench_samples_t *samples)
+{
+	if (samples->val)
+		FREE(samples->val);
+}
+
+void
+free_bench(void)
+{
+	unsigned i;
+
+	for (i = 0; i < req->concurrency; i++) {
+		bench_close(&conns[i]);
+		if (conns[i].session)
+			SSL_SESSION_free(conns[i].session);
+		FREE(conns[i].buffer);
+	}
+	FREE(conns);
+
+	free_samples(&connect_samples);
+	free_samples(&tls_samples);
+	free_samples(&ttfb_samples);
+	free_samples(&total_samples);
+}
@@ -284,14 +284,38 @@ http_response_thread(thread_t * thread)
 	return 0;
 }
 
+/* Format the GET query for url into buf. Returns the query length. */
+int
+http_format_request(char *buf, size_t len, const char *url, int keepalive)
+{
+	const char *request_host;
+	char request_host_port[7] = "";		/* ":" [0-9][0-9][0-9][0-9][0-9] "\0" */
+	int ipv6 = req->dst && req->dst->ai_family == AF_INET6 && !req->vhost;
+
+	if (req->vhost) {
+		/* If vhost was defined we don't need to override it's port */
+		request_host = req->vhost;
+	} else {
+		request_host = req->ipaddress;
+		snprintf(request_host_port, sizeof request_host_port, ":%d",
+			 ntohs(req->addr_port));
+	}
+
+	if (keepalive)
+		return snprintf(buf, len,
+				ipv6 ? REQUEST_TEMPLATE_KEEPALIVE_IPV6 : REQUEST_TEMPLATE_KEEPALIVE,
+				url, request_host, request_host_port);
+
+	return snprintf(buf, len, ipv6 ? REQUEST_TEMPLATE_IPV6 : REQUEST_TEMPLATE,
+			url, request_host, request_host_port);
+}
+
 /* remote Web server is connected, send it the get url query.  */
 int
 http_request_thread(thread_t * thread)
 {
 	SOCK *sock_obj = THREAD_ARG(thread);
 	char *str_request;
-	char *request_host;
-	char *request_host_port;
 	int ret = 0;
 
 	/* Handle read timeout */
@@ -302,25 +326,7 @@ http_request_thread(thread_t * thread)
 	str_request = (char *) MALLOC(GET_BUFFER_LENGTH);
 	memset(str_request, 0, GET_BUFFER_LENGTH);
 
-	if (req->vhost) {
-		/* If vhost was defined we don't need to override it's port */
-		request_host = req->vhost;
-		request_host_port = (char*) MALLOC(1);
-		*request_host_port = 0;
-	} else {
-		request_host = req->ipaddress;
-
-		/* Allocate a buffer for the port string ( ":" [0-9][0-9][0-9][0-9][0-9] "\0" ) */
-		request_host_port = (char*) MALLOC(7);
-		snprintf(request_host_port, 7, ":%d",
-		 ntohs(req->addr_port));
-	}
-
-	snprintf(str_request, GET_BUFFER_LENGTH,
-		 (req->dst && req->dst->ai_family == AF_INET6 && !req->vhost) ? REQUEST_TEMPLATE_IPV6 : REQUEST_TEMPLATE,
-		  req->url, request_host, request_host_port);
-
-	FREE(request_host_port);
+	http_format_request(str_request, GET_BUFFER_LENGTH, req->url, 0);
 
 	/* Send the GET request to remote Web server */
 	DBG("Sending GET request [%s] on fd:%d\n", req->url, sock_obj->fd);
@@ -0,0 +1,70 @@
+/*
+ * Soft:        Perform a GET query to a remote HTTP/HTTPS server.
+ *              Set a timer to compute global remote server response
+ *              time.
+ *
+ * Part:        bench.c include file.
+ *
+ * Authors:     Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/* system includes */
+#include <stdbool.h>
+#include <openssl/ssl.h>
+
+/* local includes */
+#include "timer.h"
+
+/* Defaults when no count or duration is given */
+#define BENCH_DEFAULT_REQUESTS	1000
+
+/* Latency samples, in micro-seconds */
+typedef struct _bench_samples {
+	unsigned long		*val;
+	size_t			count;
+	size_t			alloc;
+} bench_samples_t;
+
+/* Benchmark connection */
+typedef struct _bench_conn {
+	int			fd;
+	SSL			*ssl;
+	SSL_SESSION		*session;	/* For TLS resumption */
+	unsigned		url;		/* Index of the next url */
+	bool			reused;		/* Request sent on a kept alive connection */
+	timeval_t		start;		/* Start of the request */
+	timeval_t		stage;		/* Start of the connect or TLS handshake */
+
+	/* Response parsing */
+	bool			got_first;
+	bool			header_done;
+	bool			chunked;
+	bool			close;		/* Server closes after the response */
+	int			status;
+	long			content_length;	/* -1 if not given */
+	size_t			body;
+	char			*buffer;
+	size_t			len;
+} bench_conn_t;
+
+/* Prototypes */
+extern void init_bench(void);
+extern void bench_report(void);
+extern void free_bench(void);
+
+#endif
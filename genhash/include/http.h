@@ -47,6 +47,16 @@
 			 "User-Agent: KeepAlive GenHash Client\r\n" \
 			 "Host: [%s]%s\r\n\r\n"
 
+#define REQUEST_TEMPLATE_KEEPALIVE "GET %s HTTP/1.1\r\n" \
+			 "User-Agent: KeepAlive GenHash Client\r\n" \
+			 "Host: %s%s\r\n" \
+			 "Connection: keep-alive\r\n\r\n"
+
+#define REQUEST_TEMPLATE_KEEPALIVE_IPV6 "GET %s HTTP/1.1\r\n" \
+			 "User-Agent: KeepAlive GenHash Client\r\n" \
+			 "Host: [%s]%s\r\n" \
+			 "Connection: keep-alive\r\n\r\n"
+
 /* Output delimiters */
 #define DELIM_BEGIN		"-----------------------["
 #define DELIM_END		"]-----------------------\n"
@@ -63,6 +73,7 @@ extern const hash_t hashes[];
 extern int epilog(thread_t *);
 extern int finalize(thread_t *);
 extern int http_process_stream(SOCK *, int);
+extern int http_format_request(char *, size_t, const char *, int);
 extern int http_request_thread(thread_t *);
 
 #endif
@@ -42,6 +42,7 @@
 #include "ssl.h"
 #include "list.h"
 #include "sock.h"
+#include "bench.h"
 
 /* Build version */
 #define PROG    "genhash"
@@ -76,6 +77,15 @@ typedef struct {
 	unsigned long	ref_time;
 	unsigned long	response_time;
 	unsigned int mark;
+
+	/* Benchmark mode */
+	char		**urls;
+	unsigned	num_urls;
+	unsigned	concurrency;
+	unsigned long	requests;
+	unsigned long	duration;
+	int		keepalive;
+	int		ssl_resume;
 } REQ;
 
 /* Global variables */
@@ -73,7 +73,8 @@ usage(const char *prog)
 		"Usage:\n"
 		"  %s -s server-address -p port -u url\n"
 		"  %s -S -s server-address -p port -u url\n"
-		"  %s -h\n" "  %s -r\n\n", prog, prog, prog, prog);
+		"  %s -s server-address -p port -c conns -n count|-d secs -u url [-u url ...]\n"
+		"  %s -h\n" "  %s -r\n\n", prog, prog, prog, prog, prog);
 	fprintf(stderr,
 		"Commands:\n"
 		"Either long or short options are allowed.\n"
@@ -88,6 +89,14 @@ usage(const char *prog)
 		"  %s --release         -r       Display the release number.\n"
 		"  %s --fwmark          -m       Use the specified FW mark.\n",
 		prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
+	fprintf(stderr,
+		"\nBenchmark mode (no hash is computed, url may be repeated):\n"
+		"  %s --concurrency     -c       Number of concurrent connections.\n"
+		"  %s --requests        -n       Number of requests to run (default %d).\n"
+		"  %s --duration        -d       Number of seconds to run for.\n"
+		"  %s --keepalive       -k       Use HTTP/1.1 keep-alive connections.\n"
+		"  %s --ssl-resume      -R       Resume TLS sessions on new connections.\n",
+		prog, prog, BENCH_DEFAULT_REQUESTS, prog, prog, prog);
 	fprintf(stderr, "\nSupported hash algorithms:\n");
 	for (i = hash_first; i < hash_guard; i++)
 		fprintf(stderr, "  %s%s\n",
@@ -120,11 +129,16 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 		{"port",            required_argument, 0, 'p'},
 		{"url",             required_argument, 0, 'u'},
 		{"fwmark",          required_argument, 0, 'm'},
+		{"concurrency",     required_argument, 0, 'c'},
+		{"requests",        required_argument, 0, 'n'},
+		{"duration",        required_argument, 0, 'd'},
+		{"keepalive",       no_argument,       0, 'k'},
+		{"ssl-resume",      no_argument,       0, 'R'},
 		{0, 0, 0, 0}
 	};
 
 	/* Parse the command line arguments */
-	while ((c = getopt_long (argc, argv, "rhvSs:H:V:p:u:m:", long_options, NULL)) != EOF) {
+	while ((c = getopt_long (argc, argv, "rhvSs:H:V:p:u:m:c:n:d:kR", long_options, NULL)) != EOF) {
 		switch (c) {
 		case 'r':
 			fprintf(stderr, VERSION_STRING);
@@ -176,6 +190,9 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 			break;
 		case 'u':
 			req_obj->url = optarg;
+			if (!req_obj->urls)
+				req_obj->urls = (char **) MALLOC(sizeof(char *) * (size_t)argc);
+			req_obj->urls[req_obj->num_urls++] = optarg;
 			break;
 		case 'm':
 #ifdef _WITH_SO_MARK_
@@ -185,6 +202,25 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 			return CMD_LINE_ERROR;
 #endif
 			break;
+		case 'c':
+			req_obj->concurrency = (unsigned)strtoul(optarg, NULL, 10);
+			if (!req_obj->concurrency) {
+				fprintf(stderr, "invalid concurrency: %s\n", optarg);
+				return CMD_LINE_ERROR;
+			}
+			break;
+		case 'n':
+			req_obj->requests = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			req_obj->duration = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			req_obj->keepalive = 1;
+			break;
+		case 'R':
+			req_obj->ssl_resume = 1;
+			break;
 		default:
 			usage(argv[0]);
 			return CMD_LINE_ERROR;
@@ -206,7 +242,6 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 int
 main(int argc, char **argv)
 {
-	thread_t thread;
 	char *url_default = malloc(2);
 	url_default[0] = '/';
 	url_default[1] = '\0';
@@ -236,6 +271,22 @@ main(int argc, char **argv)
 		req->url = url_default;
 	}
 
+	/* Any of the benchmark options selects benchmark mode */
+	if (req->concurrency || req->requests || req->duration) {
+		if (!req->dst) {
+			fprintf(stderr, "benchmark mode needs a server address\n");
+			FREE(url_default);
+			FREE(req);
+			exit(1);
+		}
+		if (!req->concurrency)
+			req->concurrency = 1;
+		if (!req->urls) {
+			req->urls = (char **) MALLOC(sizeof(char *));
+			req->urls[req->num_urls++] = req->url;
+		}
+	}
+
 	/* Init the reference timer */
 	req->ref_time = timer_tol(timer_now());
 	DBG("Reference timer = %lu\n", req->ref_time);
@@ -249,29 +300,39 @@ main(int argc, char **argv)
 	/* Create the master thread */
 	master = thread_make_master();
 
-	/* Register the GET request */
-	init_sock();
+	/* Register the GET request, or the benchmark connections */
+	if (req->concurrency)
+		init_bench();
+	else
+		init_sock();
 
 	/*
 	 * Processing the master thread queues,
-	 * return and execute one ready thread.
+	 * execute all threads made ready by each poll.
 	 * Run until error, used for debuging only.
 	 * Note that not calling launch_scheduler() does
 	 * not activate SIGCHLD handling, however, this
 	 * is no issue here.
 	 */
-	while (thread_fetch(master, &thread))
-		thread_call(&thread);
+	while (thread_run_batch(master))
+		;
 
 	/* Finalize output informations */
-	if (req->verbose)
+	if (req->concurrency)
+		bench_report();
+	else if (req->verbose)
 		printf("Global response time for [%s] =%lu\n",
 			    req->url, req->response_time - req->ref_time);
 
 	/* exit cleanly */
 	FREE(url_default);
 	SSL_CTX_free(req->ctx);
-	free_sock(sock);
+	if (req->concurrency)
+		free_bench();
+	else
+		free_sock(sock);
+	if (req->urls)
+		FREE(req->urls);
 	freeaddrinfo(req->dst);
 	FREE(req);
 	exit(0);
@@ -41,6 +41,7 @@
 #include "check_http.h"
 #include "check_ssl.h"
 #include "check_dns.h"
+#include "ipwrapper.h"
 
 /* Global vars */
 list checkers_queue;
@@ -400,6 +401,27 @@ free_checkers_queue(void)
 	free_list(&checkers_queue);
 }
 
+/* When simulating, checkers don't connect to anything or run scripts.
+ * A real server passes its checks unless the simulated failure burst
+ * selects it. */
+static int
+sim_checker_thread(thread_t *thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	real_server_t *rs = checker->rs;
+	bool alive;
+
+	if (checker->enabled) {
+		alive = !thread_sim_failed(&rs->addr, rs->addr.ss_family == AF_INET6 ?
+					   sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		update_svr_checker_state(alive, checker);
+	}
+
+	thread_add_timer(thread->master, sim_checker_thread, checker, checker->delay_loop);
+
+	return 0;
+}
+
 /* register checkers to the global I/O scheduler */
 void
 register_checkers_thread(void)
@@ -421,8 +443,8 @@ register_checkers_thread(void)
 			warmup = checker->warmup;
 			if (warmup)
 				warmup = warmup * (unsigned)rand() / RAND_MAX;
-			thread_add_timer(master, checker->launch, checker,
-					 BOOTSTRAP_DELAY + warmup);
+			thread_add_timer(master, thread_simulating() ? sim_checker_thread : checker->launch,
+					 checker, BOOTSTRAP_DELAY + warmup);
 		}
 	}
 }
@@ -260,6 +260,35 @@ sighup_check(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
 	thread_add_event(master, reload_check_thread, NULL, 0);
 }
 
+static int
+print_check_stats(__attribute__((unused)) thread_t * thread)
+{
+	FILE *file;
+
+	file = fopen("/tmp/keepalived_check.stats", "w");
+	if (!file) {
+		log_message(LOG_INFO, "Can't open /tmp/keepalived_check.stats (%d: %s)",
+			errno, strerror(errno));
+		return 0;
+	}
+
+	fprintf(file, "IPVS commands:\n");
+	fprintf(file, "  Issued: %lu\n", ipvs_ops_issued);
+	fprintf(file, "  Suppressed as no-ops: %lu\n", ipvs_ops_suppressed);
+
+	fclose(file);
+
+	return 0;
+}
+
+static void
+sigusr2_check(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
+{
+	log_message(LOG_INFO, "Printing checker stats for process(%d) on signal",
+		    getpid());
+	thread_add_event(master, print_check_stats, NULL, 0);
+}
+
 /* Terminate handler */
 static void
 sigend_check(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
@@ -274,6 +303,7 @@ check_signal_init(void)
 {
 	signal_handler_child_clear();
 	signal_set(SIGHUP, sighup_check, NULL);
+	signal_set(SIGUSR2, sigusr2_check, NULL);
 	signal_set(SIGINT, sigend_check, NULL);
 	signal_set(SIGTERM, sigend_check, NULL);
 	signal_ignore(SIGPIPE);
@@ -388,6 +418,10 @@ start_check_child(void)
 	/* Signal handling initialization */
 	check_signal_init();
 
+	/* Simulation must be set up before anything touches the kernel */
+	if (simulate_duration)
+		thread_set_simulation(master, simulate_duration * TIMER_HZ, NULL);
+
 	/* Start Healthcheck daemon */
 	start_check(NULL);
 
@@ -28,6 +28,7 @@
 #include "check_data.h"
 #include "check_api.h"
 #include "check_misc.h"
+#include "check_http.h"
 #include "check_daemon.h"
 #include "global_data.h"
 #include "check_ssl.h"
@@ -49,29 +50,57 @@ alloc_ssl(void)
 	return ssl;
 }
 void
-free_ssl(void)
+free_ssl_data(ssl_data_t *ssl)
 {
-	ssl_data_t *ssl;
-
-	if (!check_data || !check_data->ssl)
-		return;
-
-	ssl = check_data->ssl;
-
 	clear_ssl(ssl);
+	FREE_PTR(ssl->name);
 	FREE_PTR(ssl->password);
 	FREE_PTR(ssl->cafile);
 	FREE_PTR(ssl->certfile);
 	FREE_PTR(ssl->keyfile);
+	FREE_PTR(ssl->ciphers);
+	FREE_PTR(ssl->sni);
 	FREE(ssl);
-	check_data->ssl = NULL;
 }
 static void
-dump_ssl(void)
+free_ssl_profile(void *data)
+{
+	free_ssl_data(data);
+}
+void
+free_ssl(void)
+{
+	if (!check_data)
+		return;
+
+	if (check_data->ssl) {
+		free_ssl_data(check_data->ssl);
+		check_data->ssl = NULL;
+	}
+	free_list(&check_data->ssl_profiles);
+}
+ssl_data_t *
+find_ssl_profile(const char *name)
 {
-	ssl_data_t *ssl = check_data->ssl;
+	element e;
+	ssl_data_t *ssl;
+
+	if (LIST_ISEMPTY(check_data->ssl_profiles))
+		return NULL;
 
-	if (!ssl->password && !ssl->cafile && !ssl->certfile && !ssl->keyfile) {
+	for (e = LIST_HEAD(check_data->ssl_profiles); e; ELEMENT_NEXT(e)) {
+		ssl = ELEMENT_DATA(e);
+		if (!strcmp(ssl->name, name))
+			return ssl;
+	}
+
+	return NULL;
+}
+static void
+dump_ssl_data(ssl_data_t *ssl)
+{
+	if (!ssl->password && !ssl->cafile && !ssl->certfile && !ssl->keyfile &&
+	    !ssl->ciphers && !ssl->sni && !ssl->strong_check && !ssl->ktls) {
 		log_message(LOG_INFO, " Using autogen SSL context");
 		return;
 	}
@@ -84,6 +113,22 @@ dump_ssl(void)
 		log_message(LOG_INFO, " Certificate file : %s", ssl->certfile);
 	if (ssl->keyfile)
 		log_message(LOG_INFO, " Key file : %s", ssl->keyfile);
+	if (ssl->ciphers)
+		log_message(LOG_INFO, " Ciphers : %s", ssl->ciphers);
+	if (ssl->sni)
+		log_message(LOG_INFO, " SNI : %s", ssl->sni);
+	if (ssl->strong_check)
+		log_message(LOG_INFO, " Strong check : on");
+	if (ssl->ktls)
+		log_message(LOG_INFO, " Kernel TLS : on");
+}
+static void
+dump_ssl_profile(void *data)
+{
+	ssl_data_t *ssl = data;
+
+	log_message(LOG_INFO, " SSL %s", ssl->name);
+	dump_ssl_data(ssl);
 }
 
 /* Virtual server group facility functions */
@@ -116,10 +161,22 @@ dump_vsg_entry(void *data)
 	virtual_server_group_entry_t *vsg_entry = data;
 	uint16_t start;
 
-	if (vsg_entry->vfwmark)
+	if (vsg_entry->vfwmark && !vsg_entry->fwmark_range)
 		log_message(LOG_INFO, "   FWMARK = %u", vsg_entry->vfwmark);
 	else {
-		if (vsg_entry->range) {
+		if (vsg_entry->fwmark_range) {
+			start = vsg_entry->addr.ss_family == AF_INET ?
+				  ntohl(((struct sockaddr_in*)&vsg_entry->addr)->sin_addr.s_addr) & 0xFF :
+				  ntohs(((struct sockaddr_in6*)&vsg_entry->addr)->sin6_addr.s6_addr16[7]);
+			log_message(LOG_INFO,
+				    vsg_entry->addr.ss_family == AF_INET ?
+					"   VIP Range = %s-%d, VPORT = %d, FWMARK = %u" :
+					"   VIP Range = %s-%x, VPORT = %d, FWMARK = %u",
+				    inet_sockaddrtos(&vsg_entry->addr),
+				    start + vsg_entry->range,
+				    ntohs(inet_sockaddrport(&vsg_entry->addr)),
+				    vsg_entry->vfwmark);
+		} else if (vsg_entry->range) {
 			start = vsg_entry->addr.ss_family == AF_INET ?
 				  ntohl(((struct sockaddr_in*)&vsg_entry->addr)->sin_addr.s_addr) & 0xFF :
 				  ntohs(((struct sockaddr_in6*)&vsg_entry->addr)->sin6_addr.s6_addr16[7]);
@@ -213,6 +270,20 @@ alloc_vsg_entry(vector_t *strvec)
 			new->range -= start;
 		}
 
+		/* A range can be given a fwmark, in which case it is set up as
+		 * a single fwmark service, with the range marked by iptables */
+		if (vector_size(strvec) >= 4 && !strcmp(strvec_slot(strvec, 2), "fwmark")) {
+			new->vfwmark = (uint32_t)strtoul(strvec_slot(strvec, 3), NULL, 10);
+			if (!new->vfwmark) {
+				log_message(LOG_INFO, "Invalid fwmark %s for virtual server group range - skipping", FMT_STR_VSLOT(strvec, 3));
+				FREE(new);
+				return;
+			}
+			new->fwmark_range = true;
+			list_add(vsg->vfwmark, new);
+			return;
+		}
+
 		list_add(vsg->addr_range, new);
 	}
 }
@@ -224,6 +295,7 @@ free_vs(void *data)
 	virtual_server_t *vs = data;
 	FREE_PTR(vs->vsgname);
 	FREE_PTR(vs->virtualhost);
+	FREE_PTR(vs->ssl_name);
 	FREE_PTR(vs->s_svr);
 	free_list(&vs->rs);
 	free_notify_script(&vs->notify_quorum_up);
@@ -245,6 +317,8 @@ dump_vs(void *data)
 				    , inet_sockaddrtos(&vs->addr), ntohs(inet_sockaddrport(&vs->addr)));
 	if (vs->virtualhost)
 		log_message(LOG_INFO, "   VirtualHost = %s", vs->virtualhost);
+	if (vs->ssl_name)
+		log_message(LOG_INFO, "   SSL = %s", vs->ssl_name);
 	if (vs->af != AF_UNSPEC)
 		log_message(LOG_INFO, "   Address family = inet%s", vs->af == AF_INET ? "" : "6");
 	log_message(LOG_INFO, "   delay_loop = %lu, lb_algo = %s", vs->delay_loop / TIMER_HZ, vs->sched);
@@ -416,6 +490,7 @@ free_rs(void *data)
 	free_notify_script(&rs->notify_up);
 	free_notify_script(&rs->notify_down);
 	FREE_PTR(rs->virtualhost);
+	FREE_PTR(rs->ssl_name);
 	FREE(rs);
 }
 
@@ -459,6 +534,8 @@ dump_rs(void *data)
 		       rs->notify_down->name, rs->notify_down->uid, rs->notify_down->gid);
 	if (rs->virtualhost)
 		log_message(LOG_INFO, "    VirtualHost = %s", rs->virtualhost);
+	if (rs->ssl_name)
+		log_message(LOG_INFO, "    SSL = %s", rs->ssl_name);
 }
 
 void
@@ -510,6 +587,7 @@ alloc_check_data(void)
 	new = (check_data_t *) MALLOC(sizeof(check_data_t));
 	new->vs = alloc_list(free_vs, dump_vs);
 	new->vs_group = alloc_list(free_vsg, dump_vsg);
+	new->ssl_profiles = alloc_list(free_ssl_profile, dump_ssl_profile);
 
 	return new;
 }
@@ -525,9 +603,11 @@ free_check_data(check_data_t *data)
 void
 dump_check_data(check_data_t *data)
 {
-	if (data->ssl) {
+	if (data->ssl || !LIST_ISEMPTY(data->ssl_profiles)) {
 		log_message(LOG_INFO, "------< SSL definitions >------");
-		dump_ssl();
+		if (data->ssl)
+			dump_ssl_data(data->ssl);
+		dump_list(data->ssl_profiles);
 	}
 	if (!LIST_ISEMPTY(data->vs)) {
 		log_message(LOG_INFO, "------< LVS Topology >------");
@@ -684,12 +764,19 @@ bool validate_check_config(void)
 			}
 
 
+			/* An SSL block named by a virtual or real server must exist */
+			if (vs->ssl_name && !find_ssl_profile(vs->ssl_name))
+				log_message(LOG_INFO, "Virtual server %s: unknown ssl_profile %s", FMT_VS(vs), vs->ssl_name);
+
 			/* Set default values */
 
 			/* Spin through all the real servers */
 			for (e1 = LIST_HEAD(vs->rs); e1; ELEMENT_NEXT(e1)) {
 				rs = ELEMENT_DATA(e1);
 
+				if (rs->ssl_name && !find_ssl_profile(rs->ssl_name))
+					log_message(LOG_INFO, "Real server %s: unknown ssl_profile %s", FMT_RS(rs, vs), rs->ssl_name);
+
 				/* Set the forwarding method if necessary */
 				if (rs->forwarding_method == IP_VS_CONN_F_FWD_MASK) {
 					if (vs->forwarding_method == IP_VS_CONN_F_FWD_MASK) {
@@ -720,6 +807,9 @@ bool validate_check_config(void)
 		}
 	}
 
+	/* SSL_GET checkers naming an unknown SSL block are removed */
+	check_http_ssl_profiles();
+
 	if (!LIST_ISEMPTY(checkers_queue)) {
 		for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
 			checker = ELEMENT_DATA(e);
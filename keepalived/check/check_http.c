@@ -25,6 +25,7 @@
 
 #include <openssl/err.h>
 #include "check_http.h"
+#include "check_http2.h"
 #include "check_ssl.h"
 #include "check_api.h"
 #include "logger.h"
@@ -32,7 +33,7 @@
 #include "parser.h"
 #include "utils.h"
 #include "html.h"
-#if !HAVE_DECL_SOCK_CLOEXEC
+#if !HAVE_DECL_SOCK_CLOEXEC || !HAVE_DECL_SOCK_NONBLOCK
 #include "old_socket.h"
 #include "string.h"
 #endif
@@ -41,6 +42,7 @@
 #define	REGISTER_CHECKER_RETRY	2
 
 static int http_connect_thread(thread_t *);
+static int http_check_thread(thread_t *);
 
 /* Configuration stream handling */
 static void
@@ -50,6 +52,8 @@ free_url(void *data)
 	FREE_PTR(url->path);
 	FREE_PTR(url->digest);
 	FREE_PTR(url->virtualhost);
+	FREE_PTR(url->request);
+	FREE_PTR(url->grpc_service);
 	FREE(url);
 }
 
@@ -64,29 +68,33 @@ dump_url(void *data)
 		log_message(LOG_INFO, "     HTTP Status Code = %d", url->status_code);
 	if (url->virtualhost)
 		log_message(LOG_INFO, "     Virtual host = %s", url->virtualhost);
-}
-
-static void
-free_http_request(request_t *req)
-{
-	if(!req)
-		return;
-	if (req->ssl)
-		SSL_free(req->ssl);
-	if (req->buffer)
-		FREE(req->buffer);
-	FREE(req);
+	if (url->grpc)
+		log_message(LOG_INFO, "     gRPC health service = %s",
+			    url->grpc_service ? url->grpc_service : "(server)");
 }
 
 static void
 free_http_get_check(void *data)
 {
 	http_checker_t *http_get_chk = CHECKER_DATA(data);
-	request_t *req = http_get_chk->req;
-
+	request_t *req;
+	unsigned i;
+
+	if (http_get_chk->req) {
+		for (i = 0; i < http_get_chk->url_concurrency; i++) {
+			req = &http_get_chk->req[i];
+			if (req->ssl)
+				SSL_free(req->ssl);
+			FREE_PTR(req->buffer);
+		}
+		FREE(http_get_chk->req);
+	}
+	if (http_get_chk->http2_conn)
+		free_http2_conn(http_get_chk->http2_conn);
 	free_list(&http_get_chk->url);
-	free_http_request(req);
+	FREE_PTR(http_get_chk->urls);
 	FREE_PTR(http_get_chk->virtualhost);
+	FREE_PTR(http_get_chk->ssl_name);
 	FREE_PTR(http_get_chk);
 	FREE_PTR(CHECKER_CO(data));
 	FREE(data);
@@ -103,6 +111,12 @@ dump_http_get_check(void *data)
 	dump_checker_opts(checker);
 	if (http_get_chk->virtualhost)
 		log_message(LOG_INFO, "   Virtualhost = %s", http_get_chk->virtualhost);
+	if (http_get_chk->ssl_name)
+		log_message(LOG_INFO, "   SSL = %s", http_get_chk->ssl_name);
+	if (http_get_chk->http2)
+		log_message(LOG_INFO, "   HTTP/2 = yes");
+	else if (http_get_chk->url_concurrency > 1)
+		log_message(LOG_INFO, "   Url concurrency = %u", http_get_chk->url_concurrency);
 	dump_list(http_get_chk->url);
 }
 static http_checker_t *
@@ -115,6 +129,7 @@ alloc_http_get(char *proto)
 	    (!strcmp(proto, "HTTP_GET")) ? PROTO_HTTP : PROTO_SSL;
 	http_get_chk->url = alloc_list(free_url, dump_url);
 	http_get_chk->virtualhost = NULL;
+	http_get_chk->url_concurrency = 1;
 
 	if (http_get_chk->proto == PROTO_SSL)
 		check_data->ssl_required = true;
@@ -138,9 +153,17 @@ http_get_check_compare(void *a, void *b)
 		return false;
 	if (old->virtualhost && strcmp(old->virtualhost, new->virtualhost))
 		return false;
+	if (!old->ssl_name != !new->ssl_name)
+		return false;
+	if (old->ssl_name && strcmp(old->ssl_name, new->ssl_name))
+		return false;
+	if (old->url_concurrency != new->url_concurrency)
+		return false;
+	if (old->http2 != new->http2)
+		return false;
 	for (n = 0; n < LIST_SIZE(new->url); n++) {
-		u1 = (url_t *)list_element(old->url, n);
-		u2 = (url_t *)list_element(new->url, n);
+		u1 = old->urls[n];
+		u2 = new->urls[n];
 		if (strcmp(u1->path, u2->path))
 			return false;
 		if (!u1->digest != !u2->digest)
@@ -153,6 +176,12 @@ http_get_check_compare(void *a, void *b)
 			return false;
 		if (u1->virtualhost && strcmp(u1->virtualhost, u2->virtualhost))
 			return false;
+		if (u1->grpc != u2->grpc)
+			return false;
+		if (!u1->grpc_service != !u2->grpc_service)
+			return false;
+		if (u1->grpc_service && strcmp(u1->grpc_service, u2->grpc_service))
+			return false;
 	}
 
 	return true;
@@ -188,18 +217,92 @@ virtualhost_handler(vector_t *strvec)
 	http_get_chk->virtualhost = CHECKER_VALUE_STRING(strvec);
 }
 
+static void
+ssl_profile_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+
+	FREE_PTR(http_get_chk->ssl_name);
+	http_get_chk->ssl_name = CHECKER_VALUE_STRING(strvec);
+}
+
+static void
+url_concurrency_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+	unsigned concurrency = CHECKER_VALUE_UINT(strvec);
+
+	if (!concurrency) {
+		log_message(LOG_INFO, "HTTP/SSL_GET url_concurrency must be at least 1 - ignoring");
+		return;
+	}
+
+	http_get_chk->url_concurrency = concurrency;
+}
+
+static void
+http2_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+	int res = true;
+
+	if (vector_size(strvec) >= 2) {
+		res = check_true_false(strvec_slot(strvec, 1));
+		if (res == -1) {
+			log_message(LOG_INFO, "Invalid http2 parameter %s", FMT_STR_VSLOT(strvec, 1));
+			return;
+		}
+	}
+	http_get_chk->http2 = res;
+}
+
 static void
 http_get_check(void)
 {
 	http_checker_t *http_get_chk = CHECKER_GET();
+	request_t *req;
+	element e;
+	unsigned i;
 
 	if (LIST_ISEMPTY(http_get_chk->url)) {
 		log_message(LOG_INFO, "HTTP/SSL_GET checker has no urls specified - ignoring");
 		dequeue_new_checker();
+		return;
 	}
 
 	if (!check_conn_opts(CHECKER_GET_CO())) {
 		dequeue_new_checker();
+		return;
+	}
+
+	if (!http_get_chk->http2) {
+		for (e = LIST_HEAD(http_get_chk->url); e; ELEMENT_NEXT(e)) {
+			if (((url_t *)ELEMENT_DATA(e))->grpc) {
+				log_message(LOG_INFO, "HTTP/SSL_GET checker grpc_health urls need http2 - ignoring");
+				dequeue_new_checker();
+				return;
+			}
+		}
+	}
+
+	/* Index the urls, so the url being checked is found directly */
+	http_get_chk->urls = (url_t **) MALLOC(LIST_SIZE(http_get_chk->url) * sizeof(url_t *));
+	i = 0;
+	for (e = LIST_HEAD(http_get_chk->url); e; ELEMENT_NEXT(e))
+		http_get_chk->urls[i++] = ELEMENT_DATA(e);
+
+	/* No more connections than urls are ever needed, and HTTP/2
+	 * checks all the urls on one connection */
+	if (http_get_chk->http2)
+		http_get_chk->url_concurrency = 1;
+	else if (http_get_chk->url_concurrency > LIST_SIZE(http_get_chk->url))
+		http_get_chk->url_concurrency = LIST_SIZE(http_get_chk->url);
+
+	http_get_chk->req = (request_t *) MALLOC(http_get_chk->url_concurrency * sizeof(request_t));
+	for (i = 0; i < http_get_chk->url_concurrency; i++) {
+		req = &http_get_chk->req[i];
+		req->checker = LIST_TAIL_DATA(checkers_queue);
+		req->fd = -1;
 	}
 }
 
@@ -251,12 +354,28 @@ url_virtualhost_handler(vector_t *strvec)
 	url->virtualhost = CHECKER_VALUE_STRING(strvec);
 }
 
+static void
+grpc_health_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+	url_t *url = LIST_TAIL_DATA(http_get_chk->url);
+
+	url->grpc = true;
+	if (vector_size(strvec) >= 2)
+		url->grpc_service = CHECKER_VALUE_STRING(strvec);
+}
+
 static void
 url_check(void)
 {
 	http_checker_t *http_get_chk = CHECKER_GET();
 	url_t *url = LIST_TAIL_DATA(http_get_chk->url);
 
+	if (!url->path && url->grpc) {
+		url->path = (char *) MALLOC(sizeof(GRPC_HEALTH_PATH));
+		strcpy(url->path, GRPC_HEALTH_PATH);
+	}
+
 	if (!url->path) {
 		log_message(LOG_INFO, "HTTP/SSL_GET checker url has no path - ignoring");
 		free_list_element(http_get_chk->url, http_get_chk->url->tail);
@@ -270,18 +389,60 @@ install_http_ssl_check_keyword(const char *keyword)
 	install_checker_common_keywords(true);
 	install_keyword("nb_get_retry", &http_get_retry_handler);	/* Deprecated */
 	install_keyword("virtualhost", &virtualhost_handler);
+	install_keyword("ssl_profile", &ssl_profile_handler);
+	install_keyword("url_concurrency", &url_concurrency_handler);
+	install_keyword("http2", &http2_handler);
 	install_keyword("url", &url_handler);
 	install_sublevel();
 	install_keyword("path", &path_handler);
 	install_keyword("digest", &digest_handler);
 	install_keyword("status_code", &status_code_handler);
 	install_keyword("virtualhost", &url_virtualhost_handler);
+	install_keyword("grpc_health", &grpc_health_handler);
 	install_sublevel_end_handler(url_check);
 	install_sublevel_end();
 	install_sublevel_end_handler(http_get_check);
 	install_sublevel_end();
 }
 
+/* Resolve the SSL block of each SSL_GET checker, named by the checker,
+ * its real server or its virtual server, and remove the checkers
+ * naming an SSL block that doesn't exist. */
+void
+check_http_ssl_profiles(void)
+{
+	element e, next;
+	checker_t *checker;
+	http_checker_t *http_get_chk;
+	char *name;
+
+	if (LIST_ISEMPTY(checkers_queue))
+		return;
+
+	for (e = LIST_HEAD(checkers_queue); e; e = next) {
+		next = e->next;
+		checker = ELEMENT_DATA(e);
+
+		if (checker->launch != http_connect_thread)
+			continue;
+
+		http_get_chk = CHECKER_ARG(checker);
+		if (http_get_chk->proto != PROTO_SSL)
+			continue;
+
+		if (!(name = http_get_chk->ssl_name) &&
+		    !(name = checker->rs->ssl_name) &&
+		    !(name = checker->vs->ssl_name))
+			continue;
+
+		if (!(http_get_chk->ssl = find_ssl_profile(name))) {
+			log_message(LOG_INFO, "SSL_GET %s: unknown ssl_profile %s - removing checker"
+					    , FMT_CHK(checker), name);
+			free_list_element(checkers_queue, e);
+		}
+	}
+}
+
 void
 install_http_check_keyword(void)
 {
@@ -317,8 +478,25 @@ install_ssl_check_keyword(void)
  *  http_read_thread   ssl_read_thread (perform HTTP|SSL stream)
  *       v              v
  *     http_handle_response (next checker thread registration)
+ *
+ * With http2, http_check_thread goes on to http2_request_thread,
+ * see check_http2.c.
  */
 
+/* Close the connection of a url check, keeping its buffers */
+void
+http_close_request(request_t *req)
+{
+	if (req->ssl) {
+		SSL_free(req->ssl);
+		req->ssl = NULL;
+	}
+	if (req->fd != -1) {
+		close(req->fd);
+		req->fd = -1;
+	}
+}
+
 /*
  * Simple epilog functions. Handling event timeout.
  * Finish the checker with memory managment or url rety check.
@@ -329,11 +507,9 @@ install_ssl_check_keyword(void)
  * method == 2 => register a retry on url checker thread
  */
 static int
-epilog(thread_t * thread, int method, unsigned t, unsigned c)
+epilog(checker_t *checker, int method, unsigned t, unsigned c)
 {
-	checker_t *checker = THREAD_ARG(thread);
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
 	unsigned long delay = 0;
 
 	http_get_check->url_it += t ? t : -http_get_check->url_it;
@@ -394,53 +570,152 @@ epilog(thread_t * thread, int method, unsigned t, unsigned c)
 		break;
 	}
 
-	/* If req == NULL, fd is not created */
-	if (req) {
-		free_http_request(req);
-		http_get_check->req = NULL;
-		close(thread->u.fd);
+	/* Register next checker thread */
+	thread_add_timer(master, http_connect_thread, checker, delay);
+	return 0;
+}
+
+/* Connect to the remote web server to check a url */
+static bool
+http_connect_url(request_t *req, unsigned url_it)
+{
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	conn_opts_t *co = checker->co;
+	enum connect_result status;
+	int fd;
+
+	/* Create the socket, non blocking for all of its life */
+#if HAVE_DECL_SOCK_NONBLOCK
+	fd = socket(co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_TCP);
+#else
+	fd = socket(co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+#endif
+	if (fd == -1) {
+		log_message(LOG_INFO, "WEB connection fail to create socket. Rescheduling.");
+		return false;
 	}
 
-	/* Register next checker thread */
-	thread_add_timer(thread->master, http_connect_thread, checker, delay);
+#if !HAVE_DECL_SOCK_CLOEXEC
+	if (set_sock_flags(fd, F_SETFD, FD_CLOEXEC))
+		log_message(LOG_INFO, "Unable to set CLOEXEC on http_connect socket - %s (%d)", strerror(errno), errno);
+#endif
+#if !HAVE_DECL_SOCK_NONBLOCK
+	if (set_sock_flags(fd, F_SETFL, O_NONBLOCK))
+		log_message(LOG_INFO, "Unable to set NONBLOCK on http_connect socket - %s (%d)", strerror(errno), errno);
+#endif
+
+	status = tcp_bind_connect(fd, co);
+
+	/* handle tcp connection status & register check worker thread */
+	if (status != connect_success && status != connect_in_progress) {
+		close(fd);
+		log_message(LOG_INFO, "WEB socket bind failed. Rescheduling");
+		return false;
+	}
+
+	req->fd = fd;
+	req->url_it = url_it;
+	req->url = http_get_check->urls[url_it];
+	thread_add_write(master, http_check_thread, req, fd, co->connection_to);
+	return true;
+}
+
+/*
+ * With url_concurrency > 1 every url is checked in each round, up to
+ * url_concurrency of them at a time. The round succeeds when all the
+ * urls do, and fails as soon as one of them does.
+ */
+static void
+http_round_end(checker_t *checker)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+
+	if (http_get_check->url_failed) {
+		if (checker->is_up)
+			epilog(checker, REGISTER_CHECKER_RETRY, 0, 1);
+		else
+			epilog(checker, REGISTER_CHECKER_NEW, 0, 0);
+	} else if (http_get_check->url_error)
+		thread_add_timer(master, http_connect_thread, checker,
+				 checker->delay_loop);
+	else if (http_get_check->url_all_ok)
+		epilog(checker, REGISTER_CHECKER_NEW, LIST_SIZE(http_get_check->url), 0);
+	else
+		epilog(checker, REGISTER_CHECKER_NEW, 0, 0);
+}
+
+/* A url of a parallel round has been checked, start the next one */
+int
+http_url_done(request_t *req, bool failed, bool ok)
+{
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+
+	if (failed)
+		http_get_check->url_failed = true;
+	if (!ok)
+		http_get_check->url_all_ok = false;
+
+	if (!http_get_check->url_failed && !http_get_check->url_error &&
+	    http_get_check->url_it < LIST_SIZE(http_get_check->url)) {
+		if (http_connect_url(req, http_get_check->url_it++))
+			return 0;
+		http_get_check->url_error = true;
+	}
+
+	if (!--http_get_check->url_active)
+		http_round_end(checker);
+
 	return 0;
 }
 
 int
 timeout_epilog(thread_t * thread, const char *debug_msg)
 {
-	checker_t *checker = THREAD_ARG(thread);
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+
+	http_close_request(req);
+
+	if (http_get_check->http2) {
+		if (checker->is_up)
+			log_message(LOG_INFO, "%s server %s."
+					    , debug_msg
+					    , FMT_HTTP_RS(checker));
+		return http_url_done(req, true, false);
+	}
+
+	if (http_get_check->url_concurrency > 1) {
+		if (checker->is_up && !http_get_check->url_failed)
+			log_message(LOG_INFO, "%s server %s url(%u)."
+					    , debug_msg
+					    , FMT_HTTP_RS(checker)
+					    , req->url_it + 1);
+		return http_url_done(req, true, false);
+	}
 
 	/* check if server is currently alive */
 	if (checker->is_up) {
 		log_message(LOG_INFO, "%s server %s."
 				    , debug_msg
 				    , FMT_HTTP_RS(checker));
-		return epilog(thread, REGISTER_CHECKER_RETRY, 0, 1);
+		return epilog(checker, REGISTER_CHECKER_RETRY, 0, 1);
 	}
 
 	/* do not retry if server is already known as dead */
-	return epilog(thread, REGISTER_CHECKER_NEW, 0, 0);
-}
-
-/* return the url pointer of the current url iterator  */
-static url_t *
-fetch_next_url(http_checker_t * http_get_check)
-{
-	return list_element(http_get_check->url, http_get_check->url_it);
+	return epilog(checker, REGISTER_CHECKER_NEW, 0, 0);
 }
 
-/* Handle response */
-int
-http_handle_response(thread_t * thread, unsigned char digest[16]
-		     , bool empty_buffer)
+/* Check the response to a url. Its success is logged if the server
+ * is down, and the reason of a failure is returned in msg. */
+enum http_url_result
+http_check_url(checker_t *checker, url_t *url, unsigned url_it,
+	       int status_code, unsigned char digest[16], const char **msg)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
 	int r, di = 0;
-	char *digest_tmp;
-	url_t *fetched_url = fetch_next_url(http_get_check);
+	char digest_tmp[MD5_BUFFER_LENGTH + 1];
 	enum {
 		NONE,
 		ON_SUCCESS,
@@ -448,32 +723,30 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 		ON_DIGEST
 	} last_success = NONE; /* the source of last considered success */
 
-	/* First check if remote webserver returned data */
-	if (empty_buffer)
-		return timeout_epilog(thread, "Read, no data received from ");
-
-	/* Next check the HTTP status code */
-	if (fetched_url->status_code) {
-		if (req->status_code != fetched_url->status_code)
-			return timeout_epilog(thread, "HTTP status code error to");
+	/* First check the HTTP status code */
+	if (url->status_code) {
+		if (status_code != url->status_code) {
+			*msg = "HTTP status code error to";
+			return HTTP_URL_FAILED;
+		}
 
 		last_success = ON_STATUS;
 	}
-	else if (req->status_code >= 200 && req->status_code <= 299)
+	else if (status_code >= 200 && status_code <= 299)
 		last_success = ON_SUCCESS;
 
 	/* Continue with MD5SUM */
-	if (fetched_url->digest) {
+	if (url->digest) {
 		/* Compute MD5SUM */
-		digest_tmp = (char *) MALLOC(MD5_BUFFER_LENGTH + 1);
 		for (di = 0; di < 16; di++)
 			sprintf(digest_tmp + 2 * di, "%02x", digest[di]);
 
-		r = strcmp(fetched_url->digest, digest_tmp);
-		FREE(digest_tmp);
+		r = strcmp(url->digest, digest_tmp);
 
-		if (r)
-			return timeout_epilog(thread, "MD5 digest error to");
+		if (r) {
+			*msg = "MD5 digest error to";
+			return HTTP_URL_FAILED;
+		}
 		last_success = ON_DIGEST;
 	}
 
@@ -485,24 +758,53 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 				log_message(LOG_INFO,
 				       "HTTP success to %s url(%u)."
 				       , FMT_HTTP_RS(checker)
-				       , http_get_check->url_it + 1);
-				return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
+				       , url_it + 1);
+				break;
 			case ON_STATUS:
 				log_message(LOG_INFO,
 				       "HTTP status code success to %s url(%u)."
 				       , FMT_HTTP_RS(checker)
-				       , http_get_check->url_it + 1);
-				return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
+				       , url_it + 1);
+				break;
 			case ON_DIGEST:
 				log_message(LOG_INFO,
 					"MD5 digest success to %s url(%u)."
 					, FMT_HTTP_RS(checker)
-					, http_get_check->url_it + 1);
-				return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
+					, url_it + 1);
+				break;
 		}
 	}
 
-	return epilog(thread, REGISTER_CHECKER_NEW, 0, 0) + 1;
+	return last_success == NONE ? HTTP_URL_NONE : HTTP_URL_SUCCESS;
+}
+
+/* Handle response */
+int
+http_handle_response(thread_t * thread, unsigned char digest[16]
+		     , bool empty_buffer)
+{
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	enum http_url_result result;
+	const char *msg;
+
+	/* First check if remote webserver returned data */
+	if (empty_buffer)
+		return timeout_epilog(thread, "Read, no data received from ");
+
+	result = http_check_url(checker, req->url, req->url_it,
+				req->status_code, digest, &msg);
+	if (result == HTTP_URL_FAILED)
+		return timeout_epilog(thread, msg);
+
+	http_close_request(req);
+
+	if (http_get_check->url_concurrency > 1)
+		return http_url_done(req, false, result == HTTP_URL_SUCCESS) + 1;
+
+	return epilog(checker, REGISTER_CHECKER_NEW,
+		      !checker->is_up && result == HTTP_URL_SUCCESS, 0) + 1;
 }
 
 /* Handle response stream performing MD5 updates */
@@ -528,36 +830,27 @@ http_process_response(request_t *req, size_t r, bool do_md5)
 static int
 http_read_thread(thread_t * thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
-	url_t *url = list_element(http_get_check->url, http_get_check->url_it);
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	url_t *url = req->url;
 	unsigned timeout = checker->co->connection_to;
 	unsigned char digest[16];
 	ssize_t r = 0;
-	int val;
 
 	/* Handle read timeout */
 	if (thread->type == THREAD_READ_TIMEOUT)
 		return timeout_epilog(thread, "Timeout HTTP read");
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
-
-	/* read the HTTP stream */
+	/* read the HTTP stream, the socket is non blocking */
 	r = read(thread->u.fd, req->buffer + req->len,
 		 MAX_BUFFER_LENGTH - req->len);
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
-
 	/* Test if data are ready */
 	if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
 		log_message(LOG_INFO, "Read error with server %s: %s"
 				    , FMT_HTTP_RS(checker)
 				    , strerror(errno));
-		thread_add_read(thread->master, http_read_thread, checker,
+		thread_add_read(thread->master, http_read_thread, req,
 				thread->u.fd, timeout);
 		return 0;
 	}
@@ -585,7 +878,7 @@ http_read_thread(thread_t * thread)
 		 * Register next http stream reader.
 		 * Register itself to not perturbe global I/O multiplexer.
 		 */
-		thread_add_read(thread->master, http_read_thread, checker,
+		thread_add_read(thread->master, http_read_thread, req,
 				thread->u.fd, timeout);
 	}
 
@@ -599,18 +892,20 @@ http_read_thread(thread_t * thread)
 static int
 http_response_thread(thread_t * thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
-	url_t *url = list_element(http_get_check->url, http_get_check->url_it);
+	url_t *url = req->url;
 	unsigned timeout = checker->co->connection_to;
 
 	/* Handle read timeout */
 	if (thread->type == THREAD_READ_TIMEOUT)
 		return timeout_epilog(thread, "Timeout WEB read");
 
-	/* Allocate & clean the get buffer */
-	req->buffer = (char *) MALLOC(MAX_BUFFER_LENGTH);
+	/* The get buffer is allocated once, and reused for each check */
+	if (!req->buffer)
+		req->buffer = (char *) MALLOC(http_get_check->proto == PROTO_SSL ?
+					      SSL_BUFFER_LENGTH : MAX_BUFFER_LENGTH);
 	req->extracted = NULL;
 	req->len = 0;
 	req->error = 0;
@@ -619,50 +914,40 @@ http_response_thread(thread_t * thread)
 
 	/* Register asynchronous http/ssl read thread */
 	if (http_get_check->proto == PROTO_SSL)
-		thread_add_read(thread->master, ssl_read_thread, checker,
+		thread_add_read(thread->master, ssl_read_thread, req,
 				thread->u.fd, timeout);
 	else
-		thread_add_read(thread->master, http_read_thread, checker,
+		thread_add_read(thread->master, http_read_thread, req,
 				thread->u.fd, timeout);
 	return 0;
 }
 
-/* remote Web server is connected, send it the get url query.  */
-static int
-http_request_thread(thread_t * thread)
+/* The virtualhost of a url, from the url, checker, real or virtual server */
+char *
+http_url_vhost(checker_t *checker, url_t *url)
 {
-	checker_t *checker = THREAD_ARG(thread);
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
+
+	if (url->virtualhost)
+		return url->virtualhost;
+	if (http_get_check->virtualhost)
+		return http_get_check->virtualhost;
+	if (checker->rs->virtualhost)
+		return checker->rs->virtualhost;
+	return checker->vs->virtualhost;
+}
+
+/* Build the GET request of a url. This is done when it is first
+ * checked rather than when it is parsed, since the real and virtual
+ * server virtualhosts can be configured after the checker. */
+static void
+http_build_request(checker_t *checker, url_t *url)
+{
 	struct sockaddr_storage *addr = &checker->co->dst;
-	unsigned timeout = checker->co->connection_to;
-	char *vhost;
+	char *vhost = http_url_vhost(checker, url);
 	char *request_host;
 	char request_host_port[7];	/* ":" [0-9][0-9][0-9][0-9][0-9] "\0" */
-	char *str_request;
-	url_t *fetched_url;
-	int ret = 0;
-	int val;
-
-	/* Handle write timeout */
-	if (thread->type == THREAD_WRITE_TIMEOUT)
-		return timeout_epilog(thread, "Timeout WEB write");
-
-	/* Allocate & clean the GET string */
-	str_request = (char *) MALLOC(GET_BUFFER_LENGTH);
-
-	fetched_url = fetch_next_url(http_get_check);
-
-	if (fetched_url->virtualhost)
-		vhost = fetched_url->virtualhost;
-	else if (http_get_check->virtualhost)
-		vhost = http_get_check->virtualhost;
-	else if (checker->rs->virtualhost)
-		vhost = checker->rs->virtualhost;
-	else if (checker->vs->virtualhost)
-		vhost = checker->vs->virtualhost;
-	else
-		vhost = NULL;
+	char str_request[GET_BUFFER_LENGTH];
 
 	if (vhost) {
 		/* If vhost was defined we don't need to override it's port */
@@ -678,80 +963,87 @@ http_request_thread(thread_t * thread)
 	if(addr->ss_family == AF_INET6 && !vhost){
 		/* if literal ipv6 address, use ipv6 template, see RFC 2732 */
 		snprintf(str_request, GET_BUFFER_LENGTH, REQUEST_TEMPLATE_IPV6,
-			fetched_url->path, request_host, request_host_port);
+			url->path, request_host, request_host_port);
 	} else {
 		snprintf(str_request, GET_BUFFER_LENGTH, REQUEST_TEMPLATE,
-			fetched_url->path, request_host, request_host_port);
+			url->path, request_host, request_host_port);
 	}
 
-	DBG("Processing url(%u) of %s.", http_get_check->url_it + 1 , FMT_HTTP_RS(checker));
+	url->request_len = strlen(str_request);
+	url->request = (char *) MALLOC(url->request_len + 1);
+	memcpy(url->request, str_request, url->request_len + 1);
+}
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
+/* remote Web server is connected, send it the get url query.  */
+static int
+http_request_thread(thread_t * thread)
+{
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	unsigned timeout = checker->co->connection_to;
+	url_t *fetched_url = req->url;
+	int ret = 0;
 
-	/* Send the GET request to remote Web server */
-	if (http_get_check->proto == PROTO_SSL)
-		ret = ssl_send_request(req->ssl, str_request, (int)strlen(str_request));
-	else
-		ret = (send(thread->u.fd, str_request, strlen(str_request), 0) != -1);
+	/* Handle write timeout */
+	if (thread->type == THREAD_WRITE_TIMEOUT)
+		return timeout_epilog(thread, "Timeout WEB write");
+
+	if (!fetched_url->request)
+		http_build_request(checker, fetched_url);
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
+	DBG("Processing url(%u) of %s.", req->url_it + 1 , FMT_HTTP_RS(checker));
 
-	FREE(str_request);
+	/* Send the GET request to remote Web server, the socket is non blocking */
+	if (http_get_check->proto == PROTO_SSL)
+		ret = ssl_send_request(req->ssl, fetched_url->request, (int)fetched_url->request_len);
+	else
+		ret = (send(thread->u.fd, fetched_url->request, fetched_url->request_len, 0) != -1);
 
 	if (!ret)
 		return timeout_epilog(thread, "Cannot send get request to");
 
 	/* Register read timeouted thread */
-	thread_add_read(thread->master, http_response_thread, checker,
+	thread_add_read(thread->master, http_response_thread, req,
 			thread->u.fd, timeout);
 	return 1;
 }
 
 /* WEB checkers threads */
-int
+static int
 http_check_thread(thread_t * thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
-#ifdef _DEBUG_
-	request_t *req = http_get_check->req;
-#endif
 	int ret = 1;
 	int status;
 	unsigned long timeout = 0;
 	int ssl_err = 0;
-	bool new_req = false;
 
 	status = tcp_socket_state(thread, http_check_thread);
 	switch (status) {
 	case connect_error:
+		req->fd = -1;	/* closed by tcp_socket_state */
 		return timeout_epilog(thread, "Error connecting");
 		break;
 
 	case connect_timeout:
+		req->fd = -1;
 		return timeout_epilog(thread, "Timeout connecting");
 		break;
 
 	case connect_success:
-		if (!http_get_check->req) {
-			http_get_check->req = (request_t *) MALLOC(sizeof (request_t));
-			new_req = true;
-		} else
-			new_req = false;
-
 		if (http_get_check->proto == PROTO_SSL) {
 			timeout = timer_long(thread->sands) - timer_long(time_now);
 			if (thread->type != THREAD_WRITE_TIMEOUT &&
 			    thread->type != THREAD_READ_TIMEOUT)
-				ret = ssl_connect(thread, new_req);
+				ret = ssl_connect(thread);
 			else
 				return timeout_epilog(thread, "Timeout connecting");
 
 			if (ret == -1) {
-				switch ((ssl_err = SSL_get_error(http_get_check->req->ssl,
+				switch ((ssl_err = SSL_get_error(req->ssl,
 								 ret))) {
 				case SSL_ERROR_WANT_READ:
 					thread_add_read(thread->master,
@@ -781,8 +1073,8 @@ http_check_thread(thread_t * thread)
 			 */
 			DBG("Remote Web server %s connected.", FMT_HTTP_RS(checker));
 			thread_add_write(thread->master,
-					 http_request_thread, checker,
-					 thread->u.fd,
+					 http_get_check->http2 ? http2_request_thread : http_request_thread,
+					 req, thread->u.fd,
 					 checker->co->connection_to);
 		} else {
 			DBG("Connection trouble to: %s."
@@ -806,10 +1098,7 @@ http_connect_thread(thread_t * thread)
 {
 	checker_t *checker = THREAD_ARG(thread);
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	conn_opts_t *co = checker->co;
-	url_t *fetched_url;
-	enum connect_result status;
-	int fd;
+	unsigned i;
 
 	/*
 	 * Register a new checker thread & return
@@ -821,35 +1110,41 @@ http_connect_thread(thread_t * thread)
 		return 0;
 	}
 
-	/* if there are no URLs in list, enable server w/o checking */
-	fetched_url = fetch_next_url(http_get_check);
-	if (!fetched_url)
-		return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
-
-	/* Create the socket */
-	if ((fd = socket(co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
-		log_message(LOG_INFO, "WEB connection fail to create socket. Rescheduling.");
-		thread_add_timer(thread->master, http_connect_thread, checker,
-				checker->delay_loop);
-
+	/* Check the urls one at a time, continuing from the current one */
+	if (http_get_check->url_concurrency == 1 && !http_get_check->http2) {
+		if (!http_connect_url(http_get_check->req, http_get_check->url_it))
+			thread_add_timer(thread->master, http_connect_thread, checker,
+					checker->delay_loop);
 		return 0;
 	}
 
-#if !HAVE_DECL_SOCK_CLOEXEC
-	if (set_sock_flags(fd, F_SETFD, FD_CLOEXEC))
-		log_message(LOG_INFO, "Unable to set CLOEXEC on http_connect socket - %s (%d)", strerror(errno), errno);
-#endif
-
-	status = tcp_bind_connect(fd, co);
+	/* Start a round of parallel checks of all the urls */
+	http_get_check->url_it = 0;
+	http_get_check->url_active = 0;
+	http_get_check->url_failed = false;
+	http_get_check->url_all_ok = true;
+	http_get_check->url_error = false;
+
+	/* With HTTP/2 they are all streams of one connection */
+	if (http_get_check->http2) {
+		if (http_connect_url(http_get_check->req, 0)) {
+			http_get_check->url_it = LIST_SIZE(http_get_check->url);
+			http_get_check->url_active = 1;
+		}
+	} else {
+		for (i = 0; i < http_get_check->url_concurrency; i++) {
+			if (!http_connect_url(&http_get_check->req[i], http_get_check->url_it)) {
+				http_get_check->url_error = true;
+				break;
+			}
+			http_get_check->url_it++;
+			http_get_check->url_active++;
+		}
+	}
 
-	/* handle tcp connection status & register check worker thread */
-	if(tcp_connection_state(fd, status, thread, http_check_thread,
-			co->connection_to)) {
-		close(fd);
-		log_message(LOG_INFO, "WEB socket bind failed. Rescheduling");
+	if (!http_get_check->url_active)
 		thread_add_timer(thread->master, http_connect_thread, checker,
 				checker->delay_loop);
-	}
 
 	return 0;
 }
@@ -0,0 +1,1101 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        WEB CHECK. HTTP/2 and gRPC health checks, on cleartext
+ *              connections with prior knowledge or on TLS with ALPN.
+ *              All the urls of a checker are the streams of one
+ *              connection.
+ *
+ * Authors:     Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+#include "check_http2.h"
+#include "check_ssl.h"
+#include "logger.h"
+#include "memory.h"
+#include "utils.h"
+
+/* HPACK static table (RFC 7541 Appendix A) */
+static const char *hpack_static[][2] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+#define HPACK_STATIC_ENTRIES	(sizeof(hpack_static) / sizeof(hpack_static[0]))
+
+/* Lengths of the HPACK Huffman codes of the 256 octets and EOS (RFC 7541
+ * Appendix B). The code is canonical, so the codes follow from these. */
+static const uint8_t huffman_len[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+#define HUFFMAN_MAX_LEN		30
+
+/* Canonical decoding tables, built on first use */
+static uint16_t huffman_sym[257];			/* symbols by code length */
+static uint32_t huffman_first[HUFFMAN_MAX_LEN + 1];	/* first code of each length */
+static uint16_t huffman_index[HUFFMAN_MAX_LEN + 1];	/* its symbol in huffman_sym */
+static uint16_t huffman_count[HUFFMAN_MAX_LEN + 1];
+static bool huffman_built;
+
+static int http2_read_thread(thread_t *);
+static int http2_write_thread(thread_t *);
+
+static void
+huffman_build(void)
+{
+	unsigned len, sym, n = 0;
+	uint32_t code = 0;
+
+	for (len = 1; len <= HUFFMAN_MAX_LEN; len++) {
+		huffman_first[len] = code;
+		huffman_index[len] = (uint16_t)n;
+		for (sym = 0; sym < 257; sym++) {
+			if (huffman_len[sym] == len)
+				huffman_sym[n++] = (uint16_t)sym;
+		}
+		huffman_count[len] = (uint16_t)(n - huffman_index[len]);
+		code = (code + huffman_count[len]) << 1;
+	}
+
+	huffman_built = true;
+}
+
+static bool
+huffman_decode(const unsigned char *in, size_t len, char *out, size_t *out_len)
+{
+	uint32_t code = 0;
+	unsigned bits = 0;
+	unsigned sym;
+	size_t i, o = 0;
+	int b;
+
+	if (!huffman_built)
+		huffman_build();
+
+	for (i = 0; i < len; i++) {
+		for (b = 7; b >= 0; b--) {
+			code = (code << 1) | ((in[i] >> b) & 1);
+			if (++bits > HUFFMAN_MAX_LEN)
+				return false;
+			if (code - huffman_first[bits] >= huffman_count[bits])
+				continue;
+
+			sym = huffman_sym[huffman_index[bits] + code - huffman_first[bits]];
+			if (sym == 256)		/* EOS */
+				return false;
+			out[o++] = (char)sym;
+			code = 0;
+			bits = 0;
+		}
+	}
+
+	/* The padding is the start of EOS, up to 7 one bits */
+	if (bits > 7 || code != (1U << bits) - 1)
+		return false;
+
+	*out_len = o;
+	return true;
+}
+
+/* HPACK primitives */
+static bool
+hpack_integer(const unsigned char **p, const unsigned char *end, unsigned prefix, uint32_t *value)
+{
+	uint32_t max = (1U << prefix) - 1;
+	uint32_t v;
+	unsigned shift = 0;
+
+	if (*p >= end)
+		return false;
+
+	v = *(*p)++ & max;
+	if (v == max) {
+		do {
+			if (*p >= end || shift > 21)
+				return false;
+			v += (uint32_t)(**p & 0x7f) << shift;
+			shift += 7;
+		} while (*(*p)++ & 0x80);
+	}
+
+	*value = v;
+	return true;
+}
+
+static char *
+hpack_string(const unsigned char **p, const unsigned char *end)
+{
+	bool huffman;
+	uint32_t len;
+	size_t out_len;
+	char *str;
+
+	if (*p >= end)
+		return NULL;
+
+	huffman = !!(**p & 0x80);
+	if (!hpack_integer(p, end, 7, &len) || len > (size_t)(end - *p))
+		return NULL;
+
+	if (huffman) {
+		/* The shortest code is 5 bits */
+		str = (char *) MALLOC(len * 8 / 5 + 1);
+		if (!huffman_decode(*p, len, str, &out_len)) {
+			FREE(str);
+			return NULL;
+		}
+		str[out_len] = '\0';
+	} else {
+		str = (char *) MALLOC(len + 1);
+		memcpy(str, *p, len);
+	}
+
+	*p += len;
+	return str;
+}
+
+static void
+hpack_evict(http2_conn_t *h2, size_t max)
+{
+	hpack_entry_t *entry;
+
+	while (h2->table_size > max) {
+		entry = &h2->table[--h2->table_count];
+		h2->table_size -= strlen(entry->name) + strlen(entry->value) + HPACK_ENTRY_OVERHEAD;
+		FREE(entry->name);
+		FREE(entry->value);
+	}
+}
+
+static void
+hpack_add(http2_conn_t *h2, const char *name, const char *value)
+{
+	size_t name_len = strlen(name);
+	size_t value_len = strlen(value);
+	size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	char *new_name, *new_value;
+
+	/* An entry larger than the table empties it */
+	if (size > h2->table_max) {
+		hpack_evict(h2, 0);
+		return;
+	}
+
+	/* Copy first, name may be an entry about to be evicted */
+	new_name = (char *) MALLOC(name_len + 1);
+	memcpy(new_name, name, name_len);
+	new_value = (char *) MALLOC(value_len + 1);
+	memcpy(new_value, value, value_len);
+
+	hpack_evict(h2, h2->table_max - size);
+	memmove(&h2->table[1], &h2->table[0], h2->table_count * sizeof(hpack_entry_t));
+	h2->table[0].name = new_name;
+	h2->table[0].value = new_value;
+	h2->table_count++;
+	h2->table_size += size;
+}
+
+static bool
+hpack_lookup(http2_conn_t *h2, uint32_t index, const char **name, const char **value)
+{
+	if (!index)
+		return false;
+
+	if (index <= HPACK_STATIC_ENTRIES) {
+		*name = hpack_static[index - 1][0];
+		*value = hpack_static[index - 1][1];
+		return true;
+	}
+
+	index -= HPACK_STATIC_ENTRIES + 1;
+	if (index >= h2->table_count)
+		return false;
+
+	*name = h2->table[index].name;
+	*value = h2->table[index].value;
+	return true;
+}
+
+static void
+http2_header(http2_stream_t *stream, const char *name, const char *value)
+{
+	if (!strcmp(name, ":status"))
+		stream->status_code = atoi(value);
+	else if (!strcmp(name, "grpc-status"))
+		stream->grpc_status = atoi(value);
+}
+
+/* Decode a header block. This is done even for an unknown stream, to keep
+ * the dynamic table in step with the server's. */
+static bool
+hpack_decode(http2_conn_t *h2, http2_stream_t *stream, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	const char *name, *value;
+	char *new_name, *new_value;
+	uint32_t index;
+	bool indexing;
+
+	while (p < end) {
+		new_name = new_value = NULL;
+		indexing = false;
+
+		if (*p & 0x80) {
+			/* Indexed header field */
+			if (!hpack_integer(&p, end, 7, &index) ||
+			    !hpack_lookup(h2, index, &name, &value))
+				return false;
+		} else if ((*p & 0xe0) == 0x20) {
+			/* Dynamic table size update */
+			if (!hpack_integer(&p, end, 5, &index) || index > HPACK_TABLE_SIZE)
+				return false;
+			h2->table_max = index;
+			hpack_evict(h2, index);
+			continue;
+		} else {
+			/* Literal, with incremental indexing, without indexing
+			 * or never indexed */
+			indexing = ((*p & 0xc0) == 0x40);
+			if (!hpack_integer(&p, end, indexing ? 6 : 4, &index))
+				return false;
+			if (index) {
+				if (!hpack_lookup(h2, index, &name, &value))
+					return false;
+			} else if (!(name = new_name = hpack_string(&p, end)))
+				return false;
+			if (!(value = new_value = hpack_string(&p, end))) {
+				FREE_PTR(new_name);
+				return false;
+			}
+		}
+
+		if (stream)
+			http2_header(stream, name, value);
+
+		/* Last, since adding may evict the entry that name points to */
+		if (indexing)
+			hpack_add(h2, name, value);
+
+		FREE_PTR(new_name);
+		FREE_PTR(new_value);
+	}
+
+	return true;
+}
+
+/* Request encoding. Header fields are literals without indexing and
+ * without Huffman coding, so the request of a url never changes. */
+static unsigned char *
+hpack_put_integer(unsigned char *p, uint8_t first, unsigned prefix, size_t value)
+{
+	size_t max = (1U << prefix) - 1;
+
+	if (value < max) {
+		*p++ = (unsigned char)(first | value);
+		return p;
+	}
+
+	*p++ = (unsigned char)(first | max);
+	for (value -= max; value >= 0x80; value >>= 7)
+		*p++ = (unsigned char)(0x80 | (value & 0x7f));
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+static unsigned char *
+hpack_put_field(unsigned char *p, unsigned index, const char *name, const char *value)
+{
+	size_t len;
+
+	p = hpack_put_integer(p, 0x00, 4, index);
+	if (!index) {
+		len = strlen(name);
+		p = hpack_put_integer(p, 0x00, 7, len);
+		memcpy(p, name, len);
+		p += len;
+	}
+	len = strlen(value);
+	p = hpack_put_integer(p, 0x00, 7, len);
+	memcpy(p, value, len);
+	return p + len;
+}
+
+static unsigned char *
+http2_put_frame_header(unsigned char *p, size_t len, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+	*p++ = (unsigned char)(len >> 16);
+	*p++ = (unsigned char)(len >> 8);
+	*p++ = (unsigned char)len;
+	*p++ = type;
+	*p++ = flags;
+	*p++ = (unsigned char)((stream_id >> 24) & 0x7f);
+	*p++ = (unsigned char)(stream_id >> 16);
+	*p++ = (unsigned char)(stream_id >> 8);
+	*p++ = (unsigned char)stream_id;
+	return p;
+}
+
+static unsigned char *
+http2_put_uint32(unsigned char *p, uint32_t val)
+{
+	*p++ = (unsigned char)(val >> 24);
+	*p++ = (unsigned char)(val >> 16);
+	*p++ = (unsigned char)(val >> 8);
+	*p++ = (unsigned char)val;
+	return p;
+}
+
+static uint32_t
+http2_get_uint32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Protocol buffers varint */
+static unsigned char *
+grpc_put_varint(unsigned char *p, size_t value)
+{
+	for (; value >= 0x80; value >>= 7)
+		*p++ = (unsigned char)(0x80 | (value & 0x7f));
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+static bool
+grpc_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value)
+{
+	unsigned shift;
+
+	*value = 0;
+	for (shift = 0; *p < end && shift < 64; shift += 7) {
+		*value |= (uint64_t)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+/* Build the connection preface, our settings, and the streams of all
+ * the urls, sent in one go on each connection. The streams are given a
+ * window as large as possible, so that no WINDOW_UPDATE is ever needed. */
+static void
+http2_build_request(checker_t *checker, http2_conn_t *h2)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	struct sockaddr_storage *addr = &checker->co->dst;
+	unsigned char *p, *frame;
+	char authority[INET6_ADDRSTRLEN + 9];
+	const char *host;
+	size_t size, service_len, msg_len;
+	url_t *url;
+	unsigned i;
+
+	size = sizeof(HTTP2_PREFACE) + 2 * HTTP2_FRAME_HEADER_LEN + 2 * 6 + 4;
+	for (i = 0; i < LIST_SIZE(http_get_check->url); i++) {
+		url = http_get_check->urls[i];
+		host = http_url_vhost(checker, url);
+		size += 2 * HTTP2_FRAME_HEADER_LEN + 128 + strlen(url->path) +
+			(host ? strlen(host) : sizeof(authority)) +
+			(url->grpc_service ? strlen(url->grpc_service) : 0);
+	}
+	h2->request = (char *) MALLOC(size);
+	p = (unsigned char *)h2->request;
+
+	memcpy(p, HTTP2_PREFACE, sizeof(HTTP2_PREFACE) - 1);
+	p += sizeof(HTTP2_PREFACE) - 1;
+
+	p = http2_put_frame_header(p, 2 * 6, HTTP2_SETTINGS, 0, 0);
+	*p++ = 0; *p++ = HTTP2_SETTINGS_ENABLE_PUSH;
+	p = http2_put_uint32(p, 0);
+	*p++ = 0; *p++ = HTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
+	p = http2_put_uint32(p, HTTP2_MAX_WINDOW_SIZE);
+
+	p = http2_put_frame_header(p, 4, HTTP2_WINDOW_UPDATE, 0, 0);
+	p = http2_put_uint32(p, HTTP2_MAX_WINDOW_SIZE - HTTP2_DEFAULT_WINDOW);
+
+	for (i = 0; i < LIST_SIZE(http_get_check->url); i++) {
+		url = http_get_check->urls[i];
+
+		if (!(host = http_url_vhost(checker, url))) {
+			if (addr->ss_family == AF_INET6)
+				snprintf(authority, sizeof(authority), "[%s]:%d",
+					 inet_sockaddrtos(addr), ntohs(inet_sockaddrport(addr)));
+			else
+				snprintf(authority, sizeof(authority), "%s:%d",
+					 inet_sockaddrtos(addr), ntohs(inet_sockaddrport(addr)));
+			host = authority;
+		}
+
+		/* HEADERS, the frame length is filled in afterwards */
+		frame = p;
+		p += HTTP2_FRAME_HEADER_LEN;
+		*p++ = url->grpc ? 0x83 : 0x82;		/* :method POST or GET */
+		*p++ = http_get_check->proto == PROTO_SSL ? 0x87 : 0x86;	/* :scheme */
+		p = hpack_put_field(p, 4, NULL, url->path);	/* :path */
+		p = hpack_put_field(p, 1, NULL, host);		/* :authority */
+		p = hpack_put_field(p, 58, NULL, "KeepAliveClient");	/* user-agent */
+		if (url->grpc) {
+			p = hpack_put_field(p, 31, NULL, "application/grpc");	/* content-type */
+			p = hpack_put_field(p, 0, "te", "trailers");
+		}
+		http2_put_frame_header(frame, (size_t)(p - frame) - HTTP2_FRAME_HEADER_LEN,
+				       HTTP2_HEADERS,
+				       HTTP2_FLAG_END_HEADERS | (url->grpc ? 0 : HTTP2_FLAG_END_STREAM),
+				       2 * i + 1);
+
+		if (!url->grpc)
+			continue;
+
+		/* DATA, a gRPC message of HealthCheckRequest { string service = 1; } */
+		service_len = url->grpc_service ? strlen(url->grpc_service) : 0;
+		frame = p;
+		p += HTTP2_FRAME_HEADER_LEN;
+		*p++ = 0;		/* not compressed */
+		p += 4;			/* message length */
+		if (service_len) {
+			*p++ = 0x0a;	/* field 1, length delimited */
+			p = grpc_put_varint(p, service_len);
+			memcpy(p, url->grpc_service, service_len);
+			p += service_len;
+		}
+		msg_len = (size_t)(p - frame) - HTTP2_FRAME_HEADER_LEN - 5;
+		http2_put_uint32(frame + HTTP2_FRAME_HEADER_LEN + 1, (uint32_t)msg_len);
+		http2_put_frame_header(frame, msg_len + 5, HTTP2_DATA, HTTP2_FLAG_END_STREAM, 2 * i + 1);
+	}
+
+	h2->request_len = (size_t)(p - (unsigned char *)h2->request);
+}
+
+static void
+http2_clear_table(http2_conn_t *h2)
+{
+	hpack_evict(h2, 0);
+	h2->table_max = HPACK_TABLE_SIZE;
+}
+
+void
+free_http2_conn(http2_conn_t *h2)
+{
+	hpack_evict(h2, 0);
+	FREE_PTR(h2->request);
+	FREE_PTR(h2->tx);
+	FREE_PTR(h2->streams);
+	FREE_PTR(h2->buffer);
+	FREE_PTR(h2->block);
+	FREE(h2);
+}
+
+/* Prepare the connection state for a new connection */
+static http2_conn_t *
+http2_init_conn(checker_t *checker)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	http2_conn_t *h2 = http_get_check->http2_conn;
+	unsigned i;
+
+	if (!h2) {
+		h2 = (http2_conn_t *) MALLOC(sizeof(http2_conn_t));
+		h2->streams = (http2_stream_t *) MALLOC(LIST_SIZE(http_get_check->url) * sizeof(http2_stream_t));
+		h2->buffer = (unsigned char *) MALLOC(HTTP2_FRAME_HEADER_LEN + HTTP2_MAX_FRAME_SIZE);
+		http2_build_request(checker, h2);
+		http_get_check->http2_conn = h2;
+	}
+
+	memset(h2->streams, 0, LIST_SIZE(http_get_check->url) * sizeof(http2_stream_t));
+	for (i = 0; i < LIST_SIZE(http_get_check->url); i++) {
+		h2->streams[i].grpc_status = -1;
+		if (http_get_check->urls[i]->digest)
+			MD5_Init(&h2->streams[i].context);
+	}
+	h2->open = LIST_SIZE(http_get_check->url);
+	h2->tx_len = 0;
+	h2->len = 0;
+	h2->block_len = 0;
+	h2->block_stream = 0;
+	http2_clear_table(h2);
+
+	return h2;
+}
+
+/* Write out as much as the socket takes, 0 if it would block, -1 on an error */
+static ssize_t
+http2_write(request_t *req, const void *buf, size_t len)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(req->checker);
+	ssize_t w;
+	int r;
+
+	if (http_get_check->proto == PROTO_SSL) {
+		r = SSL_write(req->ssl, buf, (int)len);
+		if (r <= 0)
+			return SSL_get_error(req->ssl, r) == SSL_ERROR_WANT_WRITE ? 0 : -1;
+		return r;
+	}
+
+	w = send(req->fd, buf, len, 0);
+	if (w == -1 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	return w ? w : -1;
+}
+
+/* Send the frames in buf, queueing what the socket doesn't take
+ * for http2_write_thread(). false on an error. */
+static bool
+http2_send(request_t *req, const void *buf, size_t len)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(req->checker);
+	http2_conn_t *h2 = http_get_check->http2_conn;
+	ssize_t w = 0;
+
+	/* Frames must go out in order */
+	if (!h2->tx_len && (w = http2_write(req, buf, len)) < 0)
+		return false;
+
+	if ((size_t)w == len)
+		return true;
+
+	if (h2->tx_len + len - (size_t)w > h2->tx_size) {
+		h2->tx_size = h2->tx_len + len - (size_t)w;
+		h2->tx = REALLOC(h2->tx, h2->tx_size);
+	}
+	memcpy(h2->tx + h2->tx_len, (const unsigned char *)buf + w, len - (size_t)w);
+	h2->tx_len += len - (size_t)w;
+
+	return true;
+}
+
+/* Wait for the socket to take the queued frames, or else for the reply */
+static void
+http2_wait(thread_t *thread, request_t *req)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(req->checker);
+
+	if (http_get_check->http2_conn->tx_len)
+		thread_add_write(thread->master, http2_write_thread, req,
+				 thread->u.fd, req->checker->co->connection_to);
+	else
+		thread_add_read(thread->master, http2_read_thread, req,
+				thread->u.fd, req->checker->co->connection_to);
+}
+
+static http2_stream_t *
+http2_get_stream(http2_conn_t *h2, http_checker_t *http_get_check, uint32_t stream_id)
+{
+	if (!(stream_id & 1) || (stream_id - 1) / 2 >= LIST_SIZE(http_get_check->url))
+		return NULL;
+
+	return &h2->streams[(stream_id - 1) / 2];
+}
+
+static void
+http2_close_stream(http2_conn_t *h2, http2_stream_t *stream, bool reset)
+{
+	if (!stream || stream->closed)
+		return;
+
+	stream->closed = true;
+	stream->reset = reset;
+	h2->open--;
+}
+
+static bool
+http2_end_headers(http2_conn_t *h2, http_checker_t *http_get_check)
+{
+	http2_stream_t *stream = http2_get_stream(h2, http_get_check, h2->block_stream);
+
+	if (stream && stream->closed)
+		stream = NULL;
+	if (!hpack_decode(h2, stream, h2->block, h2->block_len))
+		return false;
+
+	if (stream) {
+		stream->headers = true;
+		if (h2->block_flags & HTTP2_FLAG_END_STREAM)
+			http2_close_stream(h2, stream, false);
+	}
+
+	h2->block_len = 0;
+	h2->block_stream = 0;
+	return true;
+}
+
+static bool
+http2_add_block(http2_conn_t *h2, const unsigned char *p, size_t len)
+{
+	if (h2->block_len + len > h2->block_size) {
+		/* A response header block is no more than a few frames */
+		if (h2->block_len + len > 4 * HTTP2_MAX_FRAME_SIZE)
+			return false;
+		h2->block_size = h2->block_len + len;
+		h2->block = REALLOC(h2->block, h2->block_size);
+	}
+
+	memcpy(h2->block + h2->block_len, p, len);
+	h2->block_len += len;
+	return true;
+}
+
+/* Handle a received frame, false on a connection error */
+static bool
+http2_frame(request_t *req, http2_conn_t *h2, uint8_t type, uint8_t flags,
+	    uint32_t stream_id, unsigned char *p, size_t len)
+{
+	http_checker_t *http_get_check = CHECKER_ARG(req->checker);
+	http2_stream_t *stream = http2_get_stream(h2, http_get_check, stream_id);
+	unsigned char *end = p + len;
+	unsigned char reply[HTTP2_FRAME_HEADER_LEN + 8];
+	size_t pad = 0;
+	uint32_t last_id;
+	unsigned i;
+	url_t *url;
+
+	/* A header block must not be interrupted */
+	if (h2->block_stream && (type != HTTP2_CONTINUATION || stream_id != h2->block_stream))
+		return false;
+
+	/* Remove the padding */
+	if ((type == HTTP2_DATA || type == HTTP2_HEADERS) && (flags & HTTP2_FLAG_PADDED)) {
+		if (!len || (pad = p[0]) >= len)
+			return false;
+		p++;
+		end -= pad;
+	}
+
+	switch (type) {
+	case HTTP2_DATA:
+		if (!stream || stream->closed)
+			break;
+		url = http_get_check->urls[stream - h2->streams];
+		if (url->grpc) {
+			len = (size_t)(end - p);
+			if (len > GRPC_MSG_MAX - stream->grpc_len)
+				len = GRPC_MSG_MAX - stream->grpc_len;
+			memcpy(stream->grpc_msg + stream->grpc_len, p, len);
+			stream->grpc_len += len;
+		} else if (url->digest && stream->headers)
+			MD5_Update(&stream->context, p, (size_t)(end - p));
+		if (flags & HTTP2_FLAG_END_STREAM)
+			http2_close_stream(h2, stream, false);
+		break;
+
+	case HTTP2_HEADERS:
+		if (flags & HTTP2_FLAG_PRIORITY) {
+			if (end - p < 5)
+				return false;
+			p += 5;
+		}
+		h2->block_stream = stream_id;
+		h2->block_flags = flags;
+		if (!http2_add_block(h2, p, (size_t)(end - p)))
+			return false;
+		if (flags & HTTP2_FLAG_END_HEADERS)
+			return http2_end_headers(h2, http_get_check);
+		break;
+
+	case HTTP2_CONTINUATION:
+		if (!h2->block_stream)
+			return false;
+		if (!http2_add_block(h2, p, len))
+			return false;
+		if (flags & HTTP2_FLAG_END_HEADERS)
+			return http2_end_headers(h2, http_get_check);
+		break;
+
+	case HTTP2_RST_STREAM:
+		http2_close_stream(h2, stream, true);
+		break;
+
+	case HTTP2_SETTINGS:
+		if (flags & HTTP2_FLAG_ACK)
+			break;
+		if (len % 6)
+			return false;
+		http2_put_frame_header(reply, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0);
+		return http2_send(req, reply, HTTP2_FRAME_HEADER_LEN);
+
+	case HTTP2_PING:
+		if (flags & HTTP2_FLAG_ACK)
+			break;
+		if (len != 8)
+			return false;
+		memcpy(reply + HTTP2_FRAME_HEADER_LEN, p, 8);
+		http2_put_frame_header(reply, 8, HTTP2_PING, HTTP2_FLAG_ACK, 0);
+		return http2_send(req, reply, sizeof(reply));
+
+	case HTTP2_GOAWAY:
+		/* The streams after the last one processed never will be */
+		if (len < 8)
+			return false;
+		last_id = http2_get_uint32(p) & 0x7fffffff;
+		for (i = 0; i < LIST_SIZE(http_get_check->url); i++) {
+			if (2 * i + 1 > last_id)
+				http2_close_stream(h2, &h2->streams[i], true);
+		}
+		break;
+
+	case HTTP2_PUSH_PROMISE:
+		/* Disabled in our settings */
+		return false;
+	}
+
+	return true;
+}
+
+/* Handle the complete frames received, false on a connection error */
+static bool
+http2_process(request_t *req, http2_conn_t *h2)
+{
+	unsigned char *p = h2->buffer;
+	size_t len;
+
+	while (h2->len >= HTTP2_FRAME_HEADER_LEN) {
+		len = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+		if (len > HTTP2_MAX_FRAME_SIZE)
+			return false;
+		if (h2->len < HTTP2_FRAME_HEADER_LEN + len)
+			break;
+
+		if (!http2_frame(req, h2, p[3], p[4], http2_get_uint32(p + 5) & 0x7fffffff,
+				 p + HTTP2_FRAME_HEADER_LEN, len))
+			return false;
+
+		h2->len -= HTTP2_FRAME_HEADER_LEN + len;
+		memmove(h2->buffer, h2->buffer + HTTP2_FRAME_HEADER_LEN + len, h2->len);
+	}
+
+	return true;
+}
+
+/* The status of a HealthCheckResponse { ServingStatus status = 1; },
+ * -1 if the response is not one */
+static int
+grpc_health_status(http2_stream_t *stream)
+{
+	const unsigned char *p = stream->grpc_msg;
+	const unsigned char *end;
+	uint64_t key, val;
+	int status = 0;		/* UNKNOWN, the default */
+
+	/* Uncompressed message prefix */
+	if (stream->grpc_len < 5 || p[0])
+		return -1;
+	end = p + 5 + http2_get_uint32(p + 1);
+	if (end > p + stream->grpc_len)
+		return -1;
+
+	for (p += 5; p < end; ) {
+		if (!grpc_get_varint(&p, end, &key))
+			return -1;
+		switch (key & 7) {
+		case 0:
+			if (!grpc_get_varint(&p, end, &val))
+				return -1;
+			if (key >> 3 == 1)
+				status = (int)val;
+			break;
+		case 1:
+			p += 8;
+			break;
+		case 2:
+			if (!grpc_get_varint(&p, end, &val) || val > (uint64_t)(end - p))
+				return -1;
+			p += val;
+			break;
+		case 5:
+			p += 4;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return p == end ? status : -1;
+}
+
+static enum http_url_result
+http2_check_grpc(checker_t *checker, http2_stream_t *stream, unsigned url_it, const char **msg)
+{
+	if (stream->status_code != 200) {
+		*msg = "HTTP status code error to";
+		return HTTP_URL_FAILED;
+	}
+
+	if (stream->grpc_status != 0) {
+		*msg = "gRPC status error to";
+		return HTTP_URL_FAILED;
+	}
+
+	if (grpc_health_status(stream) != GRPC_SERVING) {
+		*msg = "gRPC health not serving on";
+		return HTTP_URL_FAILED;
+	}
+
+	if (!checker->is_up)
+		log_message(LOG_INFO, "gRPC health success to %s url(%u)."
+				    , FMT_HTTP_RS(checker)
+				    , url_it + 1);
+
+	return HTTP_URL_SUCCESS;
+}
+
+/* All the streams are closed, check each url */
+static int
+http2_done(thread_t * thread)
+{
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	http2_conn_t *h2 = http_get_check->http2_conn;
+	http2_stream_t *stream;
+	enum http_url_result result;
+	unsigned char digest[16];
+	bool failed = false;
+	bool all_ok = true;
+	const char *msg = NULL;
+	url_t *url;
+	unsigned i;
+
+	for (i = 0; i < LIST_SIZE(http_get_check->url); i++) {
+		url = http_get_check->urls[i];
+		stream = &h2->streams[i];
+
+		if (stream->reset || !stream->headers) {
+			msg = "HTTP/2 stream reset by";
+			result = HTTP_URL_FAILED;
+		} else if (url->grpc)
+			result = http2_check_grpc(checker, stream, i, &msg);
+		else {
+			if (url->digest)
+				MD5_Final(digest, &stream->context);
+			result = http_check_url(checker, url, i, stream->status_code, digest, &msg);
+		}
+
+		if (result == HTTP_URL_FAILED) {
+			if (!failed && checker->is_up)
+				log_message(LOG_INFO, "%s server %s url(%u)."
+						    , msg
+						    , FMT_HTTP_RS(checker)
+						    , i + 1);
+			failed = true;
+		}
+		if (result != HTTP_URL_SUCCESS)
+			all_ok = false;
+	}
+
+	http_close_request(req);
+	return http_url_done(req, failed, all_ok);
+}
+
+/* Asynchronous HTTP/2 stream reader */
+static int
+http2_read_thread(thread_t * thread)
+{
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	http2_conn_t *h2 = http_get_check->http2_conn;
+	size_t size = HTTP2_FRAME_HEADER_LEN + HTTP2_MAX_FRAME_SIZE;
+	unsigned i;
+	int r;
+
+	/* Handle read timeout */
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return timeout_epilog(thread, "Timeout HTTP/2 read");
+
+	/* Read until nothing is left, SSL may have buffered some */
+	while (true) {
+		if (http_get_check->proto == PROTO_SSL) {
+			r = SSL_read(req->ssl, h2->buffer + h2->len, (int)(size - h2->len));
+			if (r <= 0 && SSL_get_error(req->ssl, r) == SSL_ERROR_WANT_READ)
+				break;
+
+			/* SSL must write before it can read again */
+			if (r <= 0 && SSL_get_error(req->ssl, r) == SSL_ERROR_WANT_WRITE) {
+				thread_add_write(thread->master, http2_write_thread, req,
+						 thread->u.fd, checker->co->connection_to);
+				return 0;
+			}
+		} else {
+			r = (int)read(thread->u.fd, h2->buffer + h2->len, size - h2->len);
+			if (r == -1 && (errno == EAGAIN || errno == EINTR))
+				break;
+		}
+
+		/* Closed by the server, the open streams failed */
+		if (r <= 0) {
+			for (i = 0; i < LIST_SIZE(http_get_check->url); i++)
+				http2_close_stream(h2, &h2->streams[i], true);
+			return http2_done(thread);
+		}
+
+		h2->len += (size_t)r;
+		if (!http2_process(req, h2))
+			return timeout_epilog(thread, "HTTP/2 protocol error from");
+
+		if (!h2->open)
+			return http2_done(thread);
+	}
+
+	http2_wait(thread, req);
+	return 0;
+}
+
+/* Send the frames left over from a short send, then go back to reading */
+static int
+http2_write_thread(thread_t * thread)
+{
+	request_t *req = THREAD_ARG(thread);
+	http_checker_t *http_get_check = CHECKER_ARG(req->checker);
+	http2_conn_t *h2 = http_get_check->http2_conn;
+	ssize_t w;
+
+	/* Handle write timeout */
+	if (thread->type == THREAD_WRITE_TIMEOUT)
+		return timeout_epilog(thread, "Timeout HTTP/2 write");
+
+	if (h2->tx_len) {
+		if ((w = http2_write(req, h2->tx, h2->tx_len)) < 0)
+			return timeout_epilog(thread, "Cannot send HTTP/2 request to");
+
+		h2->tx_len -= (size_t)w;
+		memmove(h2->tx, h2->tx + w, h2->tx_len);
+	}
+
+	http2_wait(thread, req);
+	return 0;
+}
+
+/* Remote web server is connected, send it the streams of all the urls */
+int
+http2_request_thread(thread_t * thread)
+{
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	http2_conn_t *h2;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	const unsigned char *alpn;
+	unsigned alpn_len;
+#endif
+
+	/* Handle write timeout */
+	if (thread->type == THREAD_WRITE_TIMEOUT)
+		return timeout_epilog(thread, "Timeout HTTP/2 write");
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	if (http_get_check->proto == PROTO_SSL) {
+		SSL_get0_alpn_selected(req->ssl, &alpn, &alpn_len);
+		if (alpn_len != 2 || memcmp(alpn, "h2", 2))
+			return timeout_epilog(thread, "HTTP/2 not negotiated with");
+	}
+#endif
+
+	h2 = http2_init_conn(checker);
+
+	/* What is left of a short SSL_write() is sent again from h2->tx */
+	if (http_get_check->proto == PROTO_SSL)
+		SSL_set_mode(req->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	if (!http2_send(req, h2->request, h2->request_len))
+		return timeout_epilog(thread, "Cannot send HTTP/2 request to");
+
+	http2_wait(thread, req);
+	return 1;
+}
@@ -43,50 +43,117 @@
 #endif
 
 /* SSL handlers */
+static ssl_data_t *current_ssl;	/* SSL block being parsed */
+
 static void
-ssl_handler(__attribute__((unused)) vector_t *strvec)
+ssl_handler(vector_t *strvec)
 {
+	ssl_data_t *ssl;
+	element e;
+
+	/* SSL blocks with a name are selected with ssl_profile */
+	if (vector_count(strvec) >= 2) {
+		for (e = LIST_HEAD(check_data->ssl_profiles); e; ELEMENT_NEXT(e)) {
+			ssl = ELEMENT_DATA(e);
+			if (!strcmp(ssl->name, strvec_slot(strvec, 1))) {
+				log_message(LOG_INFO, "SSL %s already specified - replacing", ssl->name);
+				free_list_element(check_data->ssl_profiles, e);
+				break;
+			}
+		}
+		current_ssl = alloc_ssl();
+		current_ssl->name = set_value(strvec);
+		list_add(check_data->ssl_profiles, current_ssl);
+		return;
+	}
+
 	if (check_data->ssl) {
-		free_ssl();
+		free_ssl_data(check_data->ssl);
 		log_message(LOG_INFO, "SSL context already specified - replacing");
 	}
-	check_data->ssl = alloc_ssl();
+	check_data->ssl = current_ssl = alloc_ssl();
 }
 static void
 sslpass_handler(vector_t *strvec)
 {
-	if (check_data->ssl->password) {
+	if (current_ssl->password) {
 		log_message(LOG_INFO, "SSL password already specified - replacing");
-		FREE(check_data->ssl->password);
+		FREE(current_ssl->password);
 	}
-	check_data->ssl->password = set_value(strvec);
+	current_ssl->password = set_value(strvec);
 }
 static void
 sslca_handler(vector_t *strvec)
 {
-	if (check_data->ssl->cafile) {
+	if (current_ssl->cafile) {
 		log_message(LOG_INFO, "SSL cafile already specified - replacing");
-		FREE(check_data->ssl->cafile);
+		FREE(current_ssl->cafile);
 	}
-	check_data->ssl->cafile = set_value(strvec);
+	current_ssl->cafile = set_value(strvec);
 }
 static void
 sslcert_handler(vector_t *strvec)
 {
-	if (check_data->ssl->certfile) {
+	if (current_ssl->certfile) {
 		log_message(LOG_INFO, "SSL certfile already specified - replacing");
-		FREE(check_data->ssl->certfile);
+		FREE(current_ssl->certfile);
 	}
-	check_data->ssl->certfile = set_value(strvec);
+	current_ssl->certfile = set_value(strvec);
 }
 static void
 sslkey_handler(vector_t *strvec)
 {
-	if (check_data->ssl->keyfile) {
+	if (current_ssl->keyfile) {
 		log_message(LOG_INFO, "SSL keyfile already specified - replacing");
-		FREE(check_data->ssl->keyfile);
+		FREE(current_ssl->keyfile);
+	}
+	current_ssl->keyfile = set_value(strvec);
+}
+static void
+sslciphers_handler(vector_t *strvec)
+{
+	if (current_ssl->ciphers) {
+		log_message(LOG_INFO, "SSL ciphers already specified - replacing");
+		FREE(current_ssl->ciphers);
+	}
+	current_ssl->ciphers = set_value(strvec);
+}
+static void
+sslsni_handler(vector_t *strvec)
+{
+	if (current_ssl->sni) {
+		log_message(LOG_INFO, "SSL sni already specified - replacing");
+		FREE(current_ssl->sni);
+	}
+	current_ssl->sni = set_value(strvec);
+}
+static void
+sslstrong_handler(vector_t *strvec)
+{
+	int res = true;
+
+	if (vector_size(strvec) >= 2) {
+		res = check_true_false(strvec_slot(strvec, 1));
+		if (res == -1) {
+			log_message(LOG_INFO, "Invalid SSL strong_check parameter %s", FMT_STR_VSLOT(strvec, 1));
+			return;
+		}
+	}
+	current_ssl->strong_check = res;
+}
+static void
+sslktls_handler(vector_t *strvec)
+{
+	int res = true;
+
+	if (vector_size(strvec) >= 2) {
+		res = check_true_false(strvec_slot(strvec, 1));
+		if (res == -1) {
+			log_message(LOG_INFO, "Invalid SSL ktls parameter %s", FMT_STR_VSLOT(strvec, 1));
+			return;
+		}
 	}
-	check_data->ssl->keyfile = set_value(strvec);
+	current_ssl->ktls = res;
 }
 
 /* Virtual Servers handlers */
@@ -120,7 +187,7 @@ vs_end_handler(void)
 
 	/* If the real (sorry) server uses tunnel forwarding, the address family
 	 * does not have to match the address family of the virtaul server */
-	if (vs->s_svr->forwarding_method != IP_VS_CONN_F_TUNNEL) {
+	if (vs->s_svr && vs->s_svr->forwarding_method != IP_VS_CONN_F_TUNNEL) {
 		if (vs->af == AF_UNSPEC)
 			vs->af = vs->s_svr->addr.ss_family;
 		else if (vs->af != vs->s_svr->addr.ss_family) {
@@ -390,6 +457,14 @@ vs_virtualhost_handler(vector_t *strvec)
 	vs->virtualhost = set_value(strvec);
 }
 
+static void
+vs_ssl_profile_handler(vector_t *strvec)
+{
+	virtual_server_t *vs = LIST_TAIL_DATA(check_data->vs);
+	FREE_PTR(vs->ssl_name);
+	vs->ssl_name = set_value(strvec);
+}
+
 static void
 svr_forwarding_handler(real_server_t *rs, vector_t *strvec)
 {
@@ -592,6 +667,14 @@ rs_virtualhost_handler(vector_t *strvec)
 	rs->virtualhost = set_value(strvec);
 }
 static void
+rs_ssl_profile_handler(vector_t *strvec)
+{
+	virtual_server_t *vs = LIST_TAIL_DATA(check_data->vs);
+	real_server_t *rs = LIST_TAIL_DATA(vs->rs);
+	FREE_PTR(rs->ssl_name);
+	rs->ssl_name = set_value(strvec);
+}
+static void
 vs_alpha_handler(__attribute__((unused)) vector_t *strvec)
 {
 	virtual_server_t *vs = LIST_TAIL_DATA(check_data->vs);
@@ -658,6 +741,10 @@ init_check_keywords(bool active)
 	install_keyword("ca", &sslca_handler);
 	install_keyword("certificate", &sslcert_handler);
 	install_keyword("key", &sslkey_handler);
+	install_keyword("ciphers", &sslciphers_handler);
+	install_keyword("sni", &sslsni_handler);
+	install_keyword("strong_check", &sslstrong_handler);
+	install_keyword("ktls", &sslktls_handler);
 
 	/* Virtual server mapping */
 	install_keyword_root("virtual_server_group", &vsg_handler, active);
@@ -693,6 +780,7 @@ init_check_keywords(bool active)
 	install_keyword("protocol", &proto_handler);
 	install_keyword("ha_suspend", &hasuspend_handler);
 	install_keyword("virtualhost", &vs_virtualhost_handler);
+	install_keyword("ssl_profile", &vs_ssl_profile_handler);
 
 	/* Pool regression detection and handling. */
 	install_keyword("alpha", &vs_alpha_handler);
@@ -722,6 +810,7 @@ init_check_keywords(bool active)
 	install_keyword("warmup", &rs_warmup_handler);
 	install_keyword("delay_loop", &rs_delay_handler);
 	install_keyword("virtualhost", &rs_virtualhost_handler);
+	install_keyword("ssl_profile", &rs_ssl_profile_handler);
 
 	install_sublevel_end_handler(&rs_end_handler);
 
@@ -33,15 +33,19 @@
 #include "utils.h"
 #include "parser.h"
 #include "daemon.h"
-#if !HAVE_DECL_SOCK_CLOEXEC
+#if !HAVE_DECL_SOCK_CLOEXEC || !HAVE_DECL_SOCK_NONBLOCK
 #include "old_socket.h"
 #include "string.h"
 #endif
 
+#define SMTP_QUIT_CMD	"QUIT\r\n"
+#define SMTP_NOOP_CMD	"NOOP\r\n"
+
 static conn_opts_t* default_co;	/* Default conn_opts for SMTP_CHECK */
 static conn_opts_t *sav_co;	/* Saved conn_opts while host{} block processed */
 
 static int smtp_connect_thread(thread_t *);
+static void smtp_connect(thread_t *);
 static int smtp_final(thread_t *thread, int error, const char *format, ...)
 	 __attribute__ ((format (printf, 3, 4)));
 
@@ -63,8 +67,18 @@ static void
 free_smtp_check(void *data)
 {
 	smtp_checker_t *smtp_checker = CHECKER_DATA(data);
+	unsigned i;
+
+	if (smtp_checker->session_fd) {
+		for (i = 0; i < LIST_SIZE(smtp_checker->host); i++) {
+			if (smtp_checker->session_fd[i] != -1)
+				close(smtp_checker->session_fd[i]);
+		}
+		FREE(smtp_checker->session_fd);
+	}
 	free_list(&smtp_checker->host);
 	FREE(smtp_checker->helo_name);
+	FREE_PTR(smtp_checker->helo_cmd);
 	FREE(smtp_checker);
 	FREE(data);
 }
@@ -81,6 +95,10 @@ dump_smtp_check(void *data)
 
 	log_message(LOG_INFO, "   Keepalive method = SMTP_CHECK");
 	log_message(LOG_INFO, "   helo = %s", smtp_checker->helo_name);
+	if (smtp_checker->persistent)
+		log_message(LOG_INFO, "   Persistent session");
+	else if (smtp_checker->pipelining)
+		log_message(LOG_INFO, "   Pipelining");
 	dump_checker_opts(checker);
 
 	if (smtp_checker->host) {
@@ -99,6 +117,9 @@ smtp_check_compare(void *a, void *b)
 
 	if (strcmp(old->helo_name, new->helo_name) != 0)
 		return false;
+	if (old->pipelining != new->pipelining ||
+	    old->persistent != new->persistent)
+		return false;
 	if (!compare_conn_opts(CHECKER_CO(a), CHECKER_CO(b)))
 		return false;
 	if (LIST_SIZE(old->host) != LIST_SIZE(new->host))
@@ -149,6 +170,7 @@ smtp_check_end_handler(void)
 {
 	smtp_checker_t *smtp_checker = CHECKER_GET();
 	conn_opts_t *co = CHECKER_GET_CO();
+	unsigned n;
 
 	if (!smtp_checker->helo_name) {
 		smtp_checker->helo_name = (char *)MALLOC(strlen(SMTP_DEFAULT_HELO) + 1);
@@ -181,6 +203,8 @@ smtp_check_end_handler(void)
 		if (!check_conn_opts(co)) {
 			dequeue_new_checker();
 			FREE(co);
+			FREE(default_co);
+			return;
 		} else
 			list_add(smtp_checker->host, co);
 	}
@@ -194,6 +218,21 @@ smtp_check_end_handler(void)
 	} else
 		FREE(default_co);
 	default_co = NULL;
+
+	/* The HELO is sent as is on every check, QUIT with it if pipelining */
+	smtp_checker->helo_len = strlen("HELO \r\n") + strlen(smtp_checker->helo_name);
+	if (smtp_checker->pipelining && !smtp_checker->persistent)
+		smtp_checker->helo_len += strlen(SMTP_QUIT_CMD);
+	smtp_checker->helo_cmd = (char *)MALLOC(smtp_checker->helo_len + 1);
+	snprintf(smtp_checker->helo_cmd, smtp_checker->helo_len + 1, "HELO %s\r\n%s",
+		 smtp_checker->helo_name,
+		 smtp_checker->pipelining && !smtp_checker->persistent ? SMTP_QUIT_CMD : "");
+
+	if (smtp_checker->persistent) {
+		smtp_checker->session_fd = (int *)MALLOC(LIST_SIZE(smtp_checker->host) * sizeof(int));
+		for (n = 0; n < LIST_SIZE(smtp_checker->host); n++)
+			smtp_checker->session_fd[n] = -1;
+	}
 }
 
 /* Callback for "host" keyword */
@@ -234,6 +273,40 @@ smtp_helo_name_handler(vector_t *strvec)
 	smtp_checker->helo_name = CHECKER_VALUE_STRING(strvec);
 }
 
+/* "pipelining" keyword */
+static void
+smtp_pipelining_handler(vector_t *strvec)
+{
+	smtp_checker_t *smtp_checker = CHECKER_GET();
+	int res = true;
+
+	if (vector_size(strvec) >= 2) {
+		res = check_true_false(strvec_slot(strvec, 1));
+		if (res == -1) {
+			log_message(LOG_INFO, "Invalid pipelining parameter %s", FMT_STR_VSLOT(strvec, 1));
+			return;
+		}
+	}
+	smtp_checker->pipelining = res;
+}
+
+/* "persistent_session" keyword */
+static void
+smtp_persistent_handler(vector_t *strvec)
+{
+	smtp_checker_t *smtp_checker = CHECKER_GET();
+	int res = true;
+
+	if (vector_size(strvec) >= 2) {
+		res = check_true_false(strvec_slot(strvec, 1));
+		if (res == -1) {
+			log_message(LOG_INFO, "Invalid persistent_session parameter %s", FMT_STR_VSLOT(strvec, 1));
+			return;
+		}
+	}
+	smtp_checker->persistent = res;
+}
+
 /* Config callback installer */
 void
 install_smtp_check_keyword(void)
@@ -246,6 +319,8 @@ install_smtp_check_keyword(void)
 	install_keyword("SMTP_CHECK", &smtp_check_handler);
 	install_sublevel();
 	install_keyword("helo_name", &smtp_helo_name_handler);
+	install_keyword("pipelining", &smtp_pipelining_handler);
+	install_keyword("persistent_session", &smtp_persistent_handler);
 
 	install_checker_common_keywords(true);
 
@@ -280,8 +355,14 @@ smtp_final(thread_t *thread, int error, const char *format, ...)
 	char smtp_buff[542];
 	va_list varg_list;
 
-	/* Error or no error we should always have to close the socket */
-	close(thread->u.fd);
+	/* Keep the session open after a good check if persistent, otherwise close it */
+	if (smtp_checker->persistent && !error)
+		smtp_checker->session_fd[smtp_checker->host_ctr] = thread->u.fd;
+	else {
+		close(thread->u.fd);
+		if (smtp_checker->persistent)
+			smtp_checker->session_fd[smtp_checker->host_ctr] = -1;
+	}
 
 	/* If we're here, an attempt HAS been made already for the current host */
 	checker->retry_it++;
@@ -358,22 +439,71 @@ smtp_final(thread_t *thread, int error, const char *format, ...)
 }
 
 /*
- * Zeros out the rx/tx buffer
+ * Drop the reply the engine has analyzed, keeping anything
+ * the server sent after it, such as the reply to a pipelined
+ * command.
  */
 static void
-smtp_clear_buff(thread_t *thread)
+smtp_consume_reply(smtp_checker_t *smtp_checker)
+{
+	smtp_checker->buff_ctr -= smtp_checker->reply_len;
+	memmove(smtp_checker->buff, smtp_checker->buff + smtp_checker->reply_len,
+		smtp_checker->buff_ctr);
+	smtp_checker->buff[smtp_checker->buff_ctr] = '\0';
+	smtp_checker->reply_len = 0;
+}
+
+/*
+ * Check for a complete reply at the head of the buffer. All the
+ * lines of a multiline reply ("220-...") carry the same code, so
+ * they are dropped as they come, and we only keep the last line
+ * ("220 ...") for the engine to look at.
+ */
+static bool
+smtp_find_reply(smtp_checker_t *smtp_checker)
+{
+	char *eol;
+
+	while ((eol = memchr(smtp_checker->buff, '\n', smtp_checker->buff_ctr))) {
+		smtp_checker->reply_len = (size_t)(eol - smtp_checker->buff) + 1;
+		if (smtp_checker->reply_len < 4 || smtp_checker->buff[3] != '-')
+			return true;
+		smtp_consume_reply(smtp_checker);
+	}
+
+	return false;
+}
+
+/*
+ * A persistent session can be closed by the server while idle
+ * (timeout, restart), which shows when probing it. That is not
+ * a failure of the server, so open a new session and run the
+ * whole conversation instead.
+ */
+static bool
+smtp_session_lost(thread_t *thread)
 {
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	memset(smtp_checker->buff, 0, SMTP_BUFF_MAX);
-	smtp_checker->buff_ctr = 0;
+
+	if (smtp_checker->state != SMTP_SEND_NOOP &&
+	    smtp_checker->state != SMTP_SENT_NOOP &&
+	    smtp_checker->state != SMTP_RECV_NOOP)
+		return false;
+
+	DBG("SMTP_CHECK session to server %s lost, reconnecting"
+	    , FMT_SMTP_RS(smtp_checker->host_ptr));
+
+	close(thread->u.fd);
+	smtp_checker->session_fd[smtp_checker->host_ctr] = -1;
+	smtp_connect(thread);
+
+	return true;
 }
 
 /*
- * One thing to note here is we do a very cheap check for a newline.
- * We could receive two lines (with two newline characters) in a
- * single packet, but we don't care. We are only looking at the
- * SMTP response codes at the beginning anyway.
+ * Read until we have a whole reply, which may already have
+ * been received along with a previous one when pipelining.
  */
 static int
 smtp_get_line_cb(thread_t *thread)
@@ -381,8 +511,6 @@ smtp_get_line_cb(thread_t *thread)
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
 	conn_opts_t *smtp_host = smtp_checker->host_ptr;
-	int f;
-	unsigned x;
 	ssize_t r;
 
 	/* Handle read timeout */
@@ -392,46 +520,27 @@ smtp_get_line_cb(thread_t *thread)
 		return 0;
 	}
 
-	/* wrap the buffer, if full, by clearing it */
-	if (smtp_checker->buff_ctr > SMTP_BUFF_MAX) {
-		log_message(LOG_INFO, "SMTP_CHECK Buffer overflow reading from server %s. "
-				      "Increase SMTP_BUFF_MAX in smtp_check.h"
-				    , FMT_SMTP_RS(smtp_host));
-		smtp_clear_buff(thread);
-	}
-
-	/* Set descriptor non blocking */
-	f = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, f | O_NONBLOCK);
-
-	/* read the data */
+	/* read the data, the socket is non blocking */
 	r = read(thread->u.fd, smtp_checker->buff + smtp_checker->buff_ctr,
-		 SMTP_BUFF_MAX - smtp_checker->buff_ctr);
+		 SMTP_BUFF_MAX - 1 - smtp_checker->buff_ctr);
 
 	if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
 		thread_add_read(thread->master, smtp_get_line_cb, checker,
 				thread->u.fd, smtp_host->connection_to);
-		fcntl(thread->u.fd, F_SETFL, f);
 		return 0;
-	} else if (r > 0)
+	} else if (r > 0) {
 		smtp_checker->buff_ctr += (size_t)r;
+		smtp_checker->buff[smtp_checker->buff_ctr] = '\0';
+	}
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, f);
-
-	/* check if we have a newline, if so, callback */
-	for (x = 0; x < SMTP_BUFF_MAX; x++) {
-		if (smtp_checker->buff[x] == '\n') {
-			smtp_checker->buff[SMTP_BUFF_MAX - 1] = '\0';
-
-			DBG("SMTP_CHECK %s < %s"
-			    , FMT_SMTP_RS(smtp_host)
-			    , smtp_checker->buff);
-
-			(smtp_checker->buff_cb)(thread);
+	/* check if we have a reply, if so, callback */
+	if (smtp_find_reply(smtp_checker)) {
+		DBG("SMTP_CHECK %s < %s"
+		    , FMT_SMTP_RS(smtp_host)
+		    , smtp_checker->buff);
 
-			return 0;
-		}
+		(smtp_checker->buff_cb)(thread);
+		return 0;
 	}
 
 	/*
@@ -439,11 +548,20 @@ smtp_get_line_cb(thread_t *thread)
 	 * some sort of error, notify smtp_final()
 	 */
 	if (r <= 0) {
-		smtp_final(thread, 1, "Read failure from server %s"
-				     , FMT_SMTP_RS(smtp_host));
+		if (!smtp_session_lost(thread))
+			smtp_final(thread, 1, "Read failure from server %s"
+					     , FMT_SMTP_RS(smtp_host));
 		return 0;
 	}
 
+	/* wrap the buffer, if full, by clearing it */
+	if (smtp_checker->buff_ctr >= SMTP_BUFF_MAX - 1) {
+		log_message(LOG_INFO, "SMTP_CHECK Buffer overflow reading from server %s. "
+				      "Increase SMTP_BUFF_MAX in smtp_check.h"
+				    , FMT_SMTP_RS(smtp_host));
+		smtp_checker->buff_ctr = 0;
+	}
+
 	/*
 	 * Last case, we haven't read enough data yet
 	 * to pull a newline. Schedule ourselves for
@@ -455,9 +573,9 @@ smtp_get_line_cb(thread_t *thread)
 }
 
 /*
- * Ok a caller has asked us to asyncronously schedule a single line
+ * Ok a caller has asked us to asyncronously schedule a single reply
  * to be received from the server. They have also passed us a call back
- * function that we'll call once we have the newline. If something bad
+ * function that we'll call once we have it. If something bad
  * happens, the caller assumes we'll pass the error off to smtp_final(),
  * which will either down the real server or schedule a retry. The
  * function smtp_get_line_cb is what does the dirty work since the
@@ -470,12 +588,22 @@ smtp_get_line(thread_t *thread, int (*callback) (thread_t *))
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
 	conn_opts_t *smtp_host = smtp_checker->host_ptr;
 
-	/* clear the buffer */
-	smtp_clear_buff(thread);
+	/* drop the previous reply */
+	smtp_consume_reply(smtp_checker);
 
 	/* set the callback */
 	smtp_checker->buff_cb = callback;
 
+	/* the reply to a pipelined command may already be there */
+	if (smtp_find_reply(smtp_checker)) {
+		DBG("SMTP_CHECK %s < %s"
+		    , FMT_SMTP_RS(smtp_host)
+		    , smtp_checker->buff);
+
+		callback(thread);
+		return;
+	}
+
 	/* schedule the I/O with our helper function  */
 	thread_add_read(thread->master, smtp_get_line_cb, checker,
 		thread->u.fd, smtp_host->connection_to);
@@ -484,9 +612,8 @@ smtp_get_line(thread_t *thread, int (*callback) (thread_t *))
 
 /*
  * The scheduler function that puts the data out on the wire.
- * All our data will fit into one packet, so we only check if
- * the current write would block or not. If it wants to block,
- * we'll return to the scheduler and try again later.
+ * If the write would block, we'll return to the scheduler and
+ * send the rest when the socket is writable again.
  */
 static int
 smtp_put_line_cb(thread_t *thread)
@@ -494,45 +621,44 @@ smtp_put_line_cb(thread_t *thread)
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
 	conn_opts_t *smtp_host = smtp_checker->host_ptr;
-	int f;
 	ssize_t w;
 
-
-	/* Handle read timeout */
+	/* Handle write timeout */
 	if (thread->type == THREAD_WRITE_TIMEOUT) {
 		smtp_final(thread, 1, "Write timeout to server %s"
 				     , FMT_SMTP_RS(smtp_host));
 		return 0;
 	}
 
-	/* Set descriptor non blocking */
-	f = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, f | O_NONBLOCK);
-
-	/* write the data */
-	w = write(thread->u.fd, smtp_checker->buff, smtp_checker->buff_ctr);
+	/* write the data, a session closed by the server must not raise SIGPIPE */
+	w = send(thread->u.fd, smtp_checker->tx, smtp_checker->tx_len, MSG_NOSIGNAL);
 
 	if (w == -1 && (errno == EAGAIN || errno == EINTR)) {
 		thread_add_write(thread->master, smtp_put_line_cb, checker,
 				 thread->u.fd, smtp_host->connection_to);
-		fcntl(thread->u.fd, F_SETFL, f);
 		return 0;
 	}
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, f);
-
-	DBG("SMTP_CHECK %s > %s"
-	    , FMT_SMTP_RS(smtp_host)
-	    , smtp_checker->buff);
-
 	/*
 	 * If the connection was closed or there was
 	 * some sort of error, notify smtp_final()
 	 */
 	if (w <= 0) {
-		smtp_final(thread, 1, "Write failure to server %s"
-				     , FMT_SMTP_RS(smtp_host));
+		if (!smtp_session_lost(thread))
+			smtp_final(thread, 1, "Write failure to server %s"
+					     , FMT_SMTP_RS(smtp_host));
+		return 0;
+	}
+
+	DBG("SMTP_CHECK %s > %.*s"
+	    , FMT_SMTP_RS(smtp_host)
+	    , (int)w, smtp_checker->tx);
+
+	smtp_checker->tx += w;
+	smtp_checker->tx_len -= (size_t)w;
+	if (smtp_checker->tx_len) {
+		thread_add_write(thread->master, smtp_put_line_cb, checker,
+				 thread->u.fd, smtp_host->connection_to);
 		return 0;
 	}
 
@@ -542,26 +668,23 @@ smtp_put_line_cb(thread_t *thread)
 }
 
 /*
- * This is the same as smtp_get_line() except that we're sending a
- * line of data instead of receiving one.
+ * This is the same as smtp_get_line() except that we're sending
+ * a command instead of receiving a reply. The socket is almost
+ * always writable, so the write is tried straight away.
  */
 static void
-smtp_put_line(thread_t *thread, int (*callback) (thread_t *))
+smtp_put_line(thread_t *thread, const char *cmd, size_t len, int (*callback) (thread_t *))
 {
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
 
-	smtp_checker->buff[SMTP_BUFF_MAX - 1] = '\0';
-	smtp_checker->buff_ctr = strlen(smtp_checker->buff);
+	smtp_checker->tx = cmd;
+	smtp_checker->tx_len = len;
 
 	/* set the callback */
 	smtp_checker->buff_cb = callback;
 
-	/* schedule the I/O with our helper function  */
-	thread_add_write(thread->master, smtp_put_line_cb, checker,
-			 thread->u.fd, smtp_host->connection_to);
-	return;
+	smtp_put_line_cb(thread);
 }
 
 /*
@@ -578,11 +701,8 @@ smtp_get_status(thread_t *thread)
 
 	/* First make sure they're all digits */
 	if (isdigit(buff[0]) && isdigit(buff[1]) &&
-	    isdigit(buff[2])) {
-		/* Truncate the string and convert */
-		buff[3] = '\0';
-		return atoi(buff);
-	}
+	    isdigit(buff[2]))
+		return (buff[0] - '0') * 100 + (buff[1] - '0') * 10 + buff[2] - '0';
 
 	return -1;
 }
@@ -592,7 +712,8 @@ smtp_get_status(thread_t *thread)
  * the conversation. This function schedules itself to
  * be called via callbacks and tracking state in
  * smtp_checker->state. Upon first calling, smtp_checker->state
- * should be set to SMTP_START.
+ * should be set to SMTP_START, or to SMTP_SEND_NOOP to probe
+ * a persistent session.
  */
 static int
 smtp_engine_thread(thread_t *thread)
@@ -600,6 +721,7 @@ smtp_engine_thread(thread_t *thread)
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
 	conn_opts_t *smtp_host = smtp_checker->host_ptr;
+	int status;
 
 	switch (smtp_checker->state) {
 
@@ -626,13 +748,13 @@ smtp_engine_thread(thread_t *thread)
 			}
 
 			/*
-			 * Schedule to send the HELO, smtp_put_line will
-			 * defer directly to smtp_final on error.
+			 * Schedule to send the HELO, followed by the QUIT if
+			 * pipelining. smtp_put_line will defer directly to
+			 * smtp_final on error.
 			 */
 			smtp_checker->state = SMTP_SENT_HELO;
-			snprintf(smtp_checker->buff, SMTP_BUFF_MAX, "HELO %s\r\n",
-				 smtp_checker->helo_name);
-			smtp_put_line(thread, smtp_engine_thread);
+			smtp_put_line(thread, smtp_checker->helo_cmd, smtp_checker->helo_len,
+				      smtp_engine_thread);
 			return 0;
 			break;
 
@@ -653,9 +775,22 @@ smtp_engine_thread(thread_t *thread)
 				return 0;
 			}
 
+			/* A persistent session is kept open for the next checks */
+			if (smtp_checker->persistent) {
+				smtp_final(thread, 0, NULL);
+				return 0;
+			}
+
+			/* The QUIT went with the HELO, its reply follows */
+			if (smtp_checker->pipelining) {
+				smtp_checker->state = SMTP_RECV_QUIT;
+				smtp_get_line(thread, smtp_engine_thread);
+				return 0;
+			}
+
 			smtp_checker->state = SMTP_SENT_QUIT;
-			snprintf(smtp_checker->buff, SMTP_BUFF_MAX, "QUIT\r\n");
-			smtp_put_line(thread, smtp_engine_thread);
+			smtp_put_line(thread, SMTP_QUIT_CMD, strlen(SMTP_QUIT_CMD),
+				      smtp_engine_thread);
 			return 0;
 			break;
 
@@ -671,6 +806,43 @@ smtp_engine_thread(thread_t *thread)
 			smtp_final(thread, 0, NULL);
 			return 0;
 			break;
+
+		/* Persistent session, send a NOOP as the probe */
+		case SMTP_SEND_NOOP:
+			if (thread->type == THREAD_WRITE_TIMEOUT) {
+				smtp_final(thread, 1, "Write timeout to server %s"
+						     , FMT_SMTP_RS(smtp_host));
+				return 0;
+			}
+
+			smtp_checker->state = SMTP_SENT_NOOP;
+			smtp_put_line(thread, SMTP_NOOP_CMD, strlen(SMTP_NOOP_CMD),
+				      smtp_engine_thread);
+			return 0;
+			break;
+
+		/* Schedule to read the NOOP response */
+		case SMTP_SENT_NOOP:
+			smtp_checker->state = SMTP_RECV_NOOP;
+			smtp_get_line(thread, smtp_engine_thread);
+			return 0;
+			break;
+
+		/* Check for "250 OK", a 421 means the server closed an idle session */
+		case SMTP_RECV_NOOP:
+			status = smtp_get_status(thread);
+			if (status == 250) {
+				smtp_final(thread, 0, NULL);
+				return 0;
+			}
+
+			if (status == 421 && smtp_session_lost(thread))
+				return 0;
+
+			smtp_final(thread, 1, "Bad NOOP response from server %s"
+					     , FMT_SMTP_RS(smtp_host));
+			return 0;
+			break;
 	}
 
 	/* We shouldn't be here */
@@ -710,6 +882,8 @@ smtp_check_thread(thread_t *thread)
 
 			/* Enter the engine at SMTP_START */
 			smtp_checker->state = SMTP_START;
+			smtp_checker->buff_ctr = 0;
+			smtp_checker->reply_len = 0;
 			smtp_engine_thread(thread);
 			return 0;
 			break;
@@ -721,6 +895,52 @@ smtp_check_thread(thread_t *thread)
 	return 0;
 }
 
+/*
+ * Open a connection to the current host and register the
+ * thread handling its outcome. Failing here is an oddity,
+ * the check is just rescheduled.
+ */
+static void
+smtp_connect(thread_t *thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
+	conn_opts_t *smtp_host = smtp_checker->host_ptr;
+	enum connect_result status;
+	int sd;
+
+	/* Create the socket, non blocking for all of its life */
+#if HAVE_DECL_SOCK_NONBLOCK
+	sd = socket(smtp_host->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_TCP);
+#else
+	sd = socket(smtp_host->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+#endif
+	if (sd == -1) {
+		log_message(LOG_INFO, "SMTP_CHECK connection failed to create socket. Rescheduling.");
+		thread_add_timer(thread->master, smtp_connect_thread, checker,
+				 checker->delay_loop);
+		return;
+	}
+#if !HAVE_DECL_SOCK_CLOEXEC
+	if (set_sock_flags(sd, F_SETFD, FD_CLOEXEC))
+		log_message(LOG_INFO, "Unable to set CLOEXEC on smtp socket - %s (%d)", strerror(errno), errno);
+#endif
+#if !HAVE_DECL_SOCK_NONBLOCK
+	if (set_sock_flags(sd, F_SETFL, O_NONBLOCK))
+		log_message(LOG_INFO, "Unable to set NONBLOCK on smtp socket - %s (%d)", strerror(errno), errno);
+#endif
+
+	status = tcp_bind_connect(sd, smtp_host);
+
+	/* handle tcp connection status & register callback the next setp in the process */
+	if(tcp_connection_state(sd, status, thread, smtp_check_thread, smtp_host->connection_to)) {
+		close(sd);
+		log_message(LOG_INFO, "SMTP_CHECK socket bind failed. Rescheduling.");
+		thread_add_timer(thread->master, smtp_connect_thread, checker,
+			checker->delay_loop);
+	}
+}
+
 /*
  * This is the main thread, where all the action starts.
  * When the check daemon comes up, it goes down the checkers_queue
@@ -736,9 +956,6 @@ smtp_connect_thread(thread_t *thread)
 {
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host;
-	enum connect_result status;
-	int sd;
 
 	/* Let's review our data structures.
 	 *
@@ -801,29 +1018,17 @@ smtp_connect_thread(thread_t *thread)
 		return 0;
 	}
 
-	smtp_host = smtp_checker->host_ptr;
-
-	/* Create the socket, failling here should be an oddity */
-	if ((sd = socket(smtp_host->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
-		log_message(LOG_INFO, "SMTP_CHECK connection failed to create socket. Rescheduling.");
-		thread_add_timer(thread->master, smtp_connect_thread, checker,
-				 checker->delay_loop);
+	/* Probe the session left open by the previous check */
+	if (smtp_checker->persistent && smtp_checker->session_fd[smtp_checker->host_ctr] != -1) {
+		smtp_checker->state = SMTP_SEND_NOOP;
+		smtp_checker->buff_ctr = 0;
+		smtp_checker->reply_len = 0;
+		thread_add_write(thread->master, smtp_engine_thread, checker,
+				 smtp_checker->session_fd[smtp_checker->host_ctr],
+				 smtp_checker->host_ptr->connection_to);
 		return 0;
 	}
-#if !HAVE_DECL_SOCK_CLOEXEC
-	if (set_sock_flags(sd, F_SETFD, FD_CLOEXEC))
-		log_message(LOG_INFO, "Unable to set CLOEXEC on smtp socket - %s (%d)", strerror(errno), errno);
-#endif
-
-	status = tcp_bind_connect(sd, smtp_host);
-
-	/* handle tcp connection status & register callback the next setp in the process */
-	if(tcp_connection_state(sd, status, thread, smtp_check_thread, smtp_host->connection_to)) {
-		close(sd);
-		log_message(LOG_INFO, "SMTP_CHECK socket bind failed. Rescheduling.");
-		thread_add_timer(thread->master, smtp_connect_thread, checker,
-			checker->delay_loop);
-	}
 
+	smtp_connect(thread);
 	return 0;
 }
@@ -44,6 +44,8 @@ clear_ssl(ssl_data_t *ssl)
 		SSL_CTX_free(ssl->ctx);
 		ssl->ctx = NULL;
 	}
+	if (ssl)
+		free_list(&ssl->verify_cache);
 }
 
 /* PEM password callback function */
@@ -60,71 +62,174 @@ password_cb(char *buf, int num, __attribute__((unused)) int rwflag, void *userda
 	return (int)plen;
 }
 
-/* Inititalize global SSL context */
+#ifdef _WITH_SSL_VERIFY_CACHE_
+static void
+free_ssl_verified(void *data)
+{
+	FREE(data);
+}
+
+/* Time at which the first certificate of a verified chain expires */
+static time_t
+ssl_chain_expiry(STACK_OF(X509) *chain, time_t now)
+{
+	time_t expires = 0, t;
+	int i, day, sec;
+
+	for (i = 0; i < sk_X509_num(chain); i++) {
+		if (!ASN1_TIME_diff(&day, &sec, NULL, X509_get0_notAfter(sk_X509_value(chain, i))))
+			return now;
+		t = now + (time_t)day * 24 * 60 * 60 + sec;
+		if (!expires || t < expires)
+			expires = t;
+	}
+
+	return expires;
+}
+
+/*
+ * Certificate verification callback of the contexts with strong_check.
+ * Verifying the chain of a server on every check is expensive, and it
+ * gives the same result until a certificate expires, since the CAs we
+ * trust only change on reload. So the fingerprint of the chain sent by
+ * the server, and the name it is checked against, are kept once verified,
+ * until the chain expires.
+ */
 static int
-build_ssl_ctx(void)
+ssl_verify_cert(X509_STORE_CTX *store, void *arg)
 {
-	ssl_data_t *ssl;
+	ssl_data_t *ssl_data = arg;
+	SSL *ssl = X509_STORE_CTX_get_ex_data(store, SSL_get_ex_data_X509_STORE_CTX_idx());
+	STACK_OF(X509) *chain = X509_STORE_CTX_get0_untrusted(store);
+	const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	unsigned char fp[EVP_MAX_MD_SIZE];
+	unsigned int fp_len;
+	ssl_verified_t *verified;
+	EVP_MD_CTX *md;
+	element e, next;
+	time_t now = time(NULL);
+	int i, ret;
+
+	/* Fingerprint of the chain and the name */
+	md = EVP_MD_CTX_new();
+	EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+	if (!chain || !sk_X509_num(chain)) {
+		X509_digest(X509_STORE_CTX_get0_cert(store), EVP_sha256(), fp, &fp_len);
+		EVP_DigestUpdate(md, fp, fp_len);
+	}
+	for (i = 0; chain && i < sk_X509_num(chain); i++) {
+		X509_digest(sk_X509_value(chain, i), EVP_sha256(), fp, &fp_len);
+		EVP_DigestUpdate(md, fp, fp_len);
+	}
+	if (name)
+		EVP_DigestUpdate(md, name, strlen(name) + 1);
+	EVP_DigestFinal_ex(md, digest, NULL);
+	EVP_MD_CTX_free(md);
+
+	for (e = LIST_HEAD(ssl_data->verify_cache); e; e = next) {
+		next = e->next;
+		verified = ELEMENT_DATA(e);
+		if (verified->expires <= now) {
+			free_list_element(ssl_data->verify_cache, e);
+			continue;
+		}
+		if (!memcmp(verified->digest, digest, sizeof(digest))) {
+			X509_STORE_CTX_set_error(store, X509_V_OK);
+			return 1;
+		}
+	}
 
-	/* Library initialization */
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined LIBRESSL_VERSION_NUMBER
-	SSL_library_init();
-	SSL_load_error_strings();
-#else
-	if (!OPENSSL_init_crypto(OPENSSL_INIT_NO_LOAD_CONFIG, NULL))
-		log_message(LOG_INFO, "OPENSSL_init_crypto failed");
-#endif
+	ret = X509_verify_cert(store);
+	if (ret <= 0)
+		return ret;
 
-	if (!check_data->ssl)
-		ssl = (ssl_data_t *) MALLOC(sizeof(ssl_data_t));
-	else
-		ssl = check_data->ssl;
+	/* Drop the oldest entry if full */
+	if (LIST_SIZE(ssl_data->verify_cache) >= SSL_VERIFY_CACHE_MAX)
+		free_list_element(ssl_data->verify_cache, LIST_HEAD(ssl_data->verify_cache));
+
+	verified = (ssl_verified_t *) MALLOC(sizeof(ssl_verified_t));
+	memcpy(verified->digest, digest, sizeof(digest));
+	verified->expires = ssl_chain_expiry(X509_STORE_CTX_get0_chain(store), now);
+	list_add(ssl_data->verify_cache, verified);
 
+	return ret;
+}
+#endif
+
+/* Build the SSL context of an SSL block */
+static int
+build_ssl_ctx(ssl_data_t *ssl)
+{
 	/* Initialize SSL context for SSL v2/3 */
 	ssl->meth = (SSL_METHOD *) SSLv23_method();
 	ssl->ctx = SSL_CTX_new(ssl->meth);
-
-	/* return for autogen context */
-	if (!check_data->ssl) {
-		check_data->ssl = ssl;
-		goto end;
-	}
+	ssl->ctx_owner = ssl;
 
 	/* Load our keys and certificates */
-	if (check_data->ssl->certfile)
+	if (ssl->certfile)
 		if (!
 		    (SSL_CTX_use_certificate_chain_file
-		     (ssl->ctx, check_data->ssl->certfile))) {
+		     (ssl->ctx, ssl->certfile))) {
 			log_message(LOG_INFO,
 			       "SSL error : Cant load certificate file...");
 			return 0;
 		}
 
 	/* Handle password callback using userdata ssl */
-	if (check_data->ssl->password) {
-		SSL_CTX_set_default_passwd_cb_userdata(ssl->ctx,
-						       check_data->ssl);
+	if (ssl->password) {
+		SSL_CTX_set_default_passwd_cb_userdata(ssl->ctx, ssl);
 		SSL_CTX_set_default_passwd_cb(ssl->ctx, password_cb);
 	}
 
-	if (check_data->ssl->keyfile)
+	if (ssl->keyfile)
 		if (!
 		    (SSL_CTX_use_PrivateKey_file
-		     (ssl->ctx, check_data->ssl->keyfile, SSL_FILETYPE_PEM))) {
+		     (ssl->ctx, ssl->keyfile, SSL_FILETYPE_PEM))) {
 			log_message(LOG_INFO, "SSL error : Cant load key file...");
 			return 0;
 		}
 
 	/* Load the CAs we trust */
-	if (check_data->ssl->cafile)
+	if (ssl->cafile)
 		if (!
 		    (SSL_CTX_load_verify_locations
-		     (ssl->ctx, check_data->ssl->cafile, 0))) {
+		     (ssl->ctx, ssl->cafile, 0))) {
 			log_message(LOG_INFO, "SSL error : Cant load CA file...");
 			return 0;
 		}
 
-      end:
+	if (ssl->ciphers && !SSL_CTX_set_cipher_list(ssl->ctx, ssl->ciphers)) {
+		log_message(LOG_INFO, "SSL error : Cant set ciphers %s...", ssl->ciphers);
+		return 0;
+	}
+
+	/*
+	 * Have the kernel decrypt (and encrypt) the records once the
+	 * handshake is done, if OpenSSL, the kernel and the cipher
+	 * negotiated allow it. SSL_read() then reads the plain text
+	 * from the socket. Otherwise OpenSSL silently carries on.
+	 */
+	if (ssl->ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+#else
+		log_message(LOG_INFO, "SSL%s%s: kernel TLS is not supported by this OpenSSL - ignoring"
+				    , ssl->name ? " " : "", ssl->name ? ssl->name : "");
+#endif
+	}
+
+	/* Fail the handshake if the server certificate doesn't verify */
+	if (ssl->strong_check) {
+		if (!ssl->cafile)
+			SSL_CTX_set_default_verify_paths(ssl->ctx);
+		SSL_CTX_set_verify(ssl->ctx, SSL_VERIFY_PEER, NULL);
+#ifdef _WITH_SSL_VERIFY_CACHE_
+		ssl->verify_cache = alloc_list(free_ssl_verified, NULL);
+		SSL_CTX_set_cert_verify_callback(ssl->ctx, ssl_verify_cert, ssl);
+#endif
+	}
+
 #if (OPENSSL_VERSION_NUMBER < 0x00905100L) || defined LIBRESSL_VERSION_NUMBER
 	SSL_CTX_set_verify_depth(ssl->ctx, 1);
 #endif
@@ -132,24 +237,114 @@ build_ssl_ctx(void)
 	return 1;
 }
 
+static bool
+ssl_str_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+/* SSL blocks with the same settings can share their context */
+static bool
+ssl_same_ctx(ssl_data_t *a, ssl_data_t *b)
+{
+	return ssl_str_equal(a->password, b->password) &&
+	       ssl_str_equal(a->cafile, b->cafile) &&
+	       ssl_str_equal(a->certfile, b->certfile) &&
+	       ssl_str_equal(a->keyfile, b->keyfile) &&
+	       ssl_str_equal(a->ciphers, b->ciphers) &&
+	       !a->strong_check == !b->strong_check &&
+	       a->ktls == b->ktls;
+}
+
 /*
- * Initialize the SSL context, with or without specific
- * configuration files.
+ * Give an SSL block the context of a block already built with the
+ * same settings, or build one. The SNI is set per connection, so
+ * blocks only differing by it share their context.
+ */
+static int
+register_ssl_ctx(ssl_data_t *ssl)
+{
+	ssl_data_t *owner = NULL;
+	element e;
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined LIBRESSL_VERSION_NUMBER
+	/* No SSL_CTX_up_ref() */
+	return build_ssl_ctx(ssl);
+#endif
+
+	/* The default block is built first, then the named ones in order */
+	if (ssl == check_data->ssl)
+		return build_ssl_ctx(ssl);
+
+	if (ssl_same_ctx(ssl, check_data->ssl))
+		owner = check_data->ssl;
+	else {
+		for (e = LIST_HEAD(check_data->ssl_profiles); e && ELEMENT_DATA(e) != ssl; ELEMENT_NEXT(e)) {
+			if (ssl_same_ctx(ssl, ELEMENT_DATA(e))) {
+				owner = ELEMENT_DATA(e);
+				break;
+			}
+		}
+	}
+
+	if (!owner)
+		return build_ssl_ctx(ssl);
+
+	SSL_CTX_up_ref(owner->ctx);
+	ssl->ctx = owner->ctx;
+	ssl->ctx_owner = owner->ctx_owner;
+	return 1;
+}
+
+static void
+ssl_ctx_error(ssl_data_t *ssl)
+{
+	log_message(LOG_INFO, "Error Initialize SSL%s%s, ctx Instance"
+			    , ssl->name ? " " : "", ssl->name ? ssl->name : "");
+	log_message(LOG_INFO, "  SSL  keyfile:%s", ssl->keyfile);
+	log_message(LOG_INFO, "  SSL password:%s", ssl->password);
+	log_message(LOG_INFO, "  SSL   cafile:%s", ssl->cafile);
+	log_message(LOG_INFO, "Terminate...");
+}
+
+/*
+ * Initialize the SSL contexts, the default one with or
+ * without specific configuration files, and those of the
+ * named SSL blocks.
  */
 int
 init_ssl_ctx(void)
 {
-	ssl_data_t *ssl = check_data->ssl;
-
-	if (!build_ssl_ctx()) {
-		log_message(LOG_INFO, "Error Initialize SSL, ctx Instance");
-		log_message(LOG_INFO, "  SSL  keyfile:%s", ssl->keyfile);
-		log_message(LOG_INFO, "  SSL password:%s", ssl->password);
-		log_message(LOG_INFO, "  SSL   cafile:%s", ssl->cafile);
-		log_message(LOG_INFO, "Terminate...");
-		clear_ssl(ssl);
+	element e;
+
+	/* Library initialization */
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined LIBRESSL_VERSION_NUMBER
+	SSL_library_init();
+	SSL_load_error_strings();
+#else
+	if (!OPENSSL_init_crypto(OPENSSL_INIT_NO_LOAD_CONFIG, NULL))
+		log_message(LOG_INFO, "OPENSSL_init_crypto failed");
+#endif
+
+	/* autogen context if there is no SSL block */
+	if (!check_data->ssl)
+		check_data->ssl = alloc_ssl();
+
+	if (!register_ssl_ctx(check_data->ssl)) {
+		ssl_ctx_error(check_data->ssl);
+		clear_ssl(check_data->ssl);
 		return 0;
 	}
+
+	for (e = LIST_HEAD(check_data->ssl_profiles); e; ELEMENT_NEXT(e)) {
+		if (!register_ssl_ctx(ELEMENT_DATA(e))) {
+			ssl_ctx_error(ELEMENT_DATA(e));
+			return 0;
+		}
+	}
+
 	return 1;
 }
 
@@ -185,18 +380,33 @@ ssl_printerr(int err)
 }
 
 int
-ssl_connect(thread_t * thread, int new_req)
+ssl_connect(thread_t * thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
+	request_t *req = THREAD_ARG(thread);
+	http_checker_t *http_get_check = CHECKER_ARG(req->checker);
 	int ret = 0;
-	int val = 0;
 
 	/* First round, create SSL context */
-	if (new_req) {
+	if (!req->ssl) {
 		int bio_fd;
-		req->ssl = SSL_new(check_data->ssl->ctx);
+
+		/* Named SSL blocks are resolved at config load */
+		if (!http_get_check->ssl)
+			http_get_check->ssl = check_data->ssl;
+		req->ssl = SSL_new(http_get_check->ssl->ctx);
+		if (http_get_check->ssl->sni) {
+			SSL_set_tlsext_host_name(req->ssl, http_get_check->ssl->sni);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined LIBRESSL_VERSION_NUMBER
+			/* The certificate must be for the name */
+			if (http_get_check->ssl->strong_check)
+				SSL_set1_host(req->ssl, http_get_check->ssl->sni);
+#endif
+		}
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+		/* HTTP/2 is negotiated with ALPN */
+		if (http_get_check->http2)
+			SSL_set_alpn_protos(req->ssl, (const unsigned char *)"\x02h2", 3);
+#endif
 		req->bio = BIO_new_socket(thread->u.fd, BIO_NOCLOSE);
 		BIO_get_fd(req->bio, &bio_fd);
 		fcntl(bio_fd, F_SETFD, fcntl(bio_fd, F_GETFD) | FD_CLOEXEC);
@@ -209,14 +419,15 @@ ssl_connect(thread_t * thread, int new_req)
 #endif
 	}
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
-
+	/* The socket is non blocking */
 	ret = SSL_connect(req->ssl);
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
+#if defined SSL_OP_ENABLE_KTLS && !defined OPENSSL_NO_KTLS
+	if (ret == 1 && http_get_check->ssl->ktls) {
+		DBG("SSL_GET %s: kernel TLS receive %s", FMT_HTTP_RS(req->checker)
+		    , BIO_get_ktls_recv(SSL_get_rbio(req->ssl)) ? "on" : "off");
+	}
+#endif
 
 	return ret;
 }
@@ -245,46 +456,40 @@ ssl_send_request(SSL * ssl, char *str_request, int request_len)
 int
 ssl_read_thread(thread_t * thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
-	url_t *url = list_element(http_get_check->url, http_get_check->url_it);
+	request_t *req = THREAD_ARG(thread);
+	checker_t *checker = req->checker;
+	url_t *url = req->url;
 	unsigned timeout = checker->co->connection_to;
 	unsigned char digest[16];
 	int r = 0;
-	int val;
 
 	/* Handle read timeout */
 	if (thread->type == THREAD_READ_TIMEOUT && !req->extracted)
 		return timeout_epilog(thread, "Timeout SSL read");
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
-
-	/* read the SSL stream */
-	r = SSL_read(req->ssl, req->buffer + req->len, (int)(MAX_BUFFER_LENGTH - req->len));
+	/*
+	 * Read the SSL stream until it would block, rather than going
+	 * back to the scheduler after each record. The socket is non
+	 * blocking.
+	 */
+	while ((r = SSL_read(req->ssl, req->buffer + req->len, (int)(SSL_BUFFER_LENGTH - req->len))) > 0) {
+		http_process_response(req, (size_t)r, (url->digest != NULL));
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
+		/* The buffer is only left full by headers that don't fit */
+		if (req->len == SSL_BUFFER_LENGTH) {
+			log_message(LOG_INFO, "SSL_GET %s: response headers larger than %u bytes"
+					    , FMT_HTTP_RS(checker), SSL_BUFFER_LENGTH);
+			return timeout_epilog(thread, "SSL response headers too large from");
+		}
+	}
 
 	req->error = SSL_get_error(req->ssl, r);
 
 	if (req->error == SSL_ERROR_WANT_READ) {
 		 /* async read unfinished */
-		thread_add_read(thread->master, ssl_read_thread, checker,
-				thread->u.fd, timeout);
-	} else if (r > 0 && req->error == 0) {
-		/* Handle response stream */
-		http_process_response(req, (size_t)r, (url->digest != NULL));
-
-		/*
-		 * Register next ssl stream reader.
-		 * Register itself to not perturbe global I/O multiplexer.
-		 */
-		thread_add_read(thread->master, ssl_read_thread, checker,
+		thread_add_read(thread->master, ssl_read_thread, req,
 				thread->u.fd, timeout);
-	} else if (req->error) {
+	} else {
 
 		/* All the SSL streal has been parsed */
 		if (url->digest)
@@ -30,6 +30,9 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <netinet/ip.h>
 
 #ifndef O_CLOEXEC	/* Since Linux 2.6.23 and glibc 2.7 */
 #define O_CLOEXEC 0	/* It doesn't really matter if O_CLOEXEC isn't set here */
@@ -40,9 +43,43 @@
 #include "utils.h"
 #include "memory.h"
 #include "logger.h"
+#include "scheduler.h"
+#include "parser.h"
 
 static bool no_ipvs = false;
 
+/* Shadow of the services and dests programmed into IPVS, so that
+ * commands which would not change anything are not sent */
+typedef struct _ipvs_shadow_key {
+	union nf_inet_addr	addr;		/* Service */
+	union nf_inet_addr	daddr;		/* Dest, if daf */
+	uint32_t		fwmark;
+	uint16_t		af;
+	uint16_t		protocol;
+	uint16_t		port;
+	uint16_t		daf;
+	uint16_t		dport;
+} ipvs_shadow_key_t;
+
+typedef struct _ipvs_shadow {
+	struct _ipvs_shadow	*next;
+	ipvs_shadow_key_t	key;
+	struct ip_vs_service_user svc;
+#ifdef _HAVE_PE_NAME_
+	char			pe_name[IP_VS_PENAME_MAXLEN];
+#endif
+	struct ip_vs_dest_user	dest;
+	bool			known;		/* Parameters are those in IPVS */
+} ipvs_shadow_t;
+
+static ipvs_shadow_t **ipvs_shadow_tab;
+static unsigned ipvs_shadow_mask;
+static unsigned ipvs_shadow_count;
+
+/* IPVS commands sent, and not sent because they would have been no-ops */
+unsigned long ipvs_ops_issued;
+unsigned long ipvs_ops_suppressed;
+
 /*
  * Utility functions coming from Wensong code
  */
@@ -141,11 +178,230 @@ ipvs_get_group_by_name(char *gname, list l)
 	return NULL;
 }
 
+static void
+ipvs_shadow_set_key(ipvs_shadow_key_t *key, ipvs_service_t *srule, ipvs_dest_t *drule)
+{
+	memset(key, 0, sizeof(*key));
+
+	key->af = srule->af;
+	if (srule->user.fwmark)
+		key->fwmark = srule->user.fwmark;
+	else {
+		key->protocol = srule->user.protocol;
+		key->addr = srule->nf_addr;
+		key->port = srule->user.port;
+	}
+
+	if (drule) {
+		key->daf = drule->af ? drule->af : srule->af;
+		key->daddr = drule->nf_addr;
+		key->dport = drule->user.port;
+	}
+}
+
+static unsigned
+ipvs_shadow_hash(const ipvs_shadow_key_t *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	uint32_t hash = 0x811c9dc5;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash ^ p[i]) * 0x01000193;
+
+	return hash & ipvs_shadow_mask;
+}
+
+static ipvs_shadow_t **
+ipvs_shadow_find(const ipvs_shadow_key_t *key)
+{
+	ipvs_shadow_t **sp;
+
+	if (!ipvs_shadow_tab)
+		return NULL;
+
+	for (sp = &ipvs_shadow_tab[ipvs_shadow_hash(key)]; *sp; sp = &(*sp)->next) {
+		if (!memcmp(&(*sp)->key, key, sizeof(*key)))
+			return sp;
+	}
+
+	return NULL;
+}
+
+static void
+ipvs_shadow_grow(void)
+{
+	ipvs_shadow_t **old_tab = ipvs_shadow_tab;
+	unsigned old_size = old_tab ? ipvs_shadow_mask + 1 : 0;
+	ipvs_shadow_t *s, *next;
+	unsigned i, h;
+
+	ipvs_shadow_mask = old_size ? old_size * 2 - 1 : 255;
+	ipvs_shadow_tab = MALLOC((ipvs_shadow_mask + 1) * sizeof(ipvs_shadow_t *));
+
+	for (i = 0; i < old_size; i++) {
+		for (s = old_tab[i]; s; s = next) {
+			next = s->next;
+			h = ipvs_shadow_hash(&s->key);
+			s->next = ipvs_shadow_tab[h];
+			ipvs_shadow_tab[h] = s;
+		}
+	}
+	FREE_PTR(old_tab);
+}
+
+static void
+ipvs_shadow_set(const ipvs_shadow_key_t *key, ipvs_service_t *srule, ipvs_dest_t *drule, bool known)
+{
+	ipvs_shadow_t **sp, *s;
+	unsigned h;
+
+	if ((sp = ipvs_shadow_find(key)))
+		s = *sp;
+	else {
+		if (!ipvs_shadow_tab || ipvs_shadow_count >= ipvs_shadow_mask + 1)
+			ipvs_shadow_grow();
+		s = MALLOC(sizeof(ipvs_shadow_t));
+		s->key = *key;
+		h = ipvs_shadow_hash(key);
+		s->next = ipvs_shadow_tab[h];
+		ipvs_shadow_tab[h] = s;
+		ipvs_shadow_count++;
+	}
+
+	s->known = known;
+	if (drule)
+		s->dest = drule->user;
+	else {
+		s->svc = srule->user;
+#ifdef _HAVE_PE_NAME_
+		memcpy(s->pe_name, srule->pe_name, sizeof(s->pe_name));
+#endif
+	}
+}
+
+static void
+ipvs_shadow_remove(const ipvs_shadow_key_t *key)
+{
+	ipvs_shadow_t **sp, *s;
+	unsigned i;
+
+	if ((sp = ipvs_shadow_find(key))) {
+		s = *sp;
+		*sp = s->next;
+		FREE(s);
+		ipvs_shadow_count--;
+	}
+
+	/* Removing a service removes its dests */
+	if (key->daf || !ipvs_shadow_tab)
+		return;
+
+	for (i = 0; i <= ipvs_shadow_mask; i++) {
+		for (sp = &ipvs_shadow_tab[i]; (s = *sp); ) {
+			if (s->key.daf &&
+			    s->key.af == key->af &&
+			    s->key.fwmark == key->fwmark &&
+			    s->key.protocol == key->protocol &&
+			    s->key.port == key->port &&
+			    !memcmp(&s->key.addr, &key->addr, sizeof(key->addr))) {
+				*sp = s->next;
+				FREE(s);
+				ipvs_shadow_count--;
+			}
+			else
+				sp = &s->next;
+		}
+	}
+}
+
+static void
+ipvs_shadow_clear(void)
+{
+	ipvs_shadow_t *s, *next;
+	unsigned i;
+
+	if (!ipvs_shadow_tab)
+		return;
+
+	for (i = 0; i <= ipvs_shadow_mask; i++) {
+		for (s = ipvs_shadow_tab[i]; s; s = next) {
+			next = s->next;
+			FREE(s);
+		}
+	}
+	FREE(ipvs_shadow_tab);
+	ipvs_shadow_count = 0;
+}
+
+/* Returns true if the command would leave IPVS as it is */
+static bool
+ipvs_shadow_noop(int cmd, const ipvs_shadow_key_t *key, ipvs_service_t *srule, ipvs_dest_t *drule)
+{
+	ipvs_shadow_t **sp = ipvs_shadow_find(key);
+	ipvs_shadow_t *s = sp ? *sp : NULL;
+
+	switch (cmd) {
+	case IP_VS_SO_SET_DEL:
+	case IP_VS_SO_SET_DELDEST:
+		return !s;
+	case IP_VS_SO_SET_ADD:
+	case IP_VS_SO_SET_EDIT:
+		return s && s->known &&
+		       !strncmp(s->svc.sched_name, srule->user.sched_name, IP_VS_SCHEDNAME_MAXLEN) &&
+		       s->svc.flags == srule->user.flags &&
+		       s->svc.timeout == srule->user.timeout &&
+		       s->svc.netmask == srule->user.netmask
+#ifdef _HAVE_PE_NAME_
+		       && !strncmp(s->pe_name, srule->pe_name, IP_VS_PENAME_MAXLEN)
+#endif
+		       ;
+	case IP_VS_SO_SET_ADDDEST:
+	case IP_VS_SO_SET_EDITDEST:
+		return s && s->known &&
+		       s->dest.conn_flags == drule->user.conn_flags &&
+		       s->dest.weight == drule->user.weight &&
+		       s->dest.u_threshold == drule->user.u_threshold &&
+		       s->dest.l_threshold == drule->user.l_threshold;
+	}
+
+	return false;
+}
+
+/* Record the effect of a command IPVS has accepted. If the entry already
+ * existed when added, IPVS has kept its own parameters. */
+static void
+ipvs_shadow_update(int cmd, const ipvs_shadow_key_t *key, ipvs_service_t *srule, ipvs_dest_t *drule, bool existed)
+{
+	switch (cmd) {
+	case IP_VS_SO_SET_FLUSH:
+		ipvs_shadow_clear();
+		break;
+	case IP_VS_SO_SET_ADD:
+	case IP_VS_SO_SET_EDIT:
+		ipvs_shadow_set(key, srule, NULL, !existed);
+		break;
+	case IP_VS_SO_SET_ADDDEST:
+	case IP_VS_SO_SET_EDITDEST:
+		ipvs_shadow_set(key, srule, drule, !existed);
+		break;
+	case IP_VS_SO_SET_DEL:
+	case IP_VS_SO_SET_DELDEST:
+		ipvs_shadow_remove(key);
+		break;
+	}
+}
+
 /* Initialization helpers */
 int
 ipvs_start(void)
 {
 	log_message(LOG_DEBUG, "Initializing ipvs");
+
+	/* When simulating, IPVS is not loaded or accessed */
+	if (thread_simulating())
+		return IPVS_SUCCESS;
+
 	/* Initialize IPVS module */
 	if (ipvs_init()) {
 		if (modprobe_ipvs() || ipvs_init()) {
@@ -165,6 +421,13 @@ ipvs_stop(void)
 	if (no_ipvs)
 		return;
 
+	/* The shadow is kept across a reload, as are the IPVS entries */
+	if (!reload) {
+		log_message(LOG_INFO, "IPVS commands issued %lu, suppressed as no-ops %lu"
+				    , ipvs_ops_issued, ipvs_ops_suppressed);
+		ipvs_shadow_clear();
+	}
+
 	ipvs_close();
 }
 
@@ -188,10 +451,33 @@ static int
 ipvs_talk(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, ipvs_daemon_t *daemonrule, bool ignore_error)
 {
 	int result = -1;
+	ipvs_shadow_key_t key;
+	bool shadowed;
 
 	if (no_ipvs)
 		return result;
 
+	/* Daemon commands are not shadowed */
+	shadowed = (cmd != IP_VS_SO_SET_STARTDAEMON && cmd != IP_VS_SO_SET_STOPDAEMON &&
+		    cmd != IP_VS_SO_SET_ZERO);
+	if (shadowed && srule) {
+		ipvs_shadow_set_key(&key, srule,
+				    (cmd == IP_VS_SO_SET_ADDDEST || cmd == IP_VS_SO_SET_DELDEST ||
+				     cmd == IP_VS_SO_SET_EDITDEST) ? drule : NULL);
+		if (ipvs_shadow_noop(cmd, &key, srule, drule)) {
+			ipvs_ops_suppressed++;
+			return 0;
+		}
+	}
+	ipvs_ops_issued++;
+
+	if (thread_simulating()) {
+		sim_stats.ipvs_ops++;
+		if (shadowed)
+			ipvs_shadow_update(cmd, &key, srule, drule, false);
+		return 0;
+	}
+
 	switch (cmd) {
 		case IP_VS_SO_SET_STARTDAEMON:
 			result = ipvs_start_daemon(daemonrule);
@@ -229,6 +515,14 @@ ipvs_talk(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, ipvs_daemon_t *dae
 			break;
 	}
 
+	/* An existing entry was added or a missing one removed, so
+	 * the kernel has the entry, or not, as the shadow now will */
+	if (shadowed &&
+	    (!result ||
+	     (errno == EEXIST && (cmd == IP_VS_SO_SET_ADD || cmd == IP_VS_SO_SET_ADDDEST)) ||
+	     (errno == ENOENT && (cmd == IP_VS_SO_SET_DEL || cmd == IP_VS_SO_SET_DELDEST))))
+		ipvs_shadow_update(cmd, &key, srule, drule, !!result);
+
 	if (ignore_error)
 		result = 0;
 	else if (result) {
@@ -316,6 +610,68 @@ ipvs_group_range_cmd(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, virtual
 	return 0;
 }
 
+/* Add or remove the iptables rule marking the traffic for a range of
+ * addresses served by a single fwmark service */
+static void
+ipvs_group_range_mark_rule(virtual_server_group_entry_t *vsge, virtual_server_t *vs, bool add)
+{
+	char range[2 * INET6_ADDRSTRLEN + 1];
+	char port[6];
+	char mark[11];
+	char *argv[18];
+	struct sockaddr_storage end = vsge->addr;
+	size_t len;
+
+	if (no_ipvs || thread_simulating())
+		return;
+
+	inet_ntop(vsge->addr.ss_family, vsge->addr.ss_family == AF_INET6 ?
+		  (void *)&((struct sockaddr_in6 *)&vsge->addr)->sin6_addr :
+		  (void *)&((struct sockaddr_in *)&vsge->addr)->sin_addr, range, INET6_ADDRSTRLEN);
+	if (vsge->addr.ss_family == AF_INET6)
+		((struct sockaddr_in6 *)&end)->sin6_addr.s6_addr16[7] =
+			htons(ntohs(((struct sockaddr_in6 *)&end)->sin6_addr.s6_addr16[7]) + vsge->range);
+	else
+		((struct sockaddr_in *)&end)->sin_addr.s_addr =
+			htonl(ntohl(((struct sockaddr_in *)&end)->sin_addr.s_addr) + vsge->range);
+	len = strlen(range);
+	range[len++] = '-';
+	inet_ntop(end.ss_family, end.ss_family == AF_INET6 ?
+		  (void *)&((struct sockaddr_in6 *)&end)->sin6_addr :
+		  (void *)&((struct sockaddr_in *)&end)->sin_addr, range + len, INET6_ADDRSTRLEN);
+
+	snprintf(port, sizeof(port), "%u", ntohs(inet_sockaddrport(&vsge->addr)));
+	snprintf(mark, sizeof(mark), "%u", vsge->vfwmark);
+
+	argv[0] = vsge->addr.ss_family == AF_INET6 ? "ip6tables" : "iptables";
+	argv[1] = "-t";
+	argv[2] = "mangle";
+	argv[3] = "-C";
+	argv[4] = "PREROUTING";
+	argv[5] = "-p";
+	argv[6] = vs->service_type == IPPROTO_TCP ? "tcp" : vs->service_type == IPPROTO_UDP ? "udp" : "sctp";
+	argv[7] = "-m";
+	argv[8] = "iprange";
+	argv[9] = "--dst-range";
+	argv[10] = range;
+	argv[11] = "--dport";
+	argv[12] = port;
+	argv[13] = "-j";
+	argv[14] = "MARK";
+	argv[15] = "--set-mark";
+	argv[16] = mark;
+	argv[17] = NULL;
+
+	/* Don't add a duplicate, e.g. after keepalived was killed */
+	if (add && !fork_exec(argv))
+		return;
+
+	argv[3] = add ? "-A" : "-D";
+	if (fork_exec(argv))
+		log_message(LOG_INFO, "Failed to %s %s mark rule for range %s port %s fwmark %s"
+				    , add ? "add" : "remove", argv[0], range, port, mark);
+}
+
 /* set IPVS group rules */
 static bool
 is_vsge_alive(virtual_server_group_entry_t *vsge, virtual_server_t *vs)
@@ -447,6 +803,9 @@ ipvs_group_cmd(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, virtual_serve
 		if (ipvs_change_needed(cmd, vsg_entry, vs, rs)) {
 			if (ipvs_talk(cmd, srule, drule, NULL, false))
 				return -1;
+			if (vsg_entry->fwmark_range &&
+			    (cmd == IP_VS_SO_SET_ADD || cmd == IP_VS_SO_SET_DEL))
+				ipvs_group_range_mark_rule(vsg_entry, vs, cmd == IP_VS_SO_SET_ADD);
 			ipvs_set_vsge_alive_state(cmd, vsg_entry, vs);
 		}
 	}
@@ -577,7 +936,7 @@ ipvs_group_sync_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge)
 			drule.user.weight = rs->inhibit && !rs->alive ? 0 : rs->weight;
 
 			/* Set vs rule */
-			if (vsge->range)
+			if (vsge->range && !vsge->fwmark_range)
 				ipvs_group_range_cmd(IP_VS_SO_SET_ADDDEST, &srule, &drule, vsge);
 			else {
 				if (vsge->vfwmark)
@@ -609,6 +968,8 @@ ipvs_group_remove_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge
 	ipvs_set_srule(IP_VS_SO_SET_DELDEST, &srule, vs);
 	if (!vsge->vfwmark)
 		srule.user.port = inet_sockaddrport(&vsge->addr);
+	else
+		srule.user.fwmark = vsge->vfwmark;
 
 	/* Process realserver queue */
 	for (e = LIST_HEAD(vs->rs); e; ELEMENT_NEXT(e)) {
@@ -619,7 +980,7 @@ ipvs_group_remove_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge
 			ipvs_set_drule(IP_VS_SO_SET_DELDEST, &drule, rs);
 
 			/* Set vs rule */
-			if (vsge->range)
+			if (vsge->range && !vsge->fwmark_range)
 				ipvs_group_range_cmd(IP_VS_SO_SET_DELDEST, &srule, &drule, vsge);
 			else {
 				if (vsge->vfwmark)
@@ -638,10 +999,13 @@ ipvs_group_remove_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge
 	}
 
 	/* Remove VS entry */
-	if (vsge->range)
+	if (vsge->range && !vsge->fwmark_range)
 		ipvs_group_range_cmd(IP_VS_SO_SET_DEL, &srule, NULL, vsge);
-	else
+	else {
 		ipvs_talk(IP_VS_SO_SET_DEL, &srule, NULL, NULL, false);
+		if (vsge->fwmark_range)
+			ipvs_group_range_mark_rule(vsge, vs, false);
+	}
 	unset_vsge_alive(vsge,vs);
 }
 
@@ -819,4 +1183,278 @@ ipvs_syncd_backup(const struct lvs_syncd_config *config)
 	ipvs_syncd_cmd(IPVS_STOPDAEMON, config, IPVS_MASTER, false, false);
 	ipvs_syncd_cmd(IPVS_STARTDAEMON, config, IPVS_BACKUP, false, false);
 }
+
+/*
+ * Sync daemon telemetry.
+ *
+ * The kernel keeps no counters of sync traffic, so the master's message
+ * rate and lag are estimated from what it does expose: each connection
+ * scheduled is sent at least once, packed into messages of sync_maxlen
+ * bytes, and a partly filled message is sent after IPVS_SYNC_FLUSH_TIME.
+ * The connection counts come from the dests of all the services, so on
+ * a backup they are the connections it has been sent, and comparing them
+ * with the master's shows how much of the table would survive a failover.
+ * Loss is seen on the backup as drops on the receiving UDP sockets.
+ */
+static ipvs_syncd_stats_t syncd_stats;
+
+/* Bytes of a v1 sync message header, and of a connection entry without options */
+#define IPVS_SYNC_MESG_HEADER_LEN	8
+#define IPVS_SYNC_CONN_V4_LEN		36
+#define IPVS_SYNC_CONN_V6_LEN		72
+#define IPVS_SYNC_MAX_CONNS		255		/* nr_conns is 8 bits */
+#define IPVS_SYNC_PORT			8848
+#define IPVS_SYNC_FLUSH_TIME		2.0		/* seconds */
+
+static unsigned
+ipvs_syncd_ports(void)
+{
+	FILE *fp;
+	unsigned ports = 1;
+
+	/* Linux 3.9 onwards can use several sync threads, each with its own port */
+	if ((fp = fopen("/proc/sys/net/ipv4/vs/sync_ports", "r"))) {
+		if (fscanf(fp, "%u", &ports) != 1 || !ports)
+			ports = 1;
+		fclose(fp);
+	}
+
+	return ports;
+}
+
+/* Add up the queues and drops of the sync sockets. A master's sockets
+ * send to the sync ports, a backup's are bound to them. */
+static void
+ipvs_syncd_socket_stats(const char *proc_file, int state, unsigned base_port, unsigned ports,
+			unsigned long *send_queue, unsigned long *recv_queue, unsigned long *drops)
+{
+	FILE *fp;
+	char buf[256];
+	unsigned lport, rport, port, txq, rxq;
+	unsigned long sk_drops;
+
+	if (!(fp = fopen(proc_file, "r")))
+		return;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		/* sl local rem st tx_queue:rx_queue tr:when retrnsmt uid timeout inode ref pointer drops */
+		if (sscanf(buf, " %*u: %*[0-9A-Fa-f]:%x %*[0-9A-Fa-f]:%x %*x %x:%x %*s %*s %*s %*s %*s %*s %*s %lu",
+			   &lport, &rport, &txq, &rxq, &sk_drops) != 5)
+			continue;
+
+		port = state == IPVS_MASTER ? rport : lport;
+		if (port < base_port || port >= base_port + ports)
+			continue;
+
+		*send_queue += txq;
+		*recv_queue += rxq;
+		*drops += sk_drops;
+	}
+
+	fclose(fp);
+}
+
+/* The connections scheduled by the director. /proc/net/ip_vs_stats holds
+ * the total, so the services only need to be dumped without it. */
+static bool
+ipvs_syncd_total_conns(uint64_t *conns_total)
+{
+	FILE *fp;
+	char buf[128];
+	unsigned line = 0;
+	struct ip_vs_get_services_app *services;
+	unsigned i;
+
+	if ((fp = fopen("/proc/net/ip_vs_stats", "r"))) {
+		/* Two lines of headings, then the totals in hex */
+		while (fgets(buf, sizeof(buf), fp) && ++line < 3)
+			;
+		fclose(fp);
+		if (line == 3 && sscanf(buf, "%" SCNx64, conns_total) == 1)
+			return true;
+	}
+
+	if (!(services = ipvs_get_services()))
+		return false;
+	*conns_total = 0;
+	for (i = 0; i < services->user.num_services; i++)
+		*conns_total += services->user.entrytable[i].stats.conns;
+	FREE(services);
+
+	return true;
+}
+
+/* Count the connection entries and templates, over the dests of all the
+ * services. This dumps every dest, so is only done when the stats are
+ * printed, not at each sample. */
+void
+ipvs_syncd_count_conns(void)
+{
+	ipvs_syncd_stats_t *st = &syncd_stats;
+	struct ip_vs_get_services_app *services;
+	struct ip_vs_get_dests_app *dests;
+	ipvs_service_entry_t *svc;
+	unsigned i, j;
+	uint64_t conns = 0, conns6 = 0, templates = 0;
+
+	if (no_ipvs || !(services = ipvs_get_services()))
+		return;
+
+	for (i = 0; i < services->user.num_services; i++) {
+		svc = &services->user.entrytable[i];
+		if (!(dests = ipvs_get_dests(svc)))
+			continue;
+		for (j = 0; j < dests->user.num_dests; j++) {
+			if (svc->af == AF_INET6)
+				conns6 += dests->user.entrytable[j].user.activeconns + dests->user.entrytable[j].user.inactconns;
+			else
+				conns += dests->user.entrytable[j].user.activeconns + dests->user.entrytable[j].user.inactconns;
+			templates += dests->user.entrytable[j].user.persistconns;
+		}
+		FREE(dests);
+	}
+	FREE(services);
+
+	/* Connection entries are bigger for IPv6 services */
+	st->entry_len = conns + conns6 ?
+			(double)(conns * IPVS_SYNC_CONN_V4_LEN + conns6 * IPVS_SYNC_CONN_V6_LEN) / (conns + conns6) :
+			IPVS_SYNC_CONN_V4_LEN;
+	st->conns = conns + conns6;
+	st->templates = templates;
+	st->conns_counted = true;
+}
+
+/* Note: This function is called in the context of the vrrp child process, not the checker process */
+void
+ipvs_syncd_update_stats(const struct lvs_syncd_config *config)
+{
+	ipvs_syncd_stats_t *st = &syncd_stats;
+	ipvs_daemon_t *daemons;
+	int state = 0;
+	unsigned i;
+	unsigned maxlen = 0, base_port = 0, mtu = 0;
+	uint64_t conns_total;
+	unsigned long send_queue = 0, recv_queue = 0, recv_drops = 0;
+	interface_t *ifp;
+	timeval_t now = timer_now();
+	double interval, entry_len, entry_rate, bytes_rate;
+
+	if (no_ipvs)
+		return;
+
+	/* Which of our daemons is running, and with what parameters */
+	if (!(daemons = ipvs_get_daemon()))
+		return;
+	for (i = 0; i < 2; i++) {
+		if (!daemons[i].state || daemons[i].syncid != (int)config->syncid)
+			continue;
+		state = daemons[i].state;
+#ifdef _HAVE_IPVS_SYNCD_ATTRIBUTES_
+		maxlen = daemons[i].sync_maxlen;
+		base_port = daemons[i].mcast_port;
+#endif
+		break;
+	}
+	FREE(daemons);
+
+	/* The kernel only reports the message size and port from Linux 4.3 */
+#ifdef _HAVE_IPVS_SYNCD_ATTRIBUTES_
+	if (!maxlen)
+		maxlen = config->sync_maxlen;
+	if (!base_port)
+		base_port = config->mcast_port;
+#endif
+	if (!maxlen) {
+		ifp = if_get_by_ifname(config->ifname);
+		mtu = ifp && ifp->mtu ? ifp->mtu : 1500;
+		maxlen = mtu - sizeof(struct iphdr) - sizeof(struct udphdr);
+	}
+	if (!base_port)
+		base_port = IPVS_SYNC_PORT;
+
+	if (!ipvs_syncd_total_conns(&conns_total))
+		return;
+
+	ipvs_syncd_socket_stats("/proc/net/udp", state, base_port, ipvs_syncd_ports(), &send_queue, &recv_queue, &recv_drops);
+	ipvs_syncd_socket_stats("/proc/net/udp6", state, base_port, ipvs_syncd_ports(), &send_queue, &recv_queue, &recv_drops);
+
+	/* Start again if the daemon has changed role */
+	if (state != st->state) {
+		memset(st, 0, sizeof(*st));
+		st->state = state;
+	}
+
+	interval = st->valid ? timer_long(timer_sub(now, st->sampled)) / TIMER_HZ_FLOAT : 0;
+
+	/* The mix of IPv4 and IPv6 entries is from when they were last counted */
+	entry_len = st->entry_len ? st->entry_len : IPVS_SYNC_CONN_V4_LEN;
+
+	st->sync_maxlen = maxlen;
+	st->conns_per_msg = maxlen > IPVS_SYNC_MESG_HEADER_LEN ?
+			    (unsigned)((maxlen - IPVS_SYNC_MESG_HEADER_LEN) / entry_len) : 0;
+	if (st->conns_per_msg > IPVS_SYNC_MAX_CONNS)
+		st->conns_per_msg = IPVS_SYNC_MAX_CONNS;
+	if (!st->conns_per_msg)
+		st->conns_per_msg = 1;
+
+	if (interval > 0) {
+		st->conn_rate = conns_total >= st->conns_total ? (conns_total - st->conns_total) / interval : 0;
+		st->drop_rate = recv_drops >= st->recv_drops ? (recv_drops - st->recv_drops) / interval : 0;
+	}
+
+	/* Only the master sends; what a backup receives is the master's rate */
+	if (state == IPVS_MASTER && interval > 0) {
+		entry_rate = st->conn_rate;
+		if (entry_rate > 0) {
+			st->msg_rate = entry_rate / st->conns_per_msg;
+			if (st->msg_rate < 1 / IPVS_SYNC_FLUSH_TIME)
+				st->msg_rate = 1 / IPVS_SYNC_FLUSH_TIME;
+
+			/* Waiting for the message to fill, then behind what is queued */
+			st->lag = st->conns_per_msg / entry_rate;
+			if (st->lag > IPVS_SYNC_FLUSH_TIME)
+				st->lag = IPVS_SYNC_FLUSH_TIME;
+			bytes_rate = entry_rate * entry_len + st->msg_rate * IPVS_SYNC_MESG_HEADER_LEN;
+			st->lag += send_queue / bytes_rate;
+		}
+		else
+			st->msg_rate = st->lag = 0;
+
+		if (st->msg_rate > st->msg_rate_peak)
+			st->msg_rate_peak = st->msg_rate;
+		if (st->lag > st->lag_peak)
+			st->lag_peak = st->lag;
+	}
+
+	st->conns_total = conns_total;
+	st->send_queue = send_queue;
+	st->recv_queue = recv_queue;
+	st->recv_drops = recv_drops;
+	st->sampled = now;
+	st->valid = true;
+}
+
+void
+ipvs_syncd_print_stats(FILE *fp)
+{
+	ipvs_syncd_stats_t *st = &syncd_stats;
+
+	if (!st->valid) {
+		fprintf(fp, "  State: not sampled yet\n");
+		return;
+	}
+
+	fprintf(fp, "  State: %s\n", st->state == IPVS_MASTER ? "MASTER" :
+				     st->state == IPVS_BACKUP ? "BACKUP" : "not running");
+	fprintf(fp, "  Message size: %u bytes, %u connections\n", st->sync_maxlen, st->conns_per_msg);
+	if (st->conns_counted)
+		fprintf(fp, "  Connections: %" PRIu64 ", templates: %" PRIu64 "\n", st->conns, st->templates);
+	fprintf(fp, "  Connections scheduled: %" PRIu64 ", %.1f/s\n", st->conns_total, st->conn_rate);
+	if (st->state == IPVS_MASTER) {
+		fprintf(fp, "  Estimated messages: %.1f/s, peak %.1f/s\n", st->msg_rate, st->msg_rate_peak);
+		fprintf(fp, "  Estimated lag: %.0f ms, peak %.0f ms\n", st->lag * 1000, st->lag_peak * 1000);
+	}
+	fprintf(fp, "  Socket queues: send %lu, receive %lu bytes\n", st->send_queue, st->recv_queue);
+	fprintf(fp, "  Receive drops: %lu, %.1f/s\n", st->recv_drops, st->drop_rate);
+}
 #endif
@@ -30,12 +30,15 @@
 #include "utils.h"
 #include "notify.h"
 #include "main.h"
+#include "scheduler.h"
 #ifdef _WITH_SNMP_CHECKER_
   #include "check_snmp.h"
 #endif
 #include "global_data.h"
 
-/* Returns the sum of all alive RS weight in a virtual server. */
+/* Sets the sum of all alive RS weight in a virtual server. This is only
+ * needed when the alive states have been set up, at startup or on reload;
+ * after that vs->alive_weight is kept up to date as each RS changes. */
 static long
 weigh_live_realservers(virtual_server_t * vs)
 {
@@ -48,6 +51,8 @@ weigh_live_realservers(virtual_server_t * vs)
 		if (ISALIVE(svr))
 			count += svr->weight;
 	}
+	vs->alive_weight = count;
+
 	return count;
 }
 
@@ -123,9 +128,11 @@ clear_service_rs(virtual_server_t * vs, list l)
 {
 	element e;
 	real_server_t *rs;
-	long weight_sum;
 	long down_threshold = vs->quorum - vs->hysteresis;
 
+	/* The alive states may have been adjusted for a reload */
+	weigh_live_realservers(vs);
+
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		rs = ELEMENT_DATA(e);
 // ??? What about alpha mode. Use ->set
@@ -137,6 +144,7 @@ clear_service_rs(virtual_server_t * vs, list l)
 					, FMT_VS(vs));
 		ipvs_cmd(LVS_CMD_DEL_DEST, vs, rs);
 		UNSET_ALIVE(rs);
+		vs->alive_weight -= rs->weight;
 		if (!vs->omega)
 			continue;
 
@@ -159,9 +167,8 @@ clear_service_rs(virtual_server_t * vs, list l)
 		 * we don't push in a sorry server then, hence the regression
 		 * is intended.
 		 */
-		weight_sum = weigh_live_realservers(vs);
 		if (vs->quorum_state_up &&
-		    (!weight_sum || weight_sum < down_threshold)) {
+		    (!vs->alive_weight || vs->alive_weight < down_threshold)) {
 			vs->quorum_state_up = false;
 			if (vs->notify_quorum_down) {
 				log_message(LOG_INFO, "Executing [%s] for VS %s"
@@ -322,7 +329,7 @@ set_quorum_states(void)
 static void
 update_quorum_state(virtual_server_t * vs, bool init)
 {
-	long weight_sum = weigh_live_realservers(vs);
+	long weight_sum = vs->alive_weight;
 	long up_threshold = vs->quorum + vs->hysteresis;
 	long down_threshold = vs->quorum - vs->hysteresis;
 
@@ -337,6 +344,10 @@ update_quorum_state(virtual_server_t * vs, bool init)
 				    , weight_sum
 				    , FMT_VS(vs));
 		if (vs->s_svr && ISALIVE(vs->s_svr)) {
+			/* Swap the alive real servers in for the sorry server
+			 * as one batch of commands */
+			ipvs_batch_begin();
+
 			/* Adding back alive real servers */
 			perform_quorum_state(vs, true);
 
@@ -347,6 +358,8 @@ update_quorum_state(virtual_server_t * vs, bool init)
 
 			ipvs_cmd(LVS_CMD_DEL_DEST, vs, vs->s_svr);
 			vs->s_svr->alive = false;
+
+			ipvs_batch_end();
 		}
 		if (vs->notify_quorum_up) {
 			log_message(LOG_INFO, "Executing [%s] for VS %s"
@@ -384,12 +397,16 @@ update_quorum_state(virtual_server_t * vs, bool init)
 					    , FMT_RS(vs->s_svr, vs)
 					    , FMT_VS(vs));
 
+			ipvs_batch_begin();
+
 			/* the sorry server is now up in the pool, we flag it alive */
 			ipvs_cmd(LVS_CMD_ADD_DEST, vs, vs->s_svr);
 			vs->s_svr->alive = true;
 
 			/* Remove remaining alive real servers */
 			perform_quorum_state(vs, false);
+
+			ipvs_batch_end();
 		}
 
 		if (vs->notify_quorum_down) {
@@ -433,6 +450,9 @@ perform_svr_state(bool alive, virtual_server_t * vs, real_server_t * rs)
 			return false;
 	}
 	rs->alive = alive;
+	vs->alive_weight += alive ? rs->weight : -rs->weight;
+	if (thread_simulating())
+		sim_stats.transitions++;
 	notify_script = alive ? rs->notify_up : rs->notify_down;
 	if (notify_script) {
 		log_message(LOG_INFO, "Executing [%s] for service %s in VS %s"
@@ -474,6 +494,7 @@ init_service_vs(virtual_server_t * vs)
 
 	/* we may have got/lost quorum due to quorum setting changed */
 	/* also update, in case we need the sorry server in alpha mode */
+	weigh_live_realservers(vs);
 	update_quorum_state(vs, true);
 
 	return true;
@@ -486,13 +507,19 @@ init_services(void)
 	element e;
 	list l = check_data->vs;
 	virtual_server_t *vs;
+	bool ret = true;
 
+	ipvs_batch_begin();
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vs = ELEMENT_DATA(e);
-		if (!init_service_vs(vs))
-			return false;
+		if (!init_service_vs(vs)) {
+			ret = false;
+			break;
+		}
 	}
-	return true;
+	ipvs_batch_end();
+
+	return ret;
 }
 
 /* Store new weight in real_server struct and then update kernel. */
@@ -507,6 +534,8 @@ update_svr_wgt(int weight, virtual_server_t * vs, real_server_t * rs
 				    , ISALIVE(rs) ? "active" : "inactive"
 				    , FMT_RS(rs, vs)
 				    , FMT_VS(vs));
+		if (ISALIVE(rs))
+			vs->alive_weight += weight - rs->weight;
 		rs->weight = weight;
 		/*
 		 * Have weight change take effect now only if rs is in
@@ -844,6 +873,7 @@ link_vsg_to_vs(void)
 	virtual_server_group_t *vsg;
 	virtual_server_group_entry_t *vsge;
 	unsigned vsg_member_no;
+	bool af_mismatch;
 
 	if (LIST_ISEMPTY(check_data->vs))
 		return;
@@ -880,10 +910,35 @@ link_vsg_to_vs(void)
 				vsg_af = AF_UNSPEC;
 			}
 
-			if (vsg_af != AF_UNSPEC && vsg_af != vs->af) {
+			/* fwmark ranges have addresses too */
+			af_mismatch = (vsg_af != AF_UNSPEC && vsg_af != vs->af);
+			for (e1 = LIST_HEAD(vs->vsg->vfwmark); e1 && !af_mismatch; ELEMENT_NEXT(e1)) {
+				vsge = ELEMENT_DATA(e1);
+				if (vsge->fwmark_range && vsge->addr.ss_family != vs->af)
+					af_mismatch = true;
+			}
+
+			if (af_mismatch) {
 				log_message(LOG_INFO, "Virtual server group %s address family doesn't match virtual server %s - ignoring", vs->vsgname, FMT_VS(vs));
 				free_vs_checkers(vs);
 				free_list_element(check_data->vs, e);
+				continue;
+			}
+
+			/* The mark rules of fwmark ranges match one protocol */
+			for (e1 = LIST_HEAD(vs->vsg->vfwmark); e1; ELEMENT_NEXT(e1)) {
+				vsge = ELEMENT_DATA(e1);
+				if (vsge->fwmark_range)
+					break;
+			}
+			if (e1) {
+				if (!vs->vsg->fwmark_range_protocol)
+					vs->vsg->fwmark_range_protocol = vs->service_type;
+				else if (vs->vsg->fwmark_range_protocol != vs->service_type) {
+					log_message(LOG_INFO, "Virtual server group %s has fwmark ranges and is used for another protocol by virtual server %s - ignoring", vs->vsgname, FMT_VS(vs));
+					free_vs_checkers(vs);
+					free_list_element(check_data->vs, e);
+				}
 			}
 		}
 	}
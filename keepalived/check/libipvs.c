@@ -68,9 +68,10 @@ static void* ipvs_func = NULL;
 static struct nl_sock *sock = NULL;
 static int family;
 static bool try_nl = true;
+static unsigned batching;	/* Keep sock open between messages; nesting depth */
 
 /* Policy definitions */
-#ifdef _WITH_SNMP_CHECKER_
+#if defined _WITH_SNMP_CHECKER_ || defined _WITH_VRRP_
 static struct nla_policy ipvs_cmd_policy[IPVS_CMD_ATTR_MAX + 1] = {
 	[IPVS_CMD_ATTR_SERVICE]		= { .type = NLA_NESTED },
 	[IPVS_CMD_ATTR_DEST]		= { .type = NLA_NESTED },
@@ -151,7 +152,22 @@ static struct nla_policy ipvs_stats_policy[IPVS_STATS_ATTR_MAX + 1] = {
 	[IPVS_STATS_ATTR_INBPS]		= { .type = NLA_U32 },
 	[IPVS_STATS_ATTR_OUTBPS]	= { .type = NLA_U32 },
 };
-#endif	/* _WITH_SNMP_CHECKER */
+
+static struct nla_policy ipvs_daemon_policy[IPVS_DAEMON_ATTR_MAX + 1] = {
+	[IPVS_DAEMON_ATTR_STATE]	= { .type = NLA_U32 },
+	[IPVS_DAEMON_ATTR_MCAST_IFN]	= { .type = NLA_STRING,
+					    .maxlen = IP_VS_IFNAME_MAXLEN },
+	[IPVS_DAEMON_ATTR_SYNC_ID]	= { .type = NLA_U32 },
+#ifdef _HAVE_IPVS_SYNCD_ATTRIBUTES_
+	[IPVS_DAEMON_ATTR_SYNC_MAXLEN]	= { .type = NLA_U16 },
+	[IPVS_DAEMON_ATTR_MCAST_GROUP]	= { .type = NLA_U32 },
+	[IPVS_DAEMON_ATTR_MCAST_GROUP6]	= { .type = NLA_UNSPEC,
+					    .maxlen = sizeof(struct in6_addr) },
+	[IPVS_DAEMON_ATTR_MCAST_PORT]	= { .type = NLA_U16 },
+	[IPVS_DAEMON_ATTR_MCAST_TTL]	= { .type = NLA_U8 },
+#endif
+};
+#endif	/* _WITH_SNMP_CHECKER_ || _WITH_VRRP_ */
 
 static struct nla_policy ipvs_info_policy[IPVS_INFO_ATTR_MAX + 1] = {
 	[IPVS_INFO_ATTR_VERSION]        = { .type = NLA_U32 },
@@ -239,24 +255,29 @@ static int ipvs_nl_send_message(struct nl_msg *msg, nl_recvmsg_msg_cb_t func, vo
 {
 	int err = EINVAL;
 
-	sock = nl_socket_alloc();
+	/* In a batch, the socket from the previous message is reused */
 	if (!sock) {
-		if (msg)
-			nlmsg_free(msg);
-		return -1;
-	}
+		sock = nl_socket_alloc();
+		if (!sock) {
+			if (msg)
+				nlmsg_free(msg);
+			return -1;
+		}
 
-	if (genl_connect(sock) < 0)
-		goto fail_genl;
+		if (genl_connect(sock) < 0)
+			goto fail_genl;
 
-	family = genl_ctrl_resolve(sock, IPVS_GENL_NAME);
-	if (family < 0)
-		goto fail_genl;
+		family = genl_ctrl_resolve(sock, IPVS_GENL_NAME);
+		if (family < 0)
+			goto fail_genl;
+	}
 
 	/* To test connections and set the family */
 	if (msg == NULL) {
-		nl_socket_free(sock);
-		sock = NULL;
+		if (!batching) {
+			nl_socket_free(sock);
+			sock = NULL;
+		}
 		return 0;
 	}
 
@@ -271,7 +292,10 @@ static int ipvs_nl_send_message(struct nl_msg *msg, nl_recvmsg_msg_cb_t func, vo
 
 	nlmsg_free(msg);
 
-	nl_socket_free(sock);
+	if (!batching) {
+		nl_socket_free(sock);
+		sock = NULL;
+	}
 
 	return 0;
 
@@ -743,7 +767,7 @@ nla_put_failure:
 			  (char *)&dmk, sizeof(dmk));
 }
 
-#ifdef _WITH_SNMP_CHECKER_
+#if defined _WITH_SNMP_CHECKER_ || defined _WITH_VRRP_
 #ifdef LIBIPVS_USE_NL
 #ifdef _WITH_LVS_64BIT_STATS_
 static int ipvs_parse_stats64(ip_vs_stats_t *stats, struct nlattr *nla)
@@ -971,8 +995,130 @@ static int ipvs_dests_parse_cb(struct nl_msg *msg, void *arg)
 	*dp = d;
 	return 0;
 }
+
+static int ipvs_daemon_parse_cb(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	struct nlattr *attrs[IPVS_CMD_ATTR_MAX + 1];
+	struct nlattr *daemon_attrs[IPVS_DAEMON_ATTR_MAX + 1];
+	ipvs_daemon_t *u = (ipvs_daemon_t *)arg;
+	int i = 0;
+
+	/* We may get two daemons.  If we've already got one, this is the second */
+	if (u[0].state)
+		i = 1;
+
+	if (genlmsg_parse(nlh, 0, attrs, IPVS_CMD_ATTR_MAX, ipvs_cmd_policy) != 0)
+		return -1;
+
+	if (nla_parse_nested(daemon_attrs, IPVS_DAEMON_ATTR_MAX,
+			     attrs[IPVS_CMD_ATTR_DAEMON], ipvs_daemon_policy))
+		return -1;
+
+	if (!(daemon_attrs[IPVS_DAEMON_ATTR_STATE] &&
+	      daemon_attrs[IPVS_DAEMON_ATTR_MCAST_IFN] &&
+	      daemon_attrs[IPVS_DAEMON_ATTR_SYNC_ID]))
+		return -1;
+
+	u[i].state = (int)nla_get_u32(daemon_attrs[IPVS_DAEMON_ATTR_STATE]);
+	strncpy(u[i].mcast_ifn,
+		nla_get_string(daemon_attrs[IPVS_DAEMON_ATTR_MCAST_IFN]),
+		IP_VS_IFNAME_MAXLEN - 1);
+	u[i].syncid = (int)nla_get_u32(daemon_attrs[IPVS_DAEMON_ATTR_SYNC_ID]);
+
+#ifdef _HAVE_IPVS_SYNCD_ATTRIBUTES_
+	/* Only reported by Linux 4.3 onwards */
+	if (daemon_attrs[IPVS_DAEMON_ATTR_SYNC_MAXLEN])
+		u[i].sync_maxlen = nla_get_u16(daemon_attrs[IPVS_DAEMON_ATTR_SYNC_MAXLEN]);
+	if (daemon_attrs[IPVS_DAEMON_ATTR_MCAST_PORT])
+		u[i].mcast_port = nla_get_u16(daemon_attrs[IPVS_DAEMON_ATTR_MCAST_PORT]);
+	if (daemon_attrs[IPVS_DAEMON_ATTR_MCAST_TTL])
+		u[i].mcast_ttl = nla_get_u8(daemon_attrs[IPVS_DAEMON_ATTR_MCAST_TTL]);
+	if (daemon_attrs[IPVS_DAEMON_ATTR_MCAST_GROUP]) {
+		u[i].mcast_af = AF_INET;
+		u[i].mcast_group.ip = nla_get_u32(daemon_attrs[IPVS_DAEMON_ATTR_MCAST_GROUP]);
+	}
+	else if (daemon_attrs[IPVS_DAEMON_ATTR_MCAST_GROUP6]) {
+		u[i].mcast_af = AF_INET6;
+		memcpy(&u[i].mcast_group.in6, nla_data(daemon_attrs[IPVS_DAEMON_ATTR_MCAST_GROUP6]),
+		       sizeof(u[i].mcast_group.in6));
+	}
+#endif
+
+	return NL_OK;
+}
 #endif	/* LIBIPVS_USE_NL */
 
+struct ip_vs_get_services_app *ipvs_get_services(void)
+{
+	struct ip_vs_get_services_app *get;
+	struct ip_vs_get_services *getk;
+	struct ip_vs_getinfo ipvs_info;
+	socklen_t len;
+	unsigned i;
+
+	ipvs_func = ipvs_get_services;
+
+#ifdef LIBIPVS_USE_NL
+	if (try_nl) {
+		struct nl_msg *msg;
+
+		if (!(get = MALLOC(sizeof(*get) + sizeof(ipvs_service_entry_t))))
+			return NULL;
+
+		get->user.num_services = 0;
+
+		msg = ipvs_nl_message(IPVS_CMD_GET_SERVICE, NLM_F_DUMP);
+		if (msg && ipvs_nl_send_message(msg, ipvs_services_parse_cb, &get) == 0)
+			return get;
+
+		FREE(get);
+		return NULL;
+	}
+#endif
+
+	/* If the number of services changes between the two calls, the
+	 * kernel rejects the second one and the caller can try again */
+	len = sizeof(ipvs_info);
+	if (getsockopt(sockfd, IPPROTO_IP, IP_VS_SO_GET_INFO, (char *)&ipvs_info, &len))
+		return NULL;
+
+	len = (socklen_t)(sizeof(*getk) + sizeof(struct ip_vs_service_entry) * ipvs_info.num_services);
+	if (!(getk = MALLOC(len)))
+		return NULL;
+	getk->num_services = ipvs_info.num_services;
+
+	if (getsockopt(sockfd, IPPROTO_IP, IP_VS_SO_GET_SERVICES, getk, &len) < 0) {
+		FREE(getk);
+		return NULL;
+	}
+
+	if (!(get = MALLOC(sizeof(*get) + sizeof(ipvs_service_entry_t) * getk->num_services))) {
+		FREE(getk);
+		return NULL;
+	}
+
+	get->user.num_services = getk->num_services;
+	for (i = 0; i < getk->num_services; i++) {
+		memcpy(&get->user.entrytable[i].user, &getk->entrytable[i], sizeof(struct ip_vs_service_entry));
+		get->user.entrytable[i].af = AF_INET;
+		get->user.entrytable[i].nf_addr.ip = getk->entrytable[i].addr;
+		get->user.entrytable[i].stats.conns = getk->entrytable[i].stats.conns;
+		get->user.entrytable[i].stats.inpkts = getk->entrytable[i].stats.inpkts;
+		get->user.entrytable[i].stats.outpkts = getk->entrytable[i].stats.outpkts;
+		get->user.entrytable[i].stats.inbytes = getk->entrytable[i].stats.inbytes;
+		get->user.entrytable[i].stats.outbytes = getk->entrytable[i].stats.outbytes;
+		get->user.entrytable[i].stats.cps = getk->entrytable[i].stats.cps;
+		get->user.entrytable[i].stats.inpps = getk->entrytable[i].stats.inpps;
+		get->user.entrytable[i].stats.outpps = getk->entrytable[i].stats.outpps;
+		get->user.entrytable[i].stats.inbps = getk->entrytable[i].stats.inbps;
+		get->user.entrytable[i].stats.outbps = getk->entrytable[i].stats.outbps;
+	}
+	FREE(getk);
+
+	return get;
+}
+
 struct ip_vs_get_dests_app *ipvs_get_dests(ipvs_service_entry_t *svc)
 {
 	struct ip_vs_get_dests_app *d;
@@ -1056,7 +1202,7 @@ ipvs_nl_dest_failure:
 		FREE(dk);
 		return NULL;
 	}
-	memcpy(d, dk, sizeof(struct ip_vs_get_dests));
+	memcpy(&d->user, dk, sizeof(struct ip_vs_get_dests));
 	d->af = AF_INET;
 	d->nf_addr.ip = d->user.addr;
 	for (i = 0; i < dk->num_dests; i++) {
@@ -1149,7 +1295,75 @@ out_err:
 	FREE(svc);
 	return NULL;
 }
-#endif	/* _WITH_SNMP_CHECKER_ */
+
+/* Returns an array of two daemons, the unused entries having state 0 */
+ipvs_daemon_t *ipvs_get_daemon(void)
+{
+	ipvs_daemon_t *u;
+	struct ip_vs_daemon_kern dmk[2];
+	socklen_t len;
+	unsigned i;
+
+	if (!(u = MALLOC(2 * sizeof(ipvs_daemon_t))))
+		return NULL;
+
+	ipvs_func = ipvs_get_daemon;
+
+#ifdef LIBIPVS_USE_NL
+	if (try_nl) {
+		struct nl_msg *msg;
+
+		msg = ipvs_nl_message(IPVS_CMD_GET_DAEMON, NLM_F_DUMP);
+		if (msg && ipvs_nl_send_message(msg, ipvs_daemon_parse_cb, u) == 0)
+			return u;
+
+		FREE(u);
+		return NULL;
+	}
+#endif
+
+	memset(dmk, 0, sizeof(dmk));
+	len = sizeof(dmk);
+	if (getsockopt(sockfd, IPPROTO_IP, IP_VS_SO_GET_DAEMON, (char *)dmk, &len)) {
+		FREE(u);
+		return NULL;
+	}
+
+	for (i = 0; i < 2; i++) {
+		u[i].state = dmk[i].state;
+		strncpy(u[i].mcast_ifn, dmk[i].mcast_ifn, sizeof(u[i].mcast_ifn) - 1);
+		u[i].mcast_ifn[sizeof(u[i].mcast_ifn) - 1] = '\0';
+		u[i].syncid = dmk[i].syncid;
+	}
+
+	return u;
+}
+#endif	/* _WITH_SNMP_CHECKER_ || _WITH_VRRP_ */
+
+/* Send the following commands over the same netlink socket, rather
+ * than opening and resolving the IPVS family for each one, until
+ * ipvs_batch_end(). Each command is still acknowledged in turn, so
+ * errors are reported as before. Batches may nest; the socket is
+ * only closed at the end of the outermost one. */
+void ipvs_batch_begin(void)
+{
+#ifdef LIBIPVS_USE_NL
+	batching++;
+#endif
+}
+
+void ipvs_batch_end(void)
+{
+#ifdef LIBIPVS_USE_NL
+	if (!batching || --batching)
+		return;
+
+	if (sock) {
+		nl_socket_free(sock);
+		sock = NULL;
+	}
+#endif
+}
 
 void ipvs_close(void)
 {
@@ -1185,7 +1399,7 @@ const char *ipvs_strerror(int err)
 		{ ipvs_del_dest, ENOENT, "No such destination" },
 		{ ipvs_start_daemon, EEXIST, "Daemon has already run" },
 		{ ipvs_stop_daemon, ESRCH, "No daemon is running" },
-#ifdef _WITH_SNMP_CHECKER_
+#if defined _WITH_SNMP_CHECKER_ || defined _WITH_VRRP_
 		{ ipvs_get_dests, ESRCH, "No such service" },
 		{ ipvs_get_service, ESRCH, "No such service" },
 #endif
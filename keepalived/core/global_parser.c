@@ -774,6 +774,28 @@ instance_handler(vector_t *strvec)
 	}
 }
 
+#ifdef _WITH_VRRP_
+static void
+vrrp_workers_handler(vector_t *strvec)
+{
+	unsigned long workers;
+	char *endptr;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No number of vrrp workers specified");
+		return;
+	}
+
+	workers = strtoul(strvec_slot(strvec, 1), &endptr, 10);
+	if (*endptr || workers < 1 || workers > VRRP_MAX_WORKERS) {
+		log_message(LOG_INFO, "Invalid vrrp_workers %s - must be between 1 and %d", FMT_STR_VSLOT(strvec, 1), VRRP_MAX_WORKERS);
+		return;
+	}
+
+	vrrp_workers = (unsigned)workers;
+}
+#endif
+
 static void
 use_pid_dir_handler(__attribute__((unused)) vector_t *strvec)
 {
@@ -809,6 +831,9 @@ init_global_keywords(bool global_active)
 #endif
 	install_keyword_root("use_pid_dir", &use_pid_dir_handler, !global_active);
 	install_keyword_root("instance", &instance_handler, !global_active);
+#ifdef _WITH_VRRP_
+	install_keyword_root("vrrp_workers", &vrrp_workers_handler, !global_active);
+#endif
 	install_keyword_root("global_defs", NULL, global_active);
 	install_keyword("router_id", &routerid_handler);
 	install_keyword("notification_email_from", &emailfrom_handler);
@@ -791,6 +791,12 @@ netlink_talk(nl_handle_t *nl, struct nlmsghdr *n)
 	/* Request Netlink acknowledgement */
 	n->nlmsg_flags |= NLM_F_ACK;
 
+	/* When simulating, the kernel is not touched and everything succeeds */
+	if (thread_simulating()) {
+		sim_stats.netlink_ops++;
+		return 0;
+	}
+
 	/* Send message to netlink interface. */
 	status = sendmsg(nl->fd, &msg, 0);
 	if (status < 0) {
@@ -812,6 +818,192 @@ netlink_talk(nl_handle_t *nl, struct nlmsghdr *n)
 		netlink_set_nonblock(nl, &flags);
 	return status;
 }
+
+/* Batched requests. The requests are queued with the caller's data, and
+ * when the batch is full or is flushed they are all sent in one sendmsg().
+ * The ACKs are matched to the requests by sequence number, and the batch's
+ * done function is then called for each request with its result. */
+void
+netlink_batch_init(nl_batch_t *batch, nl_handle_t *nl, void (*done)(void *, struct nlmsghdr *, int))
+{
+	batch->nl = nl;
+	batch->done = done;
+	batch->len = 0;
+	batch->num = 0;
+}
+
+void
+netlink_batch_add(nl_batch_t *batch, struct nlmsghdr *n, void *data)
+{
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+
+	if (batch->num == NL_BATCH_MAX || batch->len + len > sizeof(batch->buf))
+		netlink_batch_flush(batch);
+
+	n->nlmsg_flags |= NLM_F_ACK;
+
+	memcpy(batch->buf + batch->len, n, n->nlmsg_len);
+	memset(batch->buf + batch->len + n->nlmsg_len, 0, len - n->nlmsg_len);
+	batch->len += len;
+	batch->data[batch->num++] = data;
+}
+
+/* Read the ACKs of a batch. error[i] is left at 1 for any request not acknowledged */
+static unsigned
+netlink_batch_read_acks(nl_batch_t *batch, int *error)
+{
+	char buf[nlmsg_buf_size];
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = sizeof buf
+	};
+	struct sockaddr_nl snl;
+	struct msghdr msg = {
+		.msg_name = &snl,
+		.msg_namelen = sizeof(snl),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct nlmsghdr *h;
+	struct nlmsgerr *err;
+	ssize_t status;
+	unsigned acked = 0;
+	uint32_t i;
+
+	while (acked < batch->num) {
+		status = recvmsg(batch->nl->fd, &msg, 0);
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			log_message(LOG_INFO, "Netlink: recvmsg error - %d (%m)", errno);
+			break;
+		}
+		if (status == 0) {
+			log_message(LOG_INFO, "Netlink: EOF");
+			break;
+		}
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, (size_t)status); h = NLMSG_NEXT(h, status)) {
+			if (h->nlmsg_type != NLMSG_ERROR) {
+				netlink_talk_filter(&snl, h);
+				continue;
+			}
+
+			/* Ignore any late ACK from an earlier request */
+			i = h->nlmsg_seq - batch->first_seq;
+			if (i >= batch->num || error[i] != 1)
+				continue;
+			acked++;
+
+			if (h->nlmsg_len < NLMSG_LENGTH(sizeof (struct nlmsgerr))) {
+				log_message(LOG_INFO, "Netlink: error: message truncated");
+				error[i] = -EIO;
+				continue;
+			}
+
+			err = (struct nlmsgerr *)NLMSG_DATA(h);
+			error[i] = err->error;
+			if (!err->error)
+				continue;
+
+			if (err->error == -EEXIST &&
+			    (err->msg.nlmsg_type == RTM_NEWROUTE || err->msg.nlmsg_type == RTM_NEWADDR)) {
+				error[i] = 0;
+				continue;
+			}
+
+			if (netlink_error_ignore != -err->error)
+				log_message(LOG_INFO,
+				       "Netlink: error: %s, type=(%u), seq=%u, pid=%d",
+				       strerror(-err->error),
+				       err->msg.nlmsg_type,
+				       err->msg.nlmsg_seq, err->msg.nlmsg_pid);
+		}
+	}
+
+	return acked;
+}
+
+void
+netlink_batch_flush(nl_batch_t *batch)
+{
+	int error[NL_BATCH_MAX];
+	struct sockaddr_nl snl;
+	struct iovec iov = {
+		.iov_base = batch->buf,
+		.iov_len = batch->len
+	};
+	struct msghdr msg = {
+		.msg_name = &snl,
+		.msg_namelen = sizeof(snl),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct nlmsghdr *n;
+	unsigned i, acked;
+	int ret, flags;
+
+	if (!batch->num)
+		return;
+
+	/* The ACKs are matched by sequence number, so the requests are
+	 * numbered consecutively when they are sent. Other requests may
+	 * have used the handle while they were queued. */
+	batch->first_seq = batch->nl->seq + 1;
+	for (i = 0, n = (struct nlmsghdr *)batch->buf; i < batch->num; i++) {
+		n->nlmsg_seq = ++batch->nl->seq;
+		n = (struct nlmsghdr *)((char *)n + NLMSG_ALIGN(n->nlmsg_len));
+	}
+
+	/* When simulating, the kernel is not touched and everything succeeds */
+	if (thread_simulating()) {
+		sim_stats.netlink_ops += batch->num;
+		for (i = 0; i < batch->num; i++)
+			error[i] = 0;
+	}
+	else {
+		for (i = 0; i < batch->num; i++)
+			error[i] = 1;
+
+		memset(&snl, 0, sizeof snl);
+		snl.nl_family = AF_NETLINK;
+
+		if (sendmsg(batch->nl->fd, &msg, 0) < 0) {
+			log_message(LOG_INFO, "Netlink: sendmsg() error: %s",
+			       strerror(errno));
+			acked = 0;
+		}
+		else {
+			ret = netlink_set_block(batch->nl, &flags);
+			if (ret < 0)
+				log_message(LOG_INFO, "Netlink: Warning, couldn't set "
+				       "blocking flag to netlink socket...");
+
+			acked = netlink_batch_read_acks(batch, error);
+
+			if (ret == 0)
+				netlink_set_nonblock(batch->nl, &flags);
+		}
+
+		if (acked < batch->num) {
+			log_message(LOG_INFO, "Netlink: %u of %u batched requests not acknowledged",
+			       batch->num - acked, batch->num);
+			for (i = 0; i < batch->num; i++) {
+				if (error[i] == 1)
+					error[i] = -EIO;
+			}
+		}
+	}
+
+	/* Report the results. The done function must not add to the batch */
+	for (i = 0, n = (struct nlmsghdr *)batch->buf; i < batch->num; i++) {
+		(*batch->done)(batch->data[i], n, error[i]);
+		n = (struct nlmsghdr *)((char *)n + NLMSG_ALIGN(n->nlmsg_len));
+	}
+
+	batch->len = 0;
+	batch->num = 0;
+}
 #endif
 
 /* Fetch a specific type information from netlink kernel */
@@ -54,9 +54,10 @@ socket_bind_connect(int fd, conn_opts_t *co)
 		setsockopt(fd, SOL_SOCKET, SO_LINGER, (char *) &li, sizeof (struct linger));
 	}
 
-	/* Make socket non-block. */
+	/* Make socket non-block, unless it was created so. */
 	val = fcntl(fd, F_GETFL, 0);
-	fcntl(fd, F_SETFL, val | O_NONBLOCK);
+	if (!(val & O_NONBLOCK))
+		fcntl(fd, F_SETFL, val | O_NONBLOCK);
 
 #ifdef _WITH_SO_MARK_
 	if (co->fwmark) {
@@ -89,7 +90,8 @@ socket_bind_connect(int fd, conn_opts_t *co)
 
 	/* Immediate success */
 	if (ret == 0) {
-		fcntl(fd, F_SETFL, val);
+		if (!(val & O_NONBLOCK))
+			fcntl(fd, F_SETFL, val);
 		return connect_success;
 	}
 
@@ -102,7 +104,8 @@ socket_bind_connect(int fd, conn_opts_t *co)
 	}
 
 	/* restore previous fd args */
-	fcntl(fd, F_SETFL, val);
+	if (!(val & O_NONBLOCK))
+		fcntl(fd, F_SETFL, val);
 	return connect_in_progress;
 }
 
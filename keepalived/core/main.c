@@ -78,11 +78,13 @@ char *checkers_pidfile;					/* overrule default pidfile */
 static bool free_checkers_pidfile;
 #endif
 #ifdef _WITH_VRRP_
-pid_t vrrp_child = -1;					/* VRRP child process ID */
+pid_t vrrp_child[VRRP_MAX_WORKERS];			/* VRRP worker process IDs */
+unsigned vrrp_workers = 1;				/* Number of VRRP worker processes */
 char *vrrp_pidfile;					/* overrule default pidfile */
 static bool free_vrrp_pidfile;
 #endif
 unsigned long daemon_mode;				/* VRRP/CHECK subsystem selection */
+unsigned long simulate_duration;			/* Simulated seconds to run, 0 if not simulating */
 #ifdef _WITH_SNMP_
 bool snmp;						/* Enable SNMP support */
 const char *snmp_socket;				/* Socket to use for SNMP agent */
@@ -238,8 +240,12 @@ find_keepalived_child_name(pid_t pid)
 		return PROG_CHECK;
 #endif
 #ifdef _WITH_VRRP_
-	if (pid == vrrp_child)
-		return PROG_VRRP;
+	unsigned i;
+
+	for (i = 0; i < vrrp_workers; i++) {
+		if (pid == vrrp_child[i])
+			return PROG_VRRP;
+	}
 #endif
 
 	return NULL;
@@ -314,6 +320,9 @@ static void
 propogate_signal(__attribute__((unused)) void *v, int sig)
 {
 	bool unsupported_change = false;
+#ifdef _WITH_VRRP_
+	unsigned i;
+#endif
 
 	if (sig == SIGHUP) {
 		/* Make sure there isn't an attempt to change the network namespace or instance name */
@@ -323,8 +332,12 @@ propogate_signal(__attribute__((unused)) void *v, int sig)
 #endif
 		char *old_instance_name = instance_name;
 		instance_name = NULL;
+#ifdef _WITH_VRRP_
+		unsigned old_vrrp_workers = vrrp_workers;
+		vrrp_workers = 1;
+#endif
 
-		/* The only parameters handled are net_namespace and instance_name */
+		/* The only parameters handled are net_namespace, instance_name and vrrp_workers */
 		read_config_file();
 
 #if HAVE_DECL_CLONE_NEWNET
@@ -345,17 +358,27 @@ propogate_signal(__attribute__((unused)) void *v, int sig)
 		FREE_PTR(instance_name);
 		instance_name = old_instance_name;
 
+#ifdef _WITH_VRRP_
+		if (vrrp_workers != old_vrrp_workers) {
+			log_message(LOG_INFO, "Cannot change the number of vrrp workers at a reload - please restart %s", PACKAGE);
+			unsupported_change = true;
+		}
+		vrrp_workers = old_vrrp_workers;
+#endif
+
 		if (unsupported_change)
 			return;
 	}
 
 	/* Signal child process */
 #ifdef _WITH_VRRP_
-	if (vrrp_child > 0)
-		kill(vrrp_child, sig);
+	for (i = 0; i < vrrp_workers; i++) {
+		if (vrrp_child[i] > 0)
+			kill(vrrp_child[i], sig);
+	}
 #endif
 #ifdef _WITH_LVS_
-	if (checkers_child > 0 && sig == SIGHUP)
+	if (checkers_child > 0 && (sig == SIGHUP || sig == SIGUSR2))
 		kill(checkers_child, sig);
 #endif
 }
@@ -373,6 +396,9 @@ sigend(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
 		.tv_nsec = 0
 	};
 	struct timeval start_time, now;
+#ifdef _WITH_VRRP_
+	unsigned i;
+#endif
 
 	/* register the terminate thread */
 	thread_add_terminate_event(master);
@@ -386,9 +412,11 @@ sigend(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
 	}
 
 #ifdef _WITH_VRRP_
-	if (vrrp_child > 0) {
-		kill(vrrp_child, SIGTERM);
-		wait_count++;
+	for (i = 0; i < vrrp_workers; i++) {
+		if (vrrp_child[i] > 0) {
+			kill(vrrp_child[i], SIGTERM);
+			wait_count++;
+		}
 	}
 #endif
 #ifdef _WITH_LVS_
@@ -409,9 +437,12 @@ sigend(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
 		}
 
 #ifdef _WITH_VRRP_
-		if (vrrp_child > 0 && vrrp_child == waitpid(vrrp_child, &status, WNOHANG)) {
-			report_child_status(status, vrrp_child, PROG_VRRP);
-			wait_count--;
+		for (i = 0; i < vrrp_workers; i++) {
+			if (vrrp_child[i] > 0 && vrrp_child[i] == waitpid(vrrp_child[i], &status, WNOHANG)) {
+				report_child_status(status, vrrp_child[i], PROG_VRRP);
+				vrrp_child[i] = -1;
+				wait_count--;
+			}
 		}
 #endif
 
@@ -585,6 +616,11 @@ usage(const char *prog)
 								", JSON"
 #endif
 								"\n");
+	fprintf(stderr, "      --simulate=SECS          Run SECS seconds on a virtual clock without changing the kernel\n"
+			"                                and report the scheduler cost (use with --dont-respawn)\n");
+	fprintf(stderr, "      --simulate-fail=PCT[,START[,DURATION]]\n"
+			"                                When simulating, fail PCT%% of real servers and track scripts\n"
+			"                                START seconds in, for DURATION seconds (default to the end)\n");
 	fprintf(stderr, "  -v, --version                Display the version number\n");
 	fprintf(stderr, "  -h, --help                   Display this help message\n");
 }
@@ -596,6 +632,8 @@ parse_cmdline(int argc, char **argv)
 	int c;
 	bool reopen_log = false;
 	int signum;
+	char *endptr;
+	unsigned long fail_percent, fail_start, fail_duration;
 	struct utsname uname_buf;
 	int longindex;
 	int curind;
@@ -645,6 +683,8 @@ parse_cmdline(int argc, char **argv)
 #endif	
 		{"config-id",		required_argument,	NULL, 'i'},
 		{"signum",		required_argument,	NULL,  4 },
+		{"simulate",		required_argument,	NULL,  5 },
+		{"simulate-fail",	required_argument,	NULL,  6 },
 		{"version",		no_argument,		NULL, 'v'},
 		{"help",		no_argument,		NULL, 'h'},
 
@@ -652,6 +692,7 @@ parse_cmdline(int argc, char **argv)
 	};
 
 	curind = optind;
+	longindex = -1;
 	while ((c = getopt_long(argc, argv, ":vhlndDRS:f:p:i:mM::g::G"
 #if defined _WITH_VRRP_ && defined _WITH_LVS_
 					    "PC"
@@ -826,6 +867,26 @@ parse_cmdline(int argc, char **argv)
 			printf("%d\n", signum);
 			exit(0);
 			break;
+		case 5:			/* --simulate */
+			simulate_duration = strtoul(optarg, &endptr, 10);
+			if (*endptr || !simulate_duration) {
+				fprintf(stderr, "Invalid simulation duration %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 6:			/* --simulate-fail */
+			fail_percent = strtoul(optarg, &endptr, 10);
+			fail_start = fail_duration = 0;
+			if (*endptr == ',')
+				fail_start = strtoul(endptr + 1, &endptr, 10);
+			if (*endptr == ',')
+				fail_duration = strtoul(endptr + 1, &endptr, 10);
+			if (*endptr || !fail_percent || fail_percent > 100) {
+				fprintf(stderr, "Invalid simulated failure %s\n", optarg);
+				exit(1);
+			}
+			thread_set_sim_failure((unsigned)fail_percent, fail_start * TIMER_HZ, fail_duration * TIMER_HZ);
+			break;
 		case '?':
 			if (optopt && argv[curind][1] != '-')
 				fprintf(stderr, "Unknown option -%c\n", optopt);
@@ -845,6 +906,9 @@ parse_cmdline(int argc, char **argv)
 			break;
 		}
 		curind = optind;
+
+		/* getopt_long() only sets longindex for long options */
+		longindex = -1;
 	}
 
 	if (optind < argc) {
@@ -621,8 +621,9 @@ smtp_alert(
 {
 	smtp_t *smtp;
 
-	/* Only send mail if email specified */
-	if (!LIST_ISEMPTY(global_data->email) && global_data->smtp_server.ss_family != 0) {
+	/* Only send mail if email specified, and not when simulating */
+	if (!LIST_ISEMPTY(global_data->email) && global_data->smtp_server.ss_family != 0 &&
+	    !thread_simulating()) {
 		/* allocate & initialize smtp argument data structure */
 		smtp = (smtp_t *) MALLOC(sizeof(smtp_t));
 		smtp->subject = (char *) MALLOC(MAX_HEADERS_LENGTH);
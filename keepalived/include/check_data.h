@@ -47,14 +47,20 @@
 
 /* SSL specific data */
 typedef struct _ssl_data {
+	char				*name;		/* NULL for the default SSL block */
 	int				enable;
-	int				strong_check;
+	int				strong_check;	/* verify the certificate of the server */
 	SSL_CTX				*ctx;
 	SSL_METHOD			*meth;
 	char				*password;
 	char				*cafile;
 	char				*certfile;
 	char				*keyfile;
+	char				*ciphers;
+	char				*sni;		/* server name sent in the handshake */
+	bool				ktls;		/* kernel TLS once the handshake is done */
+	struct _ssl_data		*ctx_owner;	/* block whose ctx is shared, or self */
+	list				verify_cache;	/* server certificates verified with ctx */
 } ssl_data_t;
 
 /* Real Server definition */
@@ -83,6 +89,7 @@ typedef struct _real_server {
 	bool				set;		/* in the IPVS table */
 	bool				reloaded;	/* active state was copied from old config while reloading */
 	char				*virtualhost;	/* Default virtualhost for HTTP and SSL health checkers */
+	char				*ssl_name;	/* SSL block for SSL health checkers */
 #if defined(_WITH_SNMP_CHECKER_) && defined(_WITH_LVS_)
 	/* Statistics */
 	uint32_t			activeconns;	/* active connections */
@@ -106,13 +113,15 @@ typedef struct _virtual_server_group_entry {
 	unsigned			sctp_alive;
 	unsigned			fwm4_alive;
 	unsigned			fwm6_alive;
+	bool				fwmark_range;	/* addr range served by the vfwmark service */
 	bool				reloaded;
 } virtual_server_group_entry_t;
 
 typedef struct _virtual_server_group {
 	char				*gname;
 	list				addr_range;
-	list				vfwmark;
+	list				vfwmark;	/* Also fwmark_range entries */
+	uint16_t			fwmark_range_protocol; /* Protocol the range mark rules match */
 } virtual_server_group_t;
 
 /* Virtual Server definition */
@@ -138,6 +147,8 @@ typedef struct _virtual_server {
 #endif
 	char				*virtualhost;	/* Default virtualhost for HTTP and SSL healthcheckers
 							   if not set on real servers */
+	char				*ssl_name;	/* SSL block for SSL healthcheckers
+							   if not set on real servers */
 	int				weight;
 	list				rs;
 	int				alive;
@@ -154,6 +165,7 @@ typedef struct _virtual_server {
 	unsigned			quorum;		/* Minimum live RSs to consider VS up. */
 	unsigned			hysteresis;	/* up/down events "lag" WRT quorum. */
 	bool				quorum_state_up; /* Reflects result of the last transition done. */
+	long				alive_weight;	/* Sum of the weights of the alive RSs */
 	bool				reloaded;	/* quorum_state was copied from old config while reloading */
 #if defined(_WITH_SNMP_CHECKER_) && defined(_WITH_LVS_)
 	/* Statistics */
@@ -170,6 +182,7 @@ typedef struct _virtual_server {
 typedef struct _check_data {
 	bool				ssl_required;
 	ssl_data_t			*ssl;
+	list				ssl_profiles;	/* named SSL blocks */
 	list				vs_group;
 	list				vs;
 } check_data_t;
@@ -256,7 +269,8 @@ static inline int inaddr_equal(sa_family_t family, void *addr1, void *addr2)
 
 #define VSGE_ISEQ(X,Y)	(sockstorage_equal(&(X)->addr,&(Y)->addr) &&	\
 			 (X)->range     == (Y)->range &&		\
-			 (X)->vfwmark   == (Y)->vfwmark)
+			 (X)->vfwmark   == (Y)->vfwmark &&		\
+			 (X)->fwmark_range == (Y)->fwmark_range)
 
 #define RS_ISEQ(X,Y)	(sockstorage_equal(&(X)->addr,&(Y)->addr)			&& \
 			 (X)->forwarding_method       == (Y)->forwarding_method		&& \
@@ -269,7 +283,9 @@ extern check_data_t *old_check_data;
 
 /* prototypes */
 extern ssl_data_t *alloc_ssl(void);
+extern void free_ssl_data(ssl_data_t *);
 extern void free_ssl(void);
+extern ssl_data_t *find_ssl_profile(const char *);
 extern void alloc_vsg(char *);
 extern void alloc_vsg_entry(vector_t *);
 extern void alloc_vs(char *, char *);
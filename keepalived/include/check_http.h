@@ -31,14 +31,31 @@
 
 /* local includes */
 #include "check_data.h"
+#include "check_api.h"
 #include "ipwrapper.h"
 #include "scheduler.h"
 #include "layer4.h"
 #include "list.h"
 
+typedef struct _url {
+	char				*path;
+	char				*digest;
+	int				status_code;
+	char				*virtualhost;
+	char				*request;	/* GET request, built on first use */
+	size_t				request_len;
+	bool				grpc;		/* gRPC health check */
+	char				*grpc_service;
+} url_t;
+
 /* Checker argument structure  */
-/* ssl specific thread arguments defs */
+/* One connection of a checker, kept between checks.
+ * ssl specific thread arguments defs */
 typedef struct _request {
+	checker_t			*checker;
+	url_t				*url;		/* url checked on this connection */
+	unsigned			url_it;		/* and its index */
+	int				fd;		/* -1 if not connected */
 	char				*buffer;
 	char				*extracted;
 	int				error;
@@ -49,25 +66,39 @@ typedef struct _request {
 	MD5_CTX				context;
 } request_t;
 
-typedef struct _url {
-	char				*path;
-	char				*digest;
-	int				status_code;
-	char				*virtualhost;
-} url_t;
-
 typedef struct _http_checker {
 	unsigned			proto;
 	unsigned			url_it;		/* current url checked index */
-	request_t			*req;		/* GET buffer and SSL args */
 	list				url;
+	url_t				**urls;		/* url list as an array */
 	char				*virtualhost;
+	char				*ssl_name;	/* SSL block, for SSL_GET */
+	ssl_data_t			*ssl;		/* resolved at config load, NULL for the default */
+	unsigned			url_concurrency; /* urls checked in parallel */
+	request_t			*req;		/* url_concurrency connections */
+
+	/* State of a round of parallel url checks */
+	unsigned			url_active;	/* connections in progress */
+	bool				url_failed;	/* a url check failed */
+	bool				url_all_ok;	/* all urls succeeded */
+	bool				url_error;	/* local error, round abandoned */
+
+	bool				http2;		/* all the urls as HTTP/2 streams */
+	struct _http2_conn		*http2_conn;
 } http_checker_t;
 
+/* Result of the check of a url */
+enum http_url_result {
+	HTTP_URL_FAILED,
+	HTTP_URL_NONE,		/* neither success nor failure */
+	HTTP_URL_SUCCESS,
+};
+
 /* global defs */
 #define MD5_BUFFER_LENGTH 32U
 #define GET_BUFFER_LENGTH 2048U
 #define MAX_BUFFER_LENGTH 4096U
+#define SSL_BUFFER_LENGTH 16384U	/* a whole TLS record per SSL_read() */
 #define PROTO_HTTP	0x01
 #define PROTO_SSL	0x02
 
@@ -85,7 +116,13 @@ typedef struct _http_checker {
 
 /* Define prototypes */
 extern void install_http_check_keyword(void);
+extern void check_http_ssl_profiles(void);
 extern int timeout_epilog(thread_t *, const char *);
+extern char *http_url_vhost(checker_t *, url_t *);
+extern enum http_url_result http_check_url(checker_t *, url_t *, unsigned, int,
+					   unsigned char digest[16], const char **);
+extern int http_url_done(request_t *, bool, bool);
+extern void http_close_request(request_t *);
 extern void http_process_response(request_t *, size_t, bool);
 extern int http_handle_response(thread_t *, unsigned char digest[16], bool);
 #endif
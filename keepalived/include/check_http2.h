@@ -0,0 +1,123 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        check_http2.c include file.
+ *
+ * Authors:     Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _CHECK_HTTP2_H
+#define _CHECK_HTTP2_H
+
+/* system includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <openssl/md5.h>
+
+/* local includes */
+#include "check_http.h"
+
+/* HTTP/2 frames (RFC 7540) */
+#define HTTP2_FRAME_HEADER_LEN	9
+#define HTTP2_MAX_FRAME_SIZE	16384	/* SETTINGS_MAX_FRAME_SIZE default */
+
+#define HTTP2_DATA		0x0
+#define HTTP2_HEADERS		0x1
+#define HTTP2_PRIORITY		0x2
+#define HTTP2_RST_STREAM	0x3
+#define HTTP2_SETTINGS		0x4
+#define HTTP2_PUSH_PROMISE	0x5
+#define HTTP2_PING		0x6
+#define HTTP2_GOAWAY		0x7
+#define HTTP2_WINDOW_UPDATE	0x8
+#define HTTP2_CONTINUATION	0x9
+
+#define HTTP2_FLAG_ACK		0x01
+#define HTTP2_FLAG_END_STREAM	0x01
+#define HTTP2_FLAG_END_HEADERS	0x04
+#define HTTP2_FLAG_PADDED	0x08
+#define HTTP2_FLAG_PRIORITY	0x20
+
+#define HTTP2_SETTINGS_ENABLE_PUSH		0x2
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE	0x4
+
+#define HTTP2_MAX_WINDOW_SIZE	0x7fffffffU
+#define HTTP2_DEFAULT_WINDOW	65535U
+
+#define HTTP2_PREFACE		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+/* HPACK (RFC 7541) decoder dynamic table, at the default size */
+#define HPACK_TABLE_SIZE	4096U
+#define HPACK_ENTRY_OVERHEAD	32U
+#define HPACK_MAX_ENTRIES	(HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+/* gRPC health checking protocol */
+#define GRPC_HEALTH_PATH	"/grpc.health.v1.Health/Check"
+#define GRPC_SERVING		1
+#define GRPC_MSG_MAX		64	/* HealthCheckResponse is 2 bytes */
+
+typedef struct _hpack_entry {
+	char				*name;
+	char				*value;
+} hpack_entry_t;
+
+/* A url checked as one stream of the connection */
+typedef struct _http2_stream {
+	int				status_code;
+	int				grpc_status;	/* -1 if not received */
+	bool				headers;	/* response headers received */
+	bool				closed;		/* ended or reset */
+	bool				reset;
+	unsigned char			grpc_msg[GRPC_MSG_MAX];
+	size_t				grpc_len;
+	MD5_CTX				context;
+} http2_stream_t;
+
+typedef struct _http2_conn {
+	char				*request;	/* preface, settings and all the streams */
+	size_t				request_len;
+	http2_stream_t			*streams;	/* one per url, stream id 2n+1 */
+	unsigned			open;		/* streams not closed yet */
+
+	/* Left over from a short send, sent when the socket is writable */
+	unsigned char			*tx;
+	size_t				tx_len;
+	size_t				tx_size;
+
+	/* Frame being received */
+	unsigned char			*buffer;
+	size_t				len;
+
+	/* Header block being received */
+	unsigned char			*block;
+	size_t				block_len;
+	size_t				block_size;
+	uint32_t			block_stream;
+	uint8_t				block_flags;
+
+	/* HPACK dynamic table, newest entry first */
+	hpack_entry_t			table[HPACK_MAX_ENTRIES];
+	unsigned			table_count;
+	size_t				table_size;
+	size_t				table_max;
+} http2_conn_t;
+
+/* Prototypes */
+extern int http2_request_thread(thread_t *);
+extern void free_http2_conn(http2_conn_t *);
+
+#endif
@@ -26,6 +26,7 @@
 
 /* system includes */
 #include <stdlib.h>
+#include <stdbool.h>
 
 /* local includes */
 #include "check_data.h"
@@ -41,6 +42,9 @@
 #define SMTP_RECV_HELO		4
 #define SMTP_SENT_QUIT		5
 #define SMTP_RECV_QUIT		6
+#define SMTP_SEND_NOOP		7
+#define SMTP_SENT_NOOP		8
+#define SMTP_RECV_NOOP		9
 
 #define SMTP_DEFAULT_HELO	"smtpchecker.keepalived.org"
 
@@ -48,16 +52,28 @@
 typedef struct _smtp_checker {
 	/* non per host config data goes here */
 	char				*helo_name;
+	bool				pipelining;	/* send HELO and QUIT together */
+	bool				persistent;	/* keep sessions open, probe with NOOP */
 	unsigned			host_ctr;
 	conn_opts_t			*host_ptr;
 
+	/* commands, built once */
+	char				*helo_cmd;
+	size_t				helo_len;
+
 	/* data buffer */
 	char				buff[SMTP_BUFF_MAX];
 	size_t				buff_ctr;
+	size_t				reply_len;	/* reply at the head of buff */
+	const char			*tx;		/* command being sent */
+	size_t				tx_len;
 	int				(*buff_cb) (thread_t *);
 
 	int				state;
 
+	/* persistent session of each host, -1 if none */
+	int				*session_fd;
+
 	/* list holding the host config data */
 	list				host;
 } smtp_checker_t;
@@ -24,14 +24,30 @@
 #ifndef _CHECK_SSL_H
 #define _CHECK_SSL_H
 
+/* system includes */
+#include <time.h>
+#include <openssl/sha.h>
+
 /* local includes */
 #include "check_http.h"
 
+/* Verified server certificates are cached per SSL context */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined LIBRESSL_VERSION_NUMBER
+#define _WITH_SSL_VERIFY_CACHE_
+#endif
+
+#define SSL_VERIFY_CACHE_MAX	1024
+
+typedef struct _ssl_verified {
+	unsigned char			digest[SHA256_DIGEST_LENGTH];	/* chain and server name */
+	time_t				expires;	/* first expiry in the chain */
+} ssl_verified_t;
+
 /* Prototypes */
 extern void install_ssl_check_keyword(void);
 extern int init_ssl_ctx(void);
 extern void clear_ssl(ssl_data_t *);
-extern int ssl_connect(thread_t *, int);
+extern int ssl_connect(thread_t *);
 extern int ssl_printerr(int);
 extern int ssl_send_request(SSL *, char *, int);
 extern int ssl_read_thread(thread_t *);
@@ -71,6 +71,10 @@ struct ip_vs_dest_entry_app {
 };
 
 struct ip_vs_get_dests_app {
+	/* These must precede the entry table, which runs on past the struct */
+	uint16_t		af;
+	union nf_inet_addr	nf_addr;
+
 	struct {	// Can we avoid this duplication of definition?
 	/* which service: user fills in these */
 	__u16			protocol;
@@ -84,9 +88,6 @@ struct ip_vs_get_dests_app {
 	/* the real servers */
 	struct ip_vs_dest_entry_app	entrytable[0];
 	} user;
-
-	uint16_t		af;
-	union nf_inet_addr	nf_addr;
 };
 
 /* The argument to IP_VS_SO_GET_SERVICES */
@@ -32,6 +32,7 @@
 #include <asm/types.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include <net/if.h>
 //#include <netinet/ip_icmp.h>
@@ -86,8 +87,38 @@ struct lvs_syncd_config {
 #endif
 	char				*vrrp_name;	/* used during configuration and SNMP */
 };
+
+/* LVS sync daemon telemetry, sampled in the vrrp process */
+typedef struct _ipvs_syncd_stats {
+	timeval_t			sampled;	/* time of the last sample */
+	bool				valid;		/* there has been a sample */
+	int				state;		/* IPVS_MASTER, IPVS_BACKUP, or 0 if not running */
+	unsigned			sync_maxlen;	/* message size in use */
+	unsigned			conns_per_msg;
+	bool				conns_counted;	/* conns and templates are set */
+	uint64_t			conns;		/* connection entries, the synced ones on a backup */
+	uint64_t			templates;	/* persistence templates */
+	double				entry_len;	/* average bytes of a sync entry, 0 if not counted */
+	uint64_t			conns_total;	/* connections scheduled by this director */
+	double				conn_rate;	/* per second */
+	double				msg_rate;	/* estimated messages sent per second */
+	double				msg_rate_peak;
+	double				lag;		/* estimated seconds before an update is sent */
+	double				lag_peak;
+	unsigned long			send_queue;	/* bytes queued on the sync sockets */
+	unsigned long			recv_queue;
+	unsigned long			recv_drops;	/* messages dropped by the receiving sockets */
+	double				drop_rate;
+} ipvs_syncd_stats_t;
+
+/* How often the sync daemon telemetry is sampled */
+#define IPVS_SYNCD_STATS_INTERVAL	(5 * TIMER_HZ)
 #endif
 
+/* IPVS commands sent, and not sent because they would have been no-ops */
+extern unsigned long ipvs_ops_issued;
+extern unsigned long ipvs_ops_suppressed;
+
 /* prototypes */
 extern int ipvs_start(void);
 extern void ipvs_stop(void);
@@ -101,6 +132,9 @@ extern int ipvs_cmd(int, virtual_server_t *, real_server_t *);
 extern void ipvs_syncd_cmd(int, const struct lvs_syncd_config *, int, bool, bool);
 extern void ipvs_syncd_master(const struct lvs_syncd_config *);
 extern void ipvs_syncd_backup(const struct lvs_syncd_config *);
+extern void ipvs_syncd_update_stats(const struct lvs_syncd_config *);
+extern void ipvs_syncd_count_conns(void);
+extern void ipvs_syncd_print_stats(FILE *);
 #endif
 
 /* Refresh statistics at most every 5 seconds */
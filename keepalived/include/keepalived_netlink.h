@@ -54,6 +54,23 @@ typedef struct _nl_handle {
 	thread_t		*thread;
 } nl_handle_t;
 
+#ifdef _WITH_VRRP_
+/* Requests queued to be sent to the kernel in one sendmsg(). The limits
+ * keep the ACKs, which echo failed requests, within the receive buffer. */
+#define NL_BATCH_SIZE	16384
+#define NL_BATCH_MAX	32
+
+typedef struct _nl_batch {
+	nl_handle_t		*nl;
+	void			(*done)(void *, struct nlmsghdr *, int);	/* Called with each request's result */
+	size_t			len;
+	unsigned		num;
+	uint32_t		first_seq;
+	void			*data[NL_BATCH_MAX];
+	char			buf[NL_BATCH_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+} nl_batch_t;
+#endif
+
 /* Define types */
 #define NETLINK_TIMER (30 * TIMER_HZ)
 #ifndef _HAVE_LIBNL3_
@@ -89,6 +106,9 @@ extern size_t rta_addattr8(struct rtattr *, size_t, unsigned short, uint8_t);
 extern struct rtattr *rta_nest(struct rtattr *, size_t, unsigned short);
 extern size_t rta_nest_end(struct rtattr *, struct rtattr *);
 extern ssize_t netlink_talk(nl_handle_t *, struct nlmsghdr *);
+extern void netlink_batch_init(nl_batch_t *, nl_handle_t *, void (*)(void *, struct nlmsghdr *, int));
+extern void netlink_batch_add(nl_batch_t *, struct nlmsghdr *, void *);
+extern void netlink_batch_flush(nl_batch_t *);
 extern int netlink_interface_lookup(char *);
 extern void kernel_netlink_poll(void);
 #endif
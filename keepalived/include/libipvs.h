@@ -73,15 +73,25 @@ extern int ipvs_start_daemon(ipvs_daemon_t *dm);
 /* stop a connection synchronizaiton daemon (master/backup) */
 extern int ipvs_stop_daemon(ipvs_daemon_t *dm);
 
-#ifdef _WITH_SNMP_CHECKER_
+#if defined _WITH_SNMP_CHECKER_ || defined _WITH_VRRP_
+/* get all the services */
+extern struct ip_vs_get_services_app *ipvs_get_services(void);
+
 /* get the destination array of the specified service */
 extern struct ip_vs_get_dests_app *ipvs_get_dests(ipvs_service_entry_t *svc);
 
 /* get an ipvs service entry */
 extern ipvs_service_entry_t *
 ipvs_get_service(__u32 fwmark, __u16 af, __u16 protocol, union nf_inet_addr *addr, __u16 port);
+
+/* get the master and backup connection synchronization daemons */
+extern ipvs_daemon_t *ipvs_get_daemon(void);
 #endif
 
+/* group commands over one netlink socket */
+extern void ipvs_batch_begin(void);
+extern void ipvs_batch_end(void);
+
 /* close the socket */
 extern void ipvs_close(void);
 
@@ -56,9 +56,13 @@ enum daemon_bits {
 /* Global vars exported */
 extern const char *version_string;	/* keepalived version */
 extern unsigned long daemon_mode;	/* Which child processes are run */
+extern unsigned long simulate_duration;	/* Simulated seconds to run */
 extern char *conf_file;			/* Configuration file */
 extern int log_facility;		/* Optional logging facilities */
-extern pid_t vrrp_child;		/* VRRP child process ID */
+#ifdef _WITH_VRRP_
+extern pid_t vrrp_child[VRRP_MAX_WORKERS]; /* VRRP worker process IDs */
+extern unsigned vrrp_workers;		/* Number of VRRP worker processes */
+#endif
 extern pid_t checkers_child;		/* Healthcheckers child process ID */
 extern char *main_pidfile;		/* overrule default pidfile */
 extern char *checkers_pidfile;		/* overrule default pidfile */
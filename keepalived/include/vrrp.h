@@ -115,6 +115,15 @@ typedef struct _vrrp_sgroup {
 	notify_script_t		*script_fault;
 	notify_script_t		*script;
 	bool			smtp_alert;
+
+	/* Number of members in each state, kept up to date by
+	 * vrrp_set_state() and vrrp_set_wantstate() */
+	unsigned		num_member;
+	unsigned		num_want_master;	/* wantstate GOTO_MASTER or MASTER */
+	unsigned		num_want_goto_master;	/* wantstate GOTO_MASTER */
+	unsigned		num_backup;
+	unsigned		num_master;
+	unsigned		num_fault;
 } vrrp_sgroup_t;
 
 /* Statistics */
@@ -196,8 +205,6 @@ typedef struct _vrrp_t {
 	unsigned		garp_rep;		/* gratuitous ARP repeat value */
 	unsigned		garp_refresh_rep;	/* refresh gratuitous ARP repeat value */
 	unsigned		garp_lower_prio_delay;	/* Delay to second set or ARP messages */
-	bool			garp_pending;		/* Are there gratuitous ARP messages still to be sent */
-	bool			gna_pending;		/* Are there gratuitous NA messages still to be sent */
 	unsigned		garp_lower_prio_rep;	/* Number of ARP messages to send at a time */
 	unsigned		lower_prio_no_advert;	/* Don't send advert after lower prio advert received */
 	unsigned		higher_prio_send_advert; /* Send advert after higher prio advert received */
@@ -236,6 +243,9 @@ typedef struct _vrrp_t {
 	int			wantstate;		/* user explicitly wants a state (back/mast) */
 	int			fd_in;			/* IN socket descriptor */
 	int			fd_out;			/* OUT socket descriptor */
+#ifdef _WITH_DBUS_
+	unsigned		dbus_index;		/* Entry in the DBus property snapshot */
+#endif
 
 	int			debug;			/* Debug level 0-4 */
 
@@ -269,6 +279,7 @@ typedef struct _vrrp_t {
 	uint8_t			auth_type;		/* authentification type. VRRP_AUTH_* */
 	uint8_t			auth_data[8];		/* authentification data */
 	seq_counter_t		*ipsecah_counter;
+	hmac_md5_ctx_t		auth_hmac;		/* AH keyed hash states */
 #endif
 
 	/*
@@ -348,6 +359,8 @@ extern int vrrp_state_master_rx(vrrp_t *, char *, ssize_t);
 extern int vrrp_state_master_tx(vrrp_t *, const int);
 extern void vrrp_state_backup(vrrp_t *, char *, ssize_t);
 extern void vrrp_state_goto_master(vrrp_t *);
+extern void vrrp_become_master_share_begin(void);
+extern void vrrp_become_master_share_end(vrrp_t **, unsigned);
 extern void vrrp_state_leave_master(vrrp_t *);
 extern bool vrrp_complete_init(void);
 extern void vrrp_restore_interfaces_startup(void);
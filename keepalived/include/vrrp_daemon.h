@@ -27,7 +27,14 @@
 #define PROG_VRRP	"Keepalived_vrrp"
 #define WDOG_VRRP	"/tmp/.vrrp"
 
+/* Maximum number of VRRP worker processes */
+#define VRRP_MAX_WORKERS	64
+
+/* Global vars exported */
+extern unsigned vrrp_worker;		/* Index of this VRRP worker process */
+
 /* Prototypes */
 extern int start_vrrp_child(void);
+extern char *make_worker_file_name(const char *);
 
 #endif
@@ -53,15 +53,24 @@ typedef struct _sock {
 	thread_t		*thread;
 } sock_t;
 
+/* Unicast advert source index slot */
+typedef struct _vrrp_unicast_slot {
+	struct sockaddr_storage	*addr;			/* Unicast peer */
+	vrrp_t			*vrrp;			/* Instance the peer belongs to */
+} vrrp_unicast_slot_t;
+
 /* Configuration data root */
 typedef struct _vrrp_data {
 	list			static_addresses;
 	list			static_routes;
 	list			static_rules;
+	list			static_nexthops;
 	list			vrrp_sync_group;
 	list			vrrp;
 	list			vrrp_index;
 	list			vrrp_index_fd;
+	vrrp_unicast_slot_t	*vrrp_unicast_index;	/* (vrid, peer) -> instance */
+	unsigned		vrrp_unicast_index_mask;
 	list			vrrp_socket_pool;
 	list			vrrp_script;
 	list			vrrp_switch;
@@ -77,6 +86,7 @@ extern size_t vrrp_buffer_len;
 extern void alloc_saddress(vector_t *);
 extern void alloc_sroute(vector_t *);
 extern void alloc_srule(vector_t *);
+extern void alloc_snexthop(vector_t *);
 extern void alloc_vrrp_sync_group(char *);
 extern void alloc_vrrp(char *);
 extern void alloc_vrrp_unicast_peer(vector_t *);
@@ -28,6 +28,7 @@
 /* Local includes */
 #include "vrrp.h"
 #include "list.h"
+#include "timer.h"
 
 /* Defines */
 #define DBUS_SERVICE_NAME                       "org.keepalived.Vrrp1"
@@ -37,7 +38,9 @@
 #define DBUS_VRRP_INSTANCE_INTERFACE            "org.keepalived.Vrrp1.Instance"
 #define DBUS_VRRP_INTERFACE_FILE_PATH           "/usr/share/dbus-1/interfaces/org.keepalived.Vrrp1.Vrrp.xml"
 #define DBUS_VRRP_INSTANCE_INTERFACE_FILE_PATH  "/usr/share/dbus-1/interfaces/org.keepalived.Vrrp1.Instance.xml"
+#define DBUS_SIGNAL_DELAY			(TIMER_HZ / 20)	/* Coalesce state signals for 50ms */
 
+void dbus_publish_snapshot(void);
 void dbus_send_state_signal(vrrp_t *);
 void dbus_remove_object(vrrp_t *);
 void dbus_reload(list, list);
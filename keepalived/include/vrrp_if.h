@@ -60,6 +60,15 @@
  * RFC2553 defines sin6_scopeid to be a uint32_t, and it can hold an ifindex */
 typedef uint32_t ifindex_t;
 
+struct _vrrp_t;
+struct _ip_address;
+
+/* FIFO of addresses waiting to send a delayed gratuitous ARP/NA message */
+typedef struct _garp_queue {
+	struct _ip_address	*head;
+	struct _ip_address	*tail;
+} garp_queue_t;
+
 /* Structure for delayed sending of gratuitous ARP/NA messages */
 typedef struct _garp_delay {
 	timeval_t		garp_interval;		/* Delay between sending gratuitous ARP messages on an interface */
@@ -69,6 +78,8 @@ typedef struct _garp_delay {
 	timeval_t		garp_next_time;		/* Time when next gratuitous ARP message can be sent */
 	timeval_t		gna_next_time;		/* Time when next gratuitous NA message can be sent */
 	int			aggregation_group;	/* Index of multi-interface group */
+	garp_queue_t		garp_queue;		/* Addresses waiting to send gratuitous ARP messages */
+	garp_queue_t		gna_queue;		/* Addresses waiting to send gratuitous NA messages */
 } garp_delay_t;
 
 /* Interface structure definition */
@@ -146,6 +157,8 @@ extern void if_vmac_reflect_flags(ifindex_t, unsigned long);
 extern int if_linkbeat(const interface_t *);
 extern void alloc_garp_delay(void);
 extern void set_default_garp_delay(void);
+extern void garp_queue_add(struct _vrrp_t *, struct _ip_address *);
+extern void garp_queue_remove(struct _ip_address *);
 extern void if_add_queue(interface_t *);
 extern int if_monitor_thread(thread_t *);
 extern void init_interface_queue(void);
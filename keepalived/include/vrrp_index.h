@@ -42,5 +42,8 @@ extern void alloc_vrrp_fd_bucket(vrrp_t *);
 extern void remove_vrrp_fd_bucket(vrrp_t *);
 extern void set_vrrp_fd_bucket(int, vrrp_t *);
 extern vrrp_t *vrrp_index_lookup(const int, const int);
+extern void alloc_vrrp_unicast_index(void);
+extern vrrp_t *vrrp_unicast_index_lookup(const int, struct sockaddr_storage *, const int);
+extern bool vrrp_is_unicast_peer(vrrp_t *, struct sockaddr_storage *);
 
 #endif
@@ -66,6 +66,10 @@ typedef struct _ip_address {
 	bool			iptable_rule_set;	/* TRUE if iptable drop rule
 							 * set to addr */
 	bool			garp_gna_pending;	/* Is a gratuitous ARP/NA message still to be sent */
+	struct _vrrp_t		*garp_vrrp;		/* Instance the pending message is for */
+	garp_queue_t		*garp_queue;		/* Queue the address is pending on */
+	struct _ip_address	*garp_next;		/* Pending gratuitous ARP/NA queue */
+	struct _ip_address	*garp_prev;
 } ip_address_t;
 
 #define IPADDRESS_DEL 0
@@ -99,6 +103,7 @@ struct ipt_handle;	// AAGH - TODO
 
 /* prototypes */
 extern char *ipaddresstos(char *, ip_address_t *);
+extern uint32_t hash_ipaddress(uint32_t, ip_address_t *);
 extern int netlink_ipaddress(ip_address_t *, int);
 extern bool netlink_iplist(list, int, bool);
 extern void handle_iptable_rule_to_iplist(struct ipt_handle *, list, int, bool force);
@@ -109,5 +114,8 @@ extern void alloc_ipaddress(list, vector_t *, interface_t *);
 extern void clear_diff_address(struct ipt_handle *, list, list);
 extern void clear_diff_saddresses(void);
 extern void iptables_init(void);
+extern void iptables_lock(void);
+extern void iptables_unlock(void);
+extern void iptables_lock_close(void);
 
 #endif
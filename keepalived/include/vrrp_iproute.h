@@ -31,6 +31,9 @@
 #if HAVE_DECL_LWTUNNEL_ENCAP_MPLS
 #include <linux/mpls.h>
 #endif
+#if HAVE_DECL_RTA_NH_ID
+#include <linux/nexthop.h>
+#endif
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -123,6 +126,21 @@ typedef struct _nexthop {
 //#endif
 } nexthop_t;
 
+#if HAVE_DECL_RTA_NH_ID	/* Since Linux 5.3 */
+/* Kernel nexthop object, shared by the routes referring to it by id */
+typedef struct _ip_nexthop {
+	uint32_t		id;
+	uint8_t			family;
+	ip_address_t		*via;
+	interface_t		*oif;
+	uint32_t		flags;
+	bool			blackhole;
+	struct nexthop_grp	*group;
+	unsigned		num_group;
+	bool			set;
+} ip_nexthop_t;
+#endif
+
 enum ip_route {
 	IPROUTE_DSFIELD = 0,
 	IPROUTE_TYPE,
@@ -218,6 +236,9 @@ typedef struct _ip_route {
 	encap_t			encap;
 #endif
 	list			nhs;
+#if HAVE_DECL_RTA_NH_ID
+	uint32_t		nhid;
+#endif
 	uint32_t		mask;
 	bool			set;
 } ip_route_t;
@@ -229,11 +250,21 @@ typedef struct _ip_route {
 /* prototypes */
 extern unsigned short add_addr2req(struct nlmsghdr *, size_t, unsigned short, ip_address_t *);
 extern void netlink_rtlist(list, int);
+extern void netlink_rtlist_share_begin(void);
+extern void netlink_rtlist_share_end(void);
 extern void free_iproute(void *);
 extern void format_iproute(ip_route_t *, char *, size_t);
 extern void dump_iproute(void *);
 extern void alloc_route(list, vector_t *);
 extern void clear_diff_routes(list, list);
 extern void clear_diff_sroutes(void);
+#if HAVE_DECL_RTA_NH_ID
+extern void netlink_nhlist(list, int);
+extern void free_ipnexthop(void *);
+extern void dump_ipnexthop(void *);
+extern void alloc_nexthop(list, vector_t *);
+extern void update_diff_snexthops(void);
+extern void clear_diff_snexthops(void);
+#endif
 
 #endif
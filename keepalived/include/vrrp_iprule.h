@@ -89,6 +89,8 @@ typedef struct _ip_rule {
 
 /* prototypes */
 extern void netlink_rulelist(list, int, bool);
+extern void netlink_rulelist_share_begin(void);
+extern void netlink_rulelist_share_end(void);
 extern void free_iprule(void *);
 extern void format_iprule(ip_rule_t *, char *, size_t);
 extern void dump_iprule(void *);
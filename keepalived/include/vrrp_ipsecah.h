@@ -61,6 +61,14 @@ typedef struct _seq_counter {
 	uint32_t		seq_number;
 } seq_counter_t;
 
-extern void hmac_md5(unsigned char *, size_t, unsigned char *, size_t, unsigned char *);
+/* HMAC-MD5 keyed hash states, after the inner and outer key pads have
+ * been hashed. They only depend on the key, so are computed once. */
+typedef struct _hmac_md5_ctx {
+	MD5_CTX			inner;
+	MD5_CTX			outer;
+} hmac_md5_ctx_t;
+
+extern void hmac_md5_init(hmac_md5_ctx_t *, const unsigned char *, size_t);
+extern void hmac_md5_digest(const hmac_md5_ctx_t *, const unsigned char *, size_t, unsigned char *);
 
 #endif
@@ -41,8 +41,11 @@
 #define GROUP_NAME(G)  ((G)->gname)
 
 /* extern prototypes */
+extern void vrrp_set_state(vrrp_t *, int);
+extern void vrrp_set_wantstate(vrrp_t *, int);
 extern void vrrp_init_instance_sands(vrrp_t *);
 extern void vrrp_sync_smtp_notifier(vrrp_sgroup_t *);
+extern vrrp_t *vrrp_get_instance(const char *);
 extern void vrrp_sync_set_group(vrrp_sgroup_t *);
 extern int vrrp_sync_leave_fault(vrrp_t *);
 extern int vrrp_sync_goto_master(vrrp_t *);
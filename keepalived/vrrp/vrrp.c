@@ -126,6 +126,7 @@ vrrp_handle_accept_mode(vrrp_t *vrrp, int cmd, bool force)
 			log_message(LOG_INFO, "VRRP_Instance(%s) %s protocol %s", vrrp->iname,
 				(cmd == IPADDRESS_ADD) ? "setting" : "removing", "iptable drop rule");
 
+		iptables_lock();
 #ifdef _HAVE_LIBIPTC_
 		do {
 #ifdef _LIBIPTC_DYNAMIC_
@@ -146,6 +147,7 @@ vrrp_handle_accept_mode(vrrp_t *vrrp, int cmd, bool force)
 				res = iptables_close(h);
 		} while (res == EAGAIN && ++tries < IPTABLES_MAX_TRIES);
 #endif
+		iptables_unlock();
 		vrrp->iptable_rules_set = (cmd == IPADDRESS_ADD);
 	}
 }
@@ -359,10 +361,9 @@ vrrp_in_chk_ipsecah(vrrp_t * vrrp, char *buffer)
 	memset(digest, 0, 16);
 
 	/* Compute the ICV */
-	hmac_md5((unsigned char *) buffer,
-		 vrrp_iphdr_len() + vrrp_ipsecah_len() + vrrp_pkt_len(vrrp)
-		 , vrrp->auth_data, sizeof (vrrp->auth_data)
-		 , digest);
+	hmac_md5_digest(&vrrp->auth_hmac, (unsigned char *) buffer,
+			vrrp_iphdr_len() + vrrp_ipsecah_len() + vrrp_pkt_len(vrrp),
+			digest);
 
 	if (memcmp(backup_auth_data, digest, HMAC_MD5_TRUNC) != 0) {
 		log_message(LOG_INFO, "VRRP_Instance(%s) IPSEC-AH : invalid"
@@ -377,22 +378,30 @@ vrrp_in_chk_ipsecah(vrrp_t * vrrp, char *buffer)
 }
 #endif
 
-/* check if ipaddr is present in VIP buffer */
+/* check if ipaddr is present in VIP buffer. The master normally sends
+ * the addresses in the order they are configured, so slot n is tried first. */
 static int
-vrrp_in_chk_vips(vrrp_t * vrrp, ip_address_t *ipaddress, unsigned char *buffer)
+vrrp_in_chk_vips(vrrp_t * vrrp, ip_address_t *ipaddress, unsigned char *buffer, size_t n)
 {
 	size_t i;
+	size_t addr_len;
+	const void *addr;
 
 	if (vrrp->family == AF_INET) {
-		for (i = 0; i < LIST_SIZE(vrrp->vip); i++) {
-			if (!memcmp(&ipaddress->u.sin.sin_addr.s_addr, buffer + i * sizeof(struct in_addr), sizeof (struct in_addr)))
-				return 1;
-		}
+		addr = &ipaddress->u.sin.sin_addr.s_addr;
+		addr_len = sizeof(struct in_addr);
 	} else if (vrrp->family == AF_INET6) {
-		for (i = 0; i < LIST_SIZE(vrrp->vip); i++) {
-			if (!memcmp(&ipaddress->u.sin6_addr, buffer + i * sizeof(struct in6_addr), sizeof (struct in6_addr)))
-				return 1;
-		}
+		addr = &ipaddress->u.sin6_addr;
+		addr_len = sizeof(struct in6_addr);
+	} else
+		return 0;
+
+	if (n < LIST_SIZE(vrrp->vip) && !memcmp(addr, buffer + n * addr_len, addr_len))
+		return 1;
+
+	for (i = 0; i < LIST_SIZE(vrrp->vip); i++) {
+		if (!memcmp(addr, buffer + i * addr_len, addr_len))
+			return 1;
 	}
 
 	return 0;
@@ -422,8 +431,8 @@ vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr
 	ipv4_phdr_t ipv4_phdr;
 	uint32_t acc_csum = 0;
 	ip = NULL;
-	struct sockaddr_storage *up_addr;
 	size_t buflen, expected_len;
+	size_t n;
 #ifdef _WITH_UNICAST_CHKSUM_COMPAT_
 	bool chksum_error;
 #endif
@@ -708,9 +717,9 @@ vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr
 				 * MAY verify that the IP address(es) associated with the
 				 * VRID are valid
 				 */
-				for (e = LIST_HEAD(vrrp->vip); e; ELEMENT_NEXT(e)) {
+				for (e = LIST_HEAD(vrrp->vip), n = 0; e; ELEMENT_NEXT(e), n++) {
 					ipaddress = ELEMENT_DATA(e);
-					if (!vrrp_in_chk_vips(vrrp, ipaddress, vips)) {
+					if (!vrrp_in_chk_vips(vrrp, ipaddress, vips, n)) {
 						log_message(LOG_INFO, "(%s): ip address associated with VRID %d"
 						       " not present in MASTER advert : %s",
 						       vrrp->iname, vrrp->vrid,
@@ -723,12 +732,7 @@ vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr
 
 			// check a unicast source address is in the unicast_peer list
 			if (global_data->vrrp_check_unicast_src && !LIST_ISEMPTY(vrrp->unicast_peer)) {
-				for (e = LIST_HEAD(vrrp->unicast_peer); e; ELEMENT_NEXT(e)) {
-					up_addr = ELEMENT_DATA(e);
-					if (((struct sockaddr_in *)&vrrp->pkt_saddr)->sin_addr.s_addr == ((struct sockaddr_in *)up_addr)->sin_addr.s_addr)
-						break;
-				}
-				if (!e) {
+				if (!vrrp_is_unicast_peer(vrrp, &vrrp->pkt_saddr)) {
 					log_message(LOG_INFO, "(%s): unicast source address %s not a unicast peer",
 						vrrp->iname, inet_ntop2(((struct sockaddr_in*)&vrrp->pkt_saddr)->sin_addr.s_addr));
 					return VRRP_PACKET_KO;
@@ -747,9 +751,9 @@ vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr
 					return VRRP_PACKET_KO;
 				}
 
-				for (e = LIST_HEAD(vrrp->vip); e; ELEMENT_NEXT(e)) {
+				for (e = LIST_HEAD(vrrp->vip), n = 0; e; ELEMENT_NEXT(e), n++) {
 					ipaddress = ELEMENT_DATA(e);
-					if (!vrrp_in_chk_vips(vrrp, ipaddress, vips)) {
+					if (!vrrp_in_chk_vips(vrrp, ipaddress, vips, n)) {
 						log_message(LOG_INFO, "(%s) ip address associated with VRID %d"
 							    " not present in MASTER advert : %s",
 							    vrrp->iname, vrrp->vrid,
@@ -763,12 +767,7 @@ vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr
 
 			/* check a unicast source address is in the unicast_peer list */
 			if (global_data->vrrp_check_unicast_src && !LIST_ISEMPTY(vrrp->unicast_peer)) {
-				for (e = LIST_HEAD(vrrp->unicast_peer); e; ELEMENT_NEXT(e)) {
-					up_addr = ELEMENT_DATA(e);
-					if (IN6_ARE_ADDR_EQUAL(&((struct sockaddr_in6 *)&vrrp->pkt_saddr)->sin6_addr, &((struct sockaddr_in6 *)up_addr)->sin6_addr))
-						break;
-				}
-				if (!e) {
+				if (!vrrp_is_unicast_peer(vrrp, &vrrp->pkt_saddr)) {
 					log_message(LOG_INFO, "(%s): unicast source address %s not a unicast peer",
 						vrrp->iname, inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&vrrp->pkt_saddr)->sin6_addr,
 							    addr_str, sizeof(addr_str)));
@@ -896,8 +895,7 @@ vrrp_build_ipsecah(vrrp_t * vrrp, char *buffer, size_t buflen)
 	   => No padding needed.
 	   -- rfc2402.3.3.3.1.1.1 & rfc2401.5
 	 */
-	hmac_md5((unsigned char *) buffer, buflen, vrrp->auth_data, sizeof (vrrp->auth_data)
-		 , digest);
+	hmac_md5_digest(&vrrp->auth_hmac, (unsigned char *) buffer, buflen, digest);
 	memcpy(ah->auth_data, digest, HMAC_MD5_TRUNC);
 
 	/* Restore the ip mutable fields */
@@ -1159,6 +1157,12 @@ vrrp_send_pkt(vrrp_t * vrrp, struct sockaddr_storage *addr)
 		vrrp_build_ancillary_data(&msg, cbuf, src);
 	}
 
+	/* When simulating, nothing goes out on the network */
+	if (thread_simulating()) {
+		sim_stats.adverts++;
+		return (ssize_t)iov.iov_len;
+	}
+
 	/* Send the packet */
 	return sendmsg(vrrp->fd_out, &msg, (addr) ? 0 : MSG_DONTROUTE);
 }
@@ -1303,26 +1307,71 @@ vrrp_remove_delayed_arp(vrrp_t *vrrp)
 	if (!LIST_ISEMPTY(vrrp->vip)) {
 		for (e = LIST_HEAD(vrrp->vip); e; ELEMENT_NEXT(e)) {
 			ipaddress = ELEMENT_DATA(e);
-			ipaddress->garp_gna_pending = false;
+			garp_queue_remove(ipaddress);
 		}
 	}
 
 	if (!LIST_ISEMPTY(vrrp->evip)) {
 		for (e = LIST_HEAD(vrrp->evip); e; ELEMENT_NEXT(e)) {
 			ipaddress = ELEMENT_DATA(e);
-			ipaddress->garp_gna_pending = false;
+			garp_queue_remove(ipaddress);
 		}
 	}
-	vrrp->garp_pending = false;
-	vrrp->gna_pending = false;
+}
+
+/* Set while the members of a sync group become master in one pass */
+static bool become_master_shared;
+
+/* Announce the addresses of an instance that has become master */
+static void
+vrrp_become_master_link_update(vrrp_t *vrrp)
+{
+	interface_t *ifp;
+
+	/* remotes neighbour update */
+	if (vrrp->family == AF_INET6) {
+		/* Refresh whether we are acting as a router for NA messages */
+		ifp = IF_BASE_IFP(vrrp->ifp);
+		ifp->gna_router = get_ipv6_forwarding(ifp);
+	}
+	vrrp_send_link_update(vrrp, vrrp->garp_rep);
+}
+
+/* The routes and rules of the instances that become master until
+ * vrrp_become_master_share_end() are sent in shared netlink batches.
+ * The kernel is then polled once, and the instances' gratuitous ARPs/NAs
+ * are sent once all their addresses, routes and rules are in place. */
+void
+vrrp_become_master_share_begin(void)
+{
+#ifdef _HAVE_FIB_ROUTING_
+	netlink_rtlist_share_begin();
+	netlink_rulelist_share_begin();
+#endif
+	become_master_shared = true;
+}
+
+void
+vrrp_become_master_share_end(vrrp_t **vrrps, unsigned num)
+{
+	unsigned i;
+
+	become_master_shared = false;
+#ifdef _HAVE_FIB_ROUTING_
+	netlink_rtlist_share_end();
+	netlink_rulelist_share_end();
+#endif
+
+	kernel_netlink_poll();
+
+	for (i = 0; i < num; i++)
+		vrrp_become_master_link_update(vrrps[i]);
 }
 
 /* becoming master */
 static void
 vrrp_state_become_master(vrrp_t * vrrp)
 {
-	interface_t *ifp ;
-
 	++vrrp->stats->become_master;
 
 	if (vrrp->version == VRRP_VERSION_3)
@@ -1347,15 +1396,10 @@ vrrp_state_become_master(vrrp_t * vrrp)
 		vrrp_handle_iprules(vrrp, IPRULE_ADD, false);
 #endif
 
-	kernel_netlink_poll();
-
-	/* remotes neighbour update */
-	if (vrrp->family == AF_INET6) {
-		/* Refresh whether we are acting as a router for NA messages */
-		ifp = IF_BASE_IFP(vrrp->ifp);
-		ifp->gna_router = get_ipv6_forwarding(ifp);
+	if (!become_master_shared) {
+		kernel_netlink_poll();
+		vrrp_become_master_link_update(vrrp);
 	}
-	vrrp_send_link_update(vrrp, vrrp->garp_rep);
 
 	/* set refresh timer */
 	if (!timer_isnull(vrrp->garp_refresh)) {
@@ -1405,7 +1449,7 @@ vrrp_state_goto_master(vrrp_t * vrrp)
 
 	vrrp_send_adv(vrrp, vrrp->effective_priority);
 
-	vrrp->state = VRRP_STATE_MAST;
+	vrrp_set_state(vrrp, VRRP_STATE_MAST);
 	log_message(LOG_INFO, "VRRP_Instance(%s) Transition to MASTER STATE"
 			    , vrrp->iname);
 }
@@ -1475,7 +1519,7 @@ vrrp_state_leave_master(vrrp_t * vrrp)
 	case VRRP_STATE_BACK:
 		log_message(LOG_INFO, "VRRP_Instance(%s) Entering BACKUP STATE", vrrp->iname);
 		vrrp_restore_interface(vrrp, false, false);
-		vrrp->state = vrrp->wantstate;
+		vrrp_set_state(vrrp, vrrp->wantstate);
 		notify_instance_exec(vrrp, VRRP_STATE_BACK);
 		vrrp->preempt_time.tv_sec = 0;
 #ifdef _WITH_SNMP_VRRP_
@@ -1485,7 +1529,7 @@ vrrp_state_leave_master(vrrp_t * vrrp)
 	case VRRP_STATE_GOTO_FAULT:
 		log_message(LOG_INFO, "VRRP_Instance(%s) Entering FAULT STATE", vrrp->iname);
 		vrrp_restore_interface(vrrp, false, false);
-		vrrp->state = VRRP_STATE_FAULT;
+		vrrp_set_state(vrrp, VRRP_STATE_FAULT);
 		notify_instance_exec(vrrp, VRRP_STATE_FAULT);
 		vrrp_send_adv(vrrp, VRRP_PRIO_STOP);
 #ifdef _WITH_SNMP_VRRP_
@@ -1581,7 +1625,7 @@ vrrp_state_backup(vrrp_t * vrrp, char *buf, ssize_t buflen)
 		}
 	} else {
 		log_message(LOG_INFO, "VRRP_Instance(%s) forcing a new MASTER election" , vrrp->iname);
-		vrrp->wantstate = VRRP_STATE_GOTO_MASTER;
+		vrrp_set_wantstate(vrrp, VRRP_STATE_GOTO_MASTER);
 		vrrp_send_adv(vrrp, vrrp->effective_priority);
 #ifdef _WITH_SNMP_RFCV3_
 		vrrp->stats->master_reason = VRRPV3_MASTER_REASON_PREEMPTED;
@@ -1652,7 +1696,7 @@ vrrp_state_master_rx(vrrp_t * vrrp, char *buf, ssize_t buflen)
 	/* return on link failure */
 	if (vrrp->wantstate == VRRP_STATE_GOTO_FAULT) {
 		vrrp->ms_down_timer = 3 * vrrp->adver_int + VRRP_TIMER_SKEW(vrrp);
-		vrrp->state = VRRP_STATE_FAULT;
+		vrrp_set_state(vrrp, VRRP_STATE_FAULT);
 		notify_instance_exec(vrrp, VRRP_STATE_FAULT);
 		vrrp->last_transition = timer_now();
 		return 1;
@@ -1755,8 +1799,8 @@ vrrp_state_master_rx(vrrp_t * vrrp, char *buf, ssize_t buflen)
 		else
 			vrrp->ms_down_timer = 3 * vrrp->adver_int + VRRP_TIMER_SKEW(vrrp);
 		vrrp->master_priority = hd->priority;
-		vrrp->wantstate = VRRP_STATE_BACK;
-		vrrp->state = VRRP_STATE_BACK;
+		vrrp_set_wantstate(vrrp, VRRP_STATE_BACK);
+		vrrp_set_state(vrrp, VRRP_STATE_BACK);
 		return 1;
 	}
 
@@ -1817,6 +1861,10 @@ open_vrrp_send_socket(sa_family_t family, int proto, ifindex_t idx, bool unicast
 		return -1;
 	}
 
+	/* When simulating, a socket that never sends or receives anything */
+	if (thread_simulating())
+		return socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
 	/* Retreive interface_t */
 	ifp = if_get_by_ifindex(idx);
 
@@ -1863,6 +1911,10 @@ open_vrrp_read_socket(sa_family_t family, int proto, ifindex_t idx, bool unicast
 	interface_t *ifp;
 	int fd = -1;
 
+	/* When simulating, don't join any multicast group */
+	if (thread_simulating())
+		return socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
 	/* Retreive interface_t */
 	ifp = if_get_by_ifindex(idx);
 
@@ -1908,7 +1960,7 @@ open_vrrp_read_socket(sa_family_t family, int proto, ifindex_t idx, bool unicast
 static void
 close_vrrp_socket(vrrp_t * vrrp)
 {
-	if (LIST_ISEMPTY(vrrp->unicast_peer))
+	if (LIST_ISEMPTY(vrrp->unicast_peer) && !thread_simulating())
 		if_leave_vrrp_group(vrrp->family, vrrp->fd_in, vrrp->ifp);
 
 	close(vrrp->fd_in);
@@ -2080,6 +2132,9 @@ vrrp_complete_instance(vrrp_t * vrrp)
 			vrrp->auth_type = VRRP_AUTH_NONE;
 		}
 	}
+
+	if (vrrp->auth_type == VRRP_AUTH_AH)
+		hmac_md5_init(&vrrp->auth_hmac, vrrp->auth_data, sizeof(vrrp->auth_data));
 #endif
 
 	if (!chk_min_cfg(vrrp))
@@ -2152,11 +2207,11 @@ vrrp_complete_instance(vrrp_t * vrrp)
 
 	if (vrrp->strict_mode && (vrrp->wantstate == VRRP_STATE_MAST) && (vrrp->base_priority != VRRP_PRIO_OWNER)) {
 		log_message(LOG_INFO,"(%s): Cannot start in MASTER state if not address owner", vrrp->iname);
-		vrrp->wantstate = VRRP_STATE_BACK;
+		vrrp_set_wantstate(vrrp, VRRP_STATE_BACK);
 	}
 	else if (vrrp->base_priority == VRRP_PRIO_OWNER && !vrrp->nopreempt) {
 		/* Act as though state MASTER had been specified, to speed transition to master state */
-		vrrp->wantstate = VRRP_STATE_MAST;
+		vrrp_set_wantstate(vrrp, VRRP_STATE_MAST);
 	}
 
 	if (vrrp->nopreempt && vrrp->wantstate == VRRP_STATE_MAST)
@@ -2170,7 +2225,7 @@ vrrp_complete_instance(vrrp_t * vrrp)
 		vrrp->preempt_delay = 0;
 	}
 
-	vrrp->state = VRRP_STATE_INIT;
+	vrrp_set_state(vrrp, VRRP_STATE_INIT);
 
 	/* Set default for accept mode if not specified. If we are running in strict mode,
 	 * default is to disable accept mode, otherwise default is to enable it.
@@ -2537,6 +2592,9 @@ vrrp_complete_init(void)
 		}
 	}
 
+	/* Index the unicast peers, for matching adverts to instances */
+	alloc_vrrp_unicast_index();
+
 	/* Build synchronization group index, and remove any
 	 * empty groups, or groups with only one member */
 	for (e = LIST_HEAD(vrrp_data->vrrp_sync_group); e; e = next) {
@@ -2594,22 +2652,22 @@ vrrp_complete_init(void)
 
 						case VRRP_STATE_BACK:
 							if (vrrp->state != VRRP_STATE_BACK) {
-								vrrp->wantstate = VRRP_STATE_BACK;
+								vrrp_set_wantstate(vrrp, VRRP_STATE_BACK);
 							}
 							break;
 
 						case VRRP_STATE_MAST:
 							if (vrrp->state != VRRP_STATE_MAST) {
-								vrrp->wantstate = VRRP_STATE_MAST;
+								vrrp_set_wantstate(vrrp, VRRP_STATE_MAST);
 							}
 							break;
 
 						case VRRP_STATE_FAULT:
 							if (vrrp->state != VRRP_STATE_FAULT) {
 								if (vrrp->state == VRRP_STATE_MAST)
-									vrrp->wantstate = VRRP_STATE_GOTO_FAULT;
+									vrrp_set_wantstate(vrrp, VRRP_STATE_GOTO_FAULT);
 								if (vrrp->state == VRRP_STATE_BACK)
-									vrrp->state = VRRP_STATE_FAULT;
+									vrrp_set_state(vrrp, VRRP_STATE_FAULT);
 							}
 							break;
 
@@ -2739,6 +2797,7 @@ clear_diff_vrrp_vip(vrrp_t *old_vrrp, vrrp_t *vrrp)
 	if (!old_vrrp->vipset)
 		return;
 
+	iptables_lock();
 #ifdef _HAVE_LIBIPTC_
 	do {
 #ifdef _LIBIPTC_DYNAMIC_
@@ -2756,6 +2815,7 @@ clear_diff_vrrp_vip(vrrp_t *old_vrrp, vrrp_t *vrrp)
 			res = iptables_close(h);
 	} while (res == EAGAIN && ++tries < IPTABLES_MAX_TRIES);
 #endif
+	iptables_unlock();
 }
 
 #ifdef _HAVE_FIB_ROUTING_
@@ -2781,8 +2841,8 @@ restore_vrrp_state(vrrp_t *old_vrrp, vrrp_t *vrrp)
 	bool added_ip_addr = false;
 
 	/* Keep VRRP state, ipsec AH seq_number */
-	vrrp->state = old_vrrp->state;
-	vrrp->wantstate = old_vrrp->state;
+	vrrp_set_state(vrrp, old_vrrp->state);
+	vrrp_set_wantstate(vrrp, old_vrrp->state);
 	if (!old_vrrp->sync)
 		vrrp->effective_priority = old_vrrp->effective_priority;
 	/* Save old stats */
@@ -58,6 +58,12 @@ static ssize_t send_arp(ip_address_t *ipaddress)
 		log_message(LOG_INFO, "Sending gratuitous ARP on %s for %s",
 			    IF_NAME(ipaddress->ifp), inet_ntop2(ipaddress->u.sin.sin_addr.s_addr));
 
+	/* When simulating, nothing goes out on the network */
+	if (thread_simulating()) {
+		sim_stats.arps++;
+		return (ssize_t)(sizeof(arphdr_t) + ETHER_HDR_LEN);
+	}
+
 	/* Send packet */
 	len = sendto(garp_fd, garp_buffer, sizeof(arphdr_t) + ETHER_HDR_LEN
 		     , 0, (struct sockaddr *)&sll, sizeof(sll));
@@ -107,8 +113,7 @@ static void queue_garp(vrrp_t *vrrp, interface_t *ifp, ip_address_t *ipaddress)
 {
 	timeval_t next_time = timer_add_now(ifp->garp_delay->garp_interval);
 
-	vrrp->garp_pending = true;
-	ipaddress->garp_gna_pending = true;
+	garp_queue_add(vrrp, ipaddress);
 
 	/* Do we need to reschedule the garp thread? */
 	if (!garp_thread || timer_cmp(next_time, garp_next_time) < 0) {
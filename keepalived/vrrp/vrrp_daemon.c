@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <stdint.h>
 #include <sys/prctl.h>
 
 #include "vrrp_daemon.h"
@@ -40,6 +41,8 @@
 #include "vrrp_parser.h"
 #include "vrrp_data.h"
 #include "vrrp.h"
+#include "vrrp_sync.h"
+#include "vrrp_track.h"
 #include "vrrp_print.h"
 #include "global_data.h"
 #include "pidfile.h"
@@ -83,14 +86,238 @@ static int reload_vrrp_thread(thread_t * thread);
 
 static char *vrrp_syslog_ident;
 
+/* VRRP workers */
+unsigned vrrp_worker;				/* Index of this worker */
+static char *vrrp_worker_pidfile;		/* This worker's pidfile */
+static bool vrrp_worker_respawned;		/* Restarted after it died */
+
 #ifdef _WITH_LVS_
 static bool
 vrrp_ipvs_needed(void)
 {
 	return !!(global_data->lvs_syncd.ifname);
 }
+
+/* Sample the LVS sync daemon telemetry */
+static int
+lvs_syncd_stats_thread(__attribute__((unused)) thread_t * thread)
+{
+	if (!global_data->lvs_syncd.ifname)
+		return 0;
+
+	ipvs_syncd_update_stats(&global_data->lvs_syncd);
+	thread_add_timer(master, lvs_syncd_stats_thread, NULL, IPVS_SYNCD_STATS_INTERVAL);
+
+	return 0;
+}
+#endif
+
+/* Add the worker number to a file name, before any extension */
+char *
+make_worker_file_name(const char *name)
+{
+	const char *dir_end = strrchr(name, '/');
+	const char *extn = strrchr(dir_end ? dir_end : name, '.');
+	size_t len = extn ? (size_t)(extn - name) : strlen(name);
+	char *file_name;
+
+	file_name = MALLOC(strlen(name) + 12);
+	memcpy(file_name, name, len);
+	if (vrrp_worker)
+		sprintf(file_name + len, "_%u", vrrp_worker);
+	if (extn)
+		strcat(file_name, extn);
+
+	return file_name;
+}
+
+/* All the instances on an interface are run by the same worker, so that
+ * only that worker receives their adverts. A sync group joins the
+ * interfaces of its members, so that it is run by a single worker. */
+typedef struct _worker_if {
+	const char		*ifname;
+	unsigned		parent;		/* union-find of joined interfaces */
+} worker_if_t;
+
+/* An instance without an interface will use the default interface */
+static const char *
+vrrp_instance_ifname(vrrp_t *vrrp)
+{
+	if (vrrp->ifp)
+		return vrrp->ifp->ifname;
+	if (global_data->default_ifp)
+		return global_data->default_ifp->ifname;
+	return vrrp->iname;
+}
+
+static unsigned
+worker_if_index(worker_if_t *ifs, unsigned *num_ifs, vrrp_t *vrrp)
+{
+	const char *ifname = vrrp_instance_ifname(vrrp);
+	unsigned i;
+
+	for (i = 0; i < *num_ifs; i++) {
+		if (!strcmp(ifs[i].ifname, ifname))
+			return i;
+	}
+
+	ifs[i].ifname = ifname;
+	ifs[i].parent = i;
+	(*num_ifs)++;
+
+	return i;
+}
+
+static unsigned
+worker_if_root(worker_if_t *ifs, unsigned i)
+{
+	while (ifs[i].parent != i)
+		i = ifs[i].parent = ifs[ifs[i].parent].parent;
+
+	return i;
+}
+
+/* The lowest interface name is the root, so that the workers agree
+ * whatever order the interfaces are joined in */
+static void
+worker_if_join(worker_if_t *ifs, unsigned i, unsigned j)
+{
+	i = worker_if_root(ifs, i);
+	j = worker_if_root(ifs, j);
+
+	if (i == j)
+		return;
+
+	if (strcmp(ifs[i].ifname, ifs[j].ifname) < 0)
+		ifs[j].parent = i;
+	else
+		ifs[i].parent = j;
+}
+
+static unsigned
+vrrp_instance_worker(worker_if_t *ifs, unsigned *num_ifs, vrrp_t *vrrp)
+{
+	const char *name = ifs[worker_if_root(ifs, worker_if_index(ifs, num_ifs, vrrp))].ifname;
+	uint32_t hash = 2166136261U;
+
+	for (; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619U;
+
+	return hash % vrrp_workers;
+}
+
+static void
+vrrp_worker_drop_instance(element e)
+{
+	vrrp_t *vrrp = ELEMENT_DATA(e);
+	tracked_sc_t *tsc;
+	element e1;
+
+	/* Scripts are only run if an instance tracks them */
+	if (!LIST_ISEMPTY(vrrp->track_script)) {
+		for (e1 = LIST_HEAD(vrrp->track_script); e1; ELEMENT_NEXT(e1)) {
+			tsc = ELEMENT_DATA(e1);
+			tsc->scr->inuse--;
+		}
+	}
+
+#ifdef _WITH_LVS_
+	/* The global lvs_sync_daemon only names its instance until vrrp_complete_init() */
+	if (global_data->lvs_syncd.vrrp == vrrp ||
+	    (global_data->lvs_syncd.vrrp_name && !strcmp(global_data->lvs_syncd.vrrp_name, vrrp->iname))) {
+		FREE_PTR(global_data->lvs_syncd.ifname);
+		global_data->lvs_syncd.ifname = NULL;
+		global_data->lvs_syncd.vrrp = NULL;
+		FREE_PTR(global_data->lvs_syncd.vrrp_name);
+		global_data->lvs_syncd.vrrp_name = NULL;
+	}
+#endif
+
+	free_list_element(vrrp_data->vrrp, e);
+}
+
+/* Remove the configuration that is handled by other workers. The first
+ * worker owns everything that isn't an instance: the static addresses,
+ * routes and rules, SNMP, DBus and the notify FIFO scripts. Every worker
+ * adds the static nexthops, since its routes may refer to them. */
+static void
+vrrp_worker_filter(void)
+{
+	vrrp_sgroup_t *vgroup;
+	vrrp_t *vrrp, *first;
+	worker_if_t *ifs = NULL;
+	unsigned num_ifs = 0;
+	element e, next;
+	unsigned i;
+
+	if (vrrp_workers <= 1)
+		return;
+
+	if (!LIST_ISEMPTY(vrrp_data->vrrp)) {
+		ifs = MALLOC(LIST_SIZE(vrrp_data->vrrp) * sizeof(*ifs));
+
+		for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e))
+			worker_if_index(ifs, &num_ifs, ELEMENT_DATA(e));
+
+		for (e = LIST_HEAD(vrrp_data->vrrp_sync_group); e; ELEMENT_NEXT(e)) {
+			vgroup = ELEMENT_DATA(e);
+			if (!vgroup->iname)
+				continue;
+
+			first = NULL;
+			for (i = 0; i < vector_size(vgroup->iname); i++) {
+				if (!(vrrp = vrrp_get_instance(vector_slot(vgroup->iname, i))))
+					continue;
+				if (!first)
+					first = vrrp;
+				else
+					worker_if_join(ifs, worker_if_index(ifs, &num_ifs, first),
+							    worker_if_index(ifs, &num_ifs, vrrp));
+			}
+		}
+	}
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_sync_group); e; e = next) {
+		next = e->next;
+		vgroup = ELEMENT_DATA(e);
+		if (!vgroup->iname ||
+		    !(vrrp = vrrp_get_instance(vector_slot(vgroup->iname, 0))))
+			continue;
+
+		if (vrrp_instance_worker(ifs, &num_ifs, vrrp) != vrrp_worker)
+			free_list_element(vrrp_data->vrrp_sync_group, e);
+	}
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; e = next) {
+		next = e->next;
+		if (vrrp_instance_worker(ifs, &num_ifs, ELEMENT_DATA(e)) != vrrp_worker)
+			vrrp_worker_drop_instance(e);
+	}
+
+	FREE_PTR(ifs);
+
+	if (vrrp_worker) {
+		free_list(&vrrp_data->static_addresses);
+		free_list(&vrrp_data->static_routes);
+		free_list(&vrrp_data->static_rules);
+
+#ifdef _WITH_SNMP_
+		global_data->enable_snmp_keepalived = false;
+		global_data->enable_snmp_rfcv2 = false;
+		global_data->enable_snmp_rfcv3 = false;
+#endif
+#ifdef _WITH_DBUS_
+		global_data->enable_dbus = false;
 #endif
 
+		/* Only write to the FIFOs */
+		free_notify_script(&global_data->notify_fifo.script);
+		free_notify_script(&global_data->vrrp_notify_fifo.script);
+	}
+
+	log_message(LOG_INFO, "VRRP worker %u of %u running %d instance(s)", vrrp_worker, vrrp_workers, LIST_SIZE(vrrp_data->vrrp));
+}
+
 static int
 vrrp_notify_fifo_script_exit(__attribute__((unused)) thread_t *thread)
 {
@@ -109,13 +336,22 @@ stop_vrrp(int status)
 	restore_vrrp_interfaces();
 
 #ifdef _HAVE_LIBIPTC_
-	iptables_fini();
+	if (!vrrp_worker) {
+		iptables_lock();
+		iptables_fini();
+		iptables_unlock();
+	}
 #endif
 
 	/* Clear static entries */
 #ifdef _HAVE_FIB_ROUTING_
 	netlink_rulelist(vrrp_data->static_rules, IPRULE_DEL, false);
 	netlink_rtlist(vrrp_data->static_routes, IPROUTE_DEL);
+#if HAVE_DECL_RTA_NH_ID
+	/* Other workers' routes may still be using the nexthops */
+	if (!vrrp_worker)
+		netlink_nhlist(vrrp_data->static_nexthops, IPROUTE_DEL);
+#endif
 #endif
 	netlink_iplist(vrrp_data->static_addresses, IPADDRESS_DEL, false);
 
@@ -125,7 +361,10 @@ stop_vrrp(int status)
 #endif
 
 	/* Stop daemon */
-	pidfile_rm(vrrp_pidfile);
+	if (vrrp_worker_pidfile) {
+		pidfile_rm(vrrp_worker_pidfile);
+		FREE(vrrp_worker_pidfile);
+	}
 
 	/* Clean data */
 	vrrp_dispatcher_release(vrrp_data);
@@ -216,6 +455,8 @@ start_vrrp(void)
 
 	init_data(conf_file, vrrp_init_keywords);
 
+	vrrp_worker_filter();
+
 	init_global_data(global_data);
 
 	/* Set the process priority and non swappable if configured */
@@ -259,6 +500,10 @@ start_vrrp(void)
 	if (reload) {
 		clear_diff_saddresses();
 #ifdef _HAVE_FIB_ROUTING_
+#if HAVE_DECL_RTA_NH_ID
+		/* Routes may refer to new nexthops */
+		update_diff_snexthops();
+#endif
 		clear_diff_srules();
 		clear_diff_sroutes();
 #endif
@@ -295,25 +540,44 @@ start_vrrp(void)
 	if (global_data->vrrp_notify_fifo.name)
 		notify_fifo_open(&global_data->notify_fifo, &global_data->vrrp_notify_fifo, vrrp_notify_fifo_script_exit, "vrrp_");
 
-	/* Make sure we don't have any old iptables/ipsets settings left around */
+	/* Make sure we don't have any old iptables/ipsets settings left around.
+	 * The first worker sets up the ipsets, and the other workers wait for
+	 * it to release the lock before using them. If it has been restarted,
+	 * the other workers' entries mustn't be removed. */
+	iptables_lock();
 #ifdef _HAVE_LIBIPTC_
-	if (!reload)
-		iptables_cleanup();
+	if (!vrrp_worker) {
+		bool in_use = reload || (vrrp_workers > 1 && vrrp_worker_respawned);
 
-	iptables_startup(reload);
+		if (!in_use)
+			iptables_cleanup();
+
+		iptables_startup(in_use);
+	}
 #endif
+	iptables_unlock();
 
 	if (!reload)
 		vrrp_restore_interfaces_startup();
 
 	/* clear_diff_vrrp must be called after vrrp_complete_init, since the latter
 	 * sets ifa_index on the addresses, which is used for the address comparison */
-	if (reload)
+	if (reload) {
 		clear_diff_vrrp();
+#if defined _HAVE_FIB_ROUTING_ && HAVE_DECL_RTA_NH_ID
+		if (!vrrp_worker)
+			clear_diff_snexthops();
+#endif
+	}
 
 #ifdef _WITH_DBUS_
-	if (reload && global_data->enable_dbus)
-		dbus_reload(old_vrrp_data->vrrp, vrrp_data->vrrp);
+	if (global_data->enable_dbus) {
+		/* Publish the instance properties read by the DBus thread */
+		dbus_publish_snapshot();
+
+		if (reload)
+			dbus_reload(old_vrrp_data->vrrp, vrrp_data->vrrp);
+	}
 #endif
 
 	/* Post initializations */
@@ -324,6 +588,9 @@ start_vrrp(void)
 	/* Set static entries */
 	netlink_iplist(vrrp_data->static_addresses, IPADDRESS_ADD, false);
 #ifdef _HAVE_FIB_ROUTING_
+#if HAVE_DECL_RTA_NH_ID
+	netlink_nhlist(vrrp_data->static_nexthops, IPROUTE_ADD);
+#endif
 	netlink_rtlist(vrrp_data->static_routes, IPROUTE_ADD);
 	netlink_rulelist(vrrp_data->static_rules, IPRULE_ADD, false);
 #endif
@@ -347,6 +614,11 @@ start_vrrp(void)
 	/* Init & start the VRRP packet dispatcher */
 	thread_add_event(master, vrrp_dispatcher_init, NULL,
 			 VRRP_DISPATCHER);
+
+#ifdef _WITH_LVS_
+	if (vrrp_ipvs_needed())
+		thread_add_timer(master, lvs_syncd_stats_thread, NULL, IPVS_SYNCD_STATS_INTERVAL);
+#endif
 }
 
 static void
@@ -492,10 +764,13 @@ print_vrrp_json(__attribute__((unused)) thread_t * thread)
 
 /* VRRP Child respawning thread */
 #ifndef _DEBUG_
+static int start_vrrp_worker(unsigned);
+
 static int
 vrrp_respawn_thread(thread_t * thread)
 {
 	pid_t pid;
+	unsigned worker;
 
 	/* Fetch thread args */
 	pid = THREAD_CHILD_PID(thread);
@@ -507,10 +782,18 @@ vrrp_respawn_thread(thread_t * thread)
 		return 0;
 	}
 
+	for (worker = 0; worker < vrrp_workers; worker++) {
+		if (vrrp_child[worker] == pid)
+			break;
+	}
+	if (worker == vrrp_workers)
+		return 0;
+
 	/* We catch a SIGCHLD, handle it */
 	if (!__test_bit(DONT_RESPAWN_BIT, &debug)) {
 		log_message(LOG_ALERT, "VRRP child process(%d) died: Respawning", pid);
-		start_vrrp_child();
+		vrrp_worker_respawned = true;
+		start_vrrp_worker(worker);
 	} else {
 		log_message(LOG_ALERT, "VRRP child process(%d) died: Exiting", pid);
 		raise(SIGTERM);
@@ -519,13 +802,14 @@ vrrp_respawn_thread(thread_t * thread)
 }
 #endif
 
-/* Register VRRP thread */
-int
-start_vrrp_child(void)
+/* Start a VRRP worker process */
+static int
+start_vrrp_worker(unsigned worker)
 {
 #ifndef _DEBUG_
 	pid_t pid;
 	char *syslog_ident;
+	char prog[16];
 
 	/* Initialize child process */
 	if (log_file_name)
@@ -538,9 +822,13 @@ start_vrrp_child(void)
 			       , strerror(errno));
 		return -1;
 	} else if (pid) {
-		vrrp_child = pid;
-		log_message(LOG_INFO, "Starting VRRP child process, pid=%d"
-			       , pid);
+		vrrp_child[worker] = pid;
+		if (vrrp_workers > 1)
+			log_message(LOG_INFO, "Starting VRRP worker %u, pid=%d"
+				       , worker, pid);
+		else
+			log_message(LOG_INFO, "Starting VRRP child process, pid=%d"
+				       , pid);
 
 		/* Start respawning thread */
 		thread_add_child(master, vrrp_respawn_thread, NULL,
@@ -552,6 +840,7 @@ start_vrrp_child(void)
 	signal_handler_destroy();
 
 	prog_type = PROG_TYPE_VRRP;
+	vrrp_worker = worker;
 
 	/* Opening local VRRP syslog channel */
 	if ((instance_name
@@ -568,8 +857,13 @@ start_vrrp_child(void)
 		openlog(syslog_ident, LOG_PID | ((__test_bit(LOG_CONSOLE_BIT, &debug)) ? LOG_CONS : 0)
 				    , (log_facility==LOG_DAEMON) ? LOG_LOCAL1 : log_facility);
 
-	if (log_file_name)
-		open_log_file(log_file_name, "vrrp", network_namespace, instance_name);
+	if (log_file_name) {
+		if (vrrp_worker)
+			snprintf(prog, sizeof(prog), "vrrp_%u", vrrp_worker);
+		else
+			strcpy(prog, "vrrp");
+		open_log_file(log_file_name, prog, network_namespace, instance_name);
+	}
 
 #ifdef _MEM_CHECK_
 	mem_log_init(PROG_VRRP, "VRRP Child process");
@@ -582,7 +876,8 @@ start_vrrp_child(void)
 	set_child_finder(NULL, NULL, NULL, NULL, NULL, 0);	/* Currently these won't be set */
 
 	/* Child process part, write pidfile */
-	if (!pidfile_write(vrrp_pidfile, getpid())) {
+	vrrp_worker_pidfile = make_worker_file_name(vrrp_pidfile);
+	if (!pidfile_write(vrrp_worker_pidfile, getpid())) {
 		/* Fatal error */
 		log_message(LOG_INFO, "VRRP child process: cannot write pidfile");
 		exit(0);
@@ -591,6 +886,8 @@ start_vrrp_child(void)
 	/* Create the new master thread */
 	thread_destroy_master(master);	/* This destroys any residual settings from the parent */
 	master = thread_make_master();
+#else
+	vrrp_worker = worker;
 #endif
 
 	/* If last process died during a reload, we can get there and we
@@ -605,6 +902,10 @@ start_vrrp_child(void)
 	libnl_init();
 #endif
 
+	/* Simulation must be set up before anything touches the kernel */
+	if (simulate_duration)
+		thread_set_simulation(master, simulate_duration * TIMER_HZ, NULL);
+
 	/* Start VRRP daemon */
 	start_vrrp();
 
@@ -617,3 +918,31 @@ start_vrrp_child(void)
 	/* unreachable */
 	exit(EXIT_SUCCESS);
 }
+
+/* Register VRRP thread */
+int
+start_vrrp_child(void)
+{
+#ifndef _DEBUG_
+	unsigned i;
+	int ret = 0;
+
+	/* The first worker releases the lock once it has set up the iptables
+	 * structures that the other workers use */
+	iptables_lock();
+
+	for (i = 0; i < vrrp_workers; i++) {
+		if (start_vrrp_worker(i))
+			ret = -1;
+		if (!i)
+			iptables_lock_close();
+	}
+
+	return ret;
+#else
+	/* There is no child process to run workers in */
+	vrrp_workers = 1;
+
+	return start_vrrp_worker(0);
+#endif
+}
@@ -74,6 +74,17 @@ alloc_srule(vector_t *strvec)
 		vrrp_data->static_rules = alloc_list(free_iprule, dump_iprule);
 	alloc_rule(vrrp_data->static_rules, strvec);
 }
+
+#if HAVE_DECL_RTA_NH_ID
+/* Static nexthops facility function */
+void
+alloc_snexthop(vector_t *strvec)
+{
+	if (!LIST_EXISTS(vrrp_data->static_nexthops))
+		vrrp_data->static_nexthops = alloc_list(free_ipnexthop, dump_ipnexthop);
+	alloc_nexthop(vrrp_data->static_nexthops, strvec);
+}
+#endif
 #endif
 
 /* VRRP facility functions */
@@ -626,8 +637,10 @@ free_vrrp_data(vrrp_data_t * data)
 	free_list(&data->static_addresses);
 	free_list(&data->static_routes);
 	free_list(&data->static_rules);
+	free_list(&data->static_nexthops);
 	free_mlist(data->vrrp_index, 1151+1);
 	free_mlist(data->vrrp_index_fd, 1024+1);
+	FREE_PTR(data->vrrp_unicast_index);
 	free_list(&data->vrrp);
 	free_list(&data->vrrp_sync_group);
 	free_list(&data->vrrp_script);
@@ -649,6 +662,10 @@ dump_vrrp_data(vrrp_data_t * data)
 		log_message(LOG_INFO, "------< Static Rules >------");
 		dump_list(data->static_rules);
 	}
+	if (!LIST_ISEMPTY(data->static_nexthops)) {
+		log_message(LOG_INFO, "------< Static Nexthops >------");
+		dump_list(data->static_nexthops);
+	}
 	if (!LIST_ISEMPTY(data->vrrp)) {
 		log_message(LOG_INFO, "------< VRRP Topology >------");
 		dump_list(data->vrrp);
@@ -72,8 +72,6 @@ typedef enum dbus_action {
 	DBUS_DESTROY_INSTANCE,
 #endif
 	DBUS_SEND_GARP,
-	DBUS_GET_NAME,
-	DBUS_GET_STATUS,
 } dbus_action_t;
 
 typedef enum dbus_error {
@@ -93,6 +91,28 @@ typedef struct dbus_queue_ent {
 	GVariant *args;
 } dbus_queue_ent_t;
 
+/* The instance properties are published by the vrrp thread in a snapshot
+ * which the DBus thread reads without waking the vrrp thread. The name
+ * and path are fixed for the life of a snapshot, and the state is updated
+ * in place. A new snapshot is published at startup and on reload; the DBus
+ * thread announces the snapshot it is reading in dbus_snapshot_hazard,
+ * and the vrrp thread only frees retired snapshots other than that one. */
+typedef struct dbus_instance_props {
+	vrrp_t *vrrp;			/* vrrp thread only */
+	char *iname;
+	gchar *object_path;
+	gint state;			/* Updated atomically */
+	int signalled_state;		/* vrrp thread only */
+	bool signal_pending;		/* vrrp thread only */
+} dbus_instance_props_t;
+
+typedef struct dbus_snapshot {
+	struct dbus_snapshot *next;	/* Retired snapshots */
+	GHashTable *paths;		/* object path -> dbus_instance_props_t */
+	unsigned num_instances;
+	dbus_instance_props_t instance[];
+} dbus_snapshot_t;
+
 /* Global file variables */
 static GDBusNodeInfo *vrrp_introspection_data = NULL;
 static GDBusNodeInfo *vrrp_instance_introspection_data = NULL;
@@ -105,6 +125,14 @@ dbus_queue_ent_t *ent_ptr;
 static int dbus_in_pipe[2], dbus_out_pipe[2];
 static sem_t thread_end;
 
+/* Instance property snapshots */
+static dbus_snapshot_t *dbus_snapshot;
+static dbus_snapshot_t *dbus_snapshot_hazard;
+static dbus_snapshot_t *dbus_retired_snapshots;
+static thread_t *dbus_signal_thread;
+
+static int dbus_send_state_signals(thread_t *);
+
 /* The only characters that are valid in a dbus path are A-Z, a-z, 0-9, _ */
 static char *
 set_valid_path(char *valid_path, const char *path)
@@ -297,6 +325,27 @@ get_interface_ids(const gchar *object_path, gchar *interface, uint8_t *vrid, uin
 	g_strfreev(dirs);
 }
 
+/* Get the current snapshot, and stop the vrrp thread freeing it until
+ * dbus_snapshot_release(). Only called in the DBus thread. */
+static dbus_snapshot_t *
+dbus_snapshot_acquire(void)
+{
+	dbus_snapshot_t *snap;
+
+	do {
+		snap = g_atomic_pointer_get(&dbus_snapshot);
+		g_atomic_pointer_set(&dbus_snapshot_hazard, snap);
+	} while (snap != g_atomic_pointer_get(&dbus_snapshot));
+
+	return snap;
+}
+
+static void
+dbus_snapshot_release(void)
+{
+	g_atomic_pointer_set(&dbus_snapshot_hazard, NULL);
+}
+
 /* handles reply to org.freedesktop.DBus.Properties.Get method on any object*/
 static GVariant *
 handle_get_property(__attribute__((unused)) GDBusConnection  *connection,
@@ -308,34 +357,41 @@ handle_get_property(__attribute__((unused)) GDBusConnection  *connection,
 		    __attribute__((unused)) gpointer          user_data)
 {
 	GVariant *ret = NULL;
-	dbus_queue_ent_t ent;
+	dbus_snapshot_t *snap;
+	dbus_instance_props_t *props = NULL;
 	char ifname_str[sizeof ((vrrp_t*)NULL)->ifp->ifname];
-	int action;
+	uint8_t vrid, family;
+	int state;
 
 	if (g_strcmp0(interface_name, DBUS_VRRP_INSTANCE_INTERFACE)) {
 		log_message(LOG_INFO, "Interface %s has not been implemented yet", interface_name);
 		return NULL;
 	}
 
-	if (!g_strcmp0(property_name, "Name"))
-		action = DBUS_GET_NAME;
-	else if (!g_strcmp0(property_name, "State"))
-		action = DBUS_GET_STATUS;
-	else {
+	if (g_strcmp0(property_name, "Name") && g_strcmp0(property_name, "State")) {
 		log_message(LOG_INFO, "Property %s does not exist", property_name);
 		return NULL;
 	}
 
-	get_interface_ids(object_path, ifname_str, &ent.vrid, &ent.family);
+	/* Read the published snapshot, rather than asking the vrrp thread */
+	snap = dbus_snapshot_acquire();
+	if (snap)
+		props = g_hash_table_lookup(snap->paths, object_path);
 
-	ent.action = action;
-	ent.ifname = ifname_str;
-	ent.args = NULL;
-	process_method_call(&ent);
-	if (ent.reply == DBUS_SUCCESS)
-		ret = ent.args;
-	else
-		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s/%d/%s' not found", ifname_str, ent.vrid, family_str(ent.family));
+	if (props) {
+		if (!g_strcmp0(property_name, "Name"))
+			ret = g_variant_new("(s)", props->iname);
+		else {
+			state = g_atomic_int_get(&props->state);
+			ret = g_variant_new("(us)", state, state_str(state));
+		}
+	}
+	dbus_snapshot_release();
+
+	if (!ret) {
+		get_interface_ids(object_path, ifname_str, &vrid, &family);
+		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s/%d/%s' not found", ifname_str, vrid, family_str(family));
+	}
 
 	return ret;
 }
@@ -517,6 +573,8 @@ on_bus_acquired(GDBusConnection *connection,
 	gchar *path;
 	element e;
 	GError *local_error = NULL;
+	dbus_snapshot_t *snap;
+	unsigned i;
 
 	log_message(LOG_INFO, "Acquired DBus bus %s\n", name);
 
@@ -548,10 +606,11 @@ on_bus_acquired(GDBusConnection *connection,
 	g_free(path);
 
 	/* Notify DBus of the state of our instances */
-	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
-		vrrp_t * vrrp = ELEMENT_DATA(e);
-		dbus_send_state_signal(vrrp);
-	}
+	snap = dbus_snapshot_acquire();
+	for (i = 0; snap && i < snap->num_instances; i++)
+		dbus_emit_signal(global_connection, snap->instance[i].object_path, DBUS_VRRP_INSTANCE_INTERFACE,
+				 "VrrpStatusChange", g_variant_new("(u)", g_atomic_int_get(&snap->instance[i].state)));
+	dbus_snapshot_release();
 }
 
 /* run if bus name is acquired successfully */
@@ -674,24 +733,145 @@ dbus_main(__attribute__ ((unused)) void *unused)
 
 /* The following functions are run in the context of the main vrrp thread */
 
-/* send signal VrrpStatusChange
- * containing the new state of vrrp */
+static void
+dbus_free_snapshot(dbus_snapshot_t *snap)
+{
+	unsigned i;
+
+	for (i = 0; i < snap->num_instances; i++) {
+		FREE(snap->instance[i].iname);
+		g_free(snap->instance[i].object_path);
+	}
+	g_hash_table_destroy(snap->paths);
+	FREE(snap);
+}
+
+/* Free the retired snapshots the DBus thread can no longer be reading */
+static void
+dbus_free_retired_snapshots(bool all)
+{
+	dbus_snapshot_t *snap, **prev;
+	dbus_snapshot_t *hazard = all ? NULL : g_atomic_pointer_get(&dbus_snapshot_hazard);
+
+	for (prev = &dbus_retired_snapshots; (snap = *prev); ) {
+		if (snap == hazard) {
+			prev = &snap->next;
+			continue;
+		}
+		*prev = snap->next;
+		dbus_free_snapshot(snap);
+	}
+}
+
+/* Publish the properties of the current instances for the DBus thread */
+void
+dbus_publish_snapshot(void)
+{
+	dbus_snapshot_t *snap, *old = dbus_snapshot;
+	dbus_instance_props_t *props, *old_props;
+	vrrp_t *vrrp;
+	element e;
+	unsigned i = 0;
+	bool signal_pending = false;
+
+	/* On a reload the thread was freed by thread_cleanup_master() */
+	dbus_signal_thread = NULL;
+
+	snap = MALLOC(sizeof(dbus_snapshot_t) + LIST_SIZE(vrrp_data->vrrp) * sizeof(dbus_instance_props_t));
+	snap->paths = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e), i++) {
+		vrrp = ELEMENT_DATA(e);
+		props = &snap->instance[i];
+
+		vrrp->dbus_index = i;
+		props->vrrp = vrrp;
+		props->iname = MALLOC(strlen(vrrp->iname) + 1);
+		strcpy(props->iname, vrrp->iname);
+		props->object_path = dbus_object_create_path_instance(IF_NAME(IF_BASE_IFP(vrrp->ifp)), vrrp->vrid, vrrp->family);
+		props->state = vrrp->state;
+		props->signalled_state = -1;
+
+		/* Carry over the signalling state of an instance that is still there */
+		if (old && (old_props = g_hash_table_lookup(old->paths, props->object_path))) {
+			props->signalled_state = old_props->signalled_state;
+			props->signal_pending = old_props->signal_pending;
+			signal_pending |= props->signal_pending;
+		}
+
+		g_hash_table_insert(snap->paths, props->object_path, props);
+	}
+	snap->num_instances = i;
+
+	g_atomic_pointer_set(&dbus_snapshot, snap);
+
+	if (old) {
+		old->next = dbus_retired_snapshots;
+		dbus_retired_snapshots = old;
+		dbus_free_retired_snapshots(false);
+	}
+
+	/* Send any signals that were queued before the reload */
+	if (signal_pending && global_connection)
+		dbus_signal_thread = thread_add_timer(master, dbus_send_state_signals, NULL, DBUS_SIGNAL_DELAY);
+}
+
+/* send signal VrrpStatusChange for each instance whose state
+ * has changed since the signals were last sent */
+static int
+dbus_send_state_signals(__attribute__((unused)) thread_t *thread)
+{
+	dbus_instance_props_t *props;
+	unsigned i;
+
+	dbus_signal_thread = NULL;
+
+	/* Also a chance to free snapshots from a reload */
+	dbus_free_retired_snapshots(false);
+
+	if (global_connection == NULL || !dbus_snapshot)
+		return 0;
+
+	for (i = 0; i < dbus_snapshot->num_instances; i++) {
+		props = &dbus_snapshot->instance[i];
+		if (!props->signal_pending)
+			continue;
+
+		props->signal_pending = false;
+		if (props->state == props->signalled_state)
+			continue;
+
+		props->signalled_state = props->state;
+		dbus_emit_signal(global_connection, props->object_path, DBUS_VRRP_INSTANCE_INTERFACE,
+				 "VrrpStatusChange", g_variant_new("(u)", props->state));
+	}
+
+	return 0;
+}
+
+/* Record the new state of vrrp. The VrrpStatusChange signals are sent
+ * after DBUS_SIGNAL_DELAY, so that a mass transition is signalled in
+ * one batch, with only the latest state of each instance. */
 void
 dbus_send_state_signal(vrrp_t *vrrp)
 {
-	gchar *object_path;
-	GVariant *args;
+	dbus_instance_props_t *props;
+
+	if (!dbus_snapshot ||
+	    vrrp->dbus_index >= dbus_snapshot->num_instances ||
+	    (props = &dbus_snapshot->instance[vrrp->dbus_index])->vrrp != vrrp)
+		return;
+
+	g_atomic_int_set(&props->state, vrrp->state);
 
 	/* the interface will go through the initial state changes before
 	 * the main loop can be started and global_connection initialised */
 	if (global_connection == NULL)
 		return;
 
-	object_path = dbus_object_create_path_instance(IF_NAME(IF_BASE_IFP(vrrp->ifp)), vrrp->vrid, vrrp->family);
-
-	args = g_variant_new("(u)", vrrp->state);
-	dbus_emit_signal(global_connection, object_path, DBUS_VRRP_INSTANCE_INTERFACE, "VrrpStatusChange", args);
-	g_free(object_path);
+	props->signal_pending = true;
+	if (!dbus_signal_thread)
+		dbus_signal_thread = thread_add_timer(master, dbus_send_state_signals, NULL, DBUS_SIGNAL_DELAY);
 }
 
 /* send signal VrrpRestarted */
@@ -777,24 +957,6 @@ handle_dbus_msg(__attribute__((unused)) thread_t *thread)
 				ent->reply = DBUS_SUCCESS;
 			}
 		}
-		else if (ent->action == DBUS_GET_NAME ||
-			 ent->action == DBUS_GET_STATUS) {
-			/* we look for the vrrp instance object that corresponds to our interface and group */
-			ent->reply = DBUS_INTERFACE_NOT_FOUND;
-
-			vrrp = get_vrrp_instance(ent->ifname, ent->vrid, ent->family);
-
-			if (vrrp) {
-				/* the property_name argument is the property we want to Get */
-				if (ent->action == DBUS_GET_NAME)
-					ent->args = g_variant_new("(s)", vrrp->iname);
-				else if (ent->action == DBUS_GET_STATUS)
-					ent->args = g_variant_new("(us)", vrrp->state, state_str(vrrp->state));
-				else
-					ent->args = NULL;	 /* How did we get here? */
-				ent->reply = DBUS_SUCCESS;
-			}
-		}
 		if (write(dbus_out_pipe[1], ent, 1) != 1)
 			log_message(LOG_INFO, "Write from main thread to DBus thread failed");
 	}
@@ -951,5 +1113,13 @@ dbus_stop(void)
 	else {
 		log_message(LOG_INFO, "Released DBus");
 		sem_destroy(&thread_end);
+
+		/* The DBus thread has gone, so no snapshot is in use */
+		if (dbus_snapshot) {
+			dbus_snapshot->next = dbus_retired_snapshots;
+			dbus_retired_snapshots = dbus_snapshot;
+			dbus_snapshot = NULL;
+		}
+		dbus_free_retired_snapshots(true);
 	}
 }
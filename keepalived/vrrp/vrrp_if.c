@@ -340,7 +340,7 @@ alloc_garp_delay(void)
 void
 set_default_garp_delay(void)
 {
-	garp_delay_t default_delay;
+	garp_delay_t default_delay = { .have_garp_interval = false };
 	element e;
 	interface_t *ifp;
 	garp_delay_t *delay;
@@ -373,6 +373,50 @@ set_default_garp_delay(void)
 	}
 }
 
+/* Queue an address to send a gratuitous ARP/NA message once the interval allows */
+void
+garp_queue_add(vrrp_t *vrrp, ip_address_t *ipaddress)
+{
+	garp_delay_t *delay = IF_BASE_IFP(ipaddress->ifp)->garp_delay;
+	garp_queue_t *queue = IP_IS6(ipaddress) ? &delay->gna_queue : &delay->garp_queue;
+
+	/* Only one message is sent however often it is requested */
+	if (ipaddress->garp_gna_pending)
+		return;
+
+	ipaddress->garp_gna_pending = true;
+	ipaddress->garp_vrrp = vrrp;
+	ipaddress->garp_queue = queue;
+	ipaddress->garp_next = NULL;
+	ipaddress->garp_prev = queue->tail;
+	if (queue->tail)
+		queue->tail->garp_next = ipaddress;
+	else
+		queue->head = ipaddress;
+	queue->tail = ipaddress;
+}
+
+void
+garp_queue_remove(ip_address_t *ipaddress)
+{
+	garp_queue_t *queue = ipaddress->garp_queue;
+
+	if (!ipaddress->garp_gna_pending)
+		return;
+
+	if (ipaddress->garp_prev)
+		ipaddress->garp_prev->garp_next = ipaddress->garp_next;
+	else
+		queue->head = ipaddress->garp_next;
+	if (ipaddress->garp_next)
+		ipaddress->garp_next->garp_prev = ipaddress->garp_prev;
+	else
+		queue->tail = ipaddress->garp_prev;
+
+	ipaddress->garp_gna_pending = false;
+	ipaddress->garp_next = ipaddress->garp_prev = NULL;
+}
+
 static void
 dump_if(void *data)
 {
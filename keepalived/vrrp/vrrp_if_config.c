@@ -74,6 +74,7 @@
 #include <unistd.h>
 
 #include "logger.h"
+#include "scheduler.h"
 
 #ifdef _HAVE_VRRP_VMAC_
 static int all_rp_filter = -1;
@@ -358,6 +359,9 @@ set_sysctl(const char* prefix, const char* iface, const char* parameter, int val
 	int fd;
 	ssize_t len;
 
+	if (thread_simulating())
+		return 0;
+
 	/* Make the filename */
 	filename = MALLOC(PATH_MAX);
 	make_sysctl_filename(filename, prefix, iface, parameter);
@@ -387,6 +391,9 @@ get_sysctl(const char* prefix, const char* iface, const char* parameter)
 	int fd;
 	ssize_t len;
 
+	if (thread_simulating())
+		return 0;
+
 	/* Make the filename */
 	filename = MALLOC(PATH_MAX);
 	make_sysctl_filename(filename, prefix, iface, parameter);
@@ -622,6 +629,10 @@ restore_rp_filter(void)
 void
 set_interface_parameters(const interface_t *ifp, interface_t *base_ifp)
 {
+	/* When simulating, the kernel is left as it is */
+	if (thread_simulating())
+		return;
+
 	if (all_rp_filter == -1)
 		clear_rp_filter();
 
@@ -642,6 +653,9 @@ set_interface_parameters(const interface_t *ifp, interface_t *base_ifp)
 
 void reset_interface_parameters(interface_t *base_ifp)
 {
+	if (thread_simulating())
+		return;
+
 #ifdef _HAVE_IPV4_DEVCONF_
 #ifdef _LIBNL_DYNAMIC_
 	if (use_nl)
@@ -28,6 +28,7 @@
 #include "vrrp.h"
 #include "memory.h"
 #include "list.h"
+#include "utils.h"
 
 /* VRID hash table */
 int
@@ -133,3 +134,116 @@ void set_vrrp_fd_bucket(int old_fd, vrrp_t *vrrp)
 		}
 	}
 }
+
+/* Unicast source index.
+ *
+ * Unicast instances on the same interface can share a VRID when they have
+ * different peers, so adverts received on a unicast socket are matched on
+ * the source address as well as the VRID. Every peer of every unicast
+ * instance has a slot in an open addressed table hashed on (vrid, peer).
+ * The fd isn't part of the key, it is checked on lookup, so the table
+ * stays valid when set_vrrp_fd_bucket() moves instances to a new socket.
+ */
+static uint32_t
+vrrp_unicast_hash(int vrid, struct sockaddr_storage *addr)
+{
+	uint32_t hash = 0x811c9dc5;
+	const unsigned char *p;
+	size_t len, i;
+
+	if (addr->ss_family == AF_INET6) {
+		p = (const unsigned char *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+		len = sizeof(struct in6_addr);
+	} else {
+		p = (const unsigned char *)&((struct sockaddr_in *)addr)->sin_addr;
+		len = sizeof(struct in_addr);
+	}
+
+	hash = (hash ^ (uint32_t)vrid) * 0x01000193;
+	for (i = 0; i < len; i++)
+		hash = (hash ^ p[i]) * 0x01000193;
+
+	return hash;
+}
+
+void
+alloc_vrrp_unicast_index(void)
+{
+	vrrp_t *vrrp;
+	element e, e1;
+	struct sockaddr_storage *addr;
+	unsigned peers = 0;
+	unsigned size, i;
+
+	FREE_PTR(vrrp_data->vrrp_unicast_index);
+	vrrp_data->vrrp_unicast_index_mask = 0;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+		if (!LIST_ISEMPTY(vrrp->unicast_peer))
+			peers += LIST_SIZE(vrrp->unicast_peer);
+	}
+
+	if (!peers)
+		return;
+
+	/* Keep the table at most half full */
+	for (size = 16; size < peers * 2; size <<= 1);
+	vrrp_data->vrrp_unicast_index = MALLOC(size * sizeof(vrrp_unicast_slot_t));
+	vrrp_data->vrrp_unicast_index_mask = size - 1;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+		if (LIST_ISEMPTY(vrrp->unicast_peer))
+			continue;
+		for (e1 = LIST_HEAD(vrrp->unicast_peer); e1; ELEMENT_NEXT(e1)) {
+			addr = ELEMENT_DATA(e1);
+			for (i = vrrp_unicast_hash(vrrp->vrid, addr) & vrrp_data->vrrp_unicast_index_mask;
+			     vrrp_data->vrrp_unicast_index[i].addr;
+			     i = (i + 1) & vrrp_data->vrrp_unicast_index_mask);
+			vrrp_data->vrrp_unicast_index[i].addr = addr;
+			vrrp_data->vrrp_unicast_index[i].vrrp = vrrp;
+		}
+	}
+}
+
+/* Find the unicast instance on fd with the vrid and the peer addr */
+vrrp_t *
+vrrp_unicast_index_lookup(const int vrid, struct sockaddr_storage *addr, const int fd)
+{
+	vrrp_unicast_slot_t *slot;
+	unsigned i;
+
+	if (!vrrp_data->vrrp_unicast_index)
+		return NULL;
+
+	for (i = vrrp_unicast_hash(vrid, addr) & vrrp_data->vrrp_unicast_index_mask;
+	     (slot = &vrrp_data->vrrp_unicast_index[i])->addr;
+	     i = (i + 1) & vrrp_data->vrrp_unicast_index_mask) {
+		if (slot->vrrp->vrid == vrid && slot->vrrp->fd_in == fd &&
+		    !inet_sockaddrcmp(slot->addr, addr))
+			return slot->vrrp;
+	}
+
+	return NULL;
+}
+
+/* Is addr one of the instance's unicast peers ? */
+bool
+vrrp_is_unicast_peer(vrrp_t *vrrp, struct sockaddr_storage *addr)
+{
+	vrrp_unicast_slot_t *slot;
+	unsigned i;
+
+	if (!vrrp_data->vrrp_unicast_index)
+		return false;
+
+	for (i = vrrp_unicast_hash(vrrp->vrid, addr) & vrrp_data->vrrp_unicast_index_mask;
+	     (slot = &vrrp_data->vrrp_unicast_index[i])->addr;
+	     i = (i + 1) & vrrp_data->vrrp_unicast_index_mask) {
+		if (slot->vrrp == vrrp && !inet_sockaddrcmp(slot->addr, addr))
+			return true;
+	}
+
+	return false;
+}
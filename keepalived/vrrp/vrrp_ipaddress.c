@@ -22,6 +22,11 @@
 
 #include "config.h"
 
+/* system include */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
 /* local include */
 #include "vrrp_ipaddress.h"
 #ifdef _HAVE_LIBIPTC_
@@ -36,6 +41,8 @@
 #include "bitops.h"
 #include "global_data.h"
 #include "rttables.h"
+#include "main.h"
+#include "scheduler.h"
 #if !defined _HAVE_LIBIPTC_ || defined _LIBIPTC_DYNAMIC_
 #include "utils.h"
 #endif
@@ -45,6 +52,11 @@
 
 #define INFINITY_LIFE_TIME      0xFFFFFFFF
 
+/* Serialises iptables and ipset updates between VRRP workers */
+#define IPTABLES_LOCK_FILE	PID_DIR PACKAGE "_iptables.lock"
+
+static int iptables_lock_fd = -1;
+
 #if !defined _HAVE_LIBIPTC_ || defined _LIBIPTC_DYNAMIC_
 static bool iptables_cmd_available;
 static bool ip6tables_cmd_available;
@@ -67,6 +79,29 @@ ipaddresstos(char *buf, ip_address_t *ipaddress)
 	return buf;
 }
 
+/* Fold an address and its prefix into a hash, for indexing routes and rules.
+ * Addresses that are IP_ISEQ() hash to the same value. */
+uint32_t
+hash_ipaddress(uint32_t hash, ip_address_t *ipaddress)
+{
+	const uint32_t *p;
+	size_t i;
+
+	if (!ipaddress)
+		return hash;
+
+	hash = (hash ^ ((uint32_t)ipaddress->ifa.ifa_family << 8 | ipaddress->ifa.ifa_prefixlen)) * 0x01000193;
+	if (IP_IS6(ipaddress)) {
+		p = ipaddress->u.sin6_addr.s6_addr32;
+		for (i = 0; i < 4; i++)
+			hash = (hash ^ p[i]) * 0x01000193;
+	}
+	else
+		hash = (hash ^ ipaddress->u.sin.sin_addr.s_addr) * 0x01000193;
+
+	return hash;
+}
+
 /* Add/Delete IP address to a specific interface_t */
 int
 netlink_ipaddress(ip_address_t *ipaddress, int cmd)
@@ -774,6 +809,10 @@ check_chains_exist(void)
 void
 iptables_init(void)
 {
+	/* When simulating, no iptables rules or ipsets are set up */
+	if (thread_simulating())
+		block_ipv4 = block_ipv6 = false;
+
 	if (!block_ipv4 && !block_ipv6) {
 #ifdef _HAVE_LIBIPSET_
 		global_data->using_ipsets = false;
@@ -826,3 +865,40 @@ iptables_init(void)
 		global_data->using_ipsets = false;
 #endif
 }
+
+/* With more than one VRRP worker, each takes the lock while updating
+ * iptables, so that one worker's commit doesn't fail because another
+ * worker's has changed the table in the meantime. The parent takes it
+ * before starting the first worker, which inherits it and releases it
+ * when it has set up the structures the other workers use. */
+void
+iptables_lock(void)
+{
+	if (vrrp_workers <= 1)
+		return;
+
+	if (iptables_lock_fd == -1 &&
+	    (iptables_lock_fd = open(IPTABLES_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)) == -1) {
+		log_message(LOG_INFO, "Unable to open %s - %m", IPTABLES_LOCK_FILE);
+		return;
+	}
+
+	while (flock(iptables_lock_fd, LOCK_EX) == -1 && errno == EINTR);
+}
+
+void
+iptables_unlock(void)
+{
+	if (iptables_lock_fd != -1)
+		flock(iptables_lock_fd, LOCK_UN);
+}
+
+/* The parent passes its lock to the first worker */
+void
+iptables_lock_close(void)
+{
+	if (iptables_lock_fd != -1) {
+		close(iptables_lock_fd);
+		iptables_lock_fd = -1;
+	}
+}
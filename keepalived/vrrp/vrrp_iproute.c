@@ -52,6 +52,14 @@
 #define	RTA_SIZE		1024
 #define	ENCAP_RTA_SIZE		 128
 #define NEXTHOP_RTA_SIZE	1024
+#define	NHM_SIZE		1024
+
+/* Route netlink request */
+typedef struct {
+	struct nlmsghdr n;
+	struct rtmsg r;
+	char buf[RTM_SIZE];
+} route_req_t;
 
 /* Utility functions */
 unsigned short
@@ -291,85 +299,94 @@ add_nexthops(ip_route_t *route, struct nlmsghdr *nlh, struct rtmsg *rtm)
 		addattr_l(nlh, sizeof(buf), RTA_MULTIPATH, RTA_DATA(rta), RTA_PAYLOAD(rta));
 }
 
-/* Add/Delete IP route to/from a specific interface */
-static int
-netlink_route(ip_route_t *iproute, int cmd)
+/* Result of a route request */
+static void
+netlink_route_done(void *data, struct nlmsghdr *n, int error)
+{
+	ip_route_t *iproute = data;
+
+#if HAVE_DECL_RTA_EXPIRES
+	/* If an expiry was set on the route, it may have disappeared already */
+	if (error && n->nlmsg_type == RTM_DELROUTE && (iproute->mask & IPROUTE_BIT_EXPIRES))
+		error = 0;
+#endif
+
+	iproute->set = !error && n->nlmsg_type == RTM_NEWROUTE;
+}
+
+/* Build the request to add/delete an IP route to/from a specific interface */
+static void
+netlink_route_msg(route_req_t *req, ip_route_t *iproute, int cmd)
 {
-	int status = 1;
-	struct {
-		struct nlmsghdr n;
-		struct rtmsg r;
-		char buf[RTM_SIZE];
-	} req;
 	char buf[RTA_SIZE];
 	struct rtattr *rta = (void*)buf;
 
-	memset(&req, 0, sizeof (req));
+	memset(req, 0, sizeof (*req));
 
-	req.n.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
 	if (cmd == IPROUTE_DEL) {
-		req.n.nlmsg_flags = NLM_F_REQUEST;
-		req.n.nlmsg_type  = RTM_DELROUTE;
+		req->n.nlmsg_flags = NLM_F_REQUEST;
+		req->n.nlmsg_type  = RTM_DELROUTE;
 	}
 	else {
-		req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE;
+		req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE;
 		if (cmd == IPROUTE_REPLACE)
-			req.n.nlmsg_flags |= NLM_F_REPLACE;
-		req.n.nlmsg_type  = RTM_NEWROUTE;
+			req->n.nlmsg_flags |= NLM_F_REPLACE;
+		req->n.nlmsg_type  = RTM_NEWROUTE;
 	}
 
 	rta->rta_type = RTA_METRICS;
 	rta->rta_len = RTA_LENGTH(0);
 
-	req.r.rtm_family = iproute->family;
+	req->r.rtm_family = iproute->family;
 	if (iproute->table < 256)
-		req.r.rtm_table = (unsigned char)iproute->table;
+		req->r.rtm_table = (unsigned char)iproute->table;
 	else {
-		req.r.rtm_table = RT_TABLE_UNSPEC;
-		addattr32(&req.n, sizeof(req), RTA_TABLE, iproute->table);
+		req->r.rtm_table = RT_TABLE_UNSPEC;
+		addattr32(&req->n, sizeof(*req), RTA_TABLE, iproute->table);
 	}
 
 	if (cmd == IPROUTE_DEL) {
-		req.r.rtm_scope = RT_SCOPE_NOWHERE;
+		req->r.rtm_scope = RT_SCOPE_NOWHERE;
 		if (iproute->mask & IPROUTE_BIT_TYPE)
-			req.r.rtm_type = iproute->type;
+			req->r.rtm_type = iproute->type;
 	}
 	else {
-		req.r.rtm_protocol = RTPROT_BOOT;
-		req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-		req.r.rtm_type = iproute->type;
+		req->r.rtm_protocol = RTPROT_BOOT;
+		req->r.rtm_scope = RT_SCOPE_UNIVERSE;
+		req->r.rtm_type = iproute->type;
 	}
 
 	if (iproute->mask & IPROUTE_BIT_PROTOCOL)
-		req.r.rtm_protocol = iproute->protocol;
+		req->r.rtm_protocol = iproute->protocol;
 
 	if (iproute->mask & IPROUTE_BIT_SCOPE)
-		req.r.rtm_scope = iproute->scope;
+		req->r.rtm_scope = iproute->scope;
 
 	if (iproute->dst) {
-		req.r.rtm_dst_len = iproute->dst->ifa.ifa_prefixlen;
-		add_addr2req(&req.n, sizeof(req), RTA_DST, iproute->dst);
+		req->r.rtm_dst_len = iproute->dst->ifa.ifa_prefixlen;
+		add_addr2req(&req->n, sizeof(*req), RTA_DST, iproute->dst);
 	}
 
 	if (iproute->src) {
-		req.r.rtm_src_len = iproute->src->ifa.ifa_prefixlen;
-		add_addr2req(&req.n, sizeof(req), RTA_SRC, iproute->src);
+		req->r.rtm_src_len = iproute->src->ifa.ifa_prefixlen;
+		add_addr2req(&req->n, sizeof(*req), RTA_SRC, iproute->src);
 	}
 
 	if (iproute->pref_src)
-		add_addr2req(&req.n, sizeof(req), RTA_PREFSRC, iproute->pref_src);
+		add_addr2req(&req->n, sizeof(*req), RTA_PREFSRC, iproute->pref_src);
 
 //#if HAVE_DECL_RTA_NEWDST
 //	if (iproute->as_to)
-//		add_addr2req(&req.n, sizeof(req), RTA_NEWDST, iproute->as_to);
+//		add_addr2req(&req->n, sizeof(*req), RTA_NEWDST, iproute->as_to);
 //#endif
 
 	if (iproute->via) {
 		if (iproute->via->ifa.ifa_family == iproute->family)
-			add_addr2req(&req.n, sizeof(req), RTA_GATEWAY, iproute->via);
+			add_addr2req(&req->n, sizeof(*req), RTA_GATEWAY, iproute->via);
 #if HAVE_DECL_RTA_VIA
 		else
-			add_addr_fam2req(&req.n, sizeof(req), RTA_VIA, iproute->via);
+			add_addr_fam2req(&req->n, sizeof(*req), RTA_VIA, iproute->via);
 #endif
 	}
 
@@ -383,27 +400,27 @@ netlink_route(ip_route_t *iproute, int cmd)
 		add_encap(encap_rta, sizeof(encap_buf), &iproute->encap);
 
 		if (encap_rta->rta_len > RTA_LENGTH(0))
-			addraw_l(&req.n, sizeof(encap_buf), RTA_DATA(encap_rta), RTA_PAYLOAD(encap_rta));
+			addraw_l(&req->n, sizeof(encap_buf), RTA_DATA(encap_rta), RTA_PAYLOAD(encap_rta));
 	}
 #endif
 
 	if (iproute->mask & IPROUTE_BIT_DSFIELD)
-		req.r.rtm_tos = iproute->tos;
+		req->r.rtm_tos = iproute->tos;
 	
 	if (iproute->oif)
-		addattr32(&req.n, sizeof(req), RTA_OIF, iproute->oif->ifindex);
+		addattr32(&req->n, sizeof(*req), RTA_OIF, iproute->oif->ifindex);
 
 	if (iproute->mask & IPROUTE_BIT_METRIC)
-		addattr32(&req.n, sizeof(req), RTA_PRIORITY, iproute->metric);
+		addattr32(&req->n, sizeof(*req), RTA_PRIORITY, iproute->metric);
 
-	req.r.rtm_flags = iproute->flags;
+	req->r.rtm_flags = iproute->flags;
 
 	if (iproute->realms)
-		addattr32(&req.n, sizeof(req), RTA_FLOW, iproute->realms);
+		addattr32(&req->n, sizeof(*req), RTA_FLOW, iproute->realms);
 
 #if HAVE_DECL_RTA_EXPIRES
 	if (iproute->mask & IPROUTE_BIT_EXPIRES)
-		addattr32(&req.n, sizeof(req), RTA_EXPIRES, iproute->expires);
+		addattr32(&req->n, sizeof(*req), RTA_EXPIRES, iproute->expires);
 #endif
 
 #if HAVE_DECL_RTAX_CC_ALGO
@@ -457,17 +474,22 @@ netlink_route(ip_route_t *iproute, int cmd)
 
 #if HAVE_DECL_RTA_PREF
 	if (iproute->mask & IPROUTE_BIT_PREF)
-		addattr8(&req.n, sizeof(req), RTA_PREF, iproute->pref);
+		addattr8(&req->n, sizeof(*req), RTA_PREF, iproute->pref);
 #endif
 
 	if (rta->rta_len > RTA_LENGTH(0)) {
 		if (iproute->lock)
 			rta_addattr32(rta, sizeof(buf), RTAX_LOCK, iproute->lock);
-		addattr_l(&req.n, sizeof(req), RTA_METRICS, RTA_DATA(rta), RTA_PAYLOAD(rta));
+		addattr_l(&req->n, sizeof(*req), RTA_METRICS, RTA_DATA(rta), RTA_PAYLOAD(rta));
 	}
 
 	if (!LIST_ISEMPTY(iproute->nhs))
-		add_nexthops(iproute, &req.n, &req.r);
+		add_nexthops(iproute, &req->n, &req->r);
+
+#if HAVE_DECL_RTA_NH_ID
+	if (iproute->nhid)
+		addattr32(&req->n, sizeof(*req), RTA_NH_ID, iproute->nhid);
+#endif
 
 #ifdef DEBUG_NETLINK_MSG
 	size_t i, j;
@@ -475,33 +497,54 @@ netlink_route(ip_route_t *iproute, int cmd)
 	char lbuf[3072];
 	char *op = lbuf;
 
-	log_message(LOG_INFO, "rtmsg buffer used %lu, rtattr buffer used %d", req.n.nlmsg_len - NLMSG_LENGTH(sizeof(struct rtmsg)), rta->rta_len);
+	log_message(LOG_INFO, "rtmsg buffer used %lu, rtattr buffer used %d", req->n.nlmsg_len - NLMSG_LENGTH(sizeof(struct rtmsg)), rta->rta_len);
 
-	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "nlmsghdr %p(%u):", &req.n, req.n.nlmsg_len);
-	for (i = 0, p = (uint8_t*)&req.n; i < sizeof(struct nlmsghdr); i++)
+	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "nlmsghdr %p(%u):", &req->n, req->n.nlmsg_len);
+	for (i = 0, p = (uint8_t*)&req->n; i < sizeof(struct nlmsghdr); i++)
 		op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), " %2.2hhx", *(p++));
 	log_message(LOG_INFO, "%s\n", lbuf);
 
 	op = lbuf;
-	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "rtmsg %p(%lu):", &req.r, req.n.nlmsg_len - sizeof(struct nlmsghdr));
-	for (i = 0, p = (uint8_t*)&req.r; i < + req.n.nlmsg_len - sizeof(struct nlmsghdr); i++)
+	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "rtmsg %p(%lu):", &req->r, req->n.nlmsg_len - sizeof(struct nlmsghdr));
+	for (i = 0, p = (uint8_t*)&req->r; i < + req->n.nlmsg_len - sizeof(struct nlmsghdr); i++)
 		op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), " %2.2hhx", *(p++));
 
 	for (j = 0; lbuf + j < op; j+= MAX_LOG_MSG)
 		log_message(LOG_INFO, "%.*\n", MAX_LOG_MSG, lbuf+j);
 #endif
 
+}
+
+/* Queue adding/deleting an IP route to/from a specific interface */
+static void
+netlink_route(nl_batch_t *batch, ip_route_t *iproute, int cmd)
+{
+	route_req_t req;
+
+	netlink_route_msg(&req, iproute, cmd);
+
 	/* This returns ESRCH if the address of via address doesn't exist */
 	/* ENETDOWN if dev p33p1.40 for example is down */
-	if (netlink_talk(&nl_cmd, &req.n) < 0) {
-#if HAVE_DECL_RTA_EXPIRES
-		/* If an expiry was set on the route, it may have disappeared already */
-		if (cmd != IPADDRESS_DEL || !(iproute->mask & IPROUTE_BIT_EXPIRES))
-#endif
-			status = -1;
-	}
+	netlink_batch_add(batch, &req.n, iproute);
+}
 
-	return status;
+/* Routes added between netlink_rtlist_share_begin() and _end() are
+ * queued in one batch, so that the members of a sync group share it */
+static nl_batch_t shared_batch;
+static bool sharing_batch;
+
+void
+netlink_rtlist_share_begin(void)
+{
+	netlink_batch_init(&shared_batch, &nl_cmd, netlink_route_done);
+	sharing_batch = true;
+}
+
+void
+netlink_rtlist_share_end(void)
+{
+	sharing_batch = false;
+	netlink_batch_flush(&shared_batch);
 }
 
 /* Add/Delete a list of IP routes */
@@ -510,20 +553,25 @@ netlink_rtlist(list rt_list, int cmd)
 {
 	ip_route_t *iproute;
 	element e;
+	nl_batch_t batch, *bp = &batch;
 
 	/* No routes to add */
 	if (LIST_ISEMPTY(rt_list))
 		return;
 
+	if (sharing_batch && cmd == IPROUTE_ADD)
+		bp = &shared_batch;
+	else
+		netlink_batch_init(&batch, &nl_cmd, netlink_route_done);
+
 	for (e = LIST_HEAD(rt_list); e; ELEMENT_NEXT(e)) {
 		iproute = ELEMENT_DATA(e);
-		if ((cmd == IPROUTE_DEL) == iproute->set) {
-			if (netlink_route(iproute, cmd) > 0)
-				iproute->set = (cmd == IPROUTE_ADD);
-			else
-				iproute->set = false;
-		}
+		if ((cmd == IPROUTE_DEL) == iproute->set)
+			netlink_route(bp, iproute, cmd);
 	}
+
+	if (bp == &batch)
+		netlink_batch_flush(&batch);
 }
 
 /* Route dump/allocation */
@@ -718,6 +766,11 @@ format_iproute(ip_route_t *route, char *buf, size_t buf_len)
 	if (route->oif)
 		op += (size_t)snprintf(op, (size_t)(buf_end - op), " dev %s", route->oif->ifname);
 
+#if HAVE_DECL_RTA_NH_ID
+	if (route->nhid)
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " nhid %u", route->nhid);
+#endif
+
 	if (route->table != RT_TABLE_MAIN)
 		op += (size_t)snprintf(op, (size_t)(buf_end - op), " table %u", route->table);
 
@@ -1410,6 +1463,19 @@ alloc_route(list rt_list, vector_t *strvec)
 			}
 			new->oif = ifp;
 		}
+		else if (!strcmp(str, "nhid")) {
+#if HAVE_DECL_RTA_NH_ID
+			if (get_u32(&new->nhid, strvec_slot(strvec, ++i), UINT32_MAX, "Invalid nhid %s specified for route"))
+				goto err;
+			if (!new->nhid) {
+				log_message(LOG_INFO, "Invalid nhid 0 specified for route");
+				goto err;
+			}
+#else
+			log_message(LOG_INFO, "nhid not supported by kernel");
+			goto err;
+#endif
+		}
 		else if (!strcmp(str, "onlink")) {
 			/* Note: IPv4 only */
 			new->flags |= RTNH_F_ONLINK;
@@ -1678,6 +1744,19 @@ alloc_route(list rt_list, vector_t *strvec)
 		goto err;
 	}
 
+#if HAVE_DECL_RTA_NH_ID
+	/* A route using a nexthop object can't have its own nexthop specification */
+	if (new->nhid &&
+	    (new->via || new->oif || !LIST_ISEMPTY(new->nhs)
+#if HAVE_DECL_RTA_ENCAP
+	     || new->encap.type != LWTUNNEL_ENCAP_NONE
+#endif
+	    )) {
+		log_message(LOG_INFO, "Route with nhid cannot also specify via, dev, encap or nexthop");
+		goto err;
+	}
+#endif
+
 	list_add(rt_list, new);
 
 	return;
@@ -1686,35 +1765,79 @@ err:
 	free_iproute(new);
 }
 
-/* Try to find a route in a list */
-static int
-route_exist(list l, ip_route_t *iproute)
+/* The kernel's key to a route is (to, tos, preference, table) */
+static bool
+route_is_same_key(const ip_route_t *x, const ip_route_t *y)
+{
+	return IP_ISEQ(x->dst, y->dst) &&
+	       (!x->dst || x->dst->ifa.ifa_prefixlen == y->dst->ifa.ifa_prefixlen) &&
+	       !((x->mask ^ y->mask) & IPROUTE_BIT_METRIC) &&
+	       (!(x->mask & IPROUTE_BIT_METRIC) || x->metric == y->metric) &&
+	       x->table == y->table;
+}
+
+static uint32_t
+route_key_hash(ip_route_t *iproute)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	hash = (hash ^ iproute->table) * 0x01000193;
+	if (iproute->mask & IPROUTE_BIT_METRIC)
+		hash = (hash ^ iproute->metric) * 0x01000193;
+
+	return hash_ipaddress(hash, iproute->dst);
+}
+
+/* Open addressed index of a route list by key, so that diffing two
+ * lists on reload is linear rather than quadratic */
+typedef struct _route_index {
+	ip_route_t		**slot;
+	uint32_t		mask;
+} route_index_t;
+
+static void
+route_index_build(route_index_t *index, list l)
 {
-	ip_route_t *ipr;
+	ip_route_t *iproute;
 	element e;
+	uint32_t size = 8;
+	uint32_t i;
+
+	while (size < 2 * LIST_SIZE(l))
+		size <<= 1;
+	index->slot = MALLOC(size * sizeof(*index->slot));
+	index->mask = size - 1;
 
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		ipr = ELEMENT_DATA(e);
-
-		/* The kernel's key to a route is (to, tos, preference, table) */
-		if (IP_ISEQ(ipr->dst, iproute->dst) &&
-		    ipr->dst->ifa.ifa_prefixlen == iproute->dst->ifa.ifa_prefixlen &&
-		    (!((ipr->mask ^ iproute->mask) & IPROUTE_BIT_METRIC)) &&
-		    (!(ipr->mask & IPROUTE_BIT_METRIC) ||
-		     ipr->metric == iproute->metric) &&
-		    ipr->table == iproute->table) {
-			ipr->set = iproute->set;
-			return 1;
-		}
+		iproute = ELEMENT_DATA(e);
+		for (i = route_key_hash(iproute) & index->mask; index->slot[i]; i = (i + 1) & index->mask)
+			;
+		index->slot[i] = iproute;
 	}
-	return 0;
+}
+
+/* Try to find a route in an index */
+static ip_route_t *
+route_index_find(route_index_t *index, ip_route_t *iproute)
+{
+	uint32_t i;
+
+	for (i = route_key_hash(iproute) & index->mask; index->slot[i]; i = (i + 1) & index->mask) {
+		if (route_is_same_key(index->slot[i], iproute))
+			return index->slot[i];
+	}
+
+	return NULL;
 }
 
 /* Clear diff routes */
 void
 clear_diff_routes(list l, list n)
 {
-	ip_route_t *iproute;
+	ip_route_t *iproute, *new_route;
+	route_index_t index;
+	route_req_t old_req, new_req;
+	nl_batch_t batch;
 	element e;
 
 	/* No route in previous conf */
@@ -1728,22 +1851,34 @@ clear_diff_routes(list l, list n)
 		return;
 	}
 
+	route_index_build(&index, n);
+	netlink_batch_init(&batch, &nl_cmd, netlink_route_done);
+
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		iproute = ELEMENT_DATA(e);
-		if (iproute->set) {
-			if (!route_exist(n, iproute)) {
-				log_message(LOG_INFO, "ip route %s/%d ... , no longer exist"
-						    , ipaddresstos(NULL, iproute->dst), iproute->dst->ifa.ifa_prefixlen);
-				netlink_route(iproute, IPROUTE_DEL);
-			}
-			else {
-				/* There are too many route options to compare to see if the
-				 * routes are the same or not, so just replace the existing route
-				 * with the new one. */
-				netlink_route(iproute, IPROUTE_REPLACE);
-			}
+		if (!iproute->set)
+			continue;
+
+		if (!(new_route = route_index_find(&index, iproute))) {
+			log_message(LOG_INFO, "ip route %s/%d ... , no longer exist"
+					    , ipaddresstos(NULL, iproute->dst), iproute->dst->ifa.ifa_prefixlen);
+			netlink_route(&batch, iproute, IPROUTE_DEL);
+		}
+		else {
+			/* There are too many route options to compare field by field,
+			 * so compare the requests. If they differ, the existing route,
+			 * including all its nexthops, is replaced with the new one. */
+			new_route->set = true;
+			netlink_route_msg(&old_req, iproute, IPROUTE_REPLACE);
+			netlink_route_msg(&new_req, new_route, IPROUTE_REPLACE);
+			if (old_req.n.nlmsg_len != new_req.n.nlmsg_len ||
+			    memcmp(&old_req, &new_req, old_req.n.nlmsg_len))
+				netlink_route(&batch, new_route, IPROUTE_REPLACE);
 		}
 	}
+
+	netlink_batch_flush(&batch);
+	FREE(index.slot);
 }
 
 /* Diff conf handler */
@@ -1752,3 +1887,330 @@ clear_diff_sroutes(void)
 {
 	clear_diff_routes(old_vrrp_data->static_routes, vrrp_data->static_routes);
 }
+
+#if HAVE_DECL_RTA_NH_ID
+/* Nexthop objects. Routes refer to them with nhid, so changing a nexthop
+ * that many routes share is a single request. */
+typedef struct {
+	struct nlmsghdr n;
+	struct nhmsg nhm;
+	char buf[NHM_SIZE];
+} nexthop_req_t;
+
+static void
+netlink_nexthop_msg(nexthop_req_t *req, ip_nexthop_t *nh, int cmd)
+{
+	memset(req, 0, sizeof(*req));
+
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+	if (cmd == IPROUTE_DEL) {
+		req->n.nlmsg_flags = NLM_F_REQUEST;
+		req->n.nlmsg_type = RTM_DELNEXTHOP;
+	}
+	else {
+		/* Replacing makes adding idempotent, and a changed nexthop a single update */
+		req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE;
+		req->n.nlmsg_type = RTM_NEWNEXTHOP;
+		req->nhm.nh_protocol = RTPROT_BOOT;
+	}
+
+	req->nhm.nh_family = nh->group ? AF_UNSPEC : nh->family;
+	addattr32(&req->n, sizeof(*req), NHA_ID, nh->id);
+
+	if (cmd == IPROUTE_DEL)
+		return;
+
+	if (nh->group)
+		addattr_l(&req->n, sizeof(*req), NHA_GROUP, nh->group, nh->num_group * sizeof(*nh->group));
+	else if (nh->blackhole)
+		addattr_l(&req->n, sizeof(*req), NHA_BLACKHOLE, NULL, 0);
+	else {
+		addattr32(&req->n, sizeof(*req), NHA_OIF, nh->oif->ifindex);
+		if (nh->via)
+			add_addr2req(&req->n, sizeof(*req), NHA_GATEWAY, nh->via);
+		req->nhm.nh_flags = nh->flags;
+	}
+}
+
+static void
+netlink_nexthop_done(void *data, struct nlmsghdr *n, int error)
+{
+	ip_nexthop_t *nh = data;
+
+	nh->set = !error && n->nlmsg_type == RTM_NEWNEXTHOP;
+}
+
+/* Add/Delete a list of nexthops. Groups are added after, and deleted
+ * before, the nexthops they may refer to. */
+void
+netlink_nhlist(list nh_list, int cmd)
+{
+	ip_nexthop_t *nh;
+	nexthop_req_t req;
+	nl_batch_t batch;
+	element e;
+	int pass;
+	bool groups;
+
+	if (LIST_ISEMPTY(nh_list))
+		return;
+
+	netlink_batch_init(&batch, &nl_cmd, netlink_nexthop_done);
+
+	for (pass = 0; pass < 2; pass++) {
+		groups = (pass == 0) == (cmd == IPROUTE_DEL);
+		for (e = LIST_HEAD(nh_list); e; ELEMENT_NEXT(e)) {
+			nh = ELEMENT_DATA(e);
+			if ((cmd == IPROUTE_DEL) != nh->set ||
+			    !nh->group == groups)
+				continue;
+
+			netlink_nexthop_msg(&req, nh, cmd);
+			netlink_batch_add(&batch, &req.n, nh);
+		}
+	}
+
+	netlink_batch_flush(&batch);
+}
+
+void
+free_ipnexthop(void *nh_data)
+{
+	ip_nexthop_t *nh = nh_data;
+
+	FREE_PTR(nh->via);
+	FREE_PTR(nh->group);
+	FREE(nh_data);
+}
+
+static void
+format_ipnexthop(ip_nexthop_t *nh, char *buf, size_t buf_len)
+{
+	char *op = buf;
+	const char *buf_end = buf + buf_len;
+	unsigned i;
+
+	op += (size_t)snprintf(op, (size_t)(buf_end - op), "id %u", nh->id);
+
+	if (nh->group) {
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " group ");
+		for (i = 0; i < nh->num_group; i++) {
+			op += (size_t)snprintf(op, (size_t)(buf_end - op), "%s%u", i ? "/" : "", nh->group[i].id);
+			if (nh->group[i].weight)
+				op += (size_t)snprintf(op, (size_t)(buf_end - op), ",%u", nh->group[i].weight + 1U);
+		}
+		return;
+	}
+
+	if (nh->family == AF_INET6)
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " inet6");
+	if (nh->blackhole)
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " blackhole");
+	if (nh->via)
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " via %s", ipaddresstos(NULL, nh->via));
+	if (nh->oif)
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " dev %s", nh->oif->ifname);
+	if (nh->flags & RTNH_F_ONLINK)
+		op += (size_t)snprintf(op, (size_t)(buf_end - op), " onlink");
+}
+
+void
+dump_ipnexthop(void *nh_data)
+{
+	char buf[ROUTE_BUF_SIZE];
+
+	format_ipnexthop(nh_data, buf, sizeof(buf));
+	log_message(LOG_INFO, "     %s", buf);
+}
+
+static ip_nexthop_t *
+find_nexthop(list l, uint32_t id)
+{
+	ip_nexthop_t *nh;
+	element e;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		nh = ELEMENT_DATA(e);
+		if (nh->id == id)
+			return nh;
+	}
+
+	return NULL;
+}
+
+/* Parse group members, id[,weight][/id[,weight]]... */
+static bool
+parse_nexthop_group(ip_nexthop_t *nh, char *str)
+{
+	char *p, *end;
+	unsigned long val;
+	unsigned num = 1;
+
+	for (p = str; *p; p++)
+		if (*p == '/')
+			num++;
+
+	nh->group = MALLOC(num * sizeof(*nh->group));
+
+	for (p = str; nh->num_group < num; p = end + 1) {
+		val = strtoul(p, &end, 10);
+		if (end == p || !val || val > UINT32_MAX)
+			return false;
+		nh->group[nh->num_group].id = (uint32_t)val;
+
+		if (*end == ',') {
+			p = end + 1;
+			val = strtoul(p, &end, 10);
+			if (end == p || !val || val > 256)
+				return false;
+			nh->group[nh->num_group].weight = (uint8_t)(val - 1);
+		}
+
+		if (*end != (++nh->num_group == num ? '\0' : '/'))
+			return false;
+	}
+
+	return true;
+}
+
+void
+alloc_nexthop(list nh_list, vector_t *strvec)
+{
+	ip_nexthop_t *new;
+	char *str;
+	unsigned int i = 0;
+
+	new = (ip_nexthop_t *) MALLOC(sizeof(ip_nexthop_t));
+	new->family = AF_UNSPEC;
+
+	while (i < vector_size(strvec)) {
+		str = strvec_slot(strvec, i);
+
+		if (!strcmp(str, "id")) {
+			if (get_u32(&new->id, strvec_slot(strvec, ++i), UINT32_MAX, "Invalid nexthop id %s"))
+				goto err;
+		}
+		else if (!strcmp(str, "inet") || !strcmp(str, "inet6")) {
+			new->family = str[4] ? AF_INET6 : AF_INET;
+		}
+		else if (!strcmp(str, "via")) {
+			if (new->via)
+				FREE(new->via);
+			new->via = parse_ipaddress(NULL, strvec_slot(strvec, ++i), false);
+			if (!new->via) {
+				log_message(LOG_INFO, "invalid nexthop via address %s", FMT_STR_VSLOT(strvec, i));
+				goto err;
+			}
+		}
+		else if (!strcmp(str, "dev")) {
+			new->oif = if_get_by_ifname(strvec_slot(strvec, ++i));
+			if (!new->oif) {
+				log_message(LOG_INFO, "VRRP is trying to assign nexthop to unknown "
+				       "%s interface !!! go out and fix your conf !!!",
+				       FMT_STR_VSLOT(strvec, i));
+				goto err;
+			}
+		}
+		else if (!strcmp(str, "onlink"))
+			new->flags |= RTNH_F_ONLINK;
+		else if (!strcmp(str, "blackhole"))
+			new->blackhole = true;
+		else if (!strcmp(str, "group")) {
+			if (new->group || !parse_nexthop_group(new, strvec_slot(strvec, ++i))) {
+				log_message(LOG_INFO, "Invalid nexthop group %s", FMT_STR_VSLOT(strvec, i));
+				goto err;
+			}
+		}
+		else {
+			log_message(LOG_INFO, "unknown nexthop keyword %s", str);
+			goto err;
+		}
+		i++;
+	}
+
+	if (!new->id) {
+		log_message(LOG_INFO, "nexthop requires a non zero id");
+		goto err;
+	}
+
+	if (find_nexthop(nh_list, new->id)) {
+		log_message(LOG_INFO, "nexthop id %u already specified - ignoring", new->id);
+		goto err;
+	}
+
+	if (new->group) {
+		if (new->via || new->oif || new->blackhole) {
+			log_message(LOG_INFO, "nexthop group %u cannot also specify via, dev or blackhole", new->id);
+			goto err;
+		}
+	}
+	else if (new->blackhole) {
+		if (new->via || new->oif) {
+			log_message(LOG_INFO, "blackhole nexthop %u cannot also specify via or dev", new->id);
+			goto err;
+		}
+	}
+	else if (!new->oif) {
+		log_message(LOG_INFO, "nexthop %u requires a dev", new->id);
+		goto err;
+	}
+
+	if (new->via) {
+		if (new->family == AF_UNSPEC)
+			new->family = new->via->ifa.ifa_family;
+		else if (new->family != new->via->ifa.ifa_family) {
+			log_message(LOG_INFO, "nexthop %u via address family mismatch", new->id);
+			goto err;
+		}
+	}
+	if (new->family == AF_UNSPEC)
+		new->family = AF_INET;
+
+	list_add(nh_list, new);
+
+	return;
+
+err:
+	free_ipnexthop(new);
+}
+
+/* On reload, install the new and changed nexthops before the routes
+ * that may use them are diffed. A nexthop that is unchanged is left
+ * alone, and a changed one is replaced, so the routes using it all
+ * follow with no route update. */
+void
+update_diff_snexthops(void)
+{
+	ip_nexthop_t *nh, *old_nh;
+	nexthop_req_t old_req, new_req;
+	element e;
+
+	if (LIST_ISEMPTY(vrrp_data->static_nexthops))
+		return;
+
+	for (e = LIST_HEAD(vrrp_data->static_nexthops); e; ELEMENT_NEXT(e)) {
+		nh = ELEMENT_DATA(e);
+		if (LIST_ISEMPTY(old_vrrp_data->static_nexthops) ||
+		    !(old_nh = find_nexthop(old_vrrp_data->static_nexthops, nh->id)))
+			continue;
+
+		/* The new configuration now owns the nexthop */
+		if (old_nh->set) {
+			netlink_nexthop_msg(&old_req, old_nh, IPROUTE_ADD);
+			netlink_nexthop_msg(&new_req, nh, IPROUTE_ADD);
+			nh->set = old_req.n.nlmsg_len == new_req.n.nlmsg_len &&
+				  !memcmp(&old_req, &new_req, old_req.n.nlmsg_len);
+		}
+		old_nh->set = false;
+	}
+
+	netlink_nhlist(vrrp_data->static_nexthops, IPROUTE_ADD);
+}
+
+/* Remove the nexthops no longer configured, once no routes use them */
+void
+clear_diff_snexthops(void)
+{
+	netlink_nhlist(old_vrrp_data->static_nexthops, IPROUTE_DEL);
+}
+#endif
@@ -83,11 +83,33 @@ rule_is_equal(const ip_rule_t *x, const ip_rule_t *y)
 	return true;
 }
 
-/* Add/Delete IP rule to/from a specific IP/network */
-static int
-netlink_rule(ip_rule_t *iprule, int cmd)
+static uint32_t
+rule_hash(ip_rule_t *iprule)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	hash = (hash ^ iprule->priority) * 0x01000193;
+	hash = (hash ^ iprule->table) * 0x01000193;
+	hash = (hash ^ iprule->fwmark) * 0x01000193;
+	hash = (hash ^ iprule->action) * 0x01000193;
+	hash = hash_ipaddress(hash, iprule->from_addr);
+
+	return hash_ipaddress(hash, iprule->to_addr);
+}
+
+/* Result of a rule request */
+static void
+netlink_rule_done(void *data, struct nlmsghdr *n, int error)
+{
+	ip_rule_t *iprule = data;
+
+	iprule->set = !error && n->nlmsg_type == RTM_NEWRULE;
+}
+
+/* Queue adding/deleting an IP rule to/from a specific IP/network */
+static void
+netlink_rule(nl_batch_t *batch, ip_rule_t *iprule, int cmd)
 {
-	int status = 1;
 	struct {
 		struct nlmsghdr n;
 		struct fib_rule_hdr frh;
@@ -190,10 +212,26 @@ netlink_rule(ip_rule_t *iprule, int cmd)
 
 	req.frh.action = iprule->action;
 
-	if (netlink_talk(&nl_cmd, &req.n) < 0)
-		status = -1;
+	netlink_batch_add(batch, &req.n, iprule);
+}
+
+/* Rules added between netlink_rulelist_share_begin() and _end() are
+ * queued in one batch, so that the members of a sync group share it */
+static nl_batch_t shared_batch;
+static bool sharing_batch;
+
+void
+netlink_rulelist_share_begin(void)
+{
+	netlink_batch_init(&shared_batch, &nl_cmd, netlink_rule_done);
+	sharing_batch = true;
+}
 
-	return status;
+void
+netlink_rulelist_share_end(void)
+{
+	sharing_batch = false;
+	netlink_batch_flush(&shared_batch);
 }
 
 void
@@ -201,11 +239,17 @@ netlink_rulelist(list rule_list, int cmd, bool force)
 {
 	ip_rule_t *iprule;
 	element e;
+	nl_batch_t batch, *bp = &batch;
 
 	/* No rules to add */
 	if (LIST_ISEMPTY(rule_list))
 		return;
 
+	if (sharing_batch && cmd == IPRULE_ADD && !force)
+		bp = &shared_batch;
+	else
+		netlink_batch_init(&batch, &nl_cmd, netlink_rule_done);
+
 	/* If force is set, we try to remove all the rules, but the
 	 * rule might not exist. That's not an error, so indicate not
 	 * to report such a situation */
@@ -216,14 +260,13 @@ netlink_rulelist(list rule_list, int cmd, bool force)
 		iprule = ELEMENT_DATA(e);
 		if (force ||
 		    (cmd == IPRULE_ADD && !iprule->set) ||
-		    (cmd == IPRULE_DEL && iprule->set)) {
-			if (netlink_rule(iprule, cmd) > 0)
-				iprule->set = (cmd == IPRULE_ADD);
-			else
-				iprule->set = false;
-		}
+		    (cmd == IPRULE_DEL && iprule->set))
+			netlink_rule(bp, iprule, cmd);
 	}
 
+	if (bp == &batch)
+		netlink_batch_flush(&batch);
+
 	netlink_error_ignore = 0;
 }
 
@@ -619,28 +662,13 @@ err:
 	FREE_PTR(new);
 }
 
-/* Try to find a rule in a list */
-static int
-rule_exist(list l, ip_rule_t *iprule)
-{
-	ip_rule_t *ipr;
-	element e;
-
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		ipr = ELEMENT_DATA(e);
-		if (rule_is_equal(ipr, iprule)) {
-			ipr->set = iprule->set;
-			return 1;
-		}
-	}
-	return 0;
-}
-
 /* Clear diff rules */
 void
 clear_diff_rules(list l, list n)
 {
-	ip_rule_t *iprule;
+	ip_rule_t *iprule, **slot;
+	uint32_t size = 8, mask, i;
+	nl_batch_t batch;
 	element e;
 
 	/* No rule in previous conf */
@@ -654,14 +682,40 @@ clear_diff_rules(list l, list n)
 		return;
 	}
 
+	/* Index the new rules, so the diff is linear rather than quadratic */
+	while (size < 2 * LIST_SIZE(n))
+		size <<= 1;
+	mask = size - 1;
+	slot = MALLOC(size * sizeof(*slot));
+	for (e = LIST_HEAD(n); e; ELEMENT_NEXT(e)) {
+		iprule = ELEMENT_DATA(e);
+		for (i = rule_hash(iprule) & mask; slot[i]; i = (i + 1) & mask)
+			;
+		slot[i] = iprule;
+	}
+
+	netlink_batch_init(&batch, &nl_cmd, netlink_rule_done);
+
+	/* Rules can't be replaced, so a changed rule is deleted here
+	 * and the new one is added */
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		iprule = ELEMENT_DATA(e);
-		if (!rule_exist(n, iprule) && iprule->set) {
+		for (i = rule_hash(iprule) & mask; slot[i]; i = (i + 1) & mask) {
+			if (rule_is_equal(slot[i], iprule)) {
+				slot[i]->set = iprule->set;
+				break;
+			}
+		}
+
+		if (!slot[i] && iprule->set) {
 			log_message(LOG_INFO, "ip rule %s/%d ... , no longer exist"
 					    , ipaddresstos(NULL, iprule->from_addr), iprule->from_addr->ifa.ifa_prefixlen);
-			netlink_rule(iprule, IPRULE_DEL);
+			netlink_rule(&batch, iprule, IPRULE_DEL);
 		}
 	}
+
+	netlink_batch_flush(&batch);
+	FREE(slot);
 }
 
 /* Diff conf handler */
@@ -28,22 +28,15 @@
 
 #define	BLOCK_SIZE	64
 
-/* hmac_md5 computation according to the RFCs 2085 & 2104 */
+/* Set up the keyed inner and outer hash states for hmac_md5_digest() */
 void
-hmac_md5(unsigned char *buffer, size_t buffer_len, unsigned char *key, size_t key_len,
-	 unsigned char *digest)
+hmac_md5_init(hmac_md5_ctx_t *ctx, const unsigned char *key, size_t key_len)
 {
-	MD5_CTX context;
-	unsigned char k_ipad[BLOCK_SIZE+1];	/* inner padding - key XORd with ipad */
-	unsigned char k_opad[BLOCK_SIZE+1];	/* outer padding - key XORd with opad */
+	unsigned char k_ipad[BLOCK_SIZE];	/* inner padding - key XORd with ipad */
+	unsigned char k_opad[BLOCK_SIZE];	/* outer padding - key XORd with opad */
 	unsigned char tk[MD5_DIGEST_LENGTH];
 	int i;
 
-	/* Initialize data */
-	memset(k_ipad, 0, sizeof (k_ipad));
-	memset(k_opad, 0, sizeof (k_opad));
-	memset(tk, 0, sizeof (tk));
-
 	/* If the key is longer than 64 bytes => set it to key=MD5(key) */
 	if (key_len > BLOCK_SIZE) {
 		MD5_CTX tctx;
@@ -75,15 +68,33 @@ hmac_md5(unsigned char *buffer, size_t buffer_len, unsigned char *key, size_t ke
 		k_opad[i] ^= 0x5c;
 	}
 
+	/* The pads are exactly one MD5 block, so the states after
+	 * hashing them can be saved and copied for each buffer */
+	MD5_Init(&ctx->inner);
+	MD5_Update(&ctx->inner, k_ipad, BLOCK_SIZE);
+	MD5_Init(&ctx->outer);
+	MD5_Update(&ctx->outer, k_opad, BLOCK_SIZE);
+
+	memset(k_ipad, 0, sizeof (k_ipad));
+	memset(k_opad, 0, sizeof (k_opad));
+	memset(tk, 0, sizeof (tk));
+}
+
+/* hmac_md5 computation according to the RFCs 2085 & 2104, from the
+ * states prepared by hmac_md5_init() */
+void
+hmac_md5_digest(const hmac_md5_ctx_t *ctx, const unsigned char *buffer, size_t buffer_len,
+		unsigned char *digest)
+{
+	MD5_CTX context;
+
 	/* Compute inner MD5 */
-	MD5_Init(&context);				/* Init context for 1st pass */
-	MD5_Update(&context, k_ipad, BLOCK_SIZE);		/* start with inner pad */
+	context = ctx->inner;				/* Init context for 1st pass */
 	MD5_Update(&context, buffer, buffer_len);	/* next with buffer datagram */
 	MD5_Final(digest, &context);			/* Finish 1st pass */
 
 	/* Compute outer MD5 */
-	MD5_Init(&context);				/* Init context for 2nd pass */
-	MD5_Update(&context, k_opad, BLOCK_SIZE);		/* start with inner pad */
+	context = ctx->outer;				/* Init context for 2nd pass */
 	MD5_Update(&context, digest, MD5_DIGEST_LENGTH); /* next result of 1st pass */
 	MD5_Final(digest, &context);			/* Finish 2nd pass */
 }
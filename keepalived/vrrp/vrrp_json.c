@@ -35,6 +35,8 @@
 #include "vrrp_iprule.h"
 #include "logger.h"
 #include "timer.h"
+#include "vrrp_daemon.h"
+#include "memory.h"
 
 static inline double
 timeval_to_double(const timeval_t *t)
@@ -53,10 +55,13 @@ vrrp_print_json(void)
 	if (LIST_ISEMPTY(vrrp_data->vrrp))
 		return;
 
-	file = fopen ("/tmp/keepalived.json","w");
+	char *file_name = make_worker_file_name("/tmp/keepalived.json");
+
+	file = fopen(file_name, "w");
 	if (!file) {
-		log_message(LOG_INFO, "Can't open /tmp/keepalived.json (%d: %s)",
-			errno, strerror(errno));
+		log_message(LOG_INFO, "Can't open %s (%d: %s)",
+			file_name, errno, strerror(errno));
+		FREE(file_name);
 		return;
 	}
 
@@ -297,4 +302,5 @@ vrrp_print_json(void)
 	}
 	fprintf(file, "%s", json_object_to_json_string(array));
 	fclose(file);
+	FREE(file_name);
 }
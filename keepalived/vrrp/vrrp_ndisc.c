@@ -69,6 +69,12 @@ ndisc_send_na(ip_address_t *ipaddress)
 	
 	}
 
+	/* When simulating, nothing goes out on the network */
+	if (thread_simulating()) {
+		sim_stats.arps++;
+		return;
+	}
+
 	/* Send packet */
 	len = sendto(ndisc_fd, ndisc_buffer,
 		     ETHER_HDR_LEN + sizeof(struct ip6hdr) + sizeof(struct ndhdr) +
@@ -88,9 +94,7 @@ ndisc_send_na(ip_address_t *ipaddress)
 static __sum16
 ndisc_icmp6_cksum(const struct ip6hdr *ip6, const struct icmp6hdr *icp, uint32_t len)
 {
-	size_t i;
-	register const uint16_t *sp;
-	uint32_t sum;
+	uint32_t acc;
 	union {
 		struct {
 			struct in6_addr ph_src;
@@ -109,22 +113,9 @@ ndisc_icmp6_cksum(const struct ip6hdr *ip6, const struct icmp6hdr *icp, uint32_t
 	phu.ph.ph_len = htonl(len);
 	phu.ph.ph_nxt = IPPROTO_ICMPV6;
 
-	sum = 0;
-	for (i = 0; i < sizeof(phu.pa) / sizeof(phu.pa[0]); i++)
-		sum += phu.pa[i];
-
-	sp = (const uint16_t *)icp;
-
-	for (i = 1; i < len; i += 2)
-		sum += *sp++;
-
-	if (len & 1)
-		sum += htons((*(const uint8_t *)sp) << 8);
-
-	while (sum > 0xffff)
-		sum = (sum & 0xffff) + (sum >> 16);
+	in_csum(phu.pa, sizeof(phu.pa), 0, &acc);
 
-	return ~sum & 0xffff;
+	return in_csum((const uint16_t *)icp, len, acc, NULL);
 }
 
 /*
@@ -200,8 +191,7 @@ queue_ndisc(vrrp_t *vrrp, interface_t *ifp, ip_address_t *ipaddress)
 {
 	timeval_t next_time = timer_add_now(ifp->garp_delay->gna_interval);
 
-	vrrp->gna_pending = true;
-	ipaddress->garp_gna_pending = true;
+	garp_queue_add(vrrp, ipaddress);
 
 	/* Do we need to schedule/reschedule the garp thread? */
 	if (!garp_thread || timer_cmp(next_time, garp_next_time) < 0) {
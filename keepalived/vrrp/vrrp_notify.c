@@ -34,6 +34,7 @@
 #include "memory.h"
 #include "notify.h"
 #include "logger.h"
+#include "scheduler.h"
 
 static notify_script_t*
 get_iscript(vrrp_t * vrrp, int state)
@@ -236,6 +237,9 @@ notify_instance_exec(vrrp_t * vrrp, int state)
 	notify_script_t *gscript = get_igscript(vrrp);
 	int ret = 0;
 
+	if (thread_simulating())
+		sim_stats.transitions++;
+
 	/* Launch the notify_* script */
 	if (script && script_open(script)) {
 		notify_exec(script);
@@ -72,6 +72,15 @@ static_rules_handler(__attribute__((unused)) vector_t *strvec)
 {
 	alloc_value_block(alloc_srule);
 }
+
+#if HAVE_DECL_RTA_NH_ID
+/* Static nexthops handler */
+static void
+static_nexthops_handler(__attribute__((unused)) vector_t *strvec)
+{
+	alloc_value_block(alloc_snexthop);
+}
+#endif
 #endif
 
 /* VRRP handlers */
@@ -930,6 +939,9 @@ init_vrrp_keywords(bool active)
 #ifdef _HAVE_FIB_ROUTING_
 	install_keyword_root("static_routes", &static_routes_handler, active);
 	install_keyword_root("static_rules", &static_rules_handler, active);
+#if HAVE_DECL_RTA_NH_ID
+	install_keyword_root("static_nexthops", &static_nexthops_handler, active);
+#endif
 #endif
 
 	/* VRRP Instance mapping */
@@ -26,6 +26,7 @@
 
 #include "memory.h"
 #include "vrrp.h"
+#include "global_data.h"
 #include "vrrp_data.h"
 #include "vrrp_print.h"
 #include "vrrp_ipaddress.h"
@@ -37,6 +38,11 @@
 #include "rttables.h"
 #include "logger.h"
 #include "vrrp_if.h"
+#include "vrrp_daemon.h"
+#ifdef _WITH_LVS_
+#include "ipvswrapper.h"
+#endif
+#include "memory.h"
 
 #include <time.h>
 #include <errno.h>
@@ -382,11 +388,14 @@ void
 vrrp_print_data(void)
 {
 	FILE *file;
-	file = fopen ("/tmp/keepalived.data","w");
+	char *file_name = make_worker_file_name("/tmp/keepalived.data");
+
+	file = fopen(file_name, "w");
 
 	if (!file) {
-		log_message(LOG_INFO, "Can't open /tmp/keepalived.data (%d: %s)",
-			errno, strerror(errno));
+		log_message(LOG_INFO, "Can't open %s (%d: %s)",
+			file_name, errno, strerror(errno));
+		FREE(file_name);
 		return;
 	}
 
@@ -401,6 +410,7 @@ vrrp_print_data(void)
 	print_interface_list(file);
 
 	fclose(file);
+	FREE(file_name);
 
 	clear_rt_names();
 }
@@ -409,11 +419,14 @@ void
 vrrp_print_stats(void)
 {
 	FILE *file;
-	file = fopen ("/tmp/keepalived.stats","w");
+	char *file_name = make_worker_file_name("/tmp/keepalived.stats");
+
+	file = fopen(file_name, "w");
 
 	if (!file) {
-		log_message(LOG_INFO, "Can't open /tmp/keepalived.stats (%d: %s)",
-			errno, strerror(errno));
+		log_message(LOG_INFO, "Can't open %s (%d: %s)",
+			file_name, errno, strerror(errno));
+		FREE(file_name);
 		return;
 	}
 
@@ -452,5 +465,19 @@ vrrp_print_stats(void)
 		fprintf(file, "    Received: %" PRIu64 "\n", vrrp->stats->pri_zero_rcvd);
 		fprintf(file, "    Sent: %" PRIu64 "\n", vrrp->stats->pri_zero_sent);
 	}
+
+#ifdef _WITH_LVS_
+	if (global_data->lvs_syncd.ifname) {
+		vrrp = global_data->lvs_syncd.vrrp;
+		fprintf(file, "LVS Sync Daemon: interface %s, syncid %u, VRRP Instance %s",
+			global_data->lvs_syncd.ifname, global_data->lvs_syncd.syncid, vrrp->iname);
+		if (vrrp->sync)
+			fprintf(file, ", Sync Group %s", vrrp->sync->gname);
+		fprintf(file, "\n");
+		ipvs_syncd_count_conns();
+		ipvs_syncd_print_stats(file);
+	}
+#endif
 	fclose(file);
+	FREE(file_name);
 }
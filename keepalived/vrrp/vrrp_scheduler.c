@@ -271,7 +271,7 @@ vrrp_init_state(list l)
 #ifdef _WITH_SNMP_RFCV3_
 			vrrp->stats->master_reason = VRRPV3_MASTER_REASON_PREEMPTED;
 #endif
-			vrrp->state = VRRP_STATE_GOTO_MASTER;
+			vrrp_set_state(vrrp, VRRP_STATE_GOTO_MASTER);
 		} else {
 			vrrp->ms_down_timer = 3 * vrrp->adver_int
 			    + VRRP_TIMER_SKEW(vrrp);
@@ -290,7 +290,7 @@ vrrp_init_state(list l)
 
 			/* Set BACKUP state */
 			vrrp_restore_interface(vrrp, false, false);
-			vrrp->state = VRRP_STATE_BACK;
+			vrrp_set_state(vrrp, VRRP_STATE_BACK);
 			vrrp_smtp_notifier(vrrp);
 			notify_instance_exec(vrrp, VRRP_STATE_BACK);
 #ifdef _WITH_SNMP_VRRP_
@@ -419,26 +419,30 @@ vrrp_timer_fd(const int fd)
 	return timer_long(timer_sub(timer, time_now));
 }
 
-static int
-vrrp_timer_vrid_timeout(const int fd)
+/* The instance on fd whose timer expires first. Unicast instances can
+ * share a VRID on an fd, so this returns the instance, not the VRID */
+static vrrp_t *
+vrrp_timer_timeout_instance(const int fd)
 {
 	vrrp_t *vrrp;
+	vrrp_t *found = NULL;
 	element e;
 	list l = &vrrp_data->vrrp_index_fd[fd%1024 + 1];
 	timeval_t timer;
-	int vrid = 0;
 
 	/* Multiple instances on the same interface */
 	timer_reset(timer);
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vrrp = ELEMENT_DATA(e);
+		if (vrrp->fd_in != fd)
+			continue;
 		if (timer_cmp(vrrp->sands, timer) < 0 ||
 		    timer_isnull(timer)) {
 			timer = timer_dup(vrrp->sands);
-			vrid = vrrp->vrid;
+			found = vrrp;
 		}
 	}
-	return vrid;
+	return found;
 }
 
 /* Thread functions */
@@ -670,7 +674,7 @@ vrrp_backup(vrrp_t * vrrp, char *buffer, ssize_t len)
 		       vrrp->iname);
 		if (vrrp->state != VRRP_STATE_FAULT) {
 			notify_instance_exec(vrrp, VRRP_STATE_FAULT);
-			vrrp->state = VRRP_STATE_FAULT;
+			vrrp_set_state(vrrp, VRRP_STATE_FAULT);
 #ifdef _WITH_SNMP_VRRP_
 			vrrp_snmp_instance_trap(vrrp);
 #endif
@@ -709,7 +713,7 @@ vrrp_become_master(vrrp_t * vrrp,
 #endif
 
 	/* Then jump to master state */
-	vrrp->wantstate = VRRP_STATE_MAST;
+	vrrp_set_wantstate(vrrp, VRRP_STATE_MAST);
 	vrrp_state_goto_master(vrrp);
 }
 
@@ -718,7 +722,7 @@ vrrp_leave_master(vrrp_t * vrrp, char *buffer, ssize_t len)
 {
 	if (!VRRP_ISUP(vrrp)) {
 		vrrp_log_int_down(vrrp);
-		vrrp->wantstate = VRRP_STATE_GOTO_FAULT;
+		vrrp_set_wantstate(vrrp, VRRP_STATE_GOTO_FAULT);
 		vrrp_state_leave_master(vrrp);
 	} else if (vrrp_state_master_rx(vrrp, buffer, len)) {
 		vrrp_state_leave_master(vrrp);
@@ -736,7 +740,7 @@ vrrp_ah_sync(vrrp_t *vrrp)
 	 */
 	log_message(LOG_INFO, "VRRP_Instance(%s) in FAULT state jump to AH sync",
 	       vrrp->iname);
-	vrrp->wantstate = VRRP_STATE_BACK;
+	vrrp_set_wantstate(vrrp, VRRP_STATE_BACK);
 	vrrp_state_leave_master(vrrp);
 }
 #endif
@@ -764,7 +768,7 @@ vrrp_leave_fault(vrrp_t * vrrp, char *buffer, ssize_t len)
 		if (!vrrp->sync || vrrp_sync_leave_fault(vrrp)) {
 			log_message(LOG_INFO, "VRRP_Instance(%s) Entering BACKUP STATE",
 			       vrrp->iname);
-			vrrp->state = VRRP_STATE_BACK;
+			vrrp_set_state(vrrp, VRRP_STATE_BACK);
 			vrrp_smtp_notifier(vrrp);
 			notify_instance_exec(vrrp, VRRP_STATE_BACK);
 #ifdef _WITH_SNMP_VRRP_
@@ -787,7 +791,7 @@ vrrp_goto_master(vrrp_t * vrrp)
 		       vrrp->iname);
 		if (vrrp->state != VRRP_STATE_FAULT)
 			notify_instance_exec(vrrp, VRRP_STATE_FAULT);
-		vrrp->state = VRRP_STATE_FAULT;
+		vrrp_set_state(vrrp, VRRP_STATE_FAULT);
 		vrrp->ms_down_timer = 3 * vrrp->adver_int + VRRP_TIMER_SKEW(vrrp);
 		notify_instance_exec(vrrp, VRRP_STATE_FAULT);
 #ifdef _WITH_SNMP_VRRP_
@@ -812,7 +816,7 @@ vrrp_goto_master(vrrp_t * vrrp)
 		vrrp->stats->master_reason = VRRPV3_MASTER_REASON_MASTER_NO_RESPONSE;
 #endif
 	/* handle master state transition */
-	vrrp->wantstate = VRRP_STATE_MAST;
+	vrrp_set_wantstate(vrrp, VRRP_STATE_MAST);
 	vrrp_state_goto_master(vrrp);
 }
 
@@ -890,6 +894,57 @@ vrrp_update_priority(thread_t * thread)
 	return 0;
 }
 
+/* Would vrrp_master() take an instance over to MASTER now ? */
+static bool
+vrrp_master_takes_over(vrrp_t *vrrp)
+{
+	return vrrp->state == VRRP_STATE_MAST &&
+	       !VRRP_VIP_ISSET(vrrp) &&
+	       VRRP_ISUP(vrrp) &&
+	       vrrp->wantstate != VRRP_STATE_GOTO_FAULT &&
+	       vrrp->wantstate != VRRP_STATE_BACK
+#ifdef _WITH_VRRP_AUTH_
+	       && !(vrrp->version == VRRP_VERSION_2 && vrrp->ipsecah_counter->cycle)
+#endif
+	       ;
+}
+
+/* The members of a sync group that are taking over to MASTER do so in
+ * one pass, sharing the netlink batches for their routes and rules,
+ * rather than each at its own next advert */
+static void
+vrrp_sync_become_master(vrrp_sgroup_t *vgroup)
+{
+	vrrp_t **vrrps, *isync;
+	unsigned num = 0;
+	element e;
+
+	vrrps = MALLOC(vgroup->num_member * sizeof(*vrrps));
+
+	vrrp_become_master_share_begin();
+
+	for (e = LIST_HEAD(vgroup->index_list); e; ELEMENT_NEXT(e)) {
+		isync = ELEMENT_DATA(e);
+		if (!vrrp_master_takes_over(isync))
+			continue;
+
+		if (vrrp_state_master_tx(isync, 0)) {
+			if (isync->garp_delay)
+				thread_add_timer(master, vrrp_gratuitous_arp_thread,
+						 isync, isync->garp_delay);
+			vrrp_smtp_notifier(isync);
+			vrrps[num++] = isync;
+		}
+
+		/* The advert has been sent */
+		vrrp_init_instance_sands(isync);
+	}
+
+	vrrp_become_master_share_end(vrrps, num);
+
+	FREE(vrrps);
+}
+
 static void
 vrrp_master(vrrp_t * vrrp)
 {
@@ -897,7 +952,7 @@ vrrp_master(vrrp_t * vrrp)
 	if (vrrp->wantstate != VRRP_STATE_GOTO_FAULT) {
 		if (!VRRP_ISUP(vrrp)) {
 			vrrp_log_int_down(vrrp);
-			vrrp->wantstate = VRRP_STATE_GOTO_FAULT;
+			vrrp_set_wantstate(vrrp, VRRP_STATE_GOTO_FAULT);
 		}
 	}
 
@@ -920,6 +975,12 @@ vrrp_master(vrrp_t * vrrp)
 			log_message(LOG_INFO, "VRRP_Instance(%s) Now in FAULT state",
 				    vrrp->iname);
 	} else if (vrrp->state == VRRP_STATE_MAST) {
+		/* The members of a sync group take over together */
+		if (vrrp->sync && !VRRP_VIP_ISSET(vrrp)) {
+			vrrp_sync_become_master(vrrp->sync);
+			return;
+		}
+
 		/*
 		 * Send the VRRP advert.
 		 * If we catch the master transition
@@ -967,7 +1028,7 @@ vrrp_fault(vrrp_t * vrrp)
 	{
 		/* Otherwise, we transit to init state */
 		if (vrrp->base_priority != VRRP_PRIO_OWNER) {
-			vrrp->state = VRRP_STATE_BACK;
+			vrrp_set_state(vrrp, VRRP_STATE_BACK);
 			notify_instance_exec(vrrp, VRRP_STATE_BACK);
 			if (vrrp->preempt_delay)
 				vrrp->preempt_time = timer_add_long(timer_now(), vrrp->preempt_delay);
@@ -994,12 +1055,10 @@ static int
 vrrp_dispatcher_read_timeout(int fd)
 {
 	vrrp_t *vrrp;
-	int vrid = 0;
 	int prev_state = 0;
 
 	/* Searching for matching instance */
-	vrid = vrrp_timer_vrid_timeout(fd);
-	vrrp = vrrp_index_lookup(vrid, fd);
+	vrrp = vrrp_timer_timeout_instance(fd);
 
 	/* Run the FSM handler */
 	prev_state = vrrp->state;
@@ -1052,8 +1111,13 @@ vrrp_dispatcher_read(sock_t * sock)
 		       (struct sockaddr *) &src_addr, &src_addr_len);
 	hd = vrrp_get_header(sock->family, vrrp_buffer, &proto);
 
-	/* Searching for matching instance */
-	vrrp = vrrp_index_lookup(hd->vrid, sock->fd_in);
+	/* Searching for matching instance. Unicast instances are matched
+	 * on the sender too, since they can share a VRID with other peers */
+	vrrp = NULL;
+	if (sock->unicast)
+		vrrp = vrrp_unicast_index_lookup(hd->vrid, &src_addr, sock->fd_in);
+	if (!vrrp)
+		vrrp = vrrp_index_lookup(hd->vrid, sock->fd_in);
 
 	/* If no instance found => ignore the advert */
 	if (!vrrp)
@@ -1111,6 +1175,34 @@ vrrp_read_dispatcher_thread(thread_t * thread)
 	return 0;
 }
 
+/* Apply the result of a run of a track script */
+static void
+vrrp_script_result(vrrp_script_t *vscript, bool script_success, const char *script_exit_type, const char *reason, int reason_code)
+{
+	if (script_success) {
+		if (vscript->result < vscript->rise - 1) {
+			vscript->result++;
+		} else {
+			if (vscript->result < vscript->rise)	/* i.e. == vscript->rise - 1 */
+				log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
+			vscript->result = vscript->rise + vscript->fall - 1;
+		}
+	} else {
+		if (vscript->result > vscript->rise) {
+			vscript->result--;
+		} else {
+			if (vscript->result == vscript->rise ||
+			    vscript->init_state == SCRIPT_INIT_STATE_INIT) {
+				if (reason)
+					log_message(LOG_INFO, "VRRP_Script(%s) %s (%s %d)", vscript->sname, script_exit_type, reason, reason_code);
+				else
+					log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
+			}
+			vscript->result = 0;
+		}
+	}
+}
+
 static int
 vrrp_script_thread(thread_t * thread)
 {
@@ -1129,6 +1221,19 @@ vrrp_script_thread(thread_t * thread)
 		return 0;
 	}
 
+	/* When simulating, the script isn't run; it fails if the simulated
+	 * failure burst selects it */
+	if (thread_simulating()) {
+		sim_stats.scripts++;
+		if (thread_sim_failed(vscript->sname, strlen(vscript->sname)))
+			vrrp_script_result(vscript, false, "failed", NULL, 0);
+		else
+			vrrp_script_result(vscript, true, "succeeded", NULL, 0);
+		vscript->init_state = SCRIPT_INIT_STATE_DONE;
+
+		return 0;
+	}
+
 	/* Execute the script in a child process. Parent returns, child doesn't */
 	ret = system_call_script(thread->master, vrrp_script_child_thread,
 				  vscript, (vscript->timeout) ? vscript->timeout : vscript->interval,
@@ -1150,7 +1255,7 @@ vrrp_script_child_thread(thread_t * thread)
 	char *script_exit_type = NULL;
 	bool script_success;
 	char *reason = NULL;
-	int reason_code;
+	int reason_code = 0;
 
 	if (thread->type == THREAD_CHILD_TIMEOUT) {
 		pid = THREAD_CHILD_PID(thread);
@@ -1223,30 +1328,8 @@ vrrp_script_child_thread(thread_t * thread)
 		script_success = false;
 	}
 
-	if (script_exit_type) {
-		if (script_success) {
-			if (vscript->result < vscript->rise - 1) {
-				vscript->result++;
-			} else {
-				if (vscript->result < vscript->rise)	/* i.e. == vscript->rise - 1 */
-					log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
-				vscript->result = vscript->rise + vscript->fall - 1;
-			}
-		} else {
-			if (vscript->result > vscript->rise) {
-				vscript->result--;
-			} else {
-				if (vscript->result == vscript->rise ||
-				    vscript->init_state == SCRIPT_INIT_STATE_INIT) {
-					if (reason)
-						log_message(LOG_INFO, "VRRP_Script(%s) %s (%s %d)", vscript->sname, script_exit_type, reason, reason_code);
-					else
-						log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
-				}
-				vscript->result = 0;
-			}
-		}
-	}
+	if (script_exit_type)
+		vrrp_script_result(vscript, script_success, script_exit_type, reason, reason_code);
 
 	vscript->state = SCRIPT_STATE_IDLE;
 	vscript->init_state = SCRIPT_INIT_STATE_DONE;
@@ -1254,83 +1337,57 @@ vrrp_script_child_thread(thread_t * thread)
 	return 0;
 }
 
-/* Delayed ARP/NA thread */
-int
-vrrp_arp_thread(thread_t *thread)
+/* Send what the interval allows from a delayed ARP/NA queue, and
+ * note when the next message on it can be sent */
+static void
+vrrp_arp_queue_run(garp_queue_t *queue, timeval_t *queue_next_time, bool ipv6, timeval_t *next_time)
 {
-	element e, a;
-	list l;
 	ip_address_t *ipaddress;
-	timeval_t next_time = {
-		.tv_sec = INT_MAX	/* We're never going to delay this long - I hope! */
-	};
-	interface_t *ifp;
 	vrrp_t *vrrp;
-	enum {
-		VIP,
-		EVIP
-	} i;
-
-	set_time_now();
-
-	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
-		vrrp = ELEMENT_DATA(e);
+	interface_t *ifp;
 
-		if (!vrrp->garp_pending && !vrrp->gna_pending)
-			continue;
+	while ((ipaddress = queue->head)) {
+		if (timer_cmp(time_now, *queue_next_time) < 0) {
+			if (timer_cmp(*queue_next_time, *next_time) < 0)
+				*next_time = *queue_next_time;
+			return;
+		}
 
-		vrrp->garp_pending = false;
-		vrrp->gna_pending = false;
+		vrrp = ipaddress->garp_vrrp;
+		garp_queue_remove(ipaddress);
 
 		if (vrrp->state != VRRP_STATE_MAST ||
-		    !vrrp->vipset)
+		    !vrrp->vipset ||
+		    !ipaddress->set)
 			continue;
 
-		for (i = VIP; i <= EVIP; i++) {
-			l = (i == VIP) ? vrrp->vip : vrrp->evip;
-
-			if (!LIST_ISEMPTY(l)) {
-				for (a = LIST_HEAD(l); a; ELEMENT_NEXT(a)) {
-					ipaddress = ELEMENT_DATA(a);
-					if (!ipaddress->garp_gna_pending)
-						continue;
-					if (!ipaddress->set) {
-						ipaddress->garp_gna_pending = false;
-						continue;
-					}
+		ifp = IF_BASE_IFP(ipaddress->ifp);
+		if (ipv6)
+			ndisc_send_unsolicited_na_immediate(ifp, ipaddress);
+		else
+			send_gratuitous_arp_immediate(ifp, ipaddress);
+	}
+}
 
-					ifp = IF_BASE_IFP(ipaddress->ifp);
+/* Delayed ARP/NA thread */
+int
+vrrp_arp_thread(thread_t *thread)
+{
+	element e;
+	garp_delay_t *delay;
+	timeval_t next_time = {
+		.tv_sec = INT_MAX	/* We're never going to delay this long - I hope! */
+	};
 
-					/* This should never happen */
-					if (!ifp->garp_delay) {
-						ipaddress->garp_gna_pending = false;
-						continue;
-					}
+	set_time_now();
 
-					if (!IP_IS6(ipaddress)) {
-						if (timer_cmp(time_now, ifp->garp_delay->garp_next_time) >= 0) {
-							send_gratuitous_arp_immediate(ifp, ipaddress);
-							ipaddress->garp_gna_pending = false;
-						}
-						else {
-							vrrp->garp_pending = true;
-							if (timer_cmp(ifp->garp_delay->garp_next_time, next_time) < 0)
-								next_time = ifp->garp_delay->garp_next_time;
-						}
-					}
-					else {
-						if (timer_cmp(time_now, ifp->garp_delay->gna_next_time) >= 0) {
-							ndisc_send_unsolicited_na_immediate(ifp, ipaddress);
-							ipaddress->garp_gna_pending = false;
-						}
-						else {
-							vrrp->gna_pending = true;
-							if (timer_cmp(ifp->garp_delay->gna_next_time, next_time) < 0)
-								next_time = ifp->garp_delay->gna_next_time;
-						}
-					}
-				}
-			}
+	/* Only the queues of each interface (group) need looking at */
+	if (!LIST_ISEMPTY(garp_delay)) {
+		for (e = LIST_HEAD(garp_delay); e; ELEMENT_NEXT(e)) {
+			delay = ELEMENT_DATA(e);
+
+			vrrp_arp_queue_run(&delay->garp_queue, &delay->garp_next_time, false, &next_time);
+			vrrp_arp_queue_run(&delay->gna_queue, &delay->gna_next_time, true, &next_time);
 		}
 	}
 
@@ -32,6 +32,58 @@
 #include "logger.h"
 #include "smtp.h"
 
+/* Add (delta 1) or remove (delta -1) an instance from its group's counts */
+static void
+vrrp_sync_count(vrrp_t *vrrp, int delta)
+{
+	vrrp_sgroup_t *vgroup = vrrp->sync;
+
+	if (vrrp->wantstate == VRRP_STATE_GOTO_MASTER ||
+	    vrrp->wantstate == VRRP_STATE_MAST)
+		vgroup->num_want_master += (unsigned)delta;
+	if (vrrp->wantstate == VRRP_STATE_GOTO_MASTER)
+		vgroup->num_want_goto_master += (unsigned)delta;
+
+	if (vrrp->state == VRRP_STATE_BACK)
+		vgroup->num_backup += (unsigned)delta;
+	else if (vrrp->state == VRRP_STATE_MAST)
+		vgroup->num_master += (unsigned)delta;
+	else if (vrrp->state == VRRP_STATE_FAULT)
+		vgroup->num_fault += (unsigned)delta;
+}
+
+/* All changes of state and wantstate go through here, so the sync
+ * group decisions don't need to look at every member */
+void
+vrrp_set_state(vrrp_t *vrrp, int state)
+{
+	if (vrrp->sync)
+		vrrp_sync_count(vrrp, -1);
+	vrrp->state = state;
+	if (vrrp->sync)
+		vrrp_sync_count(vrrp, 1);
+}
+
+void
+vrrp_set_wantstate(vrrp_t *vrrp, int wantstate)
+{
+	if (vrrp->sync)
+		vrrp_sync_count(vrrp, -1);
+	vrrp->wantstate = wantstate;
+	if (vrrp->sync)
+		vrrp_sync_count(vrrp, 1);
+}
+
+/* Are all the other members of the group already in state ? */
+static bool
+vrrp_sync_others_in_state(vrrp_t *vrrp, unsigned num_in_state, int state)
+{
+	if (vrrp->state != state)
+		num_in_state++;
+
+	return num_in_state == vrrp->sync->num_member;
+}
+
 /* Compute the new instance sands */
 void
 vrrp_init_instance_sands(vrrp_t * vrrp)
@@ -61,8 +113,8 @@ vrrp_init_instance_sands(vrrp_t * vrrp)
 }
 
 /* Instance name lookup */
-static vrrp_t *
-vrrp_get_instance(char *iname)
+vrrp_t *
+vrrp_get_instance(const char *iname)
 {
 	vrrp_t *vrrp;
 	list l = vrrp_data->vrrp;
@@ -99,6 +151,8 @@ vrrp_sync_set_group(vrrp_sgroup_t *vgroup)
 			else {
 				list_add(vgroup->index_list, vrrp);
 				vrrp->sync = vgroup;
+				vgroup->num_member++;
+				vrrp_sync_count(vrrp, 1);
 			}
 		}
 		else
@@ -120,20 +174,18 @@ vrrp_sync_group_up(vrrp_sgroup_t * vgroup)
 	vrrp_t *vrrp;
 	element e;
 	list l = vgroup->index_list;
-	unsigned int is_up = 0;
 
+	/* Tracked interfaces and scripts aren't state transitions, so this
+	 * can't be counted, but stop at the first member that is down */
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vrrp = ELEMENT_DATA(e);
-		if (VRRP_ISUP(vrrp))
-			is_up++;
+		if (!VRRP_ISUP(vrrp))
+			return 0;
 	}
 
-	if (is_up == LIST_SIZE(vgroup->index_list)) {
-		log_message(LOG_INFO, "Kernel is reporting: Group(%s) UP"
-			       , GROUP_NAME(vgroup));
-		return 1;
-	}
-	return 0;
+	log_message(LOG_INFO, "Kernel is reporting: Group(%s) UP"
+		       , GROUP_NAME(vgroup));
+	return 1;
 }
 
 /* SMTP alert group notifier */
@@ -170,10 +222,8 @@ vrrp_sync_leave_fault(vrrp_t * vrrp)
 int
 vrrp_sync_goto_master(vrrp_t * vrrp)
 {
-	vrrp_t *isync;
 	vrrp_sgroup_t *vgroup = vrrp->sync;
-	list l = vgroup->index_list;
-	element e;
+	unsigned others_want_master;
 
 	if (GROUP_STATE(vgroup) == VRRP_STATE_MAST)
 		return 1;
@@ -182,14 +232,12 @@ vrrp_sync_goto_master(vrrp_t * vrrp)
 
 	/* Only sync to master if everyone wants to
 	 * i.e. prefer backup state to avoid thrashing */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		isync = ELEMENT_DATA(e);
-		if (isync != vrrp && (isync->wantstate != VRRP_STATE_GOTO_MASTER &&
-				      isync->wantstate != VRRP_STATE_MAST)) {
-			return 0;
-		}
-	}
-	return 1;
+	others_want_master = vgroup->num_want_master;
+	if (vrrp->wantstate == VRRP_STATE_GOTO_MASTER ||
+	    vrrp->wantstate == VRRP_STATE_MAST)
+		others_want_master--;
+
+	return others_want_master == vgroup->num_member - 1;
 }
 
 void
@@ -208,12 +256,16 @@ vrrp_sync_master_election(vrrp_t * vrrp)
 	log_message(LOG_INFO, "VRRP_Group(%s) Transition to MASTER state",
 	       GROUP_NAME(vgroup));
 
+	/* A previous member's election has already forced all the others */
+	if (vgroup->num_want_goto_master == vgroup->num_member)
+		return;
+
 	/* Perform sync index */
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		isync = ELEMENT_DATA(e);
 		if (isync != vrrp && isync->wantstate != VRRP_STATE_GOTO_MASTER) {
 			/* Force a new protocol master election */
-			isync->wantstate = VRRP_STATE_GOTO_MASTER;
+			vrrp_set_wantstate(isync, VRRP_STATE_GOTO_MASTER);
 			log_message(LOG_INFO,
 			       "VRRP_Instance(%s) forcing a new MASTER election",
 			       isync->iname);
@@ -236,13 +288,15 @@ vrrp_sync_backup(vrrp_t * vrrp)
 	log_message(LOG_INFO, "VRRP_Group(%s) Syncing instances to BACKUP state",
 	       GROUP_NAME(vgroup));
 
-	/* Perform sync index */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		isync = ELEMENT_DATA(e);
-		if (isync != vrrp && isync->state != VRRP_STATE_BACK) {
-			isync->wantstate = VRRP_STATE_BACK;
-			vrrp_state_leave_master(isync);
-			vrrp_init_instance_sands(isync);
+	/* Perform sync index, unless the others are all there already */
+	if (!vrrp_sync_others_in_state(vrrp, vgroup->num_backup, VRRP_STATE_BACK)) {
+		for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+			isync = ELEMENT_DATA(e);
+			if (isync != vrrp && isync->state != VRRP_STATE_BACK) {
+				vrrp_set_wantstate(isync, VRRP_STATE_BACK);
+				vrrp_state_leave_master(isync);
+				vrrp_init_instance_sands(isync);
+			}
 		}
 	}
 	vgroup->state = VRRP_STATE_BACK;
@@ -269,15 +323,17 @@ vrrp_sync_master(vrrp_t * vrrp)
 	log_message(LOG_INFO, "VRRP_Group(%s) Syncing instances to MASTER state",
 	       GROUP_NAME(vgroup));
 
-	/* Perform sync index */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		isync = ELEMENT_DATA(e);
+	/* Perform sync index, unless the others are all there already */
+	if (!vrrp_sync_others_in_state(vrrp, vgroup->num_master, VRRP_STATE_MAST)) {
+		for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+			isync = ELEMENT_DATA(e);
 
-		/* Send the higher priority advert on all synced instances */
-		if (isync != vrrp && isync->state != VRRP_STATE_MAST) {
-			isync->wantstate = VRRP_STATE_MAST;
-			vrrp_state_goto_master(isync);
-			vrrp_init_instance_sands(isync);
+			/* Send the higher priority advert on all synced instances */
+			if (isync != vrrp && isync->state != VRRP_STATE_MAST) {
+				vrrp_set_wantstate(isync, VRRP_STATE_MAST);
+				vrrp_state_goto_master(isync);
+				vrrp_init_instance_sands(isync);
+			}
 		}
 	}
 	vgroup->state = VRRP_STATE_MAST;
@@ -302,21 +358,23 @@ vrrp_sync_fault(vrrp_t * vrrp)
 	log_message(LOG_INFO, "VRRP_Group(%s) Syncing instances to FAULT state",
 	       GROUP_NAME(vgroup));
 
-	/* Perform sync index */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		isync = ELEMENT_DATA(e);
-
-		/*
-		 * We force sync instance to backup mode.
-		 * This reduce instance takeover to less than ms_down_timer.
-		 * => by default ms_down_timer is set to 3secs.
-		 * => Takeover will be less than 3secs !
-		 */
-		if (isync != vrrp && isync->state != VRRP_STATE_FAULT) {
-			if (isync->state == VRRP_STATE_MAST)
-				isync->wantstate = VRRP_STATE_GOTO_FAULT;
-			if (isync->state == VRRP_STATE_BACK)
-				isync->state = VRRP_STATE_FAULT;
+	/* Perform sync index, unless the others are all there already */
+	if (!vrrp_sync_others_in_state(vrrp, vgroup->num_fault, VRRP_STATE_FAULT)) {
+		for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+			isync = ELEMENT_DATA(e);
+
+			/*
+			 * We force sync instance to backup mode.
+			 * This reduce instance takeover to less than ms_down_timer.
+			 * => by default ms_down_timer is set to 3secs.
+			 * => Takeover will be less than 3secs !
+			 */
+			if (isync != vrrp && isync->state != VRRP_STATE_FAULT) {
+				if (isync->state == VRRP_STATE_MAST)
+					vrrp_set_wantstate(isync, VRRP_STATE_GOTO_FAULT);
+				if (isync->state == VRRP_STATE_BACK)
+					vrrp_set_state(isync, VRRP_STATE_FAULT);
+			}
 		}
 	}
 	vgroup->state = VRRP_STATE_FAULT;
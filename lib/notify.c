@@ -203,6 +203,11 @@ notify_fifo_exec(thread_master_t *m, int (*func) (thread_t *), void *arg, const
 {
 	pid_t pid;
 
+	if (thread_simulating()) {
+		sim_stats.scripts++;
+		return 0;
+	}
+
 	if (log_file_name)
 		flush_log_file();
 
@@ -244,6 +249,12 @@ notify_exec(const notify_script_t *script)
 {
 	pid_t pid;
 
+	/* Scripts are not run when simulating */
+	if (thread_simulating()) {
+		sim_stats.scripts++;
+		return 0;
+	}
+
 	if (log_file_name)
 		flush_log_file();
 
@@ -41,6 +41,8 @@
 #include <sys/wait.h>
 #include <sys/select.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdint.h>
 
 #include "scheduler.h"
 #include "memory.h"
@@ -54,6 +56,20 @@ thread_master_t *master = NULL;
 #ifndef _DEBUG_
 prog_type_t prog_type;		/* Parent/VRRP/Checker process */
 #endif
+sim_stats_t sim_stats;		/* Counters reported in simulation mode */
+
+/* Simulation mode. The poll function decides which fds are ready, and
+ * instead of sleeping the virtual clock jumps to the end of the wait */
+static int (*sim_poll)(int, fd_set *, fd_set *, fd_set *, timeval_t *);
+static timeval_t sim_start;
+static struct timespec sim_cpu_start;
+
+/* Simulated failure burst: the percentage of objects that fail, and
+ * when, relative to the start of the simulation. A duration of 0 means
+ * until the end. */
+static unsigned sim_fail_percent;
+static unsigned long sim_fail_start;
+static unsigned long sim_fail_duration;
 
 #ifdef _WITH_LVS_
 #include "../keepalived/include/check_daemon.h"
@@ -274,19 +290,36 @@ thread_list_add_before(thread_list_t * list, thread_t * point, thread_t * thread
 	list->count++;
 }
 
-/* Add a thread in the list sorted by timeval */
+/* Add a new thread to the list. */
+static void
+thread_list_add_after(thread_list_t * list, thread_t * point, thread_t * thread)
+{
+	thread->prev = point;
+	thread->next = point->next;
+	if (point->next)
+		point->next->prev = thread;
+	else
+		list->tail = thread;
+	point->next = thread;
+	list->count++;
+}
+
+/* Add a thread in the list sorted by timeval. New threads nearly always
+ * expire after the ones already queued, so search from the tail. */
 static void
 thread_list_add_timeval(thread_list_t * list, thread_t * thread)
 {
 	thread_t *tt;
 
-	for (tt = list->head; tt; tt = tt->next) {
-		if (timer_cmp(thread->sands, tt->sands) <= 0)
+	for (tt = list->tail; tt; tt = tt->prev) {
+		if (timer_cmp(thread->sands, tt->sands) >= 0)
 			break;
 	}
 
 	if (tt)
-		thread_list_add_before(list, tt, thread);
+		thread_list_add_after(list, tt, thread);
+	else if (list->head)
+		thread_list_add_before(list, list->head, thread);
 	else
 		thread_list_add(list, thread);
 }
@@ -700,9 +733,20 @@ thread_compute_timer(thread_master_t * m, timeval_t * timer_wait)
 	}
 }
 
-/* Fetch next ready thread. */
-thread_t *
-thread_fetch(thread_master_t * m, thread_t * fetch)
+/* Hand a dequeued thread to the caller, recycling the original. */
+static thread_t *
+thread_move_to_fetch(thread_master_t * m, thread_t * thread, thread_t * fetch)
+{
+	*fetch = *thread;
+	thread->type = THREAD_UNUSED;
+	thread_add_unuse(m, thread);
+	return fetch;
+}
+
+/* Wait for fds/timers and move everything that has become ready
+ * onto the ready queue. */
+static void
+thread_poll(thread_master_t * m)
 {
 	int ret, old_errno;
 	thread_t *thread;
@@ -718,36 +762,9 @@ thread_fetch(thread_master_t * m, thread_t * fetch)
 #endif
 	bool timers_done;
 
-	assert(m != NULL);
-
 	/* Timer initialization */
 	memset(&timer_wait, 0, sizeof (timeval_t));
 
-retry:	/* When thread can't fetch try to find next thread again. */
-
-	/* If there is event process it first. */
-	while ((thread = thread_trim_head(&m->event))) {
-		*fetch = *thread;
-
-		/* If daemon hanging event is received return NULL pointer */
-		if (thread->type == THREAD_TERMINATE) {
-			thread->type = THREAD_UNUSED;
-			thread_add_unuse(m, thread);
-			return NULL;
-		}
-		thread->type = THREAD_UNUSED;
-		thread_add_unuse(m, thread);
-		return fetch;
-	}
-
-	/* If there is ready threads process them */
-	while ((thread = thread_trim_head(&m->ready))) {
-		*fetch = *thread;
-		thread->type = THREAD_UNUSED;
-		thread_add_unuse(m, thread);
-		return fetch;
-	}
-
 	/*
 	 * Re-read the current time to get the maximum accuracy.
 	 * Calculate select wait timer. Take care of timeouted fd.
@@ -777,10 +794,18 @@ retry:	/* When thread can't fetch try to find next thread again. */
 		memcpy(&timer_wait, &snmp_timer_wait, sizeof(timeval_t));
 #endif
 
-	ret = select(FD_SETSIZE, &readfd, &writefd, &exceptfd, &timer_wait);
+	if (sim_poll) {
+		ret = sim_poll(FD_SETSIZE, &readfd, &writefd, &exceptfd, &timer_wait);
+		old_errno = errno;
+		if (ret == 0)
+			timer_advance_virtual(timer_add(time_now, timer_wait));
+		sim_stats.polls++;
+	} else {
+		ret = select(FD_SETSIZE, &readfd, &writefd, &exceptfd, &timer_wait);
 
-	/* we have to save errno here because the next syscalls will set it */
-	old_errno = errno;
+		/* we have to save errno here because the next syscalls will set it */
+		old_errno = errno;
+	}
 
 	/* Handle SNMP stuff */
 #ifdef _WITH_SNMP_
@@ -893,23 +918,188 @@ retry:	/* When thread can't fetch try to find next thread again. */
 			break;
 	}
 
-	/* Return one event. */
-	thread = thread_trim_head(&m->ready);
-
 #ifdef _WITH_SNMP_
 	run_alarms();
 	netsnmp_check_outstanding_agent_requests();
 #endif
+}
 
-	/* There is no ready thread. */
-	if (!thread)
-		goto retry;
+/* Fetch next ready thread. */
+thread_t *
+thread_fetch(thread_master_t * m, thread_t * fetch)
+{
+	thread_t *thread;
 
-	*fetch = *thread;
-	thread->type = THREAD_UNUSED;
-	thread_add_unuse(m, thread);
+	assert(m != NULL);
 
-	return fetch;
+	while (true) {
+		/* If there is event process it first, then ready threads */
+		if ((thread = thread_trim_head(&m->event)) ||
+		    (thread = thread_trim_head(&m->ready))) {
+			thread_move_to_fetch(m, thread, fetch);
+
+			/* If daemon hanging event is received return NULL pointer */
+			if (fetch->type == THREAD_TERMINATE)
+				return NULL;
+			return fetch;
+		}
+
+		/* There is no ready thread, wait for one */
+		thread_poll(m);
+	}
+}
+
+/*
+ * Run all the threads made ready by a single poll before polling again,
+ * rather than going back through thread_fetch() for each one. Threads are
+ * left queued on m->ready until they are run, so a callback can still
+ * thread_cancel() a ready thread later in the same batch. Events queued by
+ * callbacks keep their priority over ready threads.
+ * Returns false if the terminate event has been received.
+ */
+bool
+thread_run_batch(thread_master_t * m)
+{
+	thread_t fetch;
+	thread_t *thread;
+	int batch;
+
+	assert(m != NULL);
+
+	if (!m->event.head && !m->ready.head)
+		thread_poll(m);
+
+	batch = m->ready.count;
+	while (true) {
+		while ((thread = thread_trim_head(&m->event))) {
+			thread_move_to_fetch(m, thread, &fetch);
+			if (fetch.type == THREAD_TERMINATE)
+				return false;
+			thread_call(&fetch);
+		}
+
+		if (batch-- <= 0 || !(thread = thread_trim_head(&m->ready)))
+			break;
+
+		thread_move_to_fetch(m, thread, &fetch);
+		thread_call(&fetch);
+	}
+
+	return true;
+}
+
+/* Default simulation poll function. Real fds (including the signal
+ * pipe) are still checked, but never waited for. */
+static int
+sim_default_poll(int nfds, fd_set *readfd, fd_set *writefd, fd_set *exceptfd, __attribute__((unused)) timeval_t *timer_wait)
+{
+	timeval_t no_wait = { 0, 0 };
+
+	return select(nfds, readfd, writefd, exceptfd, &no_wait);
+}
+
+bool
+thread_simulating(void)
+{
+	return !!sim_poll;
+}
+
+/* Log what the simulation has cost so far */
+void
+thread_sim_report(void)
+{
+	struct timespec cpu_now;
+	double sim_secs, cpu_secs;
+
+	if (!sim_poll)
+		return;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_now);
+	set_time_now();
+	sim_secs = timer_tol(timer_sub(time_now, sim_start)) / TIMER_HZ_FLOAT;
+	cpu_secs = (double)(cpu_now.tv_sec - sim_cpu_start.tv_sec) +
+		   (double)(cpu_now.tv_nsec - sim_cpu_start.tv_nsec) / 1000000000.0;
+
+	log_message(LOG_INFO, "Simulation: %.3f simulated secs, %.3f CPU secs (%.3f ms CPU per simulated sec)"
+			, sim_secs, cpu_secs, sim_secs > 0 ? cpu_secs * 1000 / sim_secs : 0.0);
+	log_message(LOG_INFO, "Simulation: polls %lu, threads run %lu, transitions %lu, netlink ops %lu, ipvs ops %lu"
+			, sim_stats.polls, sim_stats.threads_run, sim_stats.transitions
+			, sim_stats.netlink_ops, sim_stats.ipvs_ops);
+	log_message(LOG_INFO, "Simulation: adverts %lu, gratuitous ARPs/NAs %lu, scripts %lu not sent or run"
+			, sim_stats.adverts, sim_stats.arps, sim_stats.scripts);
+}
+
+/* Set the failure burst to inject when simulating */
+void
+thread_set_sim_failure(unsigned percent, unsigned long start, unsigned long duration)
+{
+	sim_fail_percent = percent;
+	sim_fail_start = start;
+	sim_fail_duration = duration;
+}
+
+/*
+ * Whether the object identified by key (e.g. a real server address or
+ * a track script name) is failed by the simulated failure burst at the
+ * current time. The objects chosen only depend on the key, so a
+ * scenario fails the same objects on every run.
+ */
+bool
+thread_sim_failed(const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	uint32_t hash = 2166136261U;
+	unsigned long elapsed;
+
+	if (!sim_poll || !sim_fail_percent)
+		return false;
+
+	elapsed = timer_tol(timer_sub(time_now, sim_start));
+	if (elapsed < sim_fail_start ||
+	    (sim_fail_duration && elapsed >= sim_fail_start + sim_fail_duration))
+		return false;
+
+	/* FNV-1a */
+	while (len--)
+		hash = (hash ^ *p++) * 16777619U;
+
+	return hash % 100 < sim_fail_percent;
+}
+
+static int
+sim_end_thread(__attribute__((unused)) thread_t *thread)
+{
+	thread_sim_report();
+	thread_add_terminate_event(master);
+
+	return 0;
+}
+
+/*
+ * Run the scheduler against a virtual clock, so that timers fire as fast
+ * as the CPU allows rather than in real time. poll_func, if not NULL,
+ * replaces select() and is how fd activity is injected. If duration is
+ * not 0, the statistics are reported and the scheduler terminated after
+ * that much simulated time.
+ *
+ * This must be called before the daemon is started, since from then on
+ * nothing that would change the kernel or reach the network is done.
+ */
+void
+thread_set_simulation(thread_master_t * m, unsigned long duration,
+		      int (*poll_func)(int, fd_set *, fd_set *, fd_set *, timeval_t *))
+{
+	sim_poll = poll_func ? poll_func : sim_default_poll;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+
+	timer_enable_virtual(timer_now());
+	sim_start = time_now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &sim_cpu_start);
+
+	if (duration)
+		thread_add_timer(m, sim_end_thread, NULL, duration);
+
+	log_message(LOG_INFO, "Running scheduler in simulation mode");
 }
 
 /* Synchronous signal handler to reap child processes */
@@ -982,6 +1172,8 @@ void
 thread_call(thread_t * thread)
 {
 	thread->id = thread_get_id();
+	if (sim_poll)
+		sim_stats.threads_run++;
 	(*thread->func) (thread);
 }
 
@@ -989,15 +1181,13 @@ thread_call(thread_t * thread)
 void
 launch_scheduler(void)
 {
-	thread_t thread;
-
 	signal_set(SIGCHLD, thread_child_handler, master);
 
 	/*
 	 * Processing the master thread queues,
-	 * return and execute one ready thread.
+	 * execute all threads made ready by each poll.
 	 */
-	while (thread_fetch(master, &thread)) {
+	while (thread_run_batch(master)) {
 		/* Run until error, used for debuging only */
 #if defined _DEBUG_ && defined _MEM_CHECK_
 		if (__test_bit(MEM_ERR_DETECT_BIT, &debug)
@@ -1012,6 +1202,5 @@ launch_scheduler(void)
 			thread_add_terminate_event(master);
 		}
 #endif
-		thread_call(&thread);
 	}
 }
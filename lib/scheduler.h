@@ -78,6 +78,18 @@ typedef struct _thread_master {
 	unsigned long alloc;
 } thread_master_t;
 
+/* Counters reported in simulation mode */
+typedef struct _sim_stats {
+	unsigned long polls;
+	unsigned long threads_run;
+	unsigned long transitions;	/* VRRP instance and real server state changes */
+	unsigned long netlink_ops;
+	unsigned long ipvs_ops;
+	unsigned long adverts;		/* VRRP adverts not sent */
+	unsigned long arps;		/* gratuitous ARPs and NAs not sent */
+	unsigned long scripts;		/* scripts not run */
+} sim_stats_t;
+
 /* Thread types. */
 #define THREAD_READ		0
 #define THREAD_WRITE		1
@@ -123,6 +135,7 @@ typedef enum {
 
 /* global vars exported */
 extern thread_master_t *master;
+extern sim_stats_t sim_stats;
 #ifndef _DEBUG_
 extern prog_type_t prog_type;		/* Parent/VRRP/Checker process */
 #endif
@@ -144,7 +157,13 @@ extern thread_t *thread_add_child(thread_master_t *, int (*func) (thread_t *), v
 extern thread_t *thread_add_event(thread_master_t *, int (*func) (thread_t *), void *, int);
 extern int thread_cancel(thread_t *);
 extern thread_t *thread_fetch(thread_master_t *, thread_t *);
+extern bool thread_run_batch(thread_master_t *);
 extern void thread_call(thread_t *);
 extern void launch_scheduler(void);
+extern void thread_set_simulation(thread_master_t *, unsigned long, int (*)(int, fd_set *, fd_set *, fd_set *, timeval_t *));
+extern bool thread_simulating(void);
+extern void thread_sim_report(void);
+extern void thread_set_sim_failure(unsigned, unsigned long, unsigned long);
+extern bool thread_sim_failed(const void *, size_t);
 
 #endif
@@ -30,6 +30,10 @@
 /* time_now holds current time */
 timeval_t time_now;
 
+/* Virtual clock used when the scheduler is run in simulation mode */
+static bool virtual_clock;
+static timeval_t virtual_time;
+
 /* set a timer to a specific value */
 timeval_t
 timer_dup(timeval_t b)
@@ -139,6 +143,11 @@ monotonic_gettimeofday(timeval_t *now)
 
 	timer_reset_lazy(*now);
 
+	if (virtual_clock) {
+		*now = virtual_time;
+		return 0;
+	}
+
 	gettimeofday(&sys_date, NULL);
 
 	/* on first call, we set mono_date to system date */
@@ -230,6 +239,24 @@ timer_add_now(timeval_t a)
 	return timer_add(time_now, a);
 }
 
+/* Switch to a virtual clock starting at start. Time then only moves
+ * when timer_advance_virtual() is called. */
+void
+timer_enable_virtual(timeval_t start)
+{
+	virtual_clock = true;
+	virtual_time = start;
+	time_now = start;
+}
+
+/* Move the virtual clock forward to t. The clock never goes backwards. */
+void
+timer_advance_virtual(timeval_t t)
+{
+	if (virtual_clock && timer_cmp(t, virtual_time) > 0)
+		virtual_time = t;
+}
+
 /* Return time as unsigned long */
 unsigned long
 timer_tol(timeval_t a)
@@ -25,6 +25,7 @@
 
 #include <sys/time.h>
 #include <limits.h>
+#include <stdbool.h>
 
 typedef struct timeval timeval_t;
 
@@ -62,6 +63,8 @@ extern timeval_t timer_add_long(timeval_t, unsigned long);
 extern timeval_t timer_sub_now(timeval_t);
 extern timeval_t timer_add_now(timeval_t);
 extern unsigned long timer_tol(timeval_t);
+extern void timer_enable_virtual(timeval_t);
+extern void timer_advance_virtual(timeval_t);
 #ifdef _INCLUDE_UNUSED_CODE_
 extern void timer_dump(timeval_t);
 #endif
@@ -26,6 +26,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdint.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #ifdef _WITH_STACKTRACE_
 #include <sys/types.h>
@@ -105,40 +108,161 @@ write_stacktrace(const char *file_name)
 }
 #endif
 
-/* Compute a checksum */
+/* Compute a checksum
+ *
+ * The ones' complement sum doesn't depend on the order the 16 bit words are
+ * added in, nor on adding them in 32 bit pairs and folding the carries back
+ * in at the end, so the bulk of the buffer is added in 32 bit lanes into a
+ * wider accumulator, using SSE2 or AVX2 where the CPU has them. The result
+ * is the same as adding one 16 bit word at a time.
+ */
+static uint64_t csum_add_init(const unsigned char *, size_t, uint64_t);
+static uint64_t (*csum_add)(const unsigned char *, size_t, uint64_t) = csum_add_init;
+
+/* Add the 16 bit words of buf, len is even */
+static uint64_t
+csum_add_scalar(const unsigned char *buf, size_t len, uint64_t sum)
+{
+	uint32_t w32;
+	uint16_t w16;
+
+	for (; len >= sizeof(w32); buf += sizeof(w32), len -= sizeof(w32)) {
+		memcpy(&w32, buf, sizeof(w32));
+		sum += w32;
+	}
+
+	if (len) {
+		memcpy(&w16, buf, sizeof(w16));
+		sum += w16;
+	}
+
+	return sum;
+}
+
+#ifdef __x86_64__
+/* Each block adds two 16 bit words to every 32 bit lane, one from the
+ * unpacklo and one from the unpackhi, so 32768 blocks can't overflow */
+#define CSUM_SIMD_BLOCKS	32768
+
+static uint64_t
+csum_add_sse2(const unsigned char *buf, size_t len, uint64_t sum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc, v;
+	uint32_t lanes[4];
+	size_t blocks;
+
+	while (len >= sizeof(v)) {
+		acc = zero;
+		for (blocks = 0; len >= sizeof(v) && blocks < CSUM_SIMD_BLOCKS; blocks++, buf += sizeof(v), len -= sizeof(v)) {
+			v = _mm_loadu_si128((const __m128i *)buf);
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+		}
+
+		_mm_storeu_si128((__m128i *)lanes, acc);
+		sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	return csum_add_scalar(buf, len, sum);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+csum_add_avx2(const unsigned char *buf, size_t len, uint64_t sum)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc, v;
+	uint32_t lanes[8];
+	size_t blocks;
+	unsigned i;
+
+	while (len >= sizeof(v)) {
+		acc = zero;
+		for (blocks = 0; len >= sizeof(v) && blocks < CSUM_SIMD_BLOCKS; blocks++, buf += sizeof(v), len -= sizeof(v)) {
+			v = _mm256_loadu_si256((const __m256i *)buf);
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+		}
+
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		for (i = 0; i < 8; i++)
+			sum += lanes[i];
+	}
+
+	/* Not the SSE2 code, to avoid the AVX to SSE transition penalty */
+	return csum_add_scalar(buf, len, sum);
+}
+#endif
+
+/* Select the checksum implementation; NULL selects the fastest the CPU
+ * supports. Returns false if the implementation isn't available. */
+bool
+in_csum_set_impl(const char *name)
+{
+#ifdef __x86_64__
+	__builtin_cpu_init();
+
+	if (!name) {
+		csum_add = __builtin_cpu_supports("avx2") ? csum_add_avx2 : csum_add_sse2;
+		return true;
+	}
+
+	if (!strcmp(name, "avx2")) {
+		if (!__builtin_cpu_supports("avx2"))
+			return false;
+		csum_add = csum_add_avx2;
+		return true;
+	}
+
+	if (!strcmp(name, "sse2")) {
+		csum_add = csum_add_sse2;
+		return true;
+	}
+#endif
+
+	if (!name || !strcmp(name, "scalar")) {
+		csum_add = csum_add_scalar;
+		return true;
+	}
+
+	return false;
+}
+
+static uint64_t
+csum_add_init(const unsigned char *buf, size_t len, uint64_t sum)
+{
+	in_csum_set_impl(NULL);
+
+	return csum_add(buf, len, sum);
+}
+
 uint16_t
 in_csum(const uint16_t *addr, size_t len, uint32_t csum, uint32_t *acc)
 {
-	register size_t nleft = len;
-	const uint16_t *w = addr;
-	register uint16_t answer;
-	register uint32_t sum = csum;
+	const unsigned char *buf = (const unsigned char *)addr;
+	uint64_t sum;
+	uint32_t sum32;
 
-	/*
-	 *  Our algorithm is simple, using a 32 bit accumulator (sum),
-	 *  we add sequential 16 bit words to it, and at the end, fold
-	 *  back all the carry bits from the top 16 bits into the lower
-	 *  16 bits.
-	 */
-	while (nleft > 1) {
-		sum += *w++;
-		nleft -= 2;
-	}
+	sum = csum_add(buf, len & ~(size_t)1, csum);
 
 	/* mop up an odd byte, if necessary */
-	if (nleft == 1)
-		sum += htons(*(u_char *) w << 8);
+	if (len & 1)
+		sum += htons(buf[len - 1] << 8);
+
+	/* Fold to 32 bits for the accumulator. This is only zero if
+	 * everything added was zero, as with a 16 bit at a time sum. */
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum32 = (uint32_t)((sum >> 32) + (sum & 0xffffffff));
 
 	if (acc)
-		*acc = sum;
+		*acc = sum32;
 
 	/*
 	 * add back carry outs from top 16 bits to low 16 bits
 	 */
-	sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
-	sum += (sum >> 16);			/* add carry */
-	answer = (~sum & 0xffff);		/* truncate to 16 bits */
-	return (answer);
+	sum32 = (sum32 >> 16) + (sum32 & 0xffff);	/* add hi 16 to low 16 */
+	sum32 += (sum32 >> 16);				/* add carry */
+	return (uint16_t)(~sum32 & 0xffff);		/* truncate to 16 bits */
 }
 
 /* IP network to ascii representation */
@@ -563,7 +687,6 @@ close_std_fd(void)
 	close(STDERR_FILENO);
 }
 
-#if !defined _HAVE_LIBIPTC_ || defined _LIBIPTC_DYNAMIC_
 int
 fork_exec(char **argv)
 {
@@ -604,4 +727,3 @@ fork_exec(char **argv)
 
 	return res;
 }
-#endif
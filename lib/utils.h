@@ -53,6 +53,7 @@ extern void dump_buffer(char *, size_t, FILE *);
 #ifdef _WITH_STACKTRACE_
 extern void write_stacktrace(const char *);
 #endif
+extern bool in_csum_set_impl(const char *);
 extern uint16_t in_csum(const uint16_t *, size_t, uint32_t, uint32_t *);
 extern char *inet_ntop2(uint32_t);
 extern uint32_t inet_stor(const char *);
@@ -73,8 +74,6 @@ extern char *get_local_name(void);
 extern int string_equal(const char *, const char *);
 extern void set_std_fd(bool);
 extern void close_std_fd(void);
-#if !defined _HAVE_LIBIPTC_ || defined _LIBIPTC_DYNAMIC_
 extern int fork_exec(char **argv);
-#endif
 
 #endif
@@ -0,0 +1,319 @@
+#! /bin/bash
+
+# Usage:
+#  checker-bench.sh [options]
+#
+# This script runs keepalived's checker process against a farm of N real
+# servers served by mock_backend in a network namespace, and measures:
+#  - the checker's CPU use in the steady state
+#  - how late checks run, from the interval between successive checks of
+#    each real server as seen by mock_backend, less delay_loop
+#  - state change latency: a percentage of the real servers are failed at
+#    once, and the time until keepalived reports each of them DOWN on its
+#    LVS notify FIFO is recorded.
+#
+# Every 1000 real servers are put in their own virtual server.
+#
+# The results are written to stdout as a single JSON object, so that
+# they can be collected and compared between runs.
+#
+# Requires root, iproute2, perl, the ip_vs kernel module and a C compiler
+# to build mock_backend.
+
+LANG=C
+
+TEST_DIR=$(dirname $0)
+: ${KEEPALIVED:=$TEST_DIR/../bin/keepalived}
+: ${MOCK_BACKEND:=$TEST_DIR/mock_backend}
+: ${CC:=gcc}
+
+NS=kabench-chk
+REAL_SERVERS=1000
+CHECK=http
+DELAY_LOOP=5
+CONNECT_TIMEOUT=3
+FAIL_PERCENT=10
+MEASURE_SECS=
+FAILOVER_TIMEOUT=
+ERROR_FAIL=
+MOCK_OPTS=
+KEEP_DIR=
+
+show_help()
+{
+	cat <<EOF
+$0 - Usage:
+	-h		Show this!
+	-n		number of real servers (default $REAL_SERVERS)
+	-t		check type: tcp, http, http2, https, smtp or dns (default $CHECK)
+	-d		delay_loop (default $DELAY_LOOP)
+	-c		connect_timeout (default $CONNECT_TIMEOUT)
+	-f		percentage of real servers to fail (default $FAIL_PERCENT)
+	-m		seconds to measure steady state CPU (default 3 x delay_loop)
+	-T		seconds to wait for the failures to be detected (default 3 x delay_loop + connect_timeout)
+	-e		fail with protocol errors rather than refusing connections
+	-o OPTS		additional mock_backend options, e.g. "-d 100 -b 65536"
+	-N		network namespace name (default $NS)
+	-k DIR		keep the config, logs and results in DIR
+EOF
+}
+
+while getopts ":hn:t:d:c:f:m:T:eo:N:k:" opt; do
+	case $opt in
+	h)
+		show_help
+		exit 0
+		;;
+	n)
+		REAL_SERVERS=$OPTARG
+		;;
+	t)
+		CHECK=$OPTARG
+		;;
+	d)
+		DELAY_LOOP=$OPTARG
+		;;
+	c)
+		CONNECT_TIMEOUT=$OPTARG
+		;;
+	f)
+		FAIL_PERCENT=$OPTARG
+		;;
+	m)
+		MEASURE_SECS=$OPTARG
+		;;
+	T)
+		FAILOVER_TIMEOUT=$OPTARG
+		;;
+	e)
+		ERROR_FAIL=-e
+		;;
+	o)
+		MOCK_OPTS=$OPTARG
+		;;
+	N)
+		NS=$OPTARG
+		;;
+	k)
+		KEEP_DIR=$OPTARG
+		;;
+	?)
+		echo Unknown option \'$OPTARG\' && show_help && exit 1
+		;;
+	esac
+done
+
+die()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+: ${MEASURE_SECS:=$((DELAY_LOOP * 3))}
+: ${FAILOVER_TIMEOUT:=$((DELAY_LOOP * 3 + CONNECT_TIMEOUT))}
+
+case $CHECK in
+tcp)	PORT=80 PROTO=tcp ;;
+http)	PORT=80 PROTO=http ;;
+http2)	PORT=80 PROTO=h2c ;;
+https)	PORT=443 PROTO=https ;;
+smtp)	PORT=25 PROTO=smtp ;;
+dns)	PORT=53 PROTO=dns ;;
+*)	die "Unknown check type $CHECK" ;;
+esac
+
+[[ $(id -u) -eq 0 ]] || die "root required"
+[[ -x $KEEPALIVED ]] || die "keepalived required (tried $KEEPALIVED)"
+which perl &>/dev/null || die "perl required"
+
+if [[ -n $KEEP_DIR ]]; then
+	DIR=$KEEP_DIR
+	mkdir -p $DIR || exit 1
+else
+	DIR=$(mktemp -d /tmp/checker-bench.XXXXXX)
+fi
+
+if [[ ! -x $MOCK_BACKEND ]]; then
+	MOCK_BACKEND=$DIR/mock_backend
+	$CC -O2 -o $MOCK_BACKEND $TEST_DIR/mock_backend.c -lssl -lcrypto || die "Cannot build mock_backend"
+fi
+
+BG_PIDS=
+MOCK_PID=
+
+cleanup()
+{
+	[[ -f $DIR/keepalived.pid ]] && kill $(cat $DIR/keepalived.pid) 2>/dev/null
+	[[ -n $MOCK_PID ]] && kill $MOCK_PID 2>/dev/null
+	for pid in $BG_PIDS; do
+		kill $pid 2>/dev/null
+	done
+	sleep 1
+	ip netns del $NS 2>/dev/null
+	[[ -z $KEEP_DIR ]] && rm -rf $DIR
+}
+
+trap cleanup EXIT
+
+# Real server number n, in 10.3.0.0 upwards
+rs_addr()
+{
+	local n=$1
+
+	echo 10.$(( (n >> 16) + 3 )).$(( (n >> 8) & 255 )).$(( n & 255 ))
+}
+
+gen_check()
+{
+	case $CHECK in
+	tcp)
+		echo "		TCP_CHECK {"
+		;;
+	http|http2|https)
+		[[ $CHECK = https ]] && echo "		SSL_GET {" || echo "		HTTP_GET {"
+		[[ $CHECK = http2 ]] && echo "			http2"
+		cat <<EOF
+			url {
+				path /
+				status_code 200
+			}
+EOF
+		;;
+	smtp)
+		echo "		SMTP_CHECK {"
+		;;
+	dns)
+		cat <<EOF
+		DNS_CHECK {
+			type A
+			name example.com
+EOF
+		;;
+	esac
+	cat <<EOF
+			connect_timeout $CONNECT_TIMEOUT
+			retry 0
+		}
+EOF
+}
+
+gen_config()
+{
+	local vs rs
+
+	cat <<EOF
+global_defs {
+	router_id checker_bench
+	lvs_notify_fifo $DIR/notify.fifo
+}
+
+EOF
+
+	for ((vs = 0; vs * 1000 < REAL_SERVERS; vs++)); do
+		cat <<EOF
+virtual_server 10.254.$((vs >> 8)).$((vs & 255)) $PORT {
+	delay_loop $DELAY_LOOP
+	lb_algo rr
+	lb_kind DR
+	protocol $([[ $CHECK = dns ]] && echo UDP || echo TCP)
+
+EOF
+		for ((rs = vs * 1000; rs < (vs + 1) * 1000 && rs < REAL_SERVERS; rs++)); do
+			echo "	real_server $(rs_addr $rs) $PORT {"
+			gen_check
+			echo "	}"
+		done
+		echo "}"
+	done
+}
+
+now()
+{
+	date +%s.%N
+}
+
+cpu_ticks()
+{
+	awk '{ print $14 + $15 }' /proc/$1/stat 2>/dev/null
+}
+
+# Build the namespace with all the real server addresses on lo
+ip netns del $NS 2>/dev/null
+ip netns add $NS || exit 1
+ip -n $NS link set up lo
+for ((rs = 0; rs < REAL_SERVERS; rs++)); do
+	echo "addr add $(rs_addr $rs)/32 dev lo"
+done | ip -n $NS -batch - || die "Cannot add real server addresses"
+
+# Start the farm
+MOCK_CERT=
+if [[ $CHECK = https ]]; then
+	openssl req -x509 -newkey rsa:2048 -nodes -keyout $DIR/key.pem -out $DIR/cert.pem \
+		-days 1 -subj /CN=mock_backend &>/dev/null || die "Cannot create certificate"
+	MOCK_CERT="-C $DIR/cert.pem -K $DIR/key.pem"
+fi
+>$DIR/fail.txt
+ip netns exec $NS $MOCK_BACKEND -l $(rs_addr 0)-$(rs_addr $((REAL_SERVERS - 1))):$PORT:$PROTO \
+	-F $DIR/fail.txt $ERROR_FAIL $MOCK_CERT $MOCK_OPTS >$DIR/backend.json &
+MOCK_PID=$!
+
+# Timestamp every LVS notification
+mkfifo $DIR/notify.fifo
+perl -MTime::HiRes=time -ne '$| = 1; printf "%.6f %s", time, $_' <$DIR/notify.fifo >$DIR/notify.txt &
+BG_PIDS="$BG_PIDS $!"
+
+gen_config >$DIR/keepalived.conf
+ip netns exec $NS $KEEPALIVED -n -C -G -f $DIR/keepalived.conf \
+	-p $DIR/keepalived.pid -c $DIR/checkers.pid \
+	--log-file=$DIR/keepalived.log &
+
+# Let the checkers settle
+sleep $((DELAY_LOOP * 2))
+CHECKER_PID=$(cat $DIR/checkers.pid 2>/dev/null)
+[[ -n $CHECKER_PID && -d /proc/$CHECKER_PID ]] || die "keepalived checker process is not running"
+
+# Steady state CPU
+t_start=$(now)
+cpu_before=$(cpu_ticks $CHECKER_PID)
+sleep $MEASURE_SECS
+cpu_after=$(cpu_ticks $CHECKER_PID)
+t_end=$(now)
+hz=$(getconf CLK_TCK)
+cpu_ms_per_sec=$(awk -v c=$((cpu_after - cpu_before)) -v hz=$hz -v a=$t_start -v b=$t_end \
+	'BEGIN { printf "%.1f", c * 1000 / hz / (b - a) }')
+
+# Fail a percentage of the real servers
+FAILED=$((REAL_SERVERS * FAIL_PERCENT / 100))
+for ((rs = 0; rs < FAILED; rs++)); do
+	rs_addr $rs
+done >$DIR/fail.txt
+t0=$(now)
+kill -HUP $MOCK_PID
+
+start=$SECONDS
+completed=true
+while [[ $(grep -c " DOWN$" $DIR/notify.txt) -lt $FAILED ]]; do
+	if [[ $((SECONDS - start)) -ge $FAILOVER_TIMEOUT ]]; then
+		completed=false
+		break
+	fi
+	sleep 0.2
+done
+cpu_failover=$(cpu_ticks $CHECKER_PID)
+
+awk -v t0=$t0 '/^[0-9.]* RS .* DOWN$/ && $1 >= t0 { printf "%.1f\n", ($1 - t0) * 1000 }' $DIR/notify.txt | sort -n >$DIR/down-latency.txt
+detected=$(wc -l <$DIR/down-latency.txt)
+pct()
+{
+	[[ $detected -eq 0 ]] && echo null && return
+	sed -n "$(awk -v p=$1 -v n=$detected 'BEGIN { i = int(p * (n - 1) + 0.5) + 1; print i }')p" $DIR/down-latency.txt
+}
+
+kill $MOCK_PID
+wait $MOCK_PID 2>/dev/null
+MOCK_PID=
+
+cat <<EOF
+{"real_servers": $REAL_SERVERS, "check": "$CHECK", "delay_loop": $DELAY_LOOP, "connect_timeout": $CONNECT_TIMEOUT, "cpu_ms_per_sec": $cpu_ms_per_sec, "failover_cpu_ms": $(( (cpu_failover - cpu_after) * 1000 / hz )), "failed": $FAILED, "detected": $detected, "completed": $completed, "down_latency_ms": {"p50": $(pct 0.5), "p90": $(pct 0.9), "p99": $(pct 0.99), "max": $(pct 1)}, "backend": $(cat $DIR/backend.json)}
+EOF
+echo "Check lateness is backend.interval_ms less delay_loop ($((DELAY_LOOP * 1000)) ms)" >&2
@@ -0,0 +1,155 @@
+/*
+ * csum-bench - verify and time the in_csum() implementations.
+ *
+ * Each implementation selectable with in_csum_set_impl() is checked to
+ * give bit for bit the same result as the original 16 bit at a time loop,
+ * over random data, lengths (odd and even), alignments, chained sums via
+ * the accumulator, and all zero and all ones buffers. The sizes of typical
+ * VRRP adverts and full frames are then timed.
+ *
+ * Build (after building keepalived):
+ *   gcc -O2 -fcommon -I lib -o csum-bench test/csum-bench.c lib/liblib.a
+ *
+ * Usage: csum-bench [iterations]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "utils.h"
+
+#define MAX_LEN		9000
+#define MAX_ALIGN	32
+
+static const char *impls[] = { "scalar", "sse2", "avx2" };
+static const size_t bench_sizes[] = { 40, 64, 128, 256, 576, 1024, 1500 };
+
+/* The original in_csum() */
+static uint16_t
+ref_csum(const uint16_t *addr, size_t len, uint32_t csum, uint32_t *acc)
+{
+	size_t nleft = len;
+	const uint16_t *w = addr;
+	uint32_t sum = csum;
+
+	while (nleft > 1) {
+		sum += *w++;
+		nleft -= 2;
+	}
+
+	if (nleft == 1)
+		sum += htons(*(const u_char *)w << 8);
+
+	if (acc)
+		*acc = sum;
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return (uint16_t)(~sum & 0xffff);
+}
+
+static bool
+check(const char *impl, const unsigned char *buf, size_t len, size_t split)
+{
+	uint32_t acc, ref_acc;
+	uint16_t res, ref;
+
+	/* Single buffer */
+	ref = ref_csum((const uint16_t *)buf, len, 0, NULL);
+	res = in_csum((const uint16_t *)buf, len, 0, NULL);
+	if (res != ref) {
+		fprintf(stderr, "%s: len %zu align %zu: 0x%4.4x, expected 0x%4.4x\n",
+			impl, len, (size_t)((uintptr_t)buf % MAX_ALIGN), res, ref);
+		return false;
+	}
+
+	/* Chained, as for a pseudo header followed by the packet */
+	split &= ~(size_t)1;
+	if (split > len)
+		return true;
+	ref_csum((const uint16_t *)buf, split, 0, &ref_acc);
+	ref = ref_csum((const uint16_t *)(buf + split), len - split, ref_acc, NULL);
+	in_csum((const uint16_t *)buf, split, 0, &acc);
+	res = in_csum((const uint16_t *)(buf + split), len - split, acc, NULL);
+	if (res != ref) {
+		fprintf(stderr, "%s: len %zu split %zu: 0x%4.4x, expected 0x%4.4x\n",
+			impl, len, split, res, ref);
+		return false;
+	}
+
+	return true;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	static unsigned char data[MAX_LEN + MAX_ALIGN];
+	unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	volatile uint16_t sink;
+	unsigned long n;
+	size_t i, j, len, align;
+	bool ok = true;
+	double t;
+
+	srandom(1);
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (!in_csum_set_impl(impls[i])) {
+			printf("%s: not available\n", impls[i]);
+			continue;
+		}
+
+		for (j = 0; j < 20000 && ok; j++) {
+			for (len = 0; len < sizeof(data); len++)
+				data[len] = (unsigned char)random();
+			len = j < MAX_LEN ? j : (size_t)random() % MAX_LEN;
+			align = j % MAX_ALIGN;
+			ok = check(impls[i], data + align, len, (size_t)random() % (len + 1));
+		}
+
+		for (j = 0; j < 2 && ok; j++) {
+			memset(data, j ? 0xff : 0, sizeof(data));
+			for (len = 0; len < MAX_LEN && ok; len += 7)
+				ok = check(impls[i], data + len % MAX_ALIGN, len, len / 2);
+		}
+
+		if (!ok)
+			break;
+
+		printf("%s:", impls[i]);
+		for (j = 0; j < sizeof(bench_sizes) / sizeof(bench_sizes[0]); j++) {
+			t = now();
+			for (n = 0; n < iterations; n++)
+				sink = in_csum((const uint16_t *)data, bench_sizes[j], 0, NULL);
+			t = now() - t;
+			printf(" %zu: %.1fns", bench_sizes[j], t * 1e9 / iterations);
+		}
+		printf("\n");
+	}
+
+	(void)sink;
+
+	if (!ok) {
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("All implementations match the reference\n");
+	return 0;
+}
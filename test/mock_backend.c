@@ -0,0 +1,1292 @@
+/*
+ * mock_backend - an epoll based fake server farm for load testing the
+ * keepalived checkers.
+ *
+ * It listens on any number of addresses and ports, and serves TCP (accept
+ * only), HTTP, HTTPS, HTTP/2 cleartext (prior knowledge), SMTP, DNS and
+ * UDP echo. Listeners can be made to fail
+ * on demand, either by refusing connections (the listening socket is
+ * closed) or, with -e, by returning a protocol error.
+ *
+ * On SIGTERM/SIGINT a JSON summary is written to stdout, including the
+ * distribution of the interval between successive checks of the same
+ * listener, from which checker lateness can be derived.
+ *
+ * Build: gcc -O2 -o mock_backend mock_backend.c -lssl -lcrypto
+ *
+ * Signals:
+ *   SIGHUP	re-read the fail file (-F)
+ *   SIGUSR1	fail all listeners
+ *   SIGUSR2	restore all listeners
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#define MAX_EVENTS	1024
+#define IN_BUF_SIZE	4096
+#define CHUNK_SIZE	8192
+
+/* HTTP/2 (RFC 7540) */
+#define H2_PREFACE		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN		24
+#define H2_FRAME_HEADER_LEN	9
+#define H2_MAX_FRAME_SIZE	16384
+#define H2_DATA			0x0
+#define H2_HEADERS		0x1
+#define H2_SETTINGS		0x4
+#define H2_FLAG_ACK		0x01
+#define H2_FLAG_END_STREAM	0x01
+#define H2_FLAG_END_HEADERS	0x04
+
+/* A header value too large for the default 4096 byte HPACK table */
+#define H2_EVICT_VALUE_LEN	4100
+
+enum proto {
+	PROTO_TCP,
+	PROTO_HTTP,
+	PROTO_HTTPS,
+	PROTO_H2C,
+	PROTO_SMTP,
+	PROTO_DNS,
+	PROTO_UDP,
+};
+
+static const char *proto_names[] = { "tcp", "http", "https", "h2c", "smtp", "dns", "udp" };
+
+enum src_type {
+	SRC_LISTENER,
+	SRC_CONN,
+	SRC_SIGNAL,
+};
+
+typedef struct _listener {
+	enum src_type type;		/* Must be first */
+	int fd;
+	enum proto proto;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	bool failing;
+	double last_check;
+	unsigned long checks;
+} listener_t;
+
+enum conn_state {
+	CONN_READING,
+	CONN_DELAYED,
+	CONN_WRITING,
+};
+
+typedef struct _conn {
+	enum src_type type;		/* Must be first */
+	int fd;
+	listener_t *l;
+	SSL *ssl;
+	enum conn_state state;
+	char in[IN_BUF_SIZE];
+	size_t in_len;
+	char *out;
+	size_t out_len;
+	size_t out_off;
+	bool close_after;
+	bool h2_preface;		/* HTTP/2 connection preface received */
+	bool want_write;
+	bool registered;
+	double due;
+	struct _conn *next;		/* delay queue */
+
+	/* datagram replies */
+	bool dgram;
+	struct sockaddr_storage peer;
+	socklen_t peer_len;
+} conn_t;
+
+/* Options */
+static int http_status = 200;
+static size_t body_size = 64;
+static unsigned delay_ms;
+static bool chunked;
+static bool fail_with_error;
+static const char *cert_file;
+static const char *key_file;
+static const char *fail_file;
+static bool verbose;
+
+static int epfd;
+static SSL_CTX *ssl_ctx;
+static listener_t **listeners;
+static listener_t **listeners_by_addr;
+static size_t num_listeners;
+static conn_t *delay_head, *delay_tail;
+
+/* Statistics */
+static unsigned long stats_checks[PROTO_UDP + 1];
+static unsigned long stats_errors_sent;
+static unsigned long stats_refused_listeners;
+static double *intervals;
+static size_t num_intervals, max_intervals;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [OPTION...] -l ADDR[-ADDR]:PORT[-PORT]:PROTO ...\n", prog);
+	fprintf(stderr, "  -l LISTEN   listen on the IPv4 address range/IPv6 address and port range\n");
+	fprintf(stderr, "              PROTO is one of tcp, http, https, h2c, smtp, dns, udp\n");
+	fprintf(stderr, "  -s STATUS   HTTP status code to return (default 200)\n");
+	fprintf(stderr, "  -b SIZE     HTTP body size in bytes (default 64)\n");
+	fprintf(stderr, "  -d MSECS    delay before responding\n");
+	fprintf(stderr, "  -k          use chunked transfer encoding for HTTP\n");
+	fprintf(stderr, "  -C FILE     TLS certificate (PEM) for https\n");
+	fprintf(stderr, "  -K FILE     TLS private key (PEM) for https\n");
+	fprintf(stderr, "  -F FILE     file of addresses to fail, re-read on SIGHUP\n");
+	fprintf(stderr, "  -e          fail with a protocol error rather than refusing connections\n");
+	fprintf(stderr, "  -v          verbose\n");
+}
+
+static void
+add_interval(double interval)
+{
+	if (num_intervals == max_intervals) {
+		max_intervals = max_intervals ? max_intervals * 2 : 65536;
+		intervals = realloc(intervals, max_intervals * sizeof(*intervals));
+		if (!intervals) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	intervals[num_intervals++] = interval;
+}
+
+static void
+record_check(listener_t *l)
+{
+	double t = now();
+
+	if (l->checks)
+		add_interval(t - l->last_check);
+	l->last_check = t;
+	l->checks++;
+	stats_checks[l->proto]++;
+}
+
+static void
+epoll_set(int fd, void *ptr, uint32_t events, int op)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(epfd, op, fd, &ev) && op != EPOLL_CTL_DEL) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static bool
+listener_open(listener_t *l)
+{
+	int one = 1;
+	bool stream = l->proto != PROTO_DNS && l->proto != PROTO_UDP;
+
+	l->fd = socket(l->addr.ss_family, (stream ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (l->fd < 0) {
+		perror("socket");
+		return false;
+	}
+
+	setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (l->addr.ss_family == AF_INET6)
+		setsockopt(l->fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one));
+
+	if (bind(l->fd, (struct sockaddr *)&l->addr, l->addr_len) ||
+	    (stream && listen(l->fd, 128))) {
+		perror("bind/listen");
+		close(l->fd);
+		l->fd = -1;
+		return false;
+	}
+
+	epoll_set(l->fd, l, EPOLLIN, EPOLL_CTL_ADD);
+
+	return true;
+}
+
+static void
+listener_close(listener_t *l)
+{
+	if (l->fd < 0)
+		return;
+
+	epoll_set(l->fd, NULL, 0, EPOLL_CTL_DEL);
+	close(l->fd);
+	l->fd = -1;
+}
+
+static void
+listener_set_failing(listener_t *l, bool failing)
+{
+	if (l->failing == failing)
+		return;
+
+	l->failing = failing;
+
+	if (fail_with_error && l->proto != PROTO_TCP && l->proto != PROTO_UDP)
+		return;
+
+	if (failing) {
+		listener_close(l);
+		stats_refused_listeners++;
+	} else
+		listener_open(l);
+}
+
+static int
+cmp_addr(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return a->ss_family < b->ss_family ? -1 : 1;
+	if (a->ss_family == AF_INET)
+		return memcmp(&((const struct sockaddr_in *)a)->sin_addr, &((const struct sockaddr_in *)b)->sin_addr, sizeof(struct in_addr));
+	return memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr, &((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+}
+
+static int
+cmp_listener_addr(const void *a, const void *b)
+{
+	return cmp_addr(&(*(listener_t * const *)a)->addr, &(*(listener_t * const *)b)->addr);
+}
+
+/* Index the listeners by address, so that the fail file can be applied
+ * quickly enough not to distort state change timings */
+static void
+index_listeners(void)
+{
+	listeners_by_addr = malloc(num_listeners * sizeof(*listeners_by_addr));
+	memcpy(listeners_by_addr, listeners, num_listeners * sizeof(*listeners_by_addr));
+	qsort(listeners_by_addr, num_listeners, sizeof(*listeners_by_addr), cmp_listener_addr);
+}
+
+/* Index in listeners_by_addr of the first listener on addr, or num_listeners */
+static size_t
+find_listener(const struct sockaddr_storage *addr)
+{
+	size_t lo = 0, hi = num_listeners, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cmp_addr(&listeners_by_addr[mid]->addr, addr) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < num_listeners && !cmp_addr(&listeners_by_addr[lo]->addr, addr) ? lo : num_listeners;
+}
+
+static bool
+parse_addr(const char *str, struct sockaddr_storage *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	if (inet_pton(AF_INET, str, &((struct sockaddr_in *)addr)->sin_addr) == 1) {
+		addr->ss_family = AF_INET;
+		return true;
+	}
+	if (inet_pton(AF_INET6, str, &((struct sockaddr_in6 *)addr)->sin6_addr) == 1) {
+		addr->ss_family = AF_INET6;
+		return true;
+	}
+
+	return false;
+}
+
+static void
+read_fail_file(void)
+{
+	FILE *fp;
+	char line[128];
+	struct sockaddr_storage addr;
+	size_t i, len;
+	bool *fail;
+
+	if (!fail_file)
+		return;
+
+	if (!(fp = fopen(fail_file, "r"))) {
+		perror(fail_file);
+		return;
+	}
+
+	fail = calloc(num_listeners, sizeof(*fail));
+
+	while (fgets(line, sizeof(line), fp)) {
+		len = strcspn(line, " \t\r\n#");
+		line[len] = '\0';
+		if (!len)
+			continue;
+		if (!parse_addr(line, &addr)) {
+			fprintf(stderr, "Invalid address %s in %s\n", line, fail_file);
+			continue;
+		}
+		for (i = find_listener(&addr); i < num_listeners && !cmp_addr(&listeners_by_addr[i]->addr, &addr); i++)
+			fail[i] = true;
+	}
+	fclose(fp);
+
+	for (i = 0; i < num_listeners; i++)
+		listener_set_failing(listeners_by_addr[i], fail[i]);
+
+	free(fail);
+}
+
+static void
+add_listener(const struct sockaddr_storage *addr, uint16_t port, enum proto proto)
+{
+	listener_t *l = calloc(1, sizeof(*l));
+
+	l->type = SRC_LISTENER;
+	l->proto = proto;
+	l->addr = *addr;
+	if (addr->ss_family == AF_INET) {
+		((struct sockaddr_in *)&l->addr)->sin_port = htons(port);
+		l->addr_len = sizeof(struct sockaddr_in);
+	} else {
+		((struct sockaddr_in6 *)&l->addr)->sin6_port = htons(port);
+		l->addr_len = sizeof(struct sockaddr_in6);
+	}
+
+	if (!listener_open(l))
+		exit(EXIT_FAILURE);
+
+	if (!(num_listeners % 1024))
+		listeners = realloc(listeners, (num_listeners + 1024) * sizeof(*listeners));
+	listeners[num_listeners++] = l;
+}
+
+/* ADDR[-ADDR]:PORT[-PORT]:PROTO, with IPv6 addresses in []s */
+static bool
+parse_listen(char *spec)
+{
+	char *addr_str, *port_str, *proto_str, *end, *p;
+	struct sockaddr_storage first, last, addr;
+	unsigned long port_first, port_last, port;
+	uint32_t a, a_last;
+	enum proto proto;
+
+	if (spec[0] == '[') {
+		addr_str = spec + 1;
+		if (!(p = strchr(addr_str, ']')) || p[1] != ':')
+			return false;
+		*p = '\0';
+		port_str = p + 2;
+	} else {
+		addr_str = spec;
+		if (!(p = strchr(spec, ':')))
+			return false;
+		*p = '\0';
+		port_str = p + 1;
+	}
+
+	if (!(proto_str = strchr(port_str, ':')))
+		return false;
+	*proto_str++ = '\0';
+
+	for (proto = PROTO_TCP; proto <= PROTO_UDP; proto++) {
+		if (!strcmp(proto_str, proto_names[proto]))
+			break;
+	}
+	if (proto > PROTO_UDP)
+		return false;
+
+	port_first = strtoul(port_str, &end, 10);
+	port_last = *end == '-' ? strtoul(end + 1, &end, 10) : port_first;
+	if (*end || !port_first || port_last > 65535 || port_last < port_first)
+		return false;
+
+	if ((p = strchr(addr_str, '-')))
+		*p++ = '\0';
+	if (!parse_addr(addr_str, &first))
+		return false;
+	if (p) {
+		if (!parse_addr(p, &last) || first.ss_family != AF_INET || last.ss_family != AF_INET)
+			return false;
+	} else
+		last = first;
+
+	if (first.ss_family == AF_INET6) {
+		for (port = port_first; port <= port_last; port++)
+			add_listener(&first, (uint16_t)port, proto);
+		return true;
+	}
+
+	a_last = ntohl(((struct sockaddr_in *)&last)->sin_addr.s_addr);
+	for (a = ntohl(((struct sockaddr_in *)&first)->sin_addr.s_addr); a <= a_last; a++) {
+		memset(&addr, 0, sizeof(addr));
+		addr.ss_family = AF_INET;
+		((struct sockaddr_in *)&addr)->sin_addr.s_addr = htonl(a);
+		for (port = port_first; port <= port_last; port++)
+			add_listener(&addr, (uint16_t)port, proto);
+		if (a == UINT32_MAX)
+			break;
+	}
+
+	return true;
+}
+
+static void
+conn_free(conn_t *c)
+{
+	if (!c->dgram) {
+		if (c->registered)
+			epoll_set(c->fd, NULL, 0, EPOLL_CTL_DEL);
+		if (c->ssl)
+			SSL_free(c->ssl);
+		close(c->fd);
+	}
+	free(c->out);
+	free(c);
+}
+
+static void
+conn_update_events(conn_t *c)
+{
+	uint32_t events;
+
+	if (c->dgram)
+		return;
+
+	/* Stop watching the socket while the response is delayed */
+	if (c->state == CONN_DELAYED) {
+		if (c->registered)
+			epoll_set(c->fd, NULL, 0, EPOLL_CTL_DEL);
+		c->registered = false;
+		return;
+	}
+
+	events = c->want_write || c->state == CONN_WRITING ? EPOLLOUT : EPOLLIN;
+	epoll_set(c->fd, c, events, c->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+	c->registered = true;
+}
+
+static void
+set_output(conn_t *c, char *buf, size_t len, bool close_after)
+{
+	free(c->out);
+	c->out = buf;
+	c->out_len = len;
+	c->out_off = 0;
+	c->close_after = close_after;
+	c->state = CONN_WRITING;
+}
+
+static void
+set_output_str(conn_t *c, const char *str, bool close_after)
+{
+	set_output(c, strdup(str), strlen(str), close_after);
+}
+
+/* Add to any output not yet sent */
+static void
+append_output(conn_t *c, const void *buf, size_t len, bool close_after)
+{
+	if (c->state != CONN_WRITING) {
+		set_output(c, memcpy(malloc(len), buf, len), len, close_after);
+		return;
+	}
+
+	c->out = realloc(c->out, c->out_len + len);
+	memcpy(c->out + c->out_len, buf, len);
+	c->out_len += len;
+	c->close_after |= close_after;
+}
+
+static void
+append_output_str(conn_t *c, const char *str, bool close_after)
+{
+	append_output(c, str, strlen(str), close_after);
+}
+
+static void
+build_http_response(conn_t *c)
+{
+	static const char pattern[] = "0123456789abcdef";
+	char header[256];
+	int status = c->l->failing ? 503 : http_status;
+	bool keepalive = !c->l->failing && strcasestr(c->in, "Connection: keep-alive");
+	const char *connection = keepalive ? "keep-alive" : "close";
+	size_t hlen, len, off, i, chunk;
+	char *buf;
+
+	/* A kept alive connection reads the next request from scratch */
+	c->in_len = 0;
+
+	if (c->l->failing)
+		stats_errors_sent++;
+
+	if (chunked)
+		hlen = (size_t)snprintf(header, sizeof(header),
+			"HTTP/1.1 %d %s\r\nServer: mock_backend\r\nContent-Type: text/plain\r\n"
+			"Transfer-Encoding: chunked\r\nConnection: %s\r\n\r\n",
+			status, status == 200 ? "OK" : "Status", connection);
+	else
+		hlen = (size_t)snprintf(header, sizeof(header),
+			"HTTP/1.1 %d %s\r\nServer: mock_backend\r\nContent-Type: text/plain\r\n"
+			"Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+			status, status == 200 ? "OK" : "Status", body_size, connection);
+
+	/* Worst case chunk overhead is 12 bytes per chunk plus the trailer */
+	len = hlen + body_size + (chunked ? (body_size / CHUNK_SIZE + 1) * 12 + 5 : 0);
+	buf = malloc(len);
+	memcpy(buf, header, hlen);
+	off = hlen;
+
+	for (i = 0; i < body_size; i += chunk) {
+		chunk = body_size - i < CHUNK_SIZE ? body_size - i : CHUNK_SIZE;
+		if (chunked)
+			off += (size_t)sprintf(buf + off, "%zx\r\n", chunk);
+		for (size_t j = 0; j < chunk; j++)
+			buf[off++] = pattern[(i + j) % 16];
+		if (chunked) {
+			buf[off++] = '\r';
+			buf[off++] = '\n';
+		}
+	}
+	if (chunked) {
+		memcpy(buf + off, "0\r\n\r\n", 5);
+		off += 5;
+	}
+
+	set_output(c, buf, off, !keepalive);
+}
+
+static void
+h2_put_frame(conn_t *c, uint8_t type, uint8_t flags, uint32_t stream_id, const void *payload, size_t len)
+{
+	unsigned char hdr[H2_FRAME_HEADER_LEN];
+
+	hdr[0] = (unsigned char)(len >> 16);
+	hdr[1] = (unsigned char)(len >> 8);
+	hdr[2] = (unsigned char)len;
+	hdr[3] = type;
+	hdr[4] = flags;
+	hdr[5] = (unsigned char)(stream_id >> 24) & 0x7f;
+	hdr[6] = (unsigned char)(stream_id >> 16);
+	hdr[7] = (unsigned char)(stream_id >> 8);
+	hdr[8] = (unsigned char)stream_id;
+
+	append_output(c, hdr, sizeof(hdr), false);
+	if (len)
+		append_output(c, payload, len, false);
+}
+
+/* The response header block, without Huffman coding. After :status,
+ * "x-mock: a" is added to the dynamic table, and then a literal naming
+ * that entry (index 62) is added with a value too large for the table.
+ * Adding it empties the table, freeing the entry whose name it uses,
+ * which a decoder must not touch afterwards. */
+static size_t
+h2_build_headers(unsigned char *buf, int status)
+{
+	unsigned char *p = buf;
+	size_t len = H2_EVICT_VALUE_LEN - 127;
+
+	/* Literal without indexing, name :status */
+	*p++ = 0x08;
+	*p++ = 3;
+	*p++ = (unsigned char)('0' + status / 100 % 10);
+	*p++ = (unsigned char)('0' + status / 10 % 10);
+	*p++ = (unsigned char)('0' + status % 10);
+
+	/* Literal with incremental indexing, new name */
+	*p++ = 0x40;
+	*p++ = 6;
+	memcpy(p, "x-mock", 6);
+	p += 6;
+	*p++ = 1;
+	*p++ = 'a';
+
+	/* Literal with incremental indexing, name of dynamic entry 62 */
+	*p++ = 0x40 | 62;
+	*p++ = 0x7f;
+	for (; len >= 0x80; len >>= 7)
+		*p++ = (unsigned char)(0x80 | (len & 0x7f));
+	*p++ = (unsigned char)len;
+	memset(p, 'x', H2_EVICT_VALUE_LEN);
+	p += H2_EVICT_VALUE_LEN;
+
+	return (size_t)(p - buf);
+}
+
+static void
+h2_respond(conn_t *c, uint32_t stream_id)
+{
+	static const char pattern[] = "0123456789abcdef";
+	unsigned char block[H2_EVICT_VALUE_LEN + 32];
+	unsigned char data[H2_MAX_FRAME_SIZE];
+	int status = c->l->failing ? 503 : http_status;
+	size_t i, j, chunk;
+
+	if (c->l->failing)
+		stats_errors_sent++;
+
+	h2_put_frame(c, H2_HEADERS, H2_FLAG_END_HEADERS | (body_size ? 0 : H2_FLAG_END_STREAM),
+		     stream_id, block, h2_build_headers(block, status));
+
+	for (i = 0; i < body_size; i += chunk) {
+		chunk = body_size - i < sizeof(data) ? body_size - i : sizeof(data);
+		for (j = 0; j < chunk; j++)
+			data[j] = (unsigned char)pattern[(i + j) % 16];
+		h2_put_frame(c, H2_DATA, i + chunk == body_size ? H2_FLAG_END_STREAM : 0,
+			     stream_id, data, chunk);
+	}
+}
+
+/* Answer the settings and every request stream received */
+static bool
+h2_process(conn_t *c)
+{
+	unsigned char *p = (unsigned char *)c->in;
+	size_t off = 0, len;
+	uint32_t stream_id;
+	bool responded = false;
+
+	if (!c->h2_preface) {
+		if (c->in_len < H2_PREFACE_LEN)
+			return false;
+		if (memcmp(c->in, H2_PREFACE, H2_PREFACE_LEN)) {
+			set_output_str(c, "", true);
+			return true;
+		}
+		off = H2_PREFACE_LEN;
+		c->h2_preface = true;
+		h2_put_frame(c, H2_SETTINGS, 0, 0, NULL, 0);
+		responded = true;
+	}
+
+	while (c->in_len - off >= H2_FRAME_HEADER_LEN) {
+		len = (size_t)p[off] << 16 | (size_t)p[off + 1] << 8 | p[off + 2];
+		if (c->in_len - off < H2_FRAME_HEADER_LEN + len)
+			break;
+
+		stream_id = (uint32_t)(p[off + 5] & 0x7f) << 24 | (uint32_t)p[off + 6] << 16 |
+			    (uint32_t)p[off + 7] << 8 | p[off + 8];
+		if (p[off + 3] == H2_SETTINGS && !(p[off + 4] & H2_FLAG_ACK)) {
+			h2_put_frame(c, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+			responded = true;
+		} else if (p[off + 3] == H2_HEADERS && (p[off + 4] & H2_FLAG_END_HEADERS)) {
+			h2_respond(c, stream_id);
+			responded = true;
+		}
+
+		off += H2_FRAME_HEADER_LEN + len;
+	}
+
+	c->in_len -= off;
+	memmove(c->in, c->in + off, c->in_len + 1);
+
+	return responded;
+}
+
+static void
+build_dns_response(conn_t *c)
+{
+	unsigned char *q = (unsigned char *)c->in;
+	unsigned char *r;
+	size_t qlen = c->in_len, off = 12;
+	uint16_t qtype;
+	bool answer;
+
+	/* Skip the question name */
+	while (off < qlen && q[off]) {
+		if ((q[off] & 0xc0) == 0xc0) {
+			off++;
+			break;
+		}
+		off += q[off] + 1U;
+	}
+	off++;
+	if (off + 4 > qlen) {
+		c->out_len = 0;
+		return;
+	}
+	qtype = (uint16_t)(q[off] << 8 | q[off + 1]);
+	off += 4;
+
+	answer = !c->l->failing && (qtype == 1 || qtype == 28);
+
+	r = malloc(off + 28);
+	memcpy(r, q, off);
+	r[2] = 0x84 | (q[2] & 0x01);			/* QR, AA, RD copied */
+	r[3] = c->l->failing ? 0x82 : 0x80;		/* RA, SERVFAIL if failing */
+	r[4] = 0; r[5] = 1;				/* QDCOUNT */
+	r[6] = 0; r[7] = answer ? 1 : 0;		/* ANCOUNT */
+	memset(r + 8, 0, 4);				/* NSCOUNT, ARCOUNT */
+
+	if (c->l->failing)
+		stats_errors_sent++;
+
+	if (answer) {
+		unsigned char *a = r + off;
+
+		a[0] = 0xc0; a[1] = 12;			/* name pointer to question */
+		a[2] = (unsigned char)(qtype >> 8); a[3] = (unsigned char)qtype;
+		a[4] = 0; a[5] = 1;			/* class IN */
+		a[6] = 0; a[7] = 0; a[8] = 0; a[9] = 60;	/* TTL */
+		if (qtype == 1) {
+			a[10] = 0; a[11] = 4;
+			a[12] = 127; a[13] = 0; a[14] = 0; a[15] = 1;
+			off += 16;
+		} else {
+			a[10] = 0; a[11] = 16;
+			memset(a + 12, 0, 15);
+			a[27] = 1;
+			off += 28;
+		}
+	}
+
+	set_output(c, (char *)r, off, true);
+}
+
+static void
+queue_delayed(conn_t *c)
+{
+	c->state = CONN_DELAYED;
+	c->due = now() + delay_ms / 1000.0;
+	c->next = NULL;
+	if (delay_tail)
+		delay_tail->next = c;
+	else
+		delay_head = c;
+	delay_tail = c;
+}
+
+static void conn_write(conn_t *);
+
+/* The request is complete, or the connection is new for SMTP */
+static void
+conn_respond(conn_t *c)
+{
+	switch (c->l->proto) {
+	case PROTO_HTTP:
+	case PROTO_HTTPS:
+		build_http_response(c);
+		break;
+	case PROTO_SMTP:
+		if (c->l->failing) {
+			stats_errors_sent++;
+			set_output_str(c, "421 mock_backend service not available\r\n", true);
+		} else
+			set_output_str(c, "220 mock_backend ESMTP\r\n", false);
+		break;
+	case PROTO_DNS:
+		build_dns_response(c);
+		break;
+	case PROTO_UDP:
+		set_output(c, memcpy(malloc(c->in_len), c->in, c->in_len), c->in_len, true);
+		break;
+	default:
+		break;
+	}
+
+	conn_write(c);
+}
+
+static void
+conn_ready(conn_t *c)
+{
+	if (delay_ms) {
+		queue_delayed(c);
+		conn_update_events(c);
+	} else
+		conn_respond(c);
+}
+
+/* Answer every complete command line received, so pipelined commands work */
+static bool
+smtp_process(conn_t *c)
+{
+	char *line = c->in, *eol;
+	bool responded = false;
+
+	while ((eol = strchr(line, '\n'))) {
+		responded = true;
+		if (!strncasecmp(line, "QUIT", 4)) {
+			append_output_str(c, "221 Bye\r\n", true);
+			c->in_len = 0;
+			return true;
+		}
+		if (!strncasecmp(line, "HELO", 4) || !strncasecmp(line, "EHLO", 4))
+			append_output_str(c, "250 mock_backend\r\n", false);
+		else if (!strncasecmp(line, "NOOP", 4) || !strncasecmp(line, "RSET", 4))
+			append_output_str(c, "250 OK\r\n", false);
+		else
+			append_output_str(c, "502 Command not implemented\r\n", false);
+		line = eol + 1;
+	}
+
+	c->in_len -= (size_t)(line - c->in);
+	memmove(c->in, line, c->in_len + 1);
+
+	return responded;
+}
+
+/* Returns bytes read, 0 on EOF, -1 if it would block, -2 on error */
+static ssize_t
+conn_recv(conn_t *c, char *buf, size_t len)
+{
+	ssize_t ret;
+	int err;
+
+	c->want_write = false;
+
+	if (!c->ssl) {
+		ret = read(c->fd, buf, len);
+		if (ret < 0)
+			return errno == EAGAIN || errno == EINTR ? -1 : -2;
+		return ret;
+	}
+
+	ret = SSL_read(c->ssl, buf, (int)len);
+	if (ret > 0)
+		return ret;
+	err = SSL_get_error(c->ssl, (int)ret);
+	if (err == SSL_ERROR_WANT_READ)
+		return -1;
+	if (err == SSL_ERROR_WANT_WRITE) {
+		c->want_write = true;
+		return -1;
+	}
+	return err == SSL_ERROR_ZERO_RETURN ? 0 : -2;
+}
+
+static ssize_t
+conn_send(conn_t *c, const char *buf, size_t len)
+{
+	ssize_t ret;
+	int err;
+
+	if (c->dgram)
+		return sendto(c->l->fd, buf, len, 0, (struct sockaddr *)&c->peer, c->peer_len);
+
+	if (!c->ssl) {
+		ret = write(c->fd, buf, len);
+		if (ret < 0)
+			return errno == EAGAIN || errno == EINTR ? -1 : -2;
+		return ret;
+	}
+
+	ret = SSL_write(c->ssl, buf, (int)len);
+	if (ret > 0)
+		return ret;
+	err = SSL_get_error(c->ssl, (int)ret);
+	return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? -1 : -2;
+}
+
+static void
+conn_write(conn_t *c)
+{
+	ssize_t ret;
+
+	while (c->out_off < c->out_len) {
+		ret = conn_send(c, c->out + c->out_off, c->out_len - c->out_off);
+		if (ret == -1) {
+			conn_update_events(c);
+			return;
+		}
+		if (ret < 0 || c->dgram) {
+			conn_free(c);
+			return;
+		}
+		c->out_off += (size_t)ret;
+	}
+
+	if (c->close_after || c->dgram) {
+		if (c->ssl)
+			SSL_shutdown(c->ssl);
+		conn_free(c);
+		return;
+	}
+
+	c->state = CONN_READING;
+	conn_update_events(c);
+}
+
+static void
+conn_read(conn_t *c)
+{
+	ssize_t ret;
+
+	while (true) {
+		if (c->in_len == sizeof(c->in) - 1) {
+			/* Oversize request, just answer it */
+			if (c->l->proto != PROTO_SMTP && c->l->proto != PROTO_H2C) {
+				conn_ready(c);
+				return;
+			}
+			c->in_len = 0;
+		}
+
+		ret = conn_recv(c, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+		if (ret == -1) {
+			conn_update_events(c);
+			return;
+		}
+		if (ret <= 0) {
+			conn_free(c);
+			return;
+		}
+		c->in_len += (size_t)ret;
+		c->in[c->in_len] = '\0';
+
+		switch (c->l->proto) {
+		case PROTO_HTTP:
+		case PROTO_HTTPS:
+			if (strstr(c->in, "\r\n\r\n") || strstr(c->in, "\n\n")) {
+				conn_ready(c);
+				return;
+			}
+			break;
+		case PROTO_H2C:
+			if (h2_process(c)) {
+				conn_write(c);
+				return;
+			}
+			break;
+		case PROTO_SMTP:
+			if (smtp_process(c)) {
+				conn_write(c);
+				return;
+			}
+			break;
+		default:
+			/* Plain TCP, just discard what is sent */
+			c->in_len = 0;
+			break;
+		}
+	}
+}
+
+static conn_t *
+conn_new(listener_t *l, int fd)
+{
+	conn_t *c = calloc(1, sizeof(*c));
+
+	c->type = SRC_CONN;
+	c->fd = fd;
+	c->l = l;
+	c->state = CONN_READING;
+
+	return c;
+}
+
+static void
+listener_accept(listener_t *l)
+{
+	conn_t *c;
+	int fd, one = 1;
+
+	while ((fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		record_check(l);
+
+		if (l->failing && l->proto == PROTO_TCP) {
+			close(fd);
+			continue;
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		c = conn_new(l, fd);
+		conn_update_events(c);
+
+		if (l->proto == PROTO_HTTPS) {
+			c->ssl = SSL_new(ssl_ctx);
+			SSL_set_fd(c->ssl, fd);
+			SSL_set_accept_state(c->ssl);
+		} else if (l->proto == PROTO_SMTP)
+			conn_ready(c);
+	}
+}
+
+static void
+listener_recv(listener_t *l)
+{
+	conn_t *c;
+	ssize_t len;
+
+	while (true) {
+		c = conn_new(l, l->fd);
+		c->dgram = true;
+		c->peer_len = sizeof(c->peer);
+		len = recvfrom(l->fd, c->in, sizeof(c->in), 0, (struct sockaddr *)&c->peer, &c->peer_len);
+		if (len <= 0) {
+			free(c);
+			return;
+		}
+		c->in_len = (size_t)len;
+		record_check(l);
+
+		if (l->proto == PROTO_DNS && len < 12) {
+			free(c);
+			continue;
+		}
+		conn_ready(c);
+	}
+}
+
+static void
+run_delayed(void)
+{
+	double t = now();
+	conn_t *c;
+
+	while ((c = delay_head) && c->due <= t) {
+		delay_head = c->next;
+		if (!delay_head)
+			delay_tail = NULL;
+		conn_respond(c);
+	}
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+static double
+percentile(double p)
+{
+	size_t i;
+
+	if (!num_intervals)
+		return 0;
+	i = (size_t)(p * (double)(num_intervals - 1) + 0.5);
+	return intervals[i] * 1000;
+}
+
+static void
+report(double start)
+{
+	enum proto proto;
+	size_t i;
+
+	qsort(intervals, num_intervals, sizeof(*intervals), cmp_double);
+
+	printf("{\"listeners\": %zu, \"runtime_s\": %.3f", num_listeners, now() - start);
+	for (proto = PROTO_TCP; proto <= PROTO_UDP; proto++)
+		printf(", \"%s_checks\": %lu", proto_names[proto], stats_checks[proto]);
+	printf(", \"errors_sent\": %lu, \"listeners_refused\": %lu", stats_errors_sent, stats_refused_listeners);
+	printf(", \"interval_count\": %zu, \"interval_ms\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+		num_intervals, percentile(0), percentile(0.5), percentile(0.9), percentile(0.99), percentile(1));
+
+	for (i = 0; i < num_listeners && verbose; i++) {
+		char buf[INET6_ADDRSTRLEN];
+		listener_t *l = listeners[i];
+
+		inet_ntop(l->addr.ss_family,
+			  l->addr.ss_family == AF_INET ? (void *)&((struct sockaddr_in *)&l->addr)->sin_addr : (void *)&((struct sockaddr_in6 *)&l->addr)->sin6_addr,
+			  buf, sizeof(buf));
+		fprintf(stderr, "%s %s checks %lu%s\n", proto_names[l->proto], buf, l->checks, l->failing ? " failing" : "");
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct { enum src_type type; int fd; } sig_src;
+	struct signalfd_siginfo si;
+	struct rlimit rlim;
+	sigset_t mask;
+	bool need_tls = false;
+	double start, wait;
+	int opt, n, i, timeout;
+	char **specs;
+	size_t num_specs = 0, s;
+
+	specs = calloc((size_t)argc, sizeof(*specs));
+
+	while ((opt = getopt(argc, argv, "l:s:b:d:kC:K:F:ev")) != -1) {
+		switch (opt) {
+		case 'l':
+			specs[num_specs++] = optarg;
+			if (strstr(optarg, ":https"))
+				need_tls = true;
+			break;
+		case 's':
+			http_status = atoi(optarg);
+			break;
+		case 'b':
+			body_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			delay_ms = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			chunked = true;
+			break;
+		case 'C':
+			cert_file = optarg;
+			break;
+		case 'K':
+			key_file = optarg;
+			break;
+		case 'F':
+			fail_file = optarg;
+			break;
+		case 'e':
+			fail_with_error = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!num_specs) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* We may need a lot of fds */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim)) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	if (need_tls) {
+		if (!cert_file || !key_file) {
+			fprintf(stderr, "https requires -C and -K\n");
+			exit(EXIT_FAILURE);
+		}
+		SSL_library_init();
+		SSL_load_error_strings();
+		ssl_ctx = SSL_CTX_new(SSLv23_server_method());
+		if (!ssl_ctx ||
+		    SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file) != 1 ||
+		    SSL_CTX_use_PrivateKey_file(ssl_ctx, key_file, SSL_FILETYPE_PEM) != 1) {
+			ERR_print_errors_fp(stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sig_src.type = SRC_SIGNAL;
+	sig_src.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	epoll_set(sig_src.fd, &sig_src, EPOLLIN, EPOLL_CTL_ADD);
+
+	for (s = 0; s < num_specs; s++) {
+		if (!parse_listen(specs[s])) {
+			fprintf(stderr, "Invalid listen specification %s\n", specs[s]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(specs);
+
+	index_listeners();
+	read_fail_file();
+
+	if (verbose)
+		fprintf(stderr, "Listening on %zu sockets\n", num_listeners);
+
+	start = now();
+
+	while (true) {
+		timeout = -1;
+		if (delay_head) {
+			wait = (delay_head->due - now()) * 1000;
+			timeout = wait < 0 ? 0 : (int)wait + 1;
+		}
+
+		n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < n; i++) {
+			enum src_type *type = events[i].data.ptr;
+
+			if (*type == SRC_LISTENER) {
+				listener_t *l = events[i].data.ptr;
+
+				if (l->proto == PROTO_DNS || l->proto == PROTO_UDP)
+					listener_recv(l);
+				else
+					listener_accept(l);
+			} else if (*type == SRC_CONN) {
+				conn_t *c = events[i].data.ptr;
+
+				if (c->state == CONN_WRITING)
+					conn_write(c);
+				else if (c->state == CONN_READING)
+					conn_read(c);
+			} else {
+				while (read(sig_src.fd, &si, sizeof(si)) == sizeof(si)) {
+					switch (si.ssi_signo) {
+					case SIGHUP:
+						read_fail_file();
+						break;
+					case SIGUSR1:
+					case SIGUSR2:
+						for (s = 0; s < num_listeners; s++)
+							listener_set_failing(listeners[s], si.ssi_signo == SIGUSR1);
+						break;
+					default:
+						report(start);
+						exit(EXIT_SUCCESS);
+					}
+				}
+			}
+		}
+
+		run_delayed();
+	}
+}
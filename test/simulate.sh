@@ -0,0 +1,292 @@
+#! /bin/bash
+
+# Usage:
+#  simulate.sh [options]
+#
+# This script runs keepalived's VRRP and checker processes in simulation
+# mode (--simulate), in which the scheduler runs on a virtual clock and
+# nothing is sent on the network, run as a script or changed in the
+# kernel. A configuration of N VRRP instances, each with its own track
+# script, and of M real servers with TCP_CHECKs is generated, and a
+# percentage of the track scripts and real servers is failed for a
+# while part way through (--simulate-fail).
+#
+# The scenarios are:
+#  vrrp-2k	2000 VRRP instances, 10% failing 30 seconds in for 30 seconds
+#  rs-50k	50000 real servers, 10% failing 30 seconds in for 30 seconds
+#  mixed	both of the above together
+#
+# The CPU time per simulated second, transitions, netlink and IPVS
+# operations reported by each process are written to stdout as a single
+# JSON object, so that they can be collected and compared between runs.
+#
+# VRRP instances need real interfaces, and a VRID can only be used once
+# per interface, so the VRRP process is run in its own network namespace
+# with a veth pair for every 255 instances.
+#
+# Requires root and iproute2.
+
+LANG=C
+
+: ${KEEPALIVED:=$(dirname $0)/../bin/keepalived}
+
+NS=kasim
+SCENARIO=
+INSTANCES=200
+REAL_SERVERS=1000
+FAIL_PERCENT=10
+FAIL_START=30
+FAIL_DURATION=30
+SIM_SECS=120
+ADVERT_INT=1
+DELAY_LOOP=5
+KEEP_DIR=
+
+show_help()
+{
+	cat <<EOF
+$0 - Usage:
+	-h		Show this!
+	-S SCENARIO	vrrp-2k, rs-50k or mixed; overrides -n and -r
+	-n		number of VRRP instances, 0 for none (default $INSTANCES)
+	-r		number of real servers, 0 for none (default $REAL_SERVERS)
+	-f		percentage of track scripts and real servers to fail, 0 for none (default $FAIL_PERCENT)
+	-s		simulated seconds before the failure (default $FAIL_START)
+	-d		simulated seconds the failure lasts, 0 to the end (default $FAIL_DURATION)
+	-t		simulated seconds to run (default $SIM_SECS)
+	-a		advert_int (default $ADVERT_INT)
+	-l		delay_loop (default $DELAY_LOOP)
+	-N		network namespace name (default $NS)
+	-k DIR		keep the configs and logs in DIR
+EOF
+}
+
+while getopts ":hS:n:r:f:s:d:t:a:l:N:k:" opt; do
+	case $opt in
+	h)
+		show_help
+		exit 0
+		;;
+	S)
+		SCENARIO=$OPTARG
+		;;
+	n)
+		INSTANCES=$OPTARG
+		;;
+	r)
+		REAL_SERVERS=$OPTARG
+		;;
+	f)
+		FAIL_PERCENT=$OPTARG
+		;;
+	s)
+		FAIL_START=$OPTARG
+		;;
+	d)
+		FAIL_DURATION=$OPTARG
+		;;
+	t)
+		SIM_SECS=$OPTARG
+		;;
+	a)
+		ADVERT_INT=$OPTARG
+		;;
+	l)
+		DELAY_LOOP=$OPTARG
+		;;
+	N)
+		NS=$OPTARG
+		;;
+	k)
+		KEEP_DIR=$OPTARG
+		;;
+	?)
+		echo Unknown option \'$OPTARG\' && show_help && exit 1
+		;;
+	esac
+done
+
+die()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+case $SCENARIO in
+"")	;;
+vrrp-2k) INSTANCES=2000 REAL_SERVERS=0 ;;
+rs-50k)	INSTANCES=0 REAL_SERVERS=50000 ;;
+mixed)	INSTANCES=2000 REAL_SERVERS=50000 ;;
+*)	die "Unknown scenario $SCENARIO" ;;
+esac
+
+[[ $(id -u) -eq 0 ]] || die "root required"
+[[ -x $KEEPALIVED ]] || die "keepalived required (tried $KEEPALIVED)"
+[[ $INSTANCES -gt 0 || $REAL_SERVERS -gt 0 ]] || die "nothing to simulate"
+
+NUM_IFS=$(( (INSTANCES + 254) / 255 ))
+
+if [[ -n $KEEP_DIR ]]; then
+	DIR=$KEEP_DIR
+	mkdir -p $DIR || exit 1
+else
+	DIR=$(mktemp -d /tmp/simulate.XXXXXX)
+fi
+
+cleanup()
+{
+	ip netns del $NS 2>/dev/null
+	[[ -z $KEEP_DIR ]] && rm -rf $DIR
+}
+
+trap cleanup EXIT
+
+# Address number n, in 10.1.0.0 upwards
+addr()
+{
+	local n=$1
+
+	echo 10.$(( (n >> 16) + 1 )).$(( (n >> 8) & 255 )).$(( n & 255 ))
+}
+
+gen_vrrp_config()
+{
+	local i
+
+	cat <<EOF
+global_defs {
+	router_id sim_vrrp
+}
+
+EOF
+
+	for ((i = 0; i < INSTANCES; i++)); do
+		cat <<EOF
+vrrp_script chk_$i {
+	script /bin/true
+	interval 2
+	fall 2
+	rise 2
+}
+
+vrrp_instance VI_$i {
+	state BACKUP
+	interface kb$((i / 255))
+	virtual_router_id $((i % 255 + 1))
+	priority 100
+	advert_int $ADVERT_INT
+	track_script {
+		chk_$i
+	}
+	virtual_ipaddress {
+		$(addr $i)/32
+	}
+}
+
+EOF
+	done
+}
+
+# Every 1000 real servers are put in their own virtual server
+gen_check_config()
+{
+	local rs
+
+	cat <<EOF
+global_defs {
+	router_id sim_check
+}
+EOF
+
+	for ((rs = 0; rs < REAL_SERVERS; rs++)); do
+		if [[ $((rs % 1000)) -eq 0 ]]; then
+			[[ $rs -gt 0 ]] && echo "}"
+			cat <<EOF
+
+virtual_server 192.168.$((rs / 1000 / 256)).$((rs / 1000 % 256)) 80 {
+	delay_loop $DELAY_LOOP
+	lb_algo rr
+	lb_kind DR
+	protocol TCP
+
+EOF
+		fi
+		cat <<EOF
+	real_server $(addr $rs) 80 {
+		TCP_CHECK {
+			connect_timeout 3
+		}
+	}
+EOF
+	done
+	echo "}"
+}
+
+# Run one keepalived process in simulation mode; $1 is vrrp or check
+simulate()
+{
+	local type=$1 opts=
+	local fail=
+
+	[[ $FAIL_PERCENT -gt 0 ]] && fail=--simulate-fail=$FAIL_PERCENT,$FAIL_START,$FAIL_DURATION
+
+	if [[ $type = vrrp ]]; then
+		opts=-P
+	else
+		opts=-C
+	fi
+
+	ip netns exec $NS $KEEPALIVED -n $opts -f $DIR/$type.conf \
+		--dont-respawn --simulate=$SIM_SECS $fail \
+		-p $DIR/$type.pid -r $DIR/$type-vrrp.pid -c $DIR/$type-checkers.pid \
+		--log-file=$DIR/$type.log
+}
+
+# The results logged by a simulation as JSON
+results()
+{
+	local type=$1
+	local log=$(ls $DIR/${type}_*.log 2>/dev/null | head -1)
+
+	[[ -z $log ]] && echo null && return
+
+	grep "Simulation: " $log | sed -e "s/.*Simulation: //" | awk '
+		/simulated secs/ { sim = $1; cpu = $4; per_sec = substr($7, 2) }
+		/^polls/ { gsub(",", ""); polls = $2; threads = $5; trans = $7; netlink = $10; ipvs = $13 }
+		/^adverts/ { gsub(",", ""); adverts = $2; arps = $5; scripts = $7 }
+		END {
+			if (sim == "") { print "null"; exit }
+			printf "{\"simulated_secs\": %s, \"cpu_secs\": %s, \"cpu_ms_per_simulated_sec\": %s, ", sim, cpu, per_sec
+			printf "\"polls\": %s, \"threads_run\": %s, \"transitions\": %s, \"netlink_ops\": %s, \"ipvs_ops\": %s, ", polls, threads, trans, netlink, ipvs
+			printf "\"adverts\": %s, \"arps\": %s, \"scripts\": %s}", adverts, arps, scripts
+		}'
+}
+
+ip netns del $NS 2>/dev/null
+ip netns add $NS || exit 1
+ip -n $NS link set up lo
+for ((g = 0; g < NUM_IFS; g++)); do
+	ip -n $NS link add kb$g type veth peer name kbp$g || exit 1
+	ip -n $NS addr add 10.255.$g.1/24 dev kb$g
+	ip -n $NS link set up kbp$g
+	ip -n $NS link set up kb$g
+done
+
+VRRP_RESULT=null
+CHECK_RESULT=null
+
+if [[ $INSTANCES -gt 0 ]]; then
+	gen_vrrp_config >$DIR/vrrp.conf
+	simulate vrrp
+	VRRP_RESULT=$(results vrrp)
+fi
+
+if [[ $REAL_SERVERS -gt 0 ]]; then
+	gen_check_config >$DIR/check.conf
+	simulate check
+	CHECK_RESULT=$(results check)
+fi
+
+cat <<EOF
+{"scenario": "${SCENARIO:-custom}", "instances": $INSTANCES, "real_servers": $REAL_SERVERS, "fail_percent": $FAIL_PERCENT, "fail_start": $FAIL_START, "fail_duration": $FAIL_DURATION, "simulated_secs": $SIM_SECS, "vrrp": $VRRP_RESULT, "checker": $CHECK_RESULT}
+EOF
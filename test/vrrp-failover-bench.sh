@@ -0,0 +1,313 @@
+#! /bin/bash
+
+# Usage:
+#  vrrp-failover-bench.sh [options]
+#
+# This script builds two keepalived nodes (A and B) in their own network
+# namespaces, joined through bridges in a third namespace, generates a
+# configuration of N VRRP instances with M VIPs each, lets A become master
+# of all of them, then kills A and measures how long B takes to send its
+# first advert, install all the VIPs and send all the gratuitous ARPs.
+# The CPU time and memory used by B's VRRP process over the failover are
+# also reported.
+#
+# A VRID can only be used once per network segment, so every 255
+# instances get their own bridge and veth pair.
+#
+# The results are written to stdout as a single JSON object, so that
+# they can be collected and compared between runs.
+#
+# Requires root, iproute2 and tcpdump.
+
+LANG=C
+
+: ${KEEPALIVED:=$(dirname $0)/../bin/keepalived}
+: ${TCPDUMP:=tcpdump}
+
+NS_PREFIX=kabench
+INSTANCES=100
+VIPS=1
+ADVERT_INT=1
+SETTLE_TIMEOUT=60
+FAILOVER_TIMEOUT=60
+KILL_SIG=KILL
+KEEP_DIR=
+
+show_help()
+{
+	cat <<EOF
+$0 - Usage:
+	-h		Show this!
+	-n		number of VRRP instances (default $INSTANCES)
+	-m		number of VIPs per instance (default $VIPS)
+	-a		advert_int (default $ADVERT_INT)
+	-p		network namespace prefix (default $NS_PREFIX)
+	-g		stop the master gracefully (SIGTERM) rather than SIGKILL
+	-s		seconds to wait for A to become master (default $SETTLE_TIMEOUT)
+	-t		seconds to wait for B to complete the takeover (default $FAILOVER_TIMEOUT)
+	-k DIR		keep the configs, logs and capture in DIR
+EOF
+}
+
+while getopts ":hn:m:a:p:gs:t:k:" opt; do
+	case $opt in
+	h)
+		show_help
+		exit 0
+		;;
+	n)
+		INSTANCES=$OPTARG
+		;;
+	m)
+		VIPS=$OPTARG
+		;;
+	a)
+		ADVERT_INT=$OPTARG
+		;;
+	p)
+		NS_PREFIX=$OPTARG
+		;;
+	g)
+		KILL_SIG=TERM
+		;;
+	s)
+		SETTLE_TIMEOUT=$OPTARG
+		;;
+	t)
+		FAILOVER_TIMEOUT=$OPTARG
+		;;
+	k)
+		KEEP_DIR=$OPTARG
+		;;
+	?)
+		echo Unknown option \'$OPTARG\' && show_help && exit 1
+		;;
+	esac
+done
+
+die()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+[[ $(id -u) -eq 0 ]] || die "root required"
+[[ -x $KEEPALIVED ]] || die "keepalived required (tried $KEEPALIVED)"
+which $TCPDUMP &>/dev/null || die "tcpdump required"
+
+NS_A=$NS_PREFIX-a
+NS_B=$NS_PREFIX-b
+NS_BR=$NS_PREFIX-br
+NUM_BRIDGES=$(( (INSTANCES + 254) / 255 ))
+TOTAL_VIPS=$((INSTANCES * VIPS))
+
+if [[ -n $KEEP_DIR ]]; then
+	DIR=$KEEP_DIR
+	mkdir -p $DIR || exit 1
+else
+	DIR=$(mktemp -d /tmp/vrrp-bench.XXXXXX)
+fi
+
+BG_PIDS=
+
+cleanup()
+{
+	for pid in $BG_PIDS; do
+		kill $pid 2>/dev/null
+	done
+	for node in a b; do
+		[[ -f $DIR/$node.pid ]] && kill $(cat $DIR/$node.pid) 2>/dev/null
+	done
+	sleep 1
+	ip netns del $NS_A 2>/dev/null
+	ip netns del $NS_B 2>/dev/null
+	ip netns del $NS_BR 2>/dev/null
+	[[ -z $KEEP_DIR ]] && rm -rf $DIR
+}
+
+trap cleanup EXIT
+
+# VIP number n of all the VIPs, as a /32 in 10.1.0.0 upwards
+vip_addr()
+{
+	local n=$1
+
+	echo 10.$(( (n >> 16) + 1 )).$(( (n >> 8) & 255 )).$(( n & 255 ))
+}
+
+gen_config()
+{
+	local node=$1 prio=$2 state=$3
+	local i j
+
+	cat <<EOF
+global_defs {
+	router_id bench_$node
+}
+
+EOF
+
+	for ((i = 0; i < INSTANCES; i++)); do
+		cat <<EOF
+vrrp_instance VI_$i {
+	state $state
+	interface kb$((i / 255))
+	virtual_router_id $((i % 255 + 1))
+	priority $prio
+	advert_int $ADVERT_INT
+	virtual_ipaddress {
+EOF
+		for ((j = 0; j < VIPS; j++)); do
+			echo "		$(vip_addr $((i * VIPS + j)))/32"
+		done
+		cat <<EOF
+	}
+}
+
+EOF
+	done
+}
+
+now()
+{
+	date +%s.%N
+}
+
+# Elapsed milliseconds from $1 to $2, or null if $2 not set
+elapsed_ms()
+{
+	[[ -z $2 ]] && echo null && return
+	awk -v a=$1 -v b=$2 'BEGIN { printf "%.1f", (b - a) * 1000 }'
+}
+
+# user + system CPU ticks of a process
+cpu_ticks()
+{
+	awk '{ print $14 + $15 }' /proc/$1/stat 2>/dev/null
+}
+
+proc_status()
+{
+	awk -v f="$2:" '$1 == f { print $2 }' /proc/$1/status 2>/dev/null
+}
+
+vip_count()
+{
+	ip -n $1 -o -4 addr show | grep -c " inet 10\.[0-9]*\.[0-9]*\.[0-9]*/32 "
+}
+
+# Build the namespaces
+ip netns del $NS_A 2>/dev/null
+ip netns del $NS_B 2>/dev/null
+ip netns del $NS_BR 2>/dev/null
+
+ip netns add $NS_A || exit 1
+ip netns add $NS_B || exit 1
+ip netns add $NS_BR || exit 1
+for ns in $NS_A $NS_B $NS_BR; do
+	ip -n $ns link set up lo
+done
+
+for ((g = 0; g < NUM_BRIDGES; g++)); do
+	ip -n $NS_BR link add br$g type bridge || exit 1
+	ip -n $NS_BR link set up br$g
+	for node in a b; do
+		[[ $node = a ]] && ns=$NS_A host=1 || ns=$NS_B host=2
+		ip -n $NS_BR link add $node$g type veth peer name kb$g netns $ns || exit 1
+		ip -n $NS_BR link set $node$g master br$g
+		ip -n $NS_BR link set up $node$g
+		ip -n $ns addr add 10.255.$g.$host/24 dev kb$g
+		ip -n $ns link set up kb$g
+	done
+done
+
+gen_config a 200 MASTER >$DIR/a.conf
+gen_config b 100 BACKUP >$DIR/b.conf
+
+for node in a b; do
+	[[ $node = a ]] && ns=$NS_A || ns=$NS_B
+	ip netns exec $ns $KEEPALIVED -n -P -G -f $DIR/$node.conf \
+		-p $DIR/$node.pid -r $DIR/$node-vrrp.pid \
+		--log-file=$DIR/$node.log &
+done
+
+# Wait for A to own all the VIPs
+start=$SECONDS
+while [[ $(vip_count $NS_A) -lt $TOTAL_VIPS ]]; do
+	[[ $((SECONDS - start)) -ge $SETTLE_TIMEOUT ]] && die "A did not become master of all instances"
+	sleep 0.5
+done
+
+# Let any outstanding gratuitous ARPs from A finish
+sleep $((ADVERT_INT * 3))
+
+B_VRRP_PID=$(cat $DIR/b-vrrp.pid)
+[[ -n $B_VRRP_PID ]] || die "B's VRRP process is not running"
+
+# Capture B's adverts and ARPs on every bridge, and watch B's addresses
+for ((g = 0; g < NUM_BRIDGES; g++)); do
+	ip netns exec $NS_BR $TCPDUMP -i b$g -n -l -tt "vrrp or arp" >$DIR/capture-$g.txt 2>/dev/null &
+	BG_PIDS="$BG_PIDS $!"
+done
+ip -n $NS_B -ts -o monitor address >$DIR/b-addr.txt &
+BG_PIDS="$BG_PIDS $!"
+sleep 1
+
+cpu_before=$(cpu_ticks $B_VRRP_PID)
+
+# Kill the master
+t0=$(now)
+kill -$KILL_SIG $(cat $DIR/a-vrrp.pid) $(cat $DIR/a.pid)
+
+# Wait for B to install all the VIPs and send all the GARPs
+start=$SECONDS
+completed=true
+while true; do
+	vips=$(vip_count $NS_B)
+	garps=$(cat $DIR/capture-*.txt | awk -v t0=$t0 '$1 >= t0 && /ARP, Request who-has 10\.[0-9.]* tell/ && $5 "," == $7' | wc -l)
+	[[ $vips -ge $TOTAL_VIPS && $garps -ge $TOTAL_VIPS ]] && break
+	if [[ $((SECONDS - start)) -ge $FAILOVER_TIMEOUT ]]; then
+		completed=false
+		break
+	fi
+	sleep 0.2
+done
+sleep 0.5
+
+cpu_after=$(cpu_ticks $B_VRRP_PID)
+rss_kb=$(proc_status $B_VRRP_PID VmRSS)
+hwm_kb=$(proc_status $B_VRRP_PID VmHWM)
+
+for pid in $BG_PIDS; do
+	kill $pid 2>/dev/null
+done
+wait $BG_PIDS 2>/dev/null
+BG_PIDS=
+
+# First advert from B after the kill
+first_advert=$(cat $DIR/capture-*.txt | awk -v t0=$t0 '$1 >= t0 && $3 ~ /^10\.255\.[0-9]*\.2$/ && /VRRP/ { print $1 }' | sort -n | head -1)
+
+# Gratuitous ARPs for the VIPs
+cat $DIR/capture-*.txt | awk -v t0=$t0 '$1 >= t0 && /ARP, Request who-has 10\.[0-9.]* tell/ && $5 "," == $7 { print $1 }' | sort -n >$DIR/garps.txt
+garp_first=$(head -1 $DIR/garps.txt)
+garp_all=$(sed -n ${TOTAL_VIPS}p $DIR/garps.txt)
+garp_count=$(wc -l <$DIR/garps.txt)
+
+# VIP additions on B
+grep " inet 10\.[0-9]*\.[0-9]*\.[0-9]*/32 " $DIR/b-addr.txt | grep -v Deleted | \
+	sed -e "s/^\[\([^]]*\)\].*/\1/" >$DIR/vip-times.txt
+vip_count_added=$(wc -l <$DIR/vip-times.txt)
+vip_first=
+vip_all=
+if [[ $vip_count_added -gt 0 ]]; then
+	vip_first=$(date -d "$(head -1 $DIR/vip-times.txt)" +%s.%N)
+	[[ $vip_count_added -ge $TOTAL_VIPS ]] && vip_all=$(date -d "$(sed -n ${TOTAL_VIPS}p $DIR/vip-times.txt)" +%s.%N)
+fi
+
+hz=$(getconf CLK_TCK)
+cpu_ms=null
+[[ -n $cpu_before && -n $cpu_after ]] && cpu_ms=$(( (cpu_after - cpu_before) * 1000 / hz ))
+
+cat <<EOF
+{"instances": $INSTANCES, "vips_per_instance": $VIPS, "advert_int": $ADVERT_INT, "bridges": $NUM_BRIDGES, "kill_signal": "$KILL_SIG", "completed": $completed, "first_advert_ms": $(elapsed_ms $t0 $first_advert), "vip_first_ms": $(elapsed_ms $t0 $vip_first), "vip_all_ms": $(elapsed_ms $t0 $vip_all), "vips_installed": $vip_count_added, "garp_first_ms": $(elapsed_ms $t0 $garp_first), "garp_all_ms": $(elapsed_ms $t0 $garp_all), "garps_sent": $garp_count, "cpu_ms": $cpu_ms, "rss_kb": ${rss_kb:-null}, "hwm_kb": ${hwm_kb:-null}}
+EOF